@@ -0,0 +1,430 @@
+/* "benchmark", measures the speed of the ESCAPI pixel conversion, scaling and
+ * pyramid and tensor kernels, and of the MJPG decoder. Needs no camera (or Windows); builds with the Makefile on Linux.
+ *
+ * usage: benchmark [-t seconds] [-f filter] [-r] [-c]
+ *   -t  minimum time spent on each kernel and size (default 0.1)
+ *   -f  only run kernels whose name contains the filter text
+ *   -r  also run the scalar reference kernels
+ *   -c  print comma separated values instead of a table
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "coretypes.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "conversion.h"
+#include "scaling.h"
+#include "pyramid.h"
+#include "tensor.h"
+#include "mjpeg.h"
+#include "testpattern.h"
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define BENCHMARK_TSC
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define BENCHMARK_TSC
+#endif
+
+struct Resolution
+{
+	const char *mName;
+	DWORD mWidth;
+	DWORD mHeight;
+};
+
+static const Resolution gResolutions[] =
+{
+	{ "QVGA", 320, 240 },
+	{ "VGA", 640, 480 },
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "4K", 3840, 2160 }
+};
+
+static const int gResolutionCount = sizeof(gResolutions) / sizeof(gResolutions[0]);
+
+static const char *gFormatNames[CAPTURE_FORMAT_MAX] = { "BGRA", "RGBA", "RGB24", "GRAY8", "I420", "NV12" };
+static const char *gMatrixNames[] = { " bt601", " bt601f", " bt709", " bt709f", "" };
+
+struct Result
+{
+	double mSeconds;  // Per frame
+	double mCycles;   // Per frame, 0 without a time stamp counter
+};
+
+static unsigned long long ReadCycles()
+{
+#ifdef BENCHMARK_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static double Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs aFrame in batches until aMinSeconds have passed, and keeps the
+// fastest batch; the others were most likely disturbed by something else.
+template <class FRAME>
+static Result Measure(FRAME aFrame, double aMinSeconds)
+{
+	aFrame();
+
+	// Enough frames per batch for the clock to be accurate
+	int frames = 1;
+	double start = Now();
+	aFrame();
+	double once = Now() - start;
+	if (once < 0.002)
+		frames = (int)(0.002 / (once > 1e-7 ? once : 1e-7)) + 1;
+
+	Result best = { 1e30, 0 };
+	double end = Now() + aMinSeconds;
+	do
+	{
+		unsigned long long cycles = ReadCycles();
+		start = Now();
+		for (int i = 0; i < frames; i++)
+			aFrame();
+		double seconds = (Now() - start) / frames;
+		cycles = ReadCycles() - cycles;
+
+		if (seconds < best.mSeconds)
+		{
+			best.mSeconds = seconds;
+			best.mCycles = (double)cycles / frames;
+		}
+	} while (Now() < end);
+
+	return best;
+}
+
+// Average bytes per pixel of a source format, for the bandwidth figures
+static double SubtypeBytes(DWORD aSubtype)
+{
+	switch (aSubtype)
+	{
+	case SUBTYPE_RGB32:
+		return 4;
+	case SUBTYPE_RGB24:
+		return 3;
+	case SUBTYPE_YUY2:
+	case SUBTYPE_UYVY:
+	case SUBTYPE_YVYU:
+		return 2;
+	}
+	return 1.5;
+}
+
+// Row pitch of a source format (of the Y plane for planar formats)
+static LONG SubtypeStride(DWORD aSubtype, DWORD aWidth)
+{
+	double bytes = SubtypeBytes(aSubtype);
+	return bytes < 2 ? aWidth : (LONG)(aWidth * bytes);
+}
+
+static double FormatBytes(int aFormat)
+{
+	if (aFormat == CAPTURE_FORMAT_I420 || aFormat == CAPTURE_FORMAT_NV12)
+		return 1.5;
+	return MinimumStride(aFormat, 1);
+}
+
+static void SubtypeName(DWORD aSubtype, char *aName)
+{
+	if (aSubtype == SUBTYPE_RGB32)
+	{
+		strcpy(aName, "RGB32");
+	}
+	else if (aSubtype == SUBTYPE_RGB24)
+	{
+		strcpy(aName, "RGB24");
+	}
+	else
+	{
+		for (int i = 0; i < 4; i++)
+			aName[i] = (char)(aSubtype >> (i * 8));
+		aName[4] = 0;
+	}
+}
+
+static int gCsv = 0;
+
+static void PrintHeader()
+{
+	if (gCsv)
+		printf("kernel,size,width,height,mpixels_per_s,cycles_per_pixel,gbytes_per_s\n");
+	else
+		printf("%-28s %-6s %10s %12s %8s\n", "kernel", "size", "MP/s", "cycles/px", "GB/s");
+}
+
+static void PrintResult(const char *aKernel, const Resolution &aSize, DWORD aWidth, DWORD aHeight, double aBytesPerPixel, const Result &aResult)
+{
+	double pixels = (double)aWidth * aHeight;
+	double mpixels = pixels / aResult.mSeconds / 1e6;
+	double cycles = aResult.mCycles / pixels;
+	double gbytes = pixels * aBytesPerPixel / aResult.mSeconds / 1e9;
+
+	if (gCsv)
+	{
+		printf("%s,%s,%u,%u,%.1f,", aKernel, aSize.mName, (unsigned)aWidth, (unsigned)aHeight, mpixels);
+		if (aResult.mCycles)
+			printf("%.2f", cycles);
+		printf(",%.2f\n", gbytes);
+	}
+	else
+	{
+		printf("%-28s %-6s %10.1f ", aKernel, aSize.mName, mpixels);
+		if (aResult.mCycles)
+			printf("%12.2f", cycles);
+		else
+			printf("%12s", "-");
+		printf(" %8.2f\n", gbytes);
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	double minSeconds = 0.1;
+	const char *filter = "";
+	int reference = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-t") && i + 1 < argc)
+		{
+			minSeconds = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+		{
+			filter = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-r"))
+		{
+			reference = 1;
+		}
+		else if (!strcmp(argv[i], "-c"))
+		{
+			gCsv = 1;
+		}
+		else
+		{
+			printf("usage: %s [-t seconds] [-f filter] [-r] [-c]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// Timing broken kernels would be pointless
+	int failures = CheckConversions() + CheckPyramid() + CheckMjpeg();
+	if (failures)
+	{
+		fprintf(stderr, "%d kernels don't match their reference\n", failures);
+		return 1;
+	}
+
+	// Big enough for any format at the largest size, plus some slack for
+	// the chroma planes
+	const Resolution &largest = gResolutions[gResolutionCount - 1];
+	const DWORD bufferSize = largest.mWidth * largest.mHeight * 4 + largest.mWidth * 4;
+	BYTE *src = new BYTE[bufferSize];
+	BYTE *dest = new BYTE[bufferSize];
+	DWORD seed = 1;
+	for (DWORD i = 0; i < bufferSize; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		src[i] = (BYTE)(seed >> 16);
+	}
+	memset(dest, 0, bufferSize);
+
+	PrintHeader();
+
+	for (int pass = 0; pass < (reference ? 2 : 1); pass++)
+	{
+		for (DWORD i = 0; i < gConversionFormats; i++)
+		{
+			const ConversionFunction &conversion = gFormatConversions[i];
+			IMAGE_TRANSFORM_FN xform = pass ? conversion.mReference : conversion.mXForm;
+			char subtype[8];
+			char name[64];
+			SubtypeName(conversion.mSubtype, subtype);
+			sprintf(name, "%s>%s%s%s", subtype, gFormatNames[conversion.mFormat], gMatrixNames[conversion.mMatrix], pass ? " ref" : "");
+			if (!strstr(name, filter))
+				continue;
+
+			for (int s = 0; s < gResolutionCount; s++)
+			{
+				const Resolution &size = gResolutions[s];
+				LONG srcStride = SubtypeStride(conversion.mSubtype, size.mWidth);
+				LONG destStride = MinimumStride(conversion.mFormat, size.mWidth);
+
+				Result result = Measure([&]() {
+					xform(dest, destStride, src, srcStride, size.mWidth, size.mHeight);
+				}, minSeconds);
+
+				PrintResult(name, size, size.mWidth, size.mHeight,
+					SubtypeBytes(conversion.mSubtype) + FormatBytes(conversion.mFormat), result);
+			}
+		}
+	}
+
+	// Scaling is used when the camera doesn't deliver the target size, so
+	// scale each size down to 3/4; the figures are per destination pixel.
+	for (DWORD i = 0; i < gScaleFormats; i++)
+	{
+		const ScaleFunction &scale = gScaleFunctions[i];
+		char name[64];
+		sprintf(name, "scale %s>%s", gFormatNames[scale.mSrcFormat], gFormatNames[scale.mFormat]);
+		if (!strstr(name, filter))
+			continue;
+
+		for (int s = 0; s < gResolutionCount; s++)
+		{
+			const Resolution &size = gResolutions[s];
+			DWORD width = size.mWidth * 3 / 4;
+			DWORD height = size.mHeight * 3 / 4;
+			LONG srcStride = MinimumStride(scale.mSrcFormat, size.mWidth);
+			LONG destStride = MinimumStride(scale.mFormat, width);
+
+			Result result = Measure([&]() {
+				scale.mScale(dest, destStride, width, height, src, srcStride, size.mWidth, size.mHeight);
+			}, minSeconds);
+
+			PrintResult(name, size, width, height, FormatBytes(scale.mSrcFormat) + FormatBytes(scale.mFormat), result);
+		}
+	}
+
+	// Four level pyramids below each size, from a random level 0; the
+	// figures are per level 0 pixel, and the bytes those read and write.
+	static const int pyramidFormats[] = { CAPTURE_FORMAT_BGRA, CAPTURE_FORMAT_RGB24, CAPTURE_FORMAT_GRAY8 };
+	for (int f = 0; f < 3; f++)
+	{
+		int format = pyramidFormats[f];
+		char name[64];
+		sprintf(name, "pyramid %s", gFormatNames[format]);
+		if (!strstr(name, filter))
+			continue;
+
+		for (int s = 0; s < gResolutionCount; s++)
+		{
+			const Resolution &size = gResolutions[s];
+			CapturePyramidInfo info;
+			PyramidBuilder builder;
+			if (!DescribePyramid(format, size.mWidth, size.mHeight, 0, 4, &info))
+				continue;
+			BYTE *pyramid = new BYTE[info.mSize];
+			memcpy(pyramid, src, info.mStride[0] * info.mHeight[0]);
+			builder.init(pyramid, info);
+
+			Result result = Measure([&]() {
+				builder.begin();
+				builder.rowsReady(size.mHeight);
+			}, minSeconds);
+
+			DWORD level0 = info.mStride[0] * info.mHeight[0];
+			PrintResult(name, size, size.mWidth, size.mHeight,
+				(double)(info.mOffset[3] + info.mSize - level0) / size.mWidth / size.mHeight, result);
+			delete[] pyramid;
+		}
+	}
+
+	// Tensors of half of each size, from BGRA and (converting the rows
+	// sampled) from YUY2; the figures are per tensor pixel.
+	static const char *tensorNames[] = { "FLOAT32", "FLOAT16" };
+	IMAGE_TRANSFORM_FN yuy2 = 0;
+	for (DWORD i = 0; i < gConversionFormats; i++)
+	{
+		if (gFormatConversions[i].mSubtype == SUBTYPE_YUY2 && gFormatConversions[i].mFormat == CAPTURE_FORMAT_BGRA &&
+			gFormatConversions[i].mMatrix == YCBCR_BT601)
+			yuy2 = gFormatConversions[i].mXForm;
+	}
+	for (int t = 0; t < 4; t++)
+	{
+		int type = t & 1;
+		IMAGE_TRANSFORM_FN convert = t < 2 ? 0 : yuy2;
+		char name[64];
+		sprintf(name, "tensor %s>%s", convert ? "YUY2" : "BGRA", tensorNames[type]);
+		if (!strstr(name, filter))
+			continue;
+
+		for (int s = 0; s < gResolutionCount; s++)
+		{
+			const Resolution &size = gResolutions[s];
+			CaptureTensorParams params;
+			memset(&params, 0, sizeof(params));
+			params.mTargetBuf = dest;
+			params.mWidth = size.mWidth / 2;
+			params.mHeight = size.mHeight / 2;
+			params.mType = type;
+			for (int c = 0; c < 3; c++)
+				params.mStd[c] = 1;
+			TensorWriter writer;
+			writer.init(params);
+			LONG srcStride = convert ? SubtypeStride(SUBTYPE_YUY2, size.mWidth) : MinimumStride(CAPTURE_FORMAT_BGRA, size.mWidth);
+
+			Result result = Measure([&]() {
+				writer.begin(size.mWidth, size.mHeight);
+				writer.writeVideo(src, srcStride, convert);
+			}, minSeconds);
+
+			PrintResult(name, size, params.mWidth, params.mHeight,
+				(convert ? 2 : 4) + 3 * TensorWriter::ElementSize(type), result);
+		}
+	}
+
+	// Test pattern frames stand in for camera MJPG; the figures include the
+	// Huffman decoding, so they depend on the picture far more than the above.
+	static const int decodeFormats[] = { CAPTURE_FORMAT_BGRA, CAPTURE_FORMAT_GRAY8 };
+	MjpegDecoder decoder;
+	for (int f = 0; f < 2; f++)
+	{
+		int format = decodeFormats[f];
+		char name[64];
+		sprintf(name, "decode MJPG>%s", gFormatNames[format]);
+		if (!strstr(name, filter))
+			continue;
+
+		for (int s = 0; s < gResolutionCount; s++)
+		{
+			const Resolution &size = gResolutions[s];
+			TestPattern pattern;
+			DWORD frameSize = 0;
+			const BYTE *frame = 0;
+			if (pattern.init(SUBTYPE_MJPG, size.mWidth, size.mHeight))
+				frame = pattern.render(12345, frameSize);
+			if (!frame)
+				continue;
+			LONG destStride = MinimumStride(format, size.mWidth);
+
+			// A frame that fails to decode returns early, which would be
+			// timed as a very fast decoder.
+			if (!decoder.decode(dest, destStride, format, YCBCR_BT601_FULL, frame, frameSize, size.mWidth, size.mHeight, 1))
+			{
+				fprintf(stderr, "%s failed to decode the %dx%d test frame\n", name, (int)size.mWidth, (int)size.mHeight);
+				delete[] src;
+				delete[] dest;
+				return 1;
+			}
+
+			Result result = Measure([&]() {
+				decoder.decode(dest, destStride, format, YCBCR_BT601_FULL, frame, frameSize, size.mWidth, size.mHeight, 1);
+			}, minSeconds);
+
+			PrintResult(name, size, size.mWidth, size.mHeight, (double)frameSize / size.mWidth / size.mHeight + FormatBytes(format), result);
+		}
+	}
+
+	delete[] src;
+	delete[] dest;
+	return 0;
+}
@@ -0,0 +1,376 @@
+/* "broker", shares capture devices between processes on Linux.
+ *
+ * usage: broker [-s socketpath]
+ *   -s  Unix domain socket to listen on (default /tmp/escapi-broker)
+ *
+ * Clients subscribe with openBrokerRing, giving a device, a frame size and a
+ * format. Each device is captured once, in BGRA at the largest size any of its
+ * clients asked for, and every distinct size and format is then scaled once per
+ * frame straight into a shared memory ring (see escapi_dll/framering.h), which
+ * all the clients that asked for it read. Runs until interrupted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+#include <vector>
+
+#include "platform.h"
+#include "escapi.h"
+#include "scaling.h"
+#include "framering.h"
+#include "brokerprotocol.h"
+
+#define MAX_CLIENTS 64
+#define MAX_SIZE 8192
+
+// One size and format of a device, as asked for by mClients clients
+struct Variant
+{
+	DWORD mDevice;
+	DWORD mWidth;
+	DWORD mHeight;
+	DWORD mFormat;
+	int mClients;
+	IMAGE_SCALE_FN mScale;
+	FrameRingPublisher mRing;
+};
+
+// A device captured for the variants of it
+struct Device
+{
+	DWORD mDevice;
+	DWORD mWidth;
+	DWORD mHeight;
+	std::vector<BYTE> mBuffer;
+	SimpleCapParamsEx mParams;
+};
+
+struct Client
+{
+	int mSocket;
+	Variant *mVariant;    // NULL until it has subscribed
+};
+
+static std::vector<Variant *> gVariants;
+static std::vector<Device *> gDevices;
+static std::vector<Client> gClients;
+static volatile sig_atomic_t gQuit = 0;
+
+static void OnSignal(int)
+{
+	gQuit = 1;
+}
+
+static IMAGE_SCALE_FN FindScale(DWORD aFormat)
+{
+	for (DWORD i = 0; i < gScaleFormats; i++)
+		if (gScaleFunctions[i].mSrcFormat == CAPTURE_FORMAT_BGRA && gScaleFunctions[i].mFormat == (int)aFormat)
+			return gScaleFunctions[i].mScale;
+	return 0;
+}
+
+// Captures each device at the largest size of its variants, or not at all
+// without any; returns 0 if a device failed to initialize at the new size.
+static int UpdateDevice(DWORD aDevice)
+{
+	DWORD width = 0, height = 0;
+	for (size_t i = 0; i < gVariants.size(); i++)
+	{
+		if (gVariants[i]->mDevice != aDevice)
+			continue;
+		if (gVariants[i]->mWidth > width)
+			width = gVariants[i]->mWidth;
+		if (gVariants[i]->mHeight > height)
+			height = gVariants[i]->mHeight;
+	}
+
+	Device *device = 0;
+	size_t index;
+	for (index = 0; index < gDevices.size() && !device; index++)
+		if (gDevices[index]->mDevice == aDevice)
+			device = gDevices[index];
+
+	if (device && device->mWidth == width && device->mHeight == height)
+		return 1;
+	if (device)
+	{
+		deinitCapture(aDevice);
+		gDevices.erase(gDevices.begin() + index - 1);
+		delete device;
+		printf("device %u: stopped\n", aDevice);
+	}
+	if (width == 0)
+		return 1;
+
+	device = new Device;
+	device->mDevice = aDevice;
+	device->mWidth = width;
+	device->mHeight = height;
+	device->mBuffer.resize((size_t)width * height * 4);
+	memset(&device->mParams, 0, sizeof(device->mParams));
+	device->mParams.mTargetBuf = device->mBuffer.data();
+	device->mParams.mWidth = width;
+	device->mParams.mHeight = height;
+	device->mParams.mFormat = CAPTURE_FORMAT_BGRA;
+	if (!initCaptureEx(aDevice, &device->mParams, 0))
+	{
+		fprintf(stderr, "device %u: can't capture at %ux%u (error %d at line %d)\n",
+			aDevice, width, height, getCaptureErrorCode(aDevice), getCaptureErrorLine(aDevice));
+		delete device;
+		return 0;
+	}
+	gDevices.push_back(device);
+	doCapture(aDevice);
+	printf("device %u: capturing at %ux%u\n", aDevice, width, height);
+	return 1;
+}
+
+static void Release(Variant *aVariant)
+{
+	if (--aVariant->mClients > 0)
+		return;
+	DWORD device = aVariant->mDevice;
+	for (size_t i = 0; i < gVariants.size(); i++)
+	{
+		if (gVariants[i] == aVariant)
+		{
+			gVariants.erase(gVariants.begin() + i);
+			break;
+		}
+	}
+	delete aVariant;
+	UpdateDevice(device);
+}
+
+// Finds or makes the variant a client asked for; NULL if it can't be had
+static Variant *Subscribe(const BrokerRequest &aRequest)
+{
+	if (memcmp(aRequest.mMagic, BROKER_MAGIC, 8) ||
+		aRequest.mVersion != BROKER_VERSION ||
+		(int)aRequest.mDevice >= countCaptureDevices() ||
+		aRequest.mWidth == 0 || aRequest.mWidth > MAX_SIZE ||
+		aRequest.mHeight == 0 || aRequest.mHeight > MAX_SIZE)
+		return 0;
+	if ((aRequest.mFormat == CAPTURE_FORMAT_I420 || aRequest.mFormat == CAPTURE_FORMAT_NV12) &&
+		((aRequest.mWidth | aRequest.mHeight) & 1))
+		return 0;
+
+	for (size_t i = 0; i < gVariants.size(); i++)
+	{
+		Variant *v = gVariants[i];
+		if (v->mDevice == aRequest.mDevice && v->mWidth == aRequest.mWidth &&
+			v->mHeight == aRequest.mHeight && v->mFormat == aRequest.mFormat)
+		{
+			v->mClients++;
+			return v;
+		}
+	}
+
+	IMAGE_SCALE_FN scale = FindScale(aRequest.mFormat);
+	if (!scale)
+		return 0;
+	Variant *v = new Variant;
+	v->mDevice = aRequest.mDevice;
+	v->mWidth = aRequest.mWidth;
+	v->mHeight = aRequest.mHeight;
+	v->mFormat = aRequest.mFormat;
+	v->mClients = 1;
+	v->mScale = scale;
+	if (FAILED(v->mRing.open(0, 0, v->mFormat, v->mWidth, v->mHeight)))
+	{
+		delete v;
+		return 0;
+	}
+	gVariants.push_back(v);
+	if (!UpdateDevice(v->mDevice))
+	{
+		// Which goes back to capturing for the others at the size before
+		Release(v);
+		return 0;
+	}
+	return v;
+}
+
+// Answers a request, passing the ring's memfd along if there is one
+static int Reply(int aSocket, Variant *aVariant)
+{
+	BrokerReply reply;
+	memset(&reply, 0, sizeof(reply));
+	memcpy(reply.mMagic, BROKER_MAGIC, 8);
+	reply.mResult = aVariant ? 1 : 0;
+
+	union
+	{
+		char mBuffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr mAlign;
+	} control;
+	struct iovec iov = { &reply, sizeof(reply) };
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	if (aVariant)
+	{
+		memset(&control, 0, sizeof(control));
+		message.msg_control = control.mBuffer;
+		message.msg_controllen = sizeof(control.mBuffer);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		int fd = aVariant->mRing.memory().mFd;
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	return sendmsg(aSocket, &message, MSG_NOSIGNAL) == sizeof(reply);
+}
+
+static void Drop(size_t aClient)
+{
+	close(gClients[aClient].mSocket);
+	Variant *variant = gClients[aClient].mVariant;
+	gClients.erase(gClients.begin() + aClient);
+	if (variant)
+		Release(variant);
+}
+
+// Something arrived from a client: its request, or the end of the connection
+static void Serve(size_t aClient)
+{
+	Client &client = gClients[aClient];
+	BrokerRequest request;
+	ssize_t len = recv(client.mSocket, &request, sizeof(request), MSG_DONTWAIT);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len != sizeof(request) || client.mVariant)
+	{
+		Drop(aClient);
+		return;
+	}
+
+	client.mVariant = Subscribe(request);
+	if (!Reply(client.mSocket, client.mVariant) || !client.mVariant)
+	{
+		Drop(aClient);
+		return;
+	}
+	printf("client %d: device %u at %ux%u, format %u\n", client.mSocket,
+		request.mDevice, request.mWidth, request.mHeight, request.mFormat);
+}
+
+// Hands a captured frame to each variant of the device
+static void Distribute(Device *aDevice)
+{
+	// doCapture doesn't tell when the frame was taken, so the frames are
+	// stamped with when they were done.
+	long long timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	for (size_t i = 0; i < gVariants.size(); i++)
+	{
+		Variant *v = gVariants[i];
+		if (v->mDevice != aDevice->mDevice)
+			continue;
+		BYTE *dst = v->mRing.beginFrame();
+		v->mScale(dst, MinimumStride(v->mFormat, v->mWidth), v->mWidth, v->mHeight,
+			aDevice->mBuffer.data(), aDevice->mWidth * 4, aDevice->mWidth, aDevice->mHeight);
+		v->mRing.endFrame(timestamp);
+	}
+	doCapture(aDevice->mDevice);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = BROKER_DEFAULT_SOCKET;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			path = argv[++i];
+		else
+		{
+			fprintf(stderr, "usage: broker [-s socketpath]\n");
+			return 1;
+		}
+	}
+
+	int devices = setupESCAPI();
+	if (devices == 0)
+	{
+		fprintf(stderr, "Unable to init ESCAPI, or no capture devices found\n");
+		return 1;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Socket path too long\n");
+		return 1;
+	}
+	strcpy(address.sun_path, path);
+
+	// A broker that crashed leaves its socket behind.
+	unlink(path);
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0 ||
+		bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+		listen(listener, 16) < 0)
+	{
+		fprintf(stderr, "Can't listen on %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+	printf("%d device(s), listening on %s\n", devices, path);
+
+	std::vector<struct pollfd> fds;
+	while (!gQuit)
+	{
+		fds.resize(gClients.size() + 1);
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for (size_t i = 0; i < gClients.size(); i++)
+		{
+			fds[i + 1].fd = gClients[i].mSocket;
+			fds[i + 1].events = POLLIN;
+		}
+
+		// Capture completion can only be polled for, so while anything is
+		// being captured, look in on it every millisecond.
+		if (poll(fds.data(), fds.size(), gDevices.empty() ? -1 : 1) < 0 && errno != EINTR)
+			break;
+
+		for (size_t i = 0; i < gDevices.size(); i++)
+			if (isCaptureDone(gDevices[i]->mDevice))
+				Distribute(gDevices[i]);
+
+		// Backwards, as serving a client may drop it
+		for (size_t i = gClients.size(); i > 0; i--)
+			if (fds[i].revents)
+				Serve(i - 1);
+
+		if (fds[0].revents & POLLIN)
+		{
+			int socket = accept4(listener, 0, 0, SOCK_CLOEXEC);
+			if (socket >= 0 && gClients.size() < MAX_CLIENTS)
+			{
+				Client client = { socket, 0 };
+				gClients.push_back(client);
+			}
+			else if (socket >= 0)
+				close(socket);
+		}
+	}
+
+	while (!gClients.empty())
+		Drop(gClients.size() - 1);
+	close(listener);
+	unlink(path);
+	return 0;
+}
@@ -7,13 +7,31 @@ fn main() {
         .cpp(true)
         .pic(true)
         .include(path.join("escapi_dll"))
+        .include(path.join("escapi_core"))
         .include(path.join("common"))
         .include("C:/Program Files (x86)/Windows Kits/8.1/Include/um/shlwapi.h")
+        .file("escapi_dll/archive.cpp")
         .file("escapi_dll/capture.cpp")
-        .file("escapi_dll/conversion.cpp")
+        .file("escapi_dll/capturegroup.cpp")
+        .file("escapi_dll/capturestats.cpp")
+        .file("escapi_dll/capturetrace.cpp")
+        .file("escapi_dll/cropbatch.cpp")
         .file("escapi_dll/escapi_dll.cpp")
+        .file("escapi_dll/filebackend.cpp")
+        .file("escapi_dll/framering.cpp")
         .file("escapi_dll/interface.cpp")
+        .file("escapi_dll/mappedfile.cpp")
+        .file("escapi_dll/mfbackend.cpp")
+        .file("escapi_dll/recorder.cpp")
+        .file("escapi_dll/testpatternbackend.cpp")
         .file("escapi_dll/videobufferlock.cpp")
+        .file("escapi_core/conversion.cpp")
+        .file("escapi_core/jobpool.cpp")
+        .file("escapi_core/mjpeg.cpp")
+        .file("escapi_core/pyramid.cpp")
+        .file("escapi_core/scaling.cpp")
+        .file("escapi_core/tensor.cpp")
+        .file("escapi_core/testpattern.cpp")
         .object("ole32.lib")
         .object("oleaut32.lib")
         .object("uuid.lib")
@@ -1,4 +1,15 @@
+#ifdef _WIN32
 #include <windows.h>
+#define ESCAPI_LIBRARY "escapi.dll"
+#else
+#include <dlfcn.h>
+#include <stddef.h>
+/* Same thing, with the shared library built by escapi_dll/Makefile */
+typedef void *HMODULE;
+#define LoadLibraryA(name) dlopen(name, RTLD_NOW)
+#define GetProcAddress dlsym
+#define ESCAPI_LIBRARY "libescapi.so"
+#endif
 #include "escapi.h"
 
 countCaptureDevicesProc countCaptureDevices;
@@ -14,6 +25,44 @@ setCapturePropertyProc setCaptureProperty;
 getCaptureErrorLineProc getCaptureErrorLine;
 getCaptureErrorCodeProc getCaptureErrorCode;
 initCaptureWithOptionsProc initCaptureWithOptions;
+initCaptureExProc initCaptureEx;
+getCaptureFrameInfoProc getCaptureFrameInfo;
+setTestPatternDeviceProc setTestPatternDevice;
+getTestPatternFrameNumberProc getTestPatternFrameNumber;
+setFileDeviceProc setFileDevice;
+startRecordingProc startRecording;
+stopRecordingProc stopRecording;
+getRecordingStatsProc getRecordingStats;
+openArchiveProc openArchive;
+closeArchiveProc closeArchive;
+getArchiveFrameCountProc getArchiveFrameCount;
+findArchiveFrameProc findArchiveFrame;
+getArchiveFrameProc getArchiveFrame;
+startPublishingProc startPublishing;
+stopPublishingProc stopPublishing;
+openCaptureRingProc openCaptureRing;
+closeCaptureRingProc closeCaptureRing;
+getRingFrameProc getRingFrame;
+checkRingFrameProc checkRingFrame;
+openBrokerRingProc openBrokerRing;
+addCaptureSinkProc addCaptureSink;
+removeCaptureSinkProc removeCaptureSink;
+doCaptureSinkProc doCaptureSink;
+isCaptureSinkDoneProc isCaptureSinkDone;
+getCapturePyramidLayoutProc getCapturePyramidLayout;
+initCapturePyramidProc initCapturePyramid;
+setCaptureRegionProc setCaptureRegion;
+getCaptureRegionProc getCaptureRegion;
+doCaptureBatchProc doCaptureBatch;
+isCaptureBatchDoneProc isCaptureBatchDone;
+initCaptureTensorProc initCaptureTensor;
+captureGroupProc captureGroup;
+getCaptureStatsProc getCaptureStats;
+resetCaptureStatsProc resetCaptureStats;
+startCaptureTraceProc startCaptureTrace;
+stopCaptureTraceProc stopCaptureTrace;
+saveCaptureTraceProc saveCaptureTrace;
+traceCaptureSpanProc traceCaptureSpan;
 
 
 /* Internal: initialize COM */
@@ -23,7 +72,7 @@ initCOMProc initCOM;
 int setupESCAPI()
 {
   /* Load DLL dynamically */
-  HMODULE capdll = LoadLibraryA("escapi.dll");
+  HMODULE capdll = LoadLibraryA(ESCAPI_LIBRARY);
   if (capdll == NULL)
     return 0;
 
@@ -42,6 +91,44 @@ int setupESCAPI()
   getCaptureErrorLine = (getCaptureErrorLineProc)GetProcAddress(capdll, "getCaptureErrorLine");
   getCaptureErrorCode = (getCaptureErrorCodeProc)GetProcAddress(capdll, "getCaptureErrorCode");
   initCaptureWithOptions = (initCaptureWithOptionsProc)GetProcAddress(capdll, "initCaptureWithOptions");
+  initCaptureEx = (initCaptureExProc)GetProcAddress(capdll, "initCaptureEx");
+  getCaptureFrameInfo = (getCaptureFrameInfoProc)GetProcAddress(capdll, "getCaptureFrameInfo");
+  setTestPatternDevice = (setTestPatternDeviceProc)GetProcAddress(capdll, "setTestPatternDevice");
+  getTestPatternFrameNumber = (getTestPatternFrameNumberProc)GetProcAddress(capdll, "getTestPatternFrameNumber");
+  setFileDevice = (setFileDeviceProc)GetProcAddress(capdll, "setFileDevice");
+  startRecording = (startRecordingProc)GetProcAddress(capdll, "startRecording");
+  stopRecording = (stopRecordingProc)GetProcAddress(capdll, "stopRecording");
+  getRecordingStats = (getRecordingStatsProc)GetProcAddress(capdll, "getRecordingStats");
+  openArchive = (openArchiveProc)GetProcAddress(capdll, "openArchive");
+  closeArchive = (closeArchiveProc)GetProcAddress(capdll, "closeArchive");
+  getArchiveFrameCount = (getArchiveFrameCountProc)GetProcAddress(capdll, "getArchiveFrameCount");
+  findArchiveFrame = (findArchiveFrameProc)GetProcAddress(capdll, "findArchiveFrame");
+  getArchiveFrame = (getArchiveFrameProc)GetProcAddress(capdll, "getArchiveFrame");
+  startPublishing = (startPublishingProc)GetProcAddress(capdll, "startPublishing");
+  stopPublishing = (stopPublishingProc)GetProcAddress(capdll, "stopPublishing");
+  openCaptureRing = (openCaptureRingProc)GetProcAddress(capdll, "openCaptureRing");
+  closeCaptureRing = (closeCaptureRingProc)GetProcAddress(capdll, "closeCaptureRing");
+  getRingFrame = (getRingFrameProc)GetProcAddress(capdll, "getRingFrame");
+  checkRingFrame = (checkRingFrameProc)GetProcAddress(capdll, "checkRingFrame");
+  openBrokerRing = (openBrokerRingProc)GetProcAddress(capdll, "openBrokerRing");
+  addCaptureSink = (addCaptureSinkProc)GetProcAddress(capdll, "addCaptureSink");
+  removeCaptureSink = (removeCaptureSinkProc)GetProcAddress(capdll, "removeCaptureSink");
+  doCaptureSink = (doCaptureSinkProc)GetProcAddress(capdll, "doCaptureSink");
+  isCaptureSinkDone = (isCaptureSinkDoneProc)GetProcAddress(capdll, "isCaptureSinkDone");
+  getCapturePyramidLayout = (getCapturePyramidLayoutProc)GetProcAddress(capdll, "getCapturePyramidLayout");
+  initCapturePyramid = (initCapturePyramidProc)GetProcAddress(capdll, "initCapturePyramid");
+  setCaptureRegion = (setCaptureRegionProc)GetProcAddress(capdll, "setCaptureRegion");
+  getCaptureRegion = (getCaptureRegionProc)GetProcAddress(capdll, "getCaptureRegion");
+  doCaptureBatch = (doCaptureBatchProc)GetProcAddress(capdll, "doCaptureBatch");
+  isCaptureBatchDone = (isCaptureBatchDoneProc)GetProcAddress(capdll, "isCaptureBatchDone");
+  initCaptureTensor = (initCaptureTensorProc)GetProcAddress(capdll, "initCaptureTensor");
+  captureGroup = (captureGroupProc)GetProcAddress(capdll, "captureGroup");
+  getCaptureStats = (getCaptureStatsProc)GetProcAddress(capdll, "getCaptureStats");
+  resetCaptureStats = (resetCaptureStatsProc)GetProcAddress(capdll, "resetCaptureStats");
+  startCaptureTrace = (startCaptureTraceProc)GetProcAddress(capdll, "startCaptureTrace");
+  stopCaptureTrace = (stopCaptureTraceProc)GetProcAddress(capdll, "stopCaptureTrace");
+  saveCaptureTrace = (saveCaptureTraceProc)GetProcAddress(capdll, "saveCaptureTrace");
+  traceCaptureSpan = (traceCaptureSpanProc)GetProcAddress(capdll, "traceCaptureSpan");
 
 
   /* Check that we got all the entry points */
@@ -58,11 +145,49 @@ int setupESCAPI()
 	  setCaptureProperty == NULL ||
 	  getCaptureErrorLine == NULL ||
 	  getCaptureErrorCode == NULL ||
-	  initCaptureWithOptions == NULL)
+	  initCaptureWithOptions == NULL ||
+	  initCaptureEx == NULL ||
+	  getCaptureFrameInfo == NULL ||
+	  setTestPatternDevice == NULL ||
+	  getTestPatternFrameNumber == NULL ||
+	  setFileDevice == NULL ||
+	  startRecording == NULL ||
+	  stopRecording == NULL ||
+	  getRecordingStats == NULL ||
+	  openArchive == NULL ||
+	  closeArchive == NULL ||
+	  getArchiveFrameCount == NULL ||
+	  findArchiveFrame == NULL ||
+	  getArchiveFrame == NULL ||
+	  startPublishing == NULL ||
+	  stopPublishing == NULL ||
+	  openCaptureRing == NULL ||
+	  closeCaptureRing == NULL ||
+	  getRingFrame == NULL ||
+	  checkRingFrame == NULL ||
+	  openBrokerRing == NULL ||
+	  addCaptureSink == NULL ||
+	  removeCaptureSink == NULL ||
+	  doCaptureSink == NULL ||
+	  isCaptureSinkDone == NULL ||
+	  getCapturePyramidLayout == NULL ||
+	  initCapturePyramid == NULL ||
+	  setCaptureRegion == NULL ||
+	  getCaptureRegion == NULL ||
+	  doCaptureBatch == NULL ||
+	  isCaptureBatchDone == NULL ||
+	  initCaptureTensor == NULL ||
+	  captureGroup == NULL ||
+	  getCaptureStats == NULL ||
+	  resetCaptureStats == NULL ||
+	  startCaptureTrace == NULL ||
+	  stopCaptureTrace == NULL ||
+	  saveCaptureTrace == NULL ||
+	  traceCaptureSpan == NULL)
       return 0;
 
   /* Verify DLL version is at least what we want */
-  if (ESCAPIVersion() < 0x301)
+  if (ESCAPIVersion() < 0x302)
     return 0;
 
   /* Initialize COM.. */
@@ -12,6 +12,70 @@ struct SimpleCapParams
 	int mHeight;
 };
 
+/* Output pixel formats for SimpleCapParamsEx. Names give the byte order in memory. */
+enum CAPTURE_FORMATS
+{
+	CAPTURE_FORMAT_BGRA,  /* 4 bytes per pixel, same as SimpleCapParams */
+	CAPTURE_FORMAT_RGBA,  /* 4 bytes per pixel */
+	CAPTURE_FORMAT_RGB24, /* 3 bytes per pixel */
+	CAPTURE_FORMAT_GRAY8, /* 1 byte per pixel, luma only */
+	CAPTURE_FORMAT_I420,  /* Y plane, followed by U and V planes at half stride */
+	CAPTURE_FORMAT_NV12,  /* Y plane, followed by interleaved UV plane at full stride */
+	CAPTURE_FORMAT_MAX
+};
+
+struct SimpleCapParamsEx
+{
+	/* Target buffer.
+	 * Must be at least mStride * mHeight bytes of size, or
+	 * mStride * mHeight * 3 / 2 for the planar I420 and NV12 formats.
+	 */
+	void * mTargetBuf;
+	/* Buffer width */
+	int mWidth;
+	/* Buffer height */
+	int mHeight;
+	/* Bytes from the start of one row to the next (of the Y plane for planar formats).
+	 * 0 means rows are tightly packed. Can be used to capture into a sub-rectangle
+	 * of a larger image, or into padded rows.
+	 */
+	int mStride;
+	/* One of CAPTURE_FORMATS. Width and height must be even for I420 and NV12. */
+	int mFormat;
+	/* CAPTURE_FLAG_* values OR:ed together */
+	unsigned int mFlags;
+};
+
+/* Layout of the target buffer, as returned by getCaptureFrameInfo */
+struct CaptureFrameInfo
+{
+	/* One of CAPTURE_FORMATS */
+	int mFormat;
+	int mWidth;
+	int mHeight;
+	/* Number of planes: 1 for packed formats, 2 for NV12 (Y, UV), 3 for I420 (Y, U, V) */
+	int mPlanes;
+	/* Byte offset of each plane from the start of the target buffer */
+	int mPlaneOffset[3];
+	/* Bytes from the start of one row of each plane to the next */
+	int mPlaneStride[3];
+};
+
+// Flags accepted in SimpleCapParamsEx::mFlags:
+// Store the image bottom-up, i.e. first row in memory is the bottom row of the image.
+#define CAPTURE_FLAG_FLIP_VERTICAL 1
+// Override the YCbCr matrix and range used to convert the camera's YUV (and MJPG)
+// video to RGB. By default, what the camera reports is used, or BT.601 limited range
+// if it reports nothing (MJPG is always full range BT.601 by default).
+// At most one of BT601 / BT709, and one of LIMITED_RANGE / FULL_RANGE may be given.
+#define CAPTURE_FLAG_BT601 2
+#define CAPTURE_FLAG_BT709 4
+#define CAPTURE_FLAG_LIMITED_RANGE 8
+#define CAPTURE_FLAG_FULL_RANGE 16
+// Mask to check for valid flags - all flags OR:ed together.
+#define CAPTURE_FLAGS_MASK (CAPTURE_FLAG_FLIP_VERTICAL | CAPTURE_FLAG_BT601 | CAPTURE_FLAG_BT709 | \
+	CAPTURE_FLAG_LIMITED_RANGE | CAPTURE_FLAG_FULL_RANGE)
+
 enum CAPTURE_PROPETIES
 {
 	CAPTURE_BRIGHTNESS,
@@ -99,8 +163,487 @@ typedef int (*initCaptureWithOptionsProc)(unsigned int deviceno, struct SimpleCa
 // Options accepted by above:
 // Return raw data instead of converted rgb. Using this option assumes you know what you're doing.
 #define CAPTURE_OPTION_RAWDATA 1 
+// Return pixels in RGBA byte order (as used by OpenGL) instead of BGRA.
+// With initCaptureEx, use CAPTURE_FORMAT_RGBA instead.
+#define CAPTURE_OPTION_RGBA 2
 // Mask to check for valid options - all options OR:ed together.
-#define CAPTURE_OPTIONS_MASK (CAPTURE_OPTION_RAWDATA) 
+#define CAPTURE_OPTIONS_MASK (CAPTURE_OPTION_RAWDATA | CAPTURE_OPTION_RGBA) 
+
+/* initCaptureEx is like initCaptureWithOptions, but takes extended capture parameters
+ * (row stride, output pixel format and flags). Raw data can only be requested with
+ * CAPTURE_FORMAT_BGRA.
+ */
+typedef int (*initCaptureExProc)(unsigned int deviceno, struct SimpleCapParamsEx *aParams, unsigned int aOptions);
+
+/* Describes the plane layout of the device's target buffer.
+ * Returns 0 if the device has not been initialized, 1 on success.
+ */
+typedef int (*getCaptureFrameInfoProc)(unsigned int deviceno, struct CaptureFrameInfo *aInfo);
+
+/* Most sinks a device can have besides its target buffer */
+#define CAPTURE_MAX_SINKS 8
+
+/* Adds another output to an initialized device, such as a small preview next to a
+ * full size target: each frame is converted once, and scaled from there into every
+ * output that asked for it. The parameters are as for initCaptureEx, except that
+ * only CAPTURE_FLAG_FLIP_VERTICAL may be given (the YCbCr flags of the device apply)
+ * and raw data devices can't have sinks. Adding a sink may restart the device, to
+ * pick a mode that covers it. Sinks last until removeCaptureSink or deinitCapture.
+ * Returns the sink's number, from 1 to CAPTURE_MAX_SINKS, or 0 on failure.
+ */
+typedef int (*addCaptureSinkProc)(unsigned int deviceno, struct SimpleCapParamsEx *aParams);
+typedef int (*removeCaptureSinkProc)(unsigned int deviceno, int sink);
+
+/* doCapture and isCaptureDone for a sink; sink 0 is the device's own target buffer. */
+typedef void (*doCaptureSinkProc)(unsigned int deviceno, int sink);
+typedef int (*isCaptureSinkDoneProc)(unsigned int deviceno, int sink);
+
+/* Most levels of an image pyramid, including the full size image */
+#define CAPTURE_MAX_PYRAMID_LEVELS 8
+
+/* Layout of an image pyramid buffer, as returned by getCapturePyramidLayout */
+struct CapturePyramidInfo
+{
+	/* One of CAPTURE_FORMATS */
+	int mFormat;
+	int mLevels;
+	/* Level 0 is the image itself; each further level is half the size of the
+	 * one before, rounded down */
+	int mWidth[CAPTURE_MAX_PYRAMID_LEVELS];
+	int mHeight[CAPTURE_MAX_PYRAMID_LEVELS];
+	/* Byte offset of each level from the start of the buffer, and its row pitch */
+	int mOffset[CAPTURE_MAX_PYRAMID_LEVELS];
+	int mStride[CAPTURE_MAX_PYRAMID_LEVELS];
+	/* Bytes the whole buffer needs */
+	int mSize;
+};
+
+/* Describes a buffer for an image pyramid of the given number of levels (1 to
+ * CAPTURE_MAX_PYRAMID_LEVELS), with level 0 at the given stride (0 for tightly
+ * packed). The further levels follow it, tightly packed, each on a 16 byte boundary.
+ * Pyramids can be BGRA, RGBA, RGB24 or GRAY8.
+ * Returns 0 if the format has no pyramid or the image is too small for the levels,
+ * 1 on success.
+ */
+typedef int (*getCapturePyramidLayoutProc)(int format, int width, int height, int stride, int levels, struct CapturePyramidInfo *info);
+
+/* initCaptureEx, with a target buffer laid out by getCapturePyramidLayout. Every
+ * captured frame fills in all the levels; each is the one before box filtered 2x2,
+ * which is done while the rows are still in cache from the conversion.
+ * CAPTURE_FLAG_FLIP_VERTICAL and raw data can't be used.
+ */
+typedef int (*initCapturePyramidProc)(unsigned int deviceno, struct SimpleCapParamsEx *aParams, unsigned int aOptions, int levels);
+
+/* Part of the camera's frames that is captured, as returned by getCaptureRegion */
+struct CaptureRegion
+{
+	int mLeft;
+	int mTop;
+	int mWidth;
+	int mHeight;
+	/* Size of the camera's video mode, which the region is in */
+	int mFrameWidth;
+	int mFrameHeight;
+};
+
+/* Captures only a rectangle of the camera's frames, given in the pixels of the
+ * camera's video mode, which is scaled to fill the target buffer and every sink.
+ * Only the region is converted, so the work per frame shrinks with its area. The
+ * region is rounded out to even coordinates and clipped to the frame, and can be
+ * changed between any two frames; a width and height of 0 go back to the whole
+ * frame. 4:2:0 and MJPG video is still converted whole, and the region then can't
+ * be used when the device captures such video into an I420 or NV12 target.
+ * Returns 0 if the region is outside the frame or can't be used, 1 on success.
+ */
+typedef int (*setCaptureRegionProc)(unsigned int deviceno, int left, int top, int width, int height);
+
+/* Gets the region in use, after rounding and clipping, and the size of the video
+ * mode. Returns 0 if the device isn't capturing yet, 1 on success.
+ */
+typedef int (*getCaptureRegionProc)(unsigned int deviceno, struct CaptureRegion *region);
+
+/* A rectangle of the camera's frames for doCaptureBatch, in the pixels of its video mode */
+struct CaptureRect
+{
+	int mLeft;
+	int mTop;
+	int mWidth;
+	int mHeight;
+};
+
+/* Most crops in a batch */
+#define CAPTURE_MAX_BATCH 64
+
+/* Cuts count rectangles out of the next frame, each scaled to crops->mWidth by
+ * crops->mHeight in crops->mFormat (BGRA, RGBA, RGB24 or GRAY8), and stores them one
+ * after another in crops->mTargetBuf, crop n starting at n * crops->mStride *
+ * crops->mHeight bytes. No flags may be given (the YCbCr flags of the device apply).
+ * The crops are made in parallel, and for packed camera formats only the rows
+ * sampled for them are converted; the target buffer and sinks aren't touched. The
+ * rectangles are copied, and clipped to the frame; a crop that misses the frame
+ * is zeroed. A new batch replaces one still waiting for a frame.
+ * Returns 0 if the device isn't initialized, is capturing raw data, or the
+ * parameters are invalid, 1 on success.
+ */
+typedef int (*doCaptureBatchProc)(unsigned int deviceno, const struct CaptureRect *rects, int count, struct SimpleCapParamsEx *crops);
+
+/* Returns 1 when the batch requested last has been made. */
+typedef int (*isCaptureBatchDoneProc)(unsigned int deviceno);
+
+/* Element types of CaptureTensorParams */
+enum CAPTURE_TENSOR_TYPES
+{
+	CAPTURE_TENSOR_FLOAT32,
+	CAPTURE_TENSOR_FLOAT16  /* IEEE half precision, stored as 16 bit integers */
+};
+
+// Flags accepted in CaptureTensorParams::mFlags:
+// Planes in blue, green, red order instead of red, green, blue.
+#define CAPTURE_TENSOR_FLAG_BGR 1
+// Keep the shape of the frame, centered between bars of mPad.
+#define CAPTURE_TENSOR_FLAG_LETTERBOX 2
+// Mask to check for valid flags - all flags OR:ed together.
+#define CAPTURE_TENSOR_FLAGS_MASK (CAPTURE_TENSOR_FLAG_BGR | CAPTURE_TENSOR_FLAG_LETTERBOX)
+
+/* A planar (CHW) tensor of normalized pixel values, as neural networks take them */
+struct CaptureTensorParams
+{
+	/* Target buffer: three planes of mWidth * mHeight elements, one per channel.
+	 * Must be at least 3 * mWidth * mHeight elements of size.
+	 */
+	void * mTargetBuf;
+	int mWidth;
+	int mHeight;
+	/* One of CAPTURE_TENSOR_TYPES */
+	int mType;
+	/* CAPTURE_TENSOR_FLAG_* values OR:ed together */
+	unsigned int mFlags;
+	/* Per plane: the stored value is (value - mMean) / mStd, where value is the
+	 * channel from 0 to 1. A mean of 0 and std of 1 / 255 store 0 to 255.
+	 */
+	float mMean[3];
+	float mStd[3];
+	/* Per plane, the value (0 to 1) of the letterbox bars, normalized likewise */
+	float mPad[3];
+};
+
+/* initCapture, but every frame is converted, resized, split into planes and
+ * normalized straight into a tensor, in one pass over the frame. The options are
+ * as for initCaptureEx, except raw data. setCaptureRegion, addCaptureSink and
+ * doCaptureBatch work as usual; getCaptureFrameInfo, publishing and recording
+ * anything but the camera's own frames don't apply.
+ * Returns 0 on failure, 1 on success.
+ */
+typedef int (*initCaptureTensorProc)(unsigned int deviceno, struct CaptureTensorParams *aParams, unsigned int aOptions);
+
+/* Most devices in a captureGroup */
+#define CAPTURE_MAX_GROUP 16
+
+/* Captures one frame on each of count initialized devices, all taken within
+ * tolerance microseconds of each other, as stereo and multi-view setups need.
+ * The last few frames of each device are kept to find the closest set, and the
+ * call blocks until there is one, or timeout milliseconds pass. Each frame then
+ * goes into its device's target buffer, as doCapture would put it, and its time
+ * into timestamps[i] unless timestamps is NULL: microseconds of a steady clock,
+ * only meaningful relative to each other. Cameras that report when each frame
+ * was taken are timed by that (V4L2), others by when it arrives.
+ * Returns 1 on success, 0 on failure or timeout. A device can be in one call at a
+ * time; a call that includes a device already waiting in another fails at once.
+ * On timeout the target buffers are not restored: each holds the last frame its
+ * device converted while waiting (or what it held before, if none came), and
+ * these frames don't match each other.
+ */
+typedef int (*captureGroupProc)(const unsigned int *devices, int count, int tolerance, int timeout, long long *timestamps);
+
+/* Stages of a frame's way through a device, as timed in CaptureStats */
+enum CAPTURE_STAGES
+{
+	CAPTURE_STAGE_LOCK,      /* Locking the camera's buffer (Media Foundation only) */
+	CAPTURE_STAGE_CONVERT,   /* Converting or decoding the frame (and filling a tensor from packed video) */
+	CAPTURE_STAGE_SCALE,     /* Scaling into the target buffer and sinks */
+	CAPTURE_STAGE_BATCH,     /* Making the crops of doCaptureBatch */
+	CAPTURE_STAGE_HANDOFF,   /* Pyramid levels left over, captureGroup, recording and publishing */
+	CAPTURE_STAGE_LATENCY,   /* From when the frame was taken (or arrived) until it was done */
+	CAPTURE_STAGE_COUNT
+};
+
+/* Buckets of the histograms in CaptureStageStats */
+#define CAPTURE_STATS_BUCKETS 20
+
+/* Times of one stage */
+struct CaptureStageStats
+{
+	unsigned long long mCount;
+	unsigned long long mTotalMicroseconds;
+	unsigned int mMaxMicroseconds;
+	/* mHistogram[0] counts times under 1 microsecond, mHistogram[i] times from 2^(i-1)
+	 * up to 2^i microseconds, and the last bucket everything longer. */
+	unsigned int mHistogram[CAPTURE_STATS_BUCKETS];
+};
+
+/* What a device has been doing since it was initialized, or since resetCaptureStats */
+struct CaptureStats
+{
+	/* Frames the camera delivered, whether anything asked for them or not */
+	unsigned long long mFramesArrived;
+	/* Frames converted for doCapture, a sink, a batch or a group */
+	unsigned long long mFramesDelivered;
+	/* Frames the camera skipped (as far as it tells), and frames that couldn't be decoded */
+	unsigned long long mFramesDropped;
+	/* Frames arriving per second, recently */
+	float mFps;
+	struct CaptureStageStats mStages[CAPTURE_STAGE_COUNT];
+};
+
+/* Fills in the statistics of a device. The counters are updated without locks, so
+ * a frame in progress may show in some of them and not yet in others.
+ * Returns 0 if the device isn't initialized, 1 on success.
+ */
+typedef int (*getCaptureStatsProc)(unsigned int deviceno, struct CaptureStats *stats);
+
+/* Starts the statistics of a device over from zero. */
+typedef void (*resetCaptureStatsProc)(unsigned int deviceno);
+
+/* Starts recording a trace of the devices' work, to be viewed in chrome://tracing
+ * or Perfetto alongside the caller's own: each stage of each frame (as in
+ * CAPTURE_STAGES) is a span on the thread that ran it, tagged with the device and
+ * the frame's number, as are the frames' arrivals, doCapture calls, captureGroup
+ * waits and spans from traceCaptureSpan. Each thread keeps up to events of them
+ * (0 for 65536), and counts the rest as lost. Any earlier trace is dropped.
+ * Without a trace running, the devices spend next to no time on it.
+ * Returns 0 if events is negative, 1 on success.
+ */
+typedef int (*startCaptureTraceProc)(int events);
+
+/* Stops recording the trace; what was recorded is kept for saveCaptureTrace. */
+typedef void (*stopCaptureTraceProc)();
+
+/* Writes the trace, stopped or still running, to a Chrome trace event JSON file.
+ * Returns 0 if no trace was started or the file couldn't be written, 1 on success.
+ */
+typedef int (*saveCaptureTraceProc)(const char *filename);
+
+/* Adds a span of the caller's own to the trace, such as each pass of a render loop,
+ * to see how it lines up with the devices. begin 1 opens a span called name on the
+ * calling thread, begin 0 (name is ignored) closes the one opened last. Spans must
+ * be closed in the reverse order they were opened. Does nothing without a trace.
+ */
+typedef void (*traceCaptureSpanProc)(const char *name, int begin);
+
+/* Frame formats of the test pattern device, for setTestPatternDevice */
+enum CAPTURE_TESTPATTERN_FORMATS
+{
+	CAPTURE_TESTPATTERN_YUY2,
+	CAPTURE_TESTPATTERN_NV12,
+	CAPTURE_TESTPATTERN_RGB24,
+	CAPTURE_TESTPATTERN_RGB32,
+	CAPTURE_TESTPATTERN_MJPG,
+	CAPTURE_TESTPATTERN_MAX
+};
+
+/* Adds (or with enable 0, removes) a virtual capture device after the real ones,
+ * which generates moving test frames and needs no camera. It goes through the same
+ * conversion and scaling as a camera of the given frame size and format would.
+ * fps 0 delivers each requested frame as fast as possible, for benchmarking.
+ * Width and height must be even. Returns 0 if the settings are invalid, 1 on success.
+ * Without this call, the ESCAPI_TESTPATTERN environment variable is read instead:
+ * "1" for 640x480 at 30 fps in YUY2, or "WIDTHxHEIGHT[@FPS][,FORMAT]" such as
+ * "1920x1080@0,MJPG". Do not call this while the test pattern device is open.
+ */
+typedef int (*setTestPatternDeviceProc)(int enable, int width, int height, int fps, int format);
+
+/* Reads back the frame number that the test pattern device draws across the top of
+ * each frame, from the last captured image, to spot dropped or repeated frames.
+ * Returns -1 if the device is not the test pattern or captures raw data.
+ */
+typedef int (*getTestPatternFrameNumberProc)(unsigned int deviceno);
+
+/* File formats of the file device, for setFileDevice */
+enum CAPTURE_FILE_FORMATS
+{
+	CAPTURE_FILE_Y4M,   /* YUV4MPEG2 with 4:2:0 chroma, size and frame rate from its header */
+	CAPTURE_FILE_YUY2,  /* Raw frames, one after the other */
+	CAPTURE_FILE_NV12,
+	CAPTURE_FILE_I420,
+	CAPTURE_FILE_MAX
+};
+
+/* Adds (or with a NULL filename, removes) a virtual capture device after the test
+ * pattern, which replays the frames of a file over and over, through the same
+ * conversion and scaling as a camera. The file is memory mapped, so once it is
+ * cached the capture rate only depends on ESCAPI itself and the content.
+ * Width and height are only used for raw files, and must be even. fps 0 delivers
+ * each requested frame as fast as possible, and -1 plays at the rate in the Y4M
+ * header (30 fps for raw files). A file that starts with a Y4M header is read as
+ * Y4M whatever the format. Returns 0 if the settings are invalid, 1 on success;
+ * the file itself is only opened by initCapture.
+ * Without this call, the ESCAPI_FILE environment variable gives the file name, and
+ * ESCAPI_FILE_FORMAT can add "@FPS" for Y4M files, or "WIDTHxHEIGHT[@FPS][,FORMAT]"
+ * for raw ones, such as "1280x720@0,NV12". Do not call this while the device is open.
+ */
+typedef int (*setFileDeviceProc)(const char *filename, int width, int height, int fps, int format);
+
+/* File layouts for startRecording */
+enum CAPTURE_RECORD_CONTAINERS
+{
+	CAPTURE_RECORD_RAW,  /* Frames one after the other */
+	CAPTURE_RECORD_Y4M,  /* YUV4MPEG2, for I420 and GRAY8 images only */
+	CAPTURE_RECORD_ARCHIVE, /* Fixed size records with an index, for openArchive */
+	CAPTURE_RECORD_MAX
+};
+
+// Flags accepted by startRecording:
+// Record the frames as the camera delivered them (such as YUY2 or MJPG), instead of the
+// converted images, with their rows in the order they lie in memory (bottom-up RGB stays
+// bottom-up). Only with CAPTURE_RECORD_RAW.
+#define CAPTURE_RECORD_NATIVE 1
+// Bypass the operating system's file cache (FILE_FLAG_NO_BUFFERING / O_DIRECT).
+#define CAPTURE_RECORD_UNBUFFERED 2
+// When the queue is full, drop the oldest queued frame instead of the new one.
+#define CAPTURE_RECORD_DROP_OLDEST 4
+// When the queue is full, make the capture wait for the disk instead of dropping frames.
+#define CAPTURE_RECORD_BLOCK 8
+// Mask to check for valid flags - all flags OR:ed together.
+#define CAPTURE_RECORD_FLAGS_MASK (CAPTURE_RECORD_NATIVE | CAPTURE_RECORD_UNBUFFERED | \
+	CAPTURE_RECORD_DROP_OLDEST | CAPTURE_RECORD_BLOCK)
+
+/* Progress of a recording, as returned by getRecordingStats */
+struct CaptureRecordingStats
+{
+	/* Frames captured while recording, written to disk, and dropped because the
+	 * queue was full or a write failed */
+	unsigned int mFramesCaptured;
+	unsigned int mFramesWritten;
+	unsigned int mFramesDropped;
+	/* Frames waiting for the writer now, at most so far, and at most at all */
+	unsigned int mQueueDepth;
+	unsigned int mQueueHighWater;
+	unsigned int mQueueFrames;
+	unsigned long long mBytesWritten;
+	/* Time the capture spent waiting for the writer, with CAPTURE_RECORD_BLOCK */
+	unsigned long long mBlockedMicroseconds;
+	/* Longest single write to the file */
+	unsigned int mWriteMaxMicroseconds;
+	/* HRESULT of the write that failed, or 0. Nothing more is written after one. */
+	int mError;
+};
+
+/* Starts writing each captured frame to a file, on a thread of its own, so that the
+ * capture loop doesn't wait for the disk. Frames go through a queue of queueframes
+ * frames (0 for 16); what happens when it is full is set by the flags, and by default
+ * the new frame is dropped. For raw and Y4M files, an index is written to filename +
+ * ".idx", with the file offset, size and capture time of each frame, in microseconds
+ * since the recording started, one line per frame; archives have their index inside.
+ * The capture time is when the camera says the frame was taken (V4L2), or else when
+ * it arrived, as for captureGroup.
+ * The device must be initialized, and the recording ends with stopRecording or
+ * deinitCapture. Returns 0 if the settings are invalid or the file can't be created.
+ */
+typedef int (*startRecordingProc)(unsigned int deviceno, const char *filename, int container, int queueframes, unsigned int flags);
+
+/* Writes out the queued frames and closes the recording. Returns 0 if there was none,
+ * or if a write failed.
+ */
+typedef int (*stopRecordingProc)(unsigned int deviceno);
+
+/* Returns 0 if the device is not recording, 1 on success. */
+typedef int (*getRecordingStatsProc)(unsigned int deviceno, struct CaptureRecordingStats *stats);
+
+/* An archive written with CAPTURE_RECORD_ARCHIVE, mapped into memory */
+struct CaptureArchive;
+
+/* A frame of an archive, as returned by getArchiveFrame */
+struct CaptureArchiveFrame
+{
+	/* Capture time in microseconds since 1970-01-01 UTC */
+	long long mTimestamp;
+	/* Number of the frame in the recording; gaps are dropped frames */
+	unsigned int mSequence;
+	/* Layout of the image, as in CaptureFrameInfo; planes follow each other */
+	int mFormat;
+	int mWidth;
+	int mHeight;
+	int mStride;
+	/* The image, inside the mapped file. Valid until closeArchive. */
+	const void *mData;
+	unsigned int mLength;
+};
+
+/* Maps an archive for reading. Only the parts that are looked at are read from disk,
+ * so opening and seeking in hours of capture is immediate. An archive whose recording
+ * didn't finish can be read up to its last complete frame.
+ * Returns NULL if the file can't be opened or isn't an archive.
+ */
+typedef struct CaptureArchive *(*openArchiveProc)(const char *filename);
+typedef void (*closeArchiveProc)(struct CaptureArchive *archive);
+typedef int (*getArchiveFrameCountProc)(struct CaptureArchive *archive);
+
+/* Binary searches the index for the last frame captured at or before timestamp.
+ * Returns its number, or -1 if the archive starts later.
+ */
+typedef int (*findArchiveFrameProc)(struct CaptureArchive *archive, long long timestamp);
+
+/* Describes a frame, with a pointer to its image in the mapping; nothing is copied.
+ * Returns 0 if there is no such frame, 1 on success.
+ */
+typedef int (*getArchiveFrameProc)(struct CaptureArchive *archive, int frame, struct CaptureArchiveFrame *info);
+
+/* Starts copying each captured frame of a device into a ring of slots (0 for 4) in
+ * shared memory, which other processes open by name with openCaptureRing, so that
+ * any number of them can use one camera. Names are up to 64 characters, without
+ * slashes; other users can't open the ring. The device must be initialized, and
+ * publishing ends with stopPublishing or deinitCapture.
+ * Returns 0 if the settings are invalid or the name is in use, 1 on success.
+ */
+typedef int (*startPublishingProc)(unsigned int deviceno, const char *name, int slots);
+typedef int (*stopPublishingProc)(unsigned int deviceno);
+
+/* A published ring, opened for reading */
+struct CaptureRing;
+
+/* A frame in a ring, as returned by getRingFrame */
+struct CaptureRingFrame
+{
+	/* Number of the frame since publishing started */
+	unsigned long long mSequence;
+	/* Capture time in microseconds since 1970-01-01 UTC: when the camera says the
+	 * frame was taken (V4L2), or else when it arrived. Frames of the broker's rings
+	 * have when the broker got them instead. */
+	long long mTimestamp;
+	/* Layout of the image, as in CaptureFrameInfo; planes follow each other */
+	int mFormat;
+	int mWidth;
+	int mHeight;
+	int mStride;
+	/* The image, in the shared memory; overwritten when the ring comes round again */
+	const void *mData;
+	unsigned int mLength;
+	/* For checkRingFrame */
+	unsigned int mSlot;
+	unsigned int mVersion;
+};
+
+/* Maps a ring read only. Returns NULL if nothing is published under the name. */
+typedef struct CaptureRing *(*openCaptureRingProc)(const char *name);
+typedef void (*closeCaptureRingProc)(struct CaptureRing *ring);
+
+/* Gets the newest frame, if its mSequence is at least next; pass the last frame's
+ * mSequence + 1 to wait for a new one, or 0 for whatever is there. Returns 1 if there
+ * was one, 0 if not. The image is not copied: read it from mData, then call
+ * checkRingFrame, and if that returns 0 the publisher overwrote it meanwhile, so
+ * whatever was read must be thrown away.
+ */
+typedef int (*getRingFrameProc)(struct CaptureRing *ring, unsigned long long next, struct CaptureRingFrame *frame);
+typedef int (*checkRingFrameProc)(struct CaptureRing *ring, const struct CaptureRingFrame *frame);
+
+/* Subscribes to a device through the frame broker (broker/main.cpp) listening on
+ * socketpath (NULL for /tmp/escapi-broker), which captures each device once and
+ * makes a ring of the given size and format for every combination asked for. Frames
+ * are read with getRingFrame and checkRingFrame as above, and the subscription ends
+ * with closeCaptureRing. Linux only.
+ * Returns NULL if there is no broker, or it can't serve the request.
+ */
+typedef struct CaptureRing *(*openBrokerRingProc)(const char *socketpath, unsigned int deviceno, int width, int height, int format);
 
 
 #ifndef ESCAPI_DEFINITIONS_ONLY
@@ -117,4 +660,42 @@ extern setCapturePropertyProc setCaptureProperty;
 extern getCaptureErrorLineProc getCaptureErrorLine;
 extern getCaptureErrorCodeProc getCaptureErrorCode;
 extern initCaptureWithOptionsProc initCaptureWithOptions;
+extern initCaptureExProc initCaptureEx;
+extern getCaptureFrameInfoProc getCaptureFrameInfo;
+extern setTestPatternDeviceProc setTestPatternDevice;
+extern getTestPatternFrameNumberProc getTestPatternFrameNumber;
+extern setFileDeviceProc setFileDevice;
+extern startRecordingProc startRecording;
+extern stopRecordingProc stopRecording;
+extern getRecordingStatsProc getRecordingStats;
+extern openArchiveProc openArchive;
+extern closeArchiveProc closeArchive;
+extern getArchiveFrameCountProc getArchiveFrameCount;
+extern findArchiveFrameProc findArchiveFrame;
+extern getArchiveFrameProc getArchiveFrame;
+extern startPublishingProc startPublishing;
+extern stopPublishingProc stopPublishing;
+extern openCaptureRingProc openCaptureRing;
+extern closeCaptureRingProc closeCaptureRing;
+extern getRingFrameProc getRingFrame;
+extern checkRingFrameProc checkRingFrame;
+extern openBrokerRingProc openBrokerRing;
+extern addCaptureSinkProc addCaptureSink;
+extern removeCaptureSinkProc removeCaptureSink;
+extern doCaptureSinkProc doCaptureSink;
+extern isCaptureSinkDoneProc isCaptureSinkDone;
+extern getCapturePyramidLayoutProc getCapturePyramidLayout;
+extern initCapturePyramidProc initCapturePyramid;
+extern setCaptureRegionProc setCaptureRegion;
+extern getCaptureRegionProc getCaptureRegion;
+extern doCaptureBatchProc doCaptureBatch;
+extern isCaptureBatchDoneProc isCaptureBatchDone;
+extern initCaptureTensorProc initCaptureTensor;
+extern captureGroupProc captureGroup;
+extern getCaptureStatsProc getCaptureStats;
+extern resetCaptureStatsProc resetCaptureStats;
+extern startCaptureTraceProc startCaptureTrace;
+extern stopCaptureTraceProc stopCaptureTrace;
+extern saveCaptureTraceProc saveCaptureTrace;
+extern traceCaptureSpanProc traceCaptureSpan;
 #endif
\ No newline at end of file
@@ -0,0 +1,743 @@
+#include "coretypes.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "conversion.h"
+#include "ycbcr.h"
+
+
+// The conversion kernels are generated by ConvertImage from a source
+// reader, which yields the pixels of a row as Y, Cb, Cr (or R, G, B)
+// samples, and a destination writer, which stores them. The loop handles
+// 8 pixels at a time with SSE2 and single pixels for the rest of the row,
+// so any width works. A new format only needs a reader or a writer.
+//
+// Readers:
+//   RGB        1 if the samples are R, G, B rather than Y, Cb, Cr
+//   SIMD       0 if get8 and chroma8 are not worth using
+//   row        selects a row
+//   get        fetches the samples of one pixel
+//   get8       fetches 8 pixels as 16 bit values (SSE2)
+//   chroma     Cb and Cr of a 2x2 block of the selected row and the next
+//   chroma8    8 such blocks (SSE2)
+//
+// Writers:
+//   SUBSAMPLED 1 for 4:2:0 formats, which also get chroma for every
+//              other row
+//   row, put, put8, chroma, chroma8 are the counterparts of the above.
+
+
+// Instruction set levels
+struct IsaScalar
+{
+	enum { SSE2 = 0 };
+};
+
+struct IsaSSE2
+{
+	enum { SSE2 = 1 };
+};
+
+#ifdef ESCAPI_SSE2
+typedef IsaSSE2 IsaBest;
+#else
+typedef IsaScalar IsaBest;
+#endif
+
+
+// RGB to YCbCr, BT.601 limited range. Used for luma-only and 4:2:0 output
+// from RGB sources.
+
+__forceinline int LumaFromRGB(int aRed, int aGreen, int aBlue)
+{
+	return ((66 * aRed + 129 * aGreen + 25 * aBlue + 128) >> 8) + 16;
+}
+
+__forceinline int CbFromRGB(int aRed, int aGreen, int aBlue)
+{
+	return ((-38 * aRed - 74 * aGreen + 112 * aBlue + 128) >> 8) + 128;
+}
+
+__forceinline int CrFromRGB(int aRed, int aGreen, int aBlue)
+{
+	return ((112 * aRed - 94 * aGreen - 18 * aBlue + 128) >> 8) + 128;
+}
+
+#ifdef ESCAPI_SSE2
+// Same as LumaFromRGB, for 8 pixels of 16 bit values.
+__forceinline __m128i LumaFromRGB_SSE2(__m128i aRed, __m128i aGreen, __m128i aBlue)
+{
+	const __m128i coefRG = _mm_setr_epi16(66, 129, 66, 129, 66, 129, 66, 129);
+	const __m128i coefB = _mm_setr_epi16(25, 128, 25, 128, 25, 128, 25, 128);
+	const __m128i one = _mm_set1_epi16(1);
+
+	__m128i lo = _mm_add_epi32(
+		_mm_madd_epi16(_mm_unpacklo_epi16(aRed, aGreen), coefRG),
+		_mm_madd_epi16(_mm_unpacklo_epi16(aBlue, one), coefB));
+	__m128i hi = _mm_add_epi32(
+		_mm_madd_epi16(_mm_unpackhi_epi16(aRed, aGreen), coefRG),
+		_mm_madd_epi16(_mm_unpackhi_epi16(aBlue, one), coefB));
+	return _mm_add_epi16(
+		_mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8)),
+		_mm_set1_epi16(16));
+}
+
+// For readers without a SIMD chroma path: fetches 8 blocks one at a time.
+template <class READER>
+__forceinline void GatherChroma8(READER &aReader, DWORD aX, __m128i &aCb, __m128i &aCr)
+{
+	int cb[8], cr[8];
+	for (int i = 0; i < 8; i++)
+	{
+		aReader.chroma(aX + i, cb[i], cr[i]);
+	}
+	aCb = _mm_setr_epi16(cb[0], cb[1], cb[2], cb[3], cb[4], cb[5], cb[6], cb[7]);
+	aCr = _mm_setr_epi16(cr[0], cr[1], cr[2], cr[3], cr[4], cr[5], cr[6], cr[7]);
+}
+
+// Byte N of each 32 bit lane, as 8 16 bit values from two vectors.
+template <int N>
+__forceinline __m128i ByteOfDwords(__m128i aLo, __m128i aHi)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	return _mm_packs_epi32(
+		_mm_and_si128(_mm_srli_epi32(aLo, N * 8), mask),
+		_mm_and_si128(_mm_srli_epi32(aHi, N * 8), mask));
+}
+#endif
+
+
+// Packed formats, one plane
+struct ReadPacked
+{
+	const BYTE *mImage;
+	const BYTE *mRow;
+	LONG        mStride;
+
+	ReadPacked(const BYTE *aSrc, LONG aStride)
+	{
+		mImage = aSrc;
+		mRow = aSrc;
+		mStride = aStride;
+	}
+
+	__forceinline void row(DWORD aY)
+	{
+		mRow = mImage + mStride * (LONG)aY;
+	}
+};
+
+// RGB32 (B G R X) and RGB24 (B G R). The fourth byte of RGB32 is not
+// alpha in Media Foundation, so the output is always opaque.
+// Only RGB32 has a SIMD path; 3 byte pixels don't split into vectors
+// without SSSE3 shuffles.
+template <int BYTES>
+struct ReadRGB : ReadPacked
+{
+	enum { RGB = 1, SIMD = BYTES == 4 };
+
+	ReadRGB(const BYTE *aSrc, LONG aStride, DWORD) : ReadPacked(aSrc, aStride) {}
+
+	__forceinline void get(DWORD aX, int &aRed, int &aGreen, int &aBlue)
+	{
+		const BYTE *p = mRow + aX * BYTES;
+		aRed = p[2];
+		aGreen = p[1];
+		aBlue = p[0];
+	}
+
+	// Chroma of the average colour
+	__forceinline void chroma(DWORD aX, int &aCb, int &aCr)
+	{
+		const BYTE *p0 = mRow + aX * 2 * BYTES;
+		const BYTE *p1 = p0 + mStride;
+		int r = (p0[2] + p0[BYTES + 2] + p1[2] + p1[BYTES + 2] + 2) >> 2;
+		int g = (p0[1] + p0[BYTES + 1] + p1[1] + p1[BYTES + 1] + 2) >> 2;
+		int b = (p0[0] + p0[BYTES] + p1[0] + p1[BYTES] + 2) >> 2;
+		aCb = CbFromRGB(r, g, b);
+		aCr = CrFromRGB(r, g, b);
+	}
+
+#ifdef ESCAPI_SSE2
+	__forceinline void get8(DWORD aX, __m128i &aRed, __m128i &aGreen, __m128i &aBlue)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i*)(mRow + aX * 4));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(mRow + aX * 4 + 16));
+		aRed = ByteOfDwords<2>(lo, hi);
+		aGreen = ByteOfDwords<1>(lo, hi);
+		aBlue = ByteOfDwords<0>(lo, hi);
+	}
+
+	__forceinline void chroma8(DWORD aX, __m128i &aCb, __m128i &aCr)
+	{
+		GatherChroma8(*this, aX, aCb, aCr);
+	}
+#endif
+};
+
+// Packed 4:2:2, see LayoutYUY2 and friends. Odd widths are fine as long
+// as the last two pixel group is there, which is how cameras pad.
+template <class LAYOUT>
+struct ReadPacked422 : ReadPacked
+{
+	enum { RGB = 0, SIMD = 1 };
+
+	ReadPacked422(const BYTE *aSrc, LONG aStride, DWORD) : ReadPacked(aSrc, aStride) {}
+
+	__forceinline void get(DWORD aX, int &aY, int &aCb, int &aCr)
+	{
+		const BYTE *group = mRow + (aX & ~1) * 2;
+		aY = group[(aX & 1) ? LAYOUT::Y1 : LAYOUT::Y0];
+		aCb = group[LAYOUT::U];
+		aCr = group[LAYOUT::V];
+	}
+
+	// Average of the two rows
+	__forceinline void chroma(DWORD aX, int &aCb, int &aCr)
+	{
+		const BYTE *group0 = mRow + aX * 4;
+		const BYTE *group1 = group0 + mStride;
+		aCb = (group0[LAYOUT::U] + group1[LAYOUT::U] + 1) >> 1;
+		aCr = (group0[LAYOUT::V] + group1[LAYOUT::V] + 1) >> 1;
+	}
+
+#ifdef ESCAPI_SSE2
+	__forceinline void get8(DWORD aX, __m128i &aY, __m128i &aCb, __m128i &aCr)
+	{
+		const __m128i lowBytes = _mm_set1_epi16(0xff);
+		const __m128i lowWords = _mm_set1_epi32(0xffff);
+
+		__m128i p = _mm_loadu_si128((const __m128i*)(mRow + aX * 2));
+		aY = (LAYOUT::Y0 & 1) ? _mm_srli_epi16(p, 8) : _mm_and_si128(p, lowBytes);
+		__m128i chroma = (LAYOUT::U & 1) ? _mm_srli_epi16(p, 8) : _mm_and_si128(p, lowBytes);
+
+		// chroma is now 4 pairs of (first, second) words; spread each
+		// value over the two pixels it covers.
+		__m128i first = _mm_and_si128(chroma, lowWords);
+		__m128i second = _mm_srli_epi32(chroma, 16);
+		first = _mm_or_si128(first, _mm_slli_epi32(first, 16));
+		second = _mm_or_si128(second, _mm_slli_epi32(second, 16));
+
+		aCb = LAYOUT::U < LAYOUT::V ? first : second;
+		aCr = LAYOUT::U < LAYOUT::V ? second : first;
+	}
+
+	__forceinline void chroma8(DWORD aX, __m128i &aCb, __m128i &aCr)
+	{
+		const BYTE *row0 = mRow + aX * 4;
+		const BYTE *row1 = row0 + mStride;
+		__m128i lo = _mm_avg_epu8(
+			_mm_loadu_si128((const __m128i*)row0),
+			_mm_loadu_si128((const __m128i*)row1));
+		__m128i hi = _mm_avg_epu8(
+			_mm_loadu_si128((const __m128i*)(row0 + 16)),
+			_mm_loadu_si128((const __m128i*)(row1 + 16)));
+		aCb = ByteOfDwords<LAYOUT::U>(lo, hi);
+		aCr = ByteOfDwords<LAYOUT::V>(lo, hi);
+	}
+#endif
+};
+
+// Planar 4:2:0, see LayoutNV12 and friends
+template <class LAYOUT>
+struct ReadPlanar420
+{
+	enum { RGB = 0, SIMD = 1 };
+
+	Planes420   mPlanes;
+	const BYTE *mLineY;
+	const BYTE *mLineU;
+	const BYTE *mLineV;
+	const BYTE *mLineUV;  // Start of the interleaved chroma row
+
+	ReadPlanar420(const BYTE *aSrc, LONG aStride, DWORD aHeight) : mPlanes((BYTE*)aSrc, aStride, aHeight, LAYOUT::INTERLEAVED) {}
+
+	__forceinline void row(DWORD aY)
+	{
+		LONG chroma = mPlanes.mStrideUV * (LONG)(aY / 2);
+		mLineY = mPlanes.mY + mPlanes.mStrideY * (LONG)aY;
+		mLineU = (LAYOUT::SWAPPED ? mPlanes.mV : mPlanes.mU) + chroma;
+		mLineV = (LAYOUT::SWAPPED ? mPlanes.mU : mPlanes.mV) + chroma;
+		mLineUV = mPlanes.mU + chroma;
+	}
+
+	__forceinline void get(DWORD aX, int &aY, int &aCb, int &aCr)
+	{
+		aY = mLineY[aX];
+		aCb = mLineU[(aX / 2) * mPlanes.mStepUV];
+		aCr = mLineV[(aX / 2) * mPlanes.mStepUV];
+	}
+
+	__forceinline void chroma(DWORD aX, int &aCb, int &aCr)
+	{
+		aCb = mLineU[aX * mPlanes.mStepUV];
+		aCr = mLineV[aX * mPlanes.mStepUV];
+	}
+
+#ifdef ESCAPI_SSE2
+	__forceinline void get8(DWORD aX, __m128i &aY, __m128i &aCb, __m128i &aCr)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		aY = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(mLineY + aX)), zero);
+
+		if (LAYOUT::INTERLEAVED)
+		{
+			// 4 chroma pairs, each repeated for two pixels
+			__m128i uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(mLineUV + aX)), zero);
+			__m128i first = _mm_and_si128(uv, _mm_set1_epi32(0xffff));
+			__m128i second = _mm_srli_epi32(uv, 16);
+			first = _mm_or_si128(first, _mm_slli_epi32(first, 16));
+			second = _mm_or_si128(second, _mm_slli_epi32(second, 16));
+			aCb = LAYOUT::SWAPPED ? second : first;
+			aCr = LAYOUT::SWAPPED ? first : second;
+		}
+		else
+		{
+			__m128i cb = _mm_unpacklo_epi8(LoadLow32(mLineU + aX / 2), zero);
+			__m128i cr = _mm_unpacklo_epi8(LoadLow32(mLineV + aX / 2), zero);
+			aCb = _mm_unpacklo_epi16(cb, cb);
+			aCr = _mm_unpacklo_epi16(cr, cr);
+		}
+	}
+
+	__forceinline void chroma8(DWORD aX, __m128i &aCb, __m128i &aCr)
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		if (LAYOUT::INTERLEAVED)
+		{
+			__m128i uv = _mm_loadu_si128((const __m128i*)(mLineUV + aX * 2));
+			__m128i first = _mm_and_si128(uv, _mm_set1_epi16(0xff));
+			__m128i second = _mm_srli_epi16(uv, 8);
+			aCb = LAYOUT::SWAPPED ? second : first;
+			aCr = LAYOUT::SWAPPED ? first : second;
+		}
+		else
+		{
+			aCb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(mLineU + aX)), zero);
+			aCr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(mLineV + aX)), zero);
+		}
+	}
+#endif
+};
+
+typedef ReadRGB<4> ReadRGB32;
+typedef ReadRGB<3> ReadRGB24;
+typedef ReadPacked422<LayoutYUY2> ReadYUY2;
+typedef ReadPacked422<LayoutUYVY> ReadUYVY;
+typedef ReadPacked422<LayoutYVYU> ReadYVYU;
+typedef ReadPlanar420<LayoutNV12> ReadNV12;
+typedef ReadPlanar420<LayoutI420> ReadI420;
+typedef ReadPlanar420<LayoutYV12> ReadYV12;
+
+
+// Packed formats, one plane and no chroma rows
+struct WritePacked
+{
+	enum { SUBSAMPLED = 0 };
+
+	BYTE *mImage;
+	BYTE *mRow;
+	LONG  mStride;
+
+	WritePacked(BYTE *aDest, LONG aStride, DWORD)
+	{
+		mImage = aDest;
+		mRow = aDest;
+		mStride = aStride;
+	}
+
+	__forceinline void row(DWORD aY)
+	{
+		mRow = mImage + mStride * (LONG)aY;
+	}
+
+	__forceinline void chroma(DWORD, int, int) {}
+#ifdef ESCAPI_SSE2
+	__forceinline void chroma8(DWORD, __m128i, __m128i) {}
+#endif
+};
+
+// 32 bit pixels with opaque alpha
+template <class ORDER>
+struct WriteRGB32 : WritePacked
+{
+	WriteRGB32(BYTE *aDest, LONG aStride, DWORD aHeight) : WritePacked(aDest, aStride, aHeight) {}
+
+	template <int RGB, class COEF>
+	__forceinline void put(DWORD aX, int aA, int aB, int aC)
+	{
+		BYTE *p = mRow + aX * 4;
+		if (RGB)
+		{
+			p[ORDER::R] = (BYTE)aA;
+			p[ORDER::G] = (BYTE)aB;
+			p[ORDER::B] = (BYTE)aC;
+			p[ORDER::A] = 0xff;
+		}
+		else
+		{
+			StoreYCbCr<COEF, ORDER>(p, aA, aB, aC);
+		}
+	}
+
+#ifdef ESCAPI_SSE2
+	template <int RGB, class COEF>
+	__forceinline void put8(DWORD aX, __m128i aA, __m128i aB, __m128i aC)
+	{
+		if (RGB)
+			StorePixels_SSE2<ORDER>(mRow + aX * 4, aA, aB, aC);
+		else
+			StoreYCbCr_SSE2<COEF, ORDER>(mRow + aX * 4, aA, aB, aC);
+	}
+#endif
+};
+
+// Luma only. Y is taken as is from YCbCr sources.
+struct WriteGRAY8 : WritePacked
+{
+	WriteGRAY8(BYTE *aDest, LONG aStride, DWORD aHeight) : WritePacked(aDest, aStride, aHeight) {}
+
+	template <int RGB, class COEF>
+	__forceinline void put(DWORD aX, int aA, int aB, int aC)
+	{
+		mRow[aX] = (BYTE)(RGB ? LumaFromRGB(aA, aB, aC) : aA);
+	}
+
+#ifdef ESCAPI_SSE2
+	template <int RGB, class COEF>
+	__forceinline void put8(DWORD aX, __m128i aA, __m128i aB, __m128i aC)
+	{
+		__m128i luma = RGB ? LumaFromRGB_SSE2(aA, aB, aC) : aA;
+		_mm_storel_epi64((__m128i*)(mRow + aX), _mm_packus_epi16(luma, luma));
+	}
+#endif
+};
+
+// Planar 4:2:0, I420 (INTERLEAVED = 0) or NV12 (INTERLEAVED = 1). Width
+// and height are expected to be even.
+template <int INTERLEAVED>
+struct WriteYUV420
+{
+	enum { SUBSAMPLED = 1 };
+
+	Planes420 mPlanes;
+	BYTE     *mLineY;
+	BYTE     *mLineU;
+	BYTE     *mLineV;
+
+	WriteYUV420(BYTE *aDest, LONG aStride, DWORD aHeight) : mPlanes(aDest, aStride, aHeight, INTERLEAVED) {}
+
+	__forceinline void row(DWORD aY)
+	{
+		LONG chroma = mPlanes.mStrideUV * (LONG)(aY / 2);
+		mLineY = mPlanes.mY + mPlanes.mStrideY * (LONG)aY;
+		mLineU = mPlanes.mU + chroma;
+		mLineV = mPlanes.mV + chroma;
+	}
+
+	template <int RGB, class COEF>
+	__forceinline void put(DWORD aX, int aA, int aB, int aC)
+	{
+		mLineY[aX] = (BYTE)(RGB ? LumaFromRGB(aA, aB, aC) : aA);
+	}
+
+	__forceinline void chroma(DWORD aX, int aCb, int aCr)
+	{
+		mLineU[aX * mPlanes.mStepUV] = (BYTE)aCb;
+		mLineV[aX * mPlanes.mStepUV] = (BYTE)aCr;
+	}
+
+#ifdef ESCAPI_SSE2
+	template <int RGB, class COEF>
+	__forceinline void put8(DWORD aX, __m128i aA, __m128i aB, __m128i aC)
+	{
+		__m128i luma = RGB ? LumaFromRGB_SSE2(aA, aB, aC) : aA;
+		_mm_storel_epi64((__m128i*)(mLineY + aX), _mm_packus_epi16(luma, luma));
+	}
+
+	__forceinline void chroma8(DWORD aX, __m128i aCb, __m128i aCr)
+	{
+		if (INTERLEAVED)
+		{
+			_mm_storeu_si128((__m128i*)(mLineU + aX * 2), _mm_or_si128(aCb, _mm_slli_epi16(aCr, 8)));
+		}
+		else
+		{
+			_mm_storel_epi64((__m128i*)(mLineU + aX), _mm_packus_epi16(aCb, aCb));
+			_mm_storel_epi64((__m128i*)(mLineV + aX), _mm_packus_epi16(aCr, aCr));
+		}
+	}
+#endif
+};
+
+typedef WriteRGB32<OrderBGRA> WriteBGRA;
+typedef WriteRGB32<OrderRGBA> WriteRGBA;
+typedef WriteYUV420<0> WriteI420;
+typedef WriteYUV420<1> WriteNV12;
+
+
+// COEF is the YCbCr to RGB conversion, used when reading YCbCr and
+// writing RGB.
+template <class SRC, class DST, class COEF, class ISA>
+void ConvertImage(
+	BYTE*       aDest,
+	LONG        aDestStride,
+	const BYTE* aSrc,
+	LONG        aSrcStride,
+	DWORD       aWidthInPixels,
+	DWORD       aHeightInPixels
+	)
+{
+	SRC src(aSrc, aSrcStride, aHeightInPixels);
+	DST dst(aDest, aDestStride, aHeightInPixels);
+
+	for (DWORD y = 0; y < aHeightInPixels; y++)
+	{
+		src.row(y);
+		dst.row(y);
+		DWORD x = 0;
+
+#ifdef ESCAPI_SSE2
+		if (ISA::SSE2 && SRC::SIMD)
+		{
+			for (; x + 8 <= aWidthInPixels; x += 8)
+			{
+				__m128i a, b, c;
+				src.get8(x, a, b, c);
+				dst.template put8<SRC::RGB, COEF>(x, a, b, c);
+			}
+		}
+#endif
+		for (; x < aWidthInPixels; x++)
+		{
+			int a, b, c;
+			src.get(x, a, b, c);
+			dst.template put<SRC::RGB, COEF>(x, a, b, c);
+		}
+
+		// One chroma row for each pair of rows
+		if (DST::SUBSAMPLED && !(y & 1) && y + 1 < aHeightInPixels)
+		{
+			DWORD chromaWidth = aWidthInPixels / 2;
+			x = 0;
+
+#ifdef ESCAPI_SSE2
+			if (ISA::SSE2 && SRC::SIMD)
+			{
+				for (; x + 8 <= chromaWidth; x += 8)
+				{
+					__m128i cb, cr;
+					src.chroma8(x, cb, cr);
+					dst.chroma8(x, cb, cr);
+				}
+			}
+#endif
+			for (; x < chromaWidth; x++)
+			{
+				int cb, cr;
+				src.chroma(x, cb, cr);
+				dst.chroma(x, cb, cr);
+			}
+		}
+	}
+}
+
+
+// The kernel and its scalar reference, for the conversion table
+#define KERNEL(SRC, DST, COEF) ConvertImage<SRC, DST, COEF, IsaBest>, ConvertImage<SRC, DST, COEF, IsaScalar>
+
+// The YCbCr to RGB kernels come in one variant per YCBCR_MATRIX; the
+// encoding is picked when the media type is set, so the loops only see
+// constant coefficients.
+ConversionFunction gFormatConversions[] =
+{
+	{ SUBTYPE_RGB32, CAPTURE_FORMAT_BGRA, YCBCR_ANY, KERNEL(ReadRGB32, WriteBGRA, YCbCrBT601) },
+	{ SUBTYPE_RGB24, CAPTURE_FORMAT_BGRA, YCBCR_ANY, KERNEL(ReadRGB24, WriteBGRA, YCbCrBT601) },
+	{ SUBTYPE_RGB32, CAPTURE_FORMAT_RGBA, YCBCR_ANY, KERNEL(ReadRGB32, WriteRGBA, YCbCrBT601) },
+	{ SUBTYPE_RGB24, CAPTURE_FORMAT_RGBA, YCBCR_ANY, KERNEL(ReadRGB24, WriteRGBA, YCbCrBT601) },
+
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_BGRA, YCBCR_BT601, KERNEL(ReadYUY2, WriteBGRA, YCbCrBT601) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_BGRA, YCBCR_BT601, KERNEL(ReadNV12, WriteBGRA, YCbCrBT601) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_BGRA, YCBCR_BT601, KERNEL(ReadUYVY, WriteBGRA, YCbCrBT601) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_BGRA, YCBCR_BT601, KERNEL(ReadYVYU, WriteBGRA, YCbCrBT601) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_BGRA, YCBCR_BT601, KERNEL(ReadI420, WriteBGRA, YCbCrBT601) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_BGRA, YCBCR_BT601, KERNEL(ReadI420, WriteBGRA, YCbCrBT601) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_BGRA, YCBCR_BT601, KERNEL(ReadYV12, WriteBGRA, YCbCrBT601) },
+
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_BGRA, YCBCR_BT601_FULL, KERNEL(ReadYUY2, WriteBGRA, YCbCrBT601Full) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_BGRA, YCBCR_BT601_FULL, KERNEL(ReadNV12, WriteBGRA, YCbCrBT601Full) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_BGRA, YCBCR_BT601_FULL, KERNEL(ReadUYVY, WriteBGRA, YCbCrBT601Full) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_BGRA, YCBCR_BT601_FULL, KERNEL(ReadYVYU, WriteBGRA, YCbCrBT601Full) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_BGRA, YCBCR_BT601_FULL, KERNEL(ReadI420, WriteBGRA, YCbCrBT601Full) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_BGRA, YCBCR_BT601_FULL, KERNEL(ReadI420, WriteBGRA, YCbCrBT601Full) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_BGRA, YCBCR_BT601_FULL, KERNEL(ReadYV12, WriteBGRA, YCbCrBT601Full) },
+
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_BGRA, YCBCR_BT709, KERNEL(ReadYUY2, WriteBGRA, YCbCrBT709) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_BGRA, YCBCR_BT709, KERNEL(ReadNV12, WriteBGRA, YCbCrBT709) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_BGRA, YCBCR_BT709, KERNEL(ReadUYVY, WriteBGRA, YCbCrBT709) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_BGRA, YCBCR_BT709, KERNEL(ReadYVYU, WriteBGRA, YCbCrBT709) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_BGRA, YCBCR_BT709, KERNEL(ReadI420, WriteBGRA, YCbCrBT709) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_BGRA, YCBCR_BT709, KERNEL(ReadI420, WriteBGRA, YCbCrBT709) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_BGRA, YCBCR_BT709, KERNEL(ReadYV12, WriteBGRA, YCbCrBT709) },
+
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_BGRA, YCBCR_BT709_FULL, KERNEL(ReadYUY2, WriteBGRA, YCbCrBT709Full) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_BGRA, YCBCR_BT709_FULL, KERNEL(ReadNV12, WriteBGRA, YCbCrBT709Full) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_BGRA, YCBCR_BT709_FULL, KERNEL(ReadUYVY, WriteBGRA, YCbCrBT709Full) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_BGRA, YCBCR_BT709_FULL, KERNEL(ReadYVYU, WriteBGRA, YCbCrBT709Full) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_BGRA, YCBCR_BT709_FULL, KERNEL(ReadI420, WriteBGRA, YCbCrBT709Full) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_BGRA, YCBCR_BT709_FULL, KERNEL(ReadI420, WriteBGRA, YCbCrBT709Full) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_BGRA, YCBCR_BT709_FULL, KERNEL(ReadYV12, WriteBGRA, YCbCrBT709Full) },
+
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_RGBA, YCBCR_BT601, KERNEL(ReadYUY2, WriteRGBA, YCbCrBT601) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_RGBA, YCBCR_BT601, KERNEL(ReadNV12, WriteRGBA, YCbCrBT601) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_RGBA, YCBCR_BT601, KERNEL(ReadUYVY, WriteRGBA, YCbCrBT601) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_RGBA, YCBCR_BT601, KERNEL(ReadYVYU, WriteRGBA, YCbCrBT601) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_RGBA, YCBCR_BT601, KERNEL(ReadI420, WriteRGBA, YCbCrBT601) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_RGBA, YCBCR_BT601, KERNEL(ReadI420, WriteRGBA, YCbCrBT601) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_RGBA, YCBCR_BT601, KERNEL(ReadYV12, WriteRGBA, YCbCrBT601) },
+
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_RGBA, YCBCR_BT601_FULL, KERNEL(ReadYUY2, WriteRGBA, YCbCrBT601Full) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_RGBA, YCBCR_BT601_FULL, KERNEL(ReadNV12, WriteRGBA, YCbCrBT601Full) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_RGBA, YCBCR_BT601_FULL, KERNEL(ReadUYVY, WriteRGBA, YCbCrBT601Full) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_RGBA, YCBCR_BT601_FULL, KERNEL(ReadYVYU, WriteRGBA, YCbCrBT601Full) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_RGBA, YCBCR_BT601_FULL, KERNEL(ReadI420, WriteRGBA, YCbCrBT601Full) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_RGBA, YCBCR_BT601_FULL, KERNEL(ReadI420, WriteRGBA, YCbCrBT601Full) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_RGBA, YCBCR_BT601_FULL, KERNEL(ReadYV12, WriteRGBA, YCbCrBT601Full) },
+
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_RGBA, YCBCR_BT709, KERNEL(ReadYUY2, WriteRGBA, YCbCrBT709) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_RGBA, YCBCR_BT709, KERNEL(ReadNV12, WriteRGBA, YCbCrBT709) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_RGBA, YCBCR_BT709, KERNEL(ReadUYVY, WriteRGBA, YCbCrBT709) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_RGBA, YCBCR_BT709, KERNEL(ReadYVYU, WriteRGBA, YCbCrBT709) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_RGBA, YCBCR_BT709, KERNEL(ReadI420, WriteRGBA, YCbCrBT709) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_RGBA, YCBCR_BT709, KERNEL(ReadI420, WriteRGBA, YCbCrBT709) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_RGBA, YCBCR_BT709, KERNEL(ReadYV12, WriteRGBA, YCbCrBT709) },
+
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_RGBA, YCBCR_BT709_FULL, KERNEL(ReadYUY2, WriteRGBA, YCbCrBT709Full) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_RGBA, YCBCR_BT709_FULL, KERNEL(ReadNV12, WriteRGBA, YCbCrBT709Full) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_RGBA, YCBCR_BT709_FULL, KERNEL(ReadUYVY, WriteRGBA, YCbCrBT709Full) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_RGBA, YCBCR_BT709_FULL, KERNEL(ReadYVYU, WriteRGBA, YCbCrBT709Full) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_RGBA, YCBCR_BT709_FULL, KERNEL(ReadI420, WriteRGBA, YCbCrBT709Full) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_RGBA, YCBCR_BT709_FULL, KERNEL(ReadI420, WriteRGBA, YCbCrBT709Full) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_RGBA, YCBCR_BT709_FULL, KERNEL(ReadYV12, WriteRGBA, YCbCrBT709Full) },
+
+	{ SUBTYPE_RGB32, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadRGB32, WriteGRAY8, YCbCrBT601) },
+	{ SUBTYPE_RGB24, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadRGB24, WriteGRAY8, YCbCrBT601) },
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadYUY2, WriteGRAY8, YCbCrBT601) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadNV12, WriteGRAY8, YCbCrBT601) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadUYVY, WriteGRAY8, YCbCrBT601) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadYVYU, WriteGRAY8, YCbCrBT601) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadI420, WriteGRAY8, YCbCrBT601) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadI420, WriteGRAY8, YCbCrBT601) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_GRAY8, YCBCR_ANY, KERNEL(ReadYV12, WriteGRAY8, YCbCrBT601) },
+
+	{ SUBTYPE_RGB32, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadRGB32, WriteI420, YCbCrBT601) },
+	{ SUBTYPE_RGB24, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadRGB24, WriteI420, YCbCrBT601) },
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadYUY2, WriteI420, YCbCrBT601) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadNV12, WriteI420, YCbCrBT601) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadUYVY, WriteI420, YCbCrBT601) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadYVYU, WriteI420, YCbCrBT601) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadI420, WriteI420, YCbCrBT601) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadI420, WriteI420, YCbCrBT601) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_I420, YCBCR_ANY, KERNEL(ReadYV12, WriteI420, YCbCrBT601) },
+
+	{ SUBTYPE_RGB32, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadRGB32, WriteNV12, YCbCrBT601) },
+	{ SUBTYPE_RGB24, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadRGB24, WriteNV12, YCbCrBT601) },
+	{ SUBTYPE_YUY2, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadYUY2, WriteNV12, YCbCrBT601) },
+	{ SUBTYPE_NV12, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadNV12, WriteNV12, YCbCrBT601) },
+	{ SUBTYPE_UYVY, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadUYVY, WriteNV12, YCbCrBT601) },
+	{ SUBTYPE_YVYU, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadYVYU, WriteNV12, YCbCrBT601) },
+	{ SUBTYPE_I420, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadI420, WriteNV12, YCbCrBT601) },
+	{ SUBTYPE_IYUV, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadI420, WriteNV12, YCbCrBT601) },
+	{ SUBTYPE_YV12, CAPTURE_FORMAT_NV12, YCBCR_ANY, KERNEL(ReadYV12, WriteNV12, YCbCrBT601) }
+};
+
+const DWORD gConversionFormats = sizeof(gFormatConversions) / sizeof(gFormatConversions[0]);
+
+
+static int IsPlanar420(DWORD aSubtype)
+{
+	return aSubtype == SUBTYPE_NV12 || aSubtype == SUBTYPE_I420 ||
+		aSubtype == SUBTYPE_IYUV || aSubtype == SUBTYPE_YV12;
+}
+
+int PackedSubtypeBytes(DWORD aSubtype)
+{
+	switch (aSubtype)
+	{
+	case SUBTYPE_RGB32:
+		return 4;
+	case SUBTYPE_RGB24:
+		return 3;
+	case SUBTYPE_YUY2:
+	case SUBTYPE_UYVY:
+	case SUBTYPE_YVYU:
+		return 2;
+	}
+	return 0;
+}
+
+int CheckConversions()
+{
+	// Big enough for 4:2:0 and padded rows at the largest size tested
+	const LONG stride = 64 * 4 + 16;
+	const DWORD bufferSize = stride * 8 * 2;
+	BYTE *src = new BYTE[bufferSize];
+	BYTE *best = new BYTE[bufferSize];
+	BYTE *reference = new BYTE[bufferSize];
+	DWORD seed = 1;
+	int failures = 0;
+
+	for (DWORD i = 0; i < bufferSize; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		src[i] = (BYTE)(seed >> 16);
+	}
+
+	for (DWORD i = 0; i < gConversionFormats; i++)
+	{
+		const ConversionFunction &conversion = gFormatConversions[i];
+		int planar = IsPlanar420(conversion.mSubtype) ||
+			conversion.mFormat == CAPTURE_FORMAT_I420 || conversion.mFormat == CAPTURE_FORMAT_NV12;
+		int pixelBytes = (conversion.mFormat == CAPTURE_FORMAT_BGRA || conversion.mFormat == CAPTURE_FORMAT_RGBA) ? 4 : 1;
+
+		// Widths that leave every remainder after the SIMD loops; odd
+		// sizes only where the formats allow them.
+		static const DWORD sizes[][2] = { { 64, 8 }, { 38, 6 }, { 37, 5 }, { 7, 3 } };
+		for (int s = 0; s < 4; s++)
+		{
+			DWORD width = sizes[s][0];
+			DWORD height = sizes[s][1];
+			if (planar && ((width | height) & 1))
+				continue;
+
+			memset(best, 0xcd, bufferSize);
+			memset(reference, 0xcd, bufferSize);
+			conversion.mXForm(best, stride, src, stride, width, height);
+			conversion.mReference(reference, stride, src, stride, width, height);
+
+			int bad = memcmp(best, reference, bufferSize) != 0;
+
+			// Packed output must stay within each row
+			for (DWORD y = 0; !planar && y < height; y++)
+			{
+				for (LONG x = width * pixelBytes; x < stride; x++)
+				{
+					bad |= reference[y * stride + x] != 0xcd;
+				}
+			}
+
+			if (bad)
+			{
+				failures++;
+				break;
+			}
+		}
+	}
+
+	delete[] src;
+	delete[] best;
+	delete[] reference;
+	return failures;
+}
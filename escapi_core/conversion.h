@@ -0,0 +1,119 @@
+#pragma once
+
+typedef void(*IMAGE_TRANSFORM_FN)(
+	BYTE*       aDest,
+	LONG        aDestStride,
+	const BYTE* aSrc,
+	LONG        aSrcStride,
+	DWORD       aWidthInPixels,
+	DWORD       aHeightInPixels
+	);
+
+// YCbCr encodings the YCbCr to RGB kernels are specialized for (see the
+// coefficient structs in ycbcr.h).
+enum YCBCR_MATRIX
+{
+	YCBCR_BT601,       // Limited range
+	YCBCR_BT601_FULL,  // Full range, as used by JPEG
+	YCBCR_BT709,
+	YCBCR_BT709_FULL,
+	YCBCR_ANY          // Conversion doesn't depend on the encoding
+};
+
+struct ConversionFunction
+{
+	DWORD              mSubtype; // One of VIDEO_SUBTYPES
+	int                mFormat;  // Output format, one of CAPTURE_FORMATS
+	int                mMatrix;  // Source encoding, one of YCBCR_MATRIX
+	IMAGE_TRANSFORM_FN mXForm;
+	IMAGE_TRANSFORM_FN mReference; // Scalar version of mXForm, for CheckConversions
+};
+
+// Plane pointers of a 4:2:0 image. The image pointer and stride describe
+// the Y plane like a packed image (first row, and a negative stride for
+// bottom-up images); the chroma plane(s) follow the Y plane in memory, at
+// half (I420) or full (NV12, interleaved) stride.
+struct Planes420
+{
+	BYTE *mY;
+	BYTE *mU;
+	BYTE *mV;
+	LONG  mStrideY;
+	LONG  mStrideUV;
+	int   mStepUV;   // Bytes between horizontally adjacent chroma samples
+
+	Planes420(BYTE *aImage, LONG aStride, DWORD aHeight, int aInterleaved)
+	{
+		LONG stride = aStride < 0 ? -aStride : aStride;
+		LONG chromaRows = (LONG)(aHeight / 2);
+		BYTE *base = aStride < 0 ? aImage + aStride * (LONG)(aHeight - 1) : aImage;
+
+		mY = aImage;
+		mStrideY = aStride;
+		mStrideUV = aInterleaved ? stride : stride / 2;
+		mStepUV = aInterleaved ? 2 : 1;
+		mU = base + stride * (LONG)aHeight;
+		mV = aInterleaved ? mU + 1 : mU + mStrideUV * chromaRows;
+
+		if (aStride < 0)
+		{
+			mU += mStrideUV * (chromaRows - 1);
+			mV += mStrideUV * (chromaRows - 1);
+			mStrideUV = -mStrideUV;
+		}
+	}
+};
+
+// Byte positions within each two pixel group of packed 4:2:2 formats
+struct LayoutYUY2
+{
+	enum { Y0 = 0, U = 1, Y1 = 2, V = 3 };
+};
+
+struct LayoutUYVY
+{
+	enum { U = 0, Y0 = 1, V = 2, Y1 = 3 };
+};
+
+struct LayoutYVYU
+{
+	enum { Y0 = 0, V = 1, Y1 = 2, U = 3 };
+};
+
+// Chroma plane arrangement of planar 4:2:0 formats
+struct LayoutNV12
+{
+	enum { INTERLEAVED = 1, SWAPPED = 0 };
+};
+
+struct LayoutI420
+{
+	enum { INTERLEAVED = 0, SWAPPED = 0 };
+};
+
+struct LayoutYV12
+{
+	enum { INTERLEAVED = 0, SWAPPED = 1 };
+};
+
+// Byte positions of the colour channels in 32 bit output pixels
+struct OrderBGRA
+{
+	enum { R = 2, G = 1, B = 0, A = 3 };
+};
+
+struct OrderRGBA
+{
+	enum { R = 0, G = 1, B = 2, A = 3 };
+};
+
+extern ConversionFunction gFormatConversions[];
+extern const DWORD gConversionFormats;
+
+// Bytes per pixel of a packed subtype, or 0 for planar and compressed ones.
+int PackedSubtypeBytes(DWORD aSubtype);
+
+// Runs every kernel in gFormatConversions against its scalar reference on
+// a few image sizes. Returns the number of kernels that don't match, or
+// that write past the end of a row.
+int CheckConversions();
@@ -0,0 +1,41 @@
+#pragma once
+
+// The pixel code only needs a few Windows types, so it builds with any
+// compiler; the DLL gets them from windows.h as usual.
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t  BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t  LONG;
+typedef int      BOOL;
+
+#define TRUE  1
+#define FALSE 0
+
+#define __forceinline inline __attribute__((always_inline))
+#endif
+
+#define ESCAPI_FOURCC(a, b, c, d) \
+	((DWORD)(BYTE)(a) | ((DWORD)(BYTE)(b) << 8) | ((DWORD)(BYTE)(c) << 16) | ((DWORD)(BYTE)(d) << 24))
+
+// Source formats of the conversion kernels. Media Foundation subtypes are
+// MFVideoFormat_Base with Data1 set to these (a FOURCC, or a D3DFORMAT for
+// the RGB formats).
+enum VIDEO_SUBTYPES
+{
+	SUBTYPE_RGB32 = 22,   // D3DFMT_X8R8G8B8
+	SUBTYPE_RGB24 = 20,   // D3DFMT_R8G8B8
+	SUBTYPE_YUY2 = ESCAPI_FOURCC('Y', 'U', 'Y', '2'),
+	SUBTYPE_UYVY = ESCAPI_FOURCC('U', 'Y', 'V', 'Y'),
+	SUBTYPE_YVYU = ESCAPI_FOURCC('Y', 'V', 'Y', 'U'),
+	SUBTYPE_NV12 = ESCAPI_FOURCC('N', 'V', '1', '2'),
+	SUBTYPE_I420 = ESCAPI_FOURCC('I', '4', '2', '0'),
+	SUBTYPE_IYUV = ESCAPI_FOURCC('I', 'Y', 'U', 'V'),
+	SUBTYPE_YV12 = ESCAPI_FOURCC('Y', 'V', '1', '2'),
+	SUBTYPE_MJPG = ESCAPI_FOURCC('M', 'J', 'P', 'G')
+};
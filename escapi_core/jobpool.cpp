@@ -0,0 +1,129 @@
+#include "jobpool.h"
+
+JobPool::JobPool(int aThreads)
+{
+	mJob = 0;
+	mData = 0;
+	mCount = 0;
+	mNext = 0;
+	mPending = 0;
+	mQuit = 0;
+	mThreadCount = aThreads > 0 ? aThreads : 0;
+	mThreads = mThreadCount ? new std::thread[mThreadCount] : 0;
+	for (int i = 0; i < mThreadCount; i++)
+	{
+		mThreads[i] = std::thread(&JobPool::worker, this);
+	}
+}
+
+JobPool::~JobPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mQuit = 1;
+	}
+	mWake.notify_all();
+	for (int i = 0; i < mThreadCount; i++)
+	{
+		mThreads[i].join();
+	}
+	delete[] mThreads;
+}
+
+int JobPool::concurrency() const
+{
+	return mThreadCount + 1;
+}
+
+void JobPool::run(JOB_FN aJob, void *aData, int aCount)
+{
+	if (mThreadCount == 0 || aCount < 2)
+	{
+		for (int i = 0; i < aCount; i++)
+		{
+			aJob(aData, i);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> run(mRunLock);
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mJob = aJob;
+		mData = aData;
+		mCount = aCount;
+		mNext = 0;
+		mPending = aCount;
+	}
+	mWake.notify_all();
+
+	work();
+
+	std::unique_lock<std::mutex> lock(mLock);
+	while (mPending)
+	{
+		mDone.wait(lock);
+	}
+	mJob = 0;
+}
+
+void JobPool::work()
+{
+	for (;;)
+	{
+		JOB_FN job;
+		void *data;
+		int index;
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			if (mJob == 0 || mNext >= mCount)
+			{
+				return;
+			}
+			job = mJob;
+			data = mData;
+			index = mNext++;
+		}
+
+		job(data, index);
+
+		std::lock_guard<std::mutex> lock(mLock);
+		if (--mPending == 0)
+		{
+			mDone.notify_all();
+		}
+	}
+}
+
+void JobPool::worker()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mLock);
+			while (!mQuit && (mJob == 0 || mNext >= mCount))
+			{
+				mWake.wait(lock);
+			}
+			if (mQuit)
+			{
+				return;
+			}
+		}
+		work();
+	}
+}
+
+JobPool &SharedJobPool()
+{
+	// Never deleted: joining threads while the DLL is being unloaded would
+	// deadlock on the loader lock, and the process is going away anyway.
+	static JobPool *pool = 0;
+	static std::once_flag once;
+	std::call_once(once, []()
+	{
+		int threads = (int)std::thread::hardware_concurrency() - 1;
+		pool = new JobPool(threads > 7 ? 7 : threads);
+	});
+	return *pool;
+}
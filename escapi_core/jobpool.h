@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+typedef void(*JOB_FN)(void *aData, int aIndex);
+
+// A handful of worker threads that split up per-frame work (such as
+// independent restart intervals of a JPEG frame). The calling thread
+// helps out, so a pool without workers simply runs the jobs in order.
+class JobPool
+{
+public:
+	JobPool(int aThreads);
+	~JobPool();
+
+	// Calls aJob(aData, i) for i in [0, aCount) and waits for all of them.
+	void run(JOB_FN aJob, void *aData, int aCount);
+
+	// Number of threads that work on a run, including the caller.
+	int concurrency() const;
+
+private:
+	void work();
+	void worker();
+
+	std::thread             *mThreads;
+	int                     mThreadCount;
+	std::mutex              mRunLock;    // One run at a time
+	std::mutex              mLock;       // Guards the fields below
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	JOB_FN                  mJob;
+	void                    *mData;
+	int                     mCount;
+	int                     mNext;
+	int                     mPending;
+	int                     mQuit;
+};
+
+// The pool shared by all devices, sized to the machine.
+JobPool &SharedJobPool();
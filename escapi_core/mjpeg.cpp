@@ -0,0 +1,1557 @@
+#include "coretypes.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "conversion.h"
+#include "ycbcr.h"
+#include "jobpool.h"
+#include "mjpeg.h"
+#include "testpattern.h"
+
+#include <math.h>
+
+
+// Natural order index of each zigzag position
+static const BYTE gZigzag[64] =
+{
+	0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Many MJPEG cameras leave out the DHT segment and expect the example
+// tables from the JPEG spec (K.3), as per the AVI1 MJPEG format.
+static const BYTE gDcLumaBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const BYTE gDcChromaBits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const BYTE gDcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const BYTE gAcLumaBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const BYTE gAcLumaValues[162] =
+{
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+	0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+static const BYTE gAcChromaBits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const BYTE gAcChromaValues[162] =
+{
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+	0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+// Example quantization tables (K.1), which libjpeg uses for quality 50
+static const BYTE gLumaQuant[64] =
+{
+	16, 11, 10, 16, 24, 40, 51, 61,
+	12, 12, 14, 19, 26, 58, 60, 55,
+	14, 13, 16, 24, 40, 57, 69, 56,
+	14, 17, 22, 29, 51, 87, 80, 62,
+	18, 22, 37, 56, 68, 109, 103, 77,
+	24, 35, 55, 64, 81, 104, 113, 92,
+	49, 64, 78, 87, 103, 121, 120, 101,
+	72, 92, 95, 98, 112, 100, 103, 99
+};
+
+static const BYTE gChromaQuant[64] =
+{
+	17, 18, 24, 47, 99, 99, 99, 99,
+	18, 21, 26, 66, 99, 99, 99, 99,
+	24, 26, 56, 99, 99, 99, 99, 99,
+	47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99
+};
+
+#define FAST_BITS 9
+
+
+static int BuildHuffman(MjpegHuffman *aTable, const BYTE *aBits, const BYTE *aValues)
+{
+	int i, j, k = 0;
+	DWORD code = 0;
+
+	for (i = 0; i < 16; i++)
+	{
+		for (j = 0; j < aBits[i]; j++)
+		{
+			if (k == 256)
+				return 0;
+			aTable->mSize[k++] = (BYTE)(i + 1);
+		}
+	}
+	aTable->mSize[k] = 0;
+	memcpy(aTable->mValues, aValues, k);
+
+	// Canonical codes, as in the JPEG spec (C.2)
+	k = 0;
+	for (j = 1; j <= 16; j++)
+	{
+		aTable->mDelta[j] = k - (int)code;
+		while (aTable->mSize[k] == j)
+		{
+			aTable->mCode[k++] = (WORD)(code++);
+		}
+		if (code > (1u << j))
+			return 0;
+		aTable->mMaxCode[j] = code << (16 - j);
+		code <<= 1;
+	}
+	aTable->mMaxCode[17] = 0xffffffff;
+
+	memset(aTable->mFast, 255, sizeof(aTable->mFast));
+	for (i = 0; i < k; i++)
+	{
+		int size = aTable->mSize[i];
+		if (size <= FAST_BITS)
+		{
+			int first = aTable->mCode[i] << (FAST_BITS - size);
+			int count = 1 << (FAST_BITS - size);
+			for (j = 0; j < count; j++)
+			{
+				aTable->mFast[first + j] = (BYTE)i;
+			}
+		}
+	}
+
+	// For AC tables: run, size and the coefficient itself in one lookup,
+	// when code and coefficient bits fit in the lookahead together.
+	for (i = 0; i < (1 << FAST_BITS); i++)
+	{
+		aTable->mFastAc[i] = 0;
+		int index = aTable->mFast[i];
+		if (index == 255)
+			continue;
+
+		int rs = aTable->mValues[index];
+		int run = rs >> 4;
+		int size = rs & 15;
+		int length = aTable->mSize[index];
+		if (size == 0 || length + size > FAST_BITS)
+			continue;
+
+		int value = ((i << length) & ((1 << FAST_BITS) - 1)) >> (FAST_BITS - size);
+		if (value < (1 << (size - 1)))
+			value += 1 - (1 << size);
+		if (value >= -128 && value <= 127)
+			aTable->mFastAc[i] = (short)(value * 256 + run * 16 + length + size);
+	}
+	return 1;
+}
+
+
+// Reads the entropy coded data of one restart interval. Stops at the next
+// marker and feeds zeros from there on, so a truncated interval decodes
+// to garbage instead of running off the end.
+struct BitReader
+{
+	const BYTE *mPos;
+	const BYTE *mEnd;
+	DWORD      mBits;   // Left aligned
+	int        mCount;
+
+	BitReader(const BYTE *aPos, const BYTE *aEnd)
+	{
+		mPos = aPos;
+		mEnd = aEnd;
+		mBits = 0;
+		mCount = 0;
+	}
+
+	__forceinline void fill()
+	{
+		while (mCount <= 24)
+		{
+			DWORD b = 0;
+			if (mPos < mEnd)
+			{
+				b = *mPos;
+				if (b != 0xff)
+				{
+					mPos++;
+				}
+				else if (mPos + 1 < mEnd && mPos[1] == 0)
+				{
+					mPos += 2;
+				}
+				else
+				{
+					b = 0;
+					mEnd = mPos;
+				}
+			}
+			mBits |= b << (24 - mCount);
+			mCount += 8;
+		}
+	}
+
+	__forceinline int bits(int aCount)
+	{
+		if (aCount == 0)
+			return 0;
+		if (mCount < aCount)
+			fill();
+		int value = (int)(mBits >> (32 - aCount));
+		mBits <<= aCount;
+		mCount -= aCount;
+		return value;
+	}
+
+	// A coefficient of aCount bits, with the JPEG sign convention (F.2.2.1)
+	__forceinline int coefficient(int aCount)
+	{
+		int value = bits(aCount);
+		if (aCount && value < (1 << (aCount - 1)))
+			value += 1 - (1 << aCount);
+		return value;
+	}
+
+	__forceinline int symbol(const MjpegHuffman &aTable)
+	{
+		if (mCount < 16)
+			fill();
+
+		int index = aTable.mFast[mBits >> (32 - FAST_BITS)];
+		if (index < 255)
+		{
+			int size = aTable.mSize[index];
+			mBits <<= size;
+			mCount -= size;
+			return aTable.mValues[index];
+		}
+
+		DWORD top = mBits >> 16;
+		int size;
+		for (size = FAST_BITS + 1; top >= aTable.mMaxCode[size]; size++)
+			;
+		if (size == 17)
+			return -1;
+
+		index = (int)(mBits >> (32 - size)) + aTable.mDelta[size];
+		if (index < 0 || index > 255)
+			return -1;
+		mBits <<= size;
+		mCount -= size;
+		return aTable.mValues[index];
+	}
+};
+
+
+// Decodes one block into natural order, dequantized. Returns the zigzag
+// position of the last coefficient (0 for a flat block), or -1 if the
+// data is corrupt.
+static __forceinline int DecodeBlock(
+	BitReader          &aBits,
+	short              *aBlock,
+	const MjpegHuffman &aDc,
+	const MjpegHuffman &aAc,
+	const short        *aQuant,
+	int                &aPredictor
+	)
+{
+	int size = aBits.symbol(aDc);
+	if (size < 0 || size > 11)
+		return -1;
+
+	aPredictor += aBits.coefficient(size);
+	aBlock[0] = (short)(aPredictor * aQuant[0]);
+
+	int last = 0;
+	for (int k = 1; k < 64;)
+	{
+		if (aBits.mCount < 16)
+			aBits.fill();
+
+		int fast = aAc.mFastAc[aBits.mBits >> (32 - FAST_BITS)];
+		if (fast)
+		{
+			int used = fast & 15;
+			aBits.mBits <<= used;
+			aBits.mCount -= used;
+			k += (fast >> 4) & 15;
+			if (k > 63)
+				return -1;
+			aBlock[gZigzag[k]] = (short)((fast >> 8) * aQuant[k]);
+			last = k++;
+			continue;
+		}
+
+		int rs = aBits.symbol(aAc);
+		if (rs < 0)
+			return -1;
+
+		int run = rs >> 4;
+		size = rs & 15;
+		if (size == 0)
+		{
+			if (run != 15)
+				break;
+			k += 16;
+			continue;
+		}
+
+		k += run;
+		if (k > 63)
+			return -1;
+		aBlock[gZigzag[k]] = (short)(aBits.coefficient(size) * aQuant[k]);
+		last = k++;
+	}
+	return last;
+}
+
+
+// Inverse DCT. The 8 point transform has the structure of the "islow" IDCT
+// of the IJG library, with the multiplications folded into 4096 scaled
+// constants so that each output is a sum of pairwise products (which SSE2
+// does with pmaddwd).
+//
+// Downscaled decoding uses N point transforms of the N lowest frequencies
+// (N = 4, 2 or 1), which gives the block downscaled by 8 / N. They have the
+// same gain as the 8 point one, sqrt(2) * C(k) * cos((2n + 1) k pi / 2N),
+// so all sizes share the fixed point steps: pass one keeps 2 extra bits,
+// pass two removes them along with the 8x DCT gain and adds the 128 level
+// shift. Horizontal and vertical sizes differ for subsampled chroma, which
+// is decoded at up to twice the luma scale instead of being upsampled.
+
+enum
+{
+	IDCT_ONE = 4096,
+	IDCT_A = 2217,   // sqrt(2) * cos(3 pi / 8)
+	IDCT_C = 5352,   // sqrt(2) * cos(pi / 8)
+
+	IDCT_PASS1_BIAS = 1 << 9,
+	IDCT_PASS1_SHIFT = 10,
+	IDCT_PASS2_BIAS = (1 << 16) + (128 << 17),
+	IDCT_PASS2_SHIFT = 17
+};
+
+static const short gIdctOdd[4][4] =
+{
+	// Factors of s7, s5, s3, s1
+	{ -5681, 4816, -3218, 1130 },
+	{ 4816, 1130, -5681, 3218 },
+	{ -3218, -5681, -1130, 4816 },
+	{ 1130, 3218, 4816, 5681 }
+};
+
+static __forceinline int Saturate16(int aValue)
+{
+	return aValue < -32768 ? -32768 : (aValue > 32767 ? 32767 : aValue);
+}
+
+// One N point IDCT of aIn[0], aIn[aStep], ...
+template <int N>
+static __forceinline void Idct1D(const int *aIn, int aStep, int *aOut, int aBias, int aShift)
+{
+	int s0 = aIn[0];
+	int s1 = N > 1 ? aIn[aStep] : 0;
+
+	if (N == 1)
+	{
+		aOut[0] = Saturate16((s0 * IDCT_ONE + aBias) >> aShift);
+		return;
+	}
+
+	if (N == 2)
+	{
+		aOut[0] = Saturate16(((s0 + s1) * IDCT_ONE + aBias) >> aShift);
+		aOut[1] = Saturate16(((s0 - s1) * IDCT_ONE + aBias) >> aShift);
+		return;
+	}
+
+	int s2 = aIn[aStep * 2];
+	int s3 = aIn[aStep * 3];
+
+	if (N == 4)
+	{
+		int x0 = (s0 + s2) * IDCT_ONE + aBias;
+		int x1 = (s0 - s2) * IDCT_ONE + aBias;
+		int o0 = s1 * IDCT_C + s3 * IDCT_A;
+		int o1 = s1 * IDCT_A - s3 * IDCT_C;
+
+		aOut[0] = Saturate16((x0 + o0) >> aShift);
+		aOut[3] = Saturate16((x0 - o0) >> aShift);
+		aOut[1] = Saturate16((x1 + o1) >> aShift);
+		aOut[2] = Saturate16((x1 - o1) >> aShift);
+		return;
+	}
+
+	int s4 = aIn[aStep * 4], s5 = aIn[aStep * 5], s6 = aIn[aStep * 6], s7 = aIn[aStep * 7];
+
+	int t2 = s2 * IDCT_A - s6 * IDCT_C;
+	int t3 = s2 * IDCT_C + s6 * IDCT_A;
+	int t0 = (s0 + s4) * IDCT_ONE;
+	int t1 = (s0 - s4) * IDCT_ONE;
+
+	int x0 = t0 + t3 + aBias;
+	int x3 = t0 - t3 + aBias;
+	int x1 = t1 + t2 + aBias;
+	int x2 = t1 - t2 + aBias;
+
+	int o0 = s7 * gIdctOdd[0][0] + s5 * gIdctOdd[0][1] + s3 * gIdctOdd[0][2] + s1 * gIdctOdd[0][3];
+	int o1 = s7 * gIdctOdd[1][0] + s5 * gIdctOdd[1][1] + s3 * gIdctOdd[1][2] + s1 * gIdctOdd[1][3];
+	int o2 = s7 * gIdctOdd[2][0] + s5 * gIdctOdd[2][1] + s3 * gIdctOdd[2][2] + s1 * gIdctOdd[2][3];
+	int o3 = s7 * gIdctOdd[3][0] + s5 * gIdctOdd[3][1] + s3 * gIdctOdd[3][2] + s1 * gIdctOdd[3][3];
+
+	aOut[0] = Saturate16((x0 + o3) >> aShift);
+	aOut[7] = Saturate16((x0 - o3) >> aShift);
+	aOut[1] = Saturate16((x1 + o2) >> aShift);
+	aOut[6] = Saturate16((x1 - o2) >> aShift);
+	aOut[2] = Saturate16((x2 + o1) >> aShift);
+	aOut[5] = Saturate16((x2 - o1) >> aShift);
+	aOut[3] = Saturate16((x3 + o0) >> aShift);
+	aOut[4] = Saturate16((x3 - o0) >> aShift);
+}
+
+#ifdef ESCAPI_SSE2
+
+struct Wide32
+{
+	__m128i mLo;
+	__m128i mHi;
+};
+
+static __forceinline Wide32 MulPairs(__m128i aA, __m128i aB, __m128i aCoef)
+{
+	Wide32 r;
+	r.mLo = _mm_madd_epi16(_mm_unpacklo_epi16(aA, aB), aCoef);
+	r.mHi = _mm_madd_epi16(_mm_unpackhi_epi16(aA, aB), aCoef);
+	return r;
+}
+
+static __forceinline Wide32 Add(Wide32 aA, Wide32 aB)
+{
+	Wide32 r;
+	r.mLo = _mm_add_epi32(aA.mLo, aB.mLo);
+	r.mHi = _mm_add_epi32(aA.mHi, aB.mHi);
+	return r;
+}
+
+static __forceinline Wide32 Sub(Wide32 aA, Wide32 aB)
+{
+	Wide32 r;
+	r.mLo = _mm_sub_epi32(aA.mLo, aB.mLo);
+	r.mHi = _mm_sub_epi32(aA.mHi, aB.mHi);
+	return r;
+}
+
+static __forceinline Wide32 AddBias(Wide32 aA, __m128i aBias)
+{
+	Wide32 r;
+	r.mLo = _mm_add_epi32(aA.mLo, aBias);
+	r.mHi = _mm_add_epi32(aA.mHi, aBias);
+	return r;
+}
+
+template <int SHIFT>
+static __forceinline __m128i Narrow(Wide32 aA)
+{
+	return _mm_packs_epi32(_mm_srai_epi32(aA.mLo, SHIFT), _mm_srai_epi32(aA.mHi, SHIFT));
+}
+
+static __forceinline __m128i Pair(int aA, int aB)
+{
+	return _mm_setr_epi16((short)aA, (short)aB, (short)aA, (short)aB, (short)aA, (short)aB, (short)aA, (short)aB);
+}
+
+// Eight N point IDCTs, one per lane; aRow[k] holds coefficient k.
+template <int N, int SHIFT>
+static __forceinline void Idct1D_SSE2(__m128i *aRow, __m128i aBias)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	if (N == 1)
+	{
+		aRow[0] = Narrow<SHIFT>(AddBias(MulPairs(aRow[0], zero, Pair(IDCT_ONE, 0)), aBias));
+		return;
+	}
+
+	if (N == 2)
+	{
+		Wide32 x0 = AddBias(MulPairs(aRow[0], aRow[1], Pair(IDCT_ONE, IDCT_ONE)), aBias);
+		Wide32 x1 = AddBias(MulPairs(aRow[0], aRow[1], Pair(IDCT_ONE, -IDCT_ONE)), aBias);
+		aRow[0] = Narrow<SHIFT>(x0);
+		aRow[1] = Narrow<SHIFT>(x1);
+		return;
+	}
+
+	if (N == 4)
+	{
+		Wide32 x0 = AddBias(MulPairs(aRow[0], aRow[2], Pair(IDCT_ONE, IDCT_ONE)), aBias);
+		Wide32 x1 = AddBias(MulPairs(aRow[0], aRow[2], Pair(IDCT_ONE, -IDCT_ONE)), aBias);
+		Wide32 o0 = MulPairs(aRow[1], aRow[3], Pair(IDCT_C, IDCT_A));
+		Wide32 o1 = MulPairs(aRow[1], aRow[3], Pair(IDCT_A, -IDCT_C));
+
+		aRow[0] = Narrow<SHIFT>(Add(x0, o0));
+		aRow[3] = Narrow<SHIFT>(Sub(x0, o0));
+		aRow[1] = Narrow<SHIFT>(Add(x1, o1));
+		aRow[2] = Narrow<SHIFT>(Sub(x1, o1));
+		return;
+	}
+
+	Wide32 t2 = MulPairs(aRow[2], aRow[6], Pair(IDCT_A, -IDCT_C));
+	Wide32 t3 = MulPairs(aRow[2], aRow[6], Pair(IDCT_C, IDCT_A));
+	Wide32 t0 = MulPairs(aRow[0], aRow[4], Pair(IDCT_ONE, IDCT_ONE));
+	Wide32 t1 = MulPairs(aRow[0], aRow[4], Pair(IDCT_ONE, -IDCT_ONE));
+
+	Wide32 x0 = AddBias(Add(t0, t3), aBias);
+	Wide32 x3 = AddBias(Sub(t0, t3), aBias);
+	Wide32 x1 = AddBias(Add(t1, t2), aBias);
+	Wide32 x2 = AddBias(Sub(t1, t2), aBias);
+
+	Wide32 o[4];
+	for (int i = 0; i < 4; i++)
+	{
+		o[i] = Add(
+			MulPairs(aRow[7], aRow[5], Pair(gIdctOdd[i][0], gIdctOdd[i][1])),
+			MulPairs(aRow[3], aRow[1], Pair(gIdctOdd[i][2], gIdctOdd[i][3])));
+	}
+
+	aRow[0] = Narrow<SHIFT>(Add(x0, o[3]));
+	aRow[7] = Narrow<SHIFT>(Sub(x0, o[3]));
+	aRow[1] = Narrow<SHIFT>(Add(x1, o[2]));
+	aRow[6] = Narrow<SHIFT>(Sub(x1, o[2]));
+	aRow[2] = Narrow<SHIFT>(Add(x2, o[1]));
+	aRow[5] = Narrow<SHIFT>(Sub(x2, o[1]));
+	aRow[3] = Narrow<SHIFT>(Add(x3, o[0]));
+	aRow[4] = Narrow<SHIFT>(Sub(x3, o[0]));
+}
+
+static __forceinline void Transpose8x8(__m128i *aRow)
+{
+	__m128i a0 = _mm_unpacklo_epi16(aRow[0], aRow[1]);
+	__m128i a1 = _mm_unpackhi_epi16(aRow[0], aRow[1]);
+	__m128i a2 = _mm_unpacklo_epi16(aRow[2], aRow[3]);
+	__m128i a3 = _mm_unpackhi_epi16(aRow[2], aRow[3]);
+	__m128i a4 = _mm_unpacklo_epi16(aRow[4], aRow[5]);
+	__m128i a5 = _mm_unpackhi_epi16(aRow[4], aRow[5]);
+	__m128i a6 = _mm_unpacklo_epi16(aRow[6], aRow[7]);
+	__m128i a7 = _mm_unpackhi_epi16(aRow[6], aRow[7]);
+
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	aRow[0] = _mm_unpacklo_epi64(b0, b4);
+	aRow[1] = _mm_unpackhi_epi64(b0, b4);
+	aRow[2] = _mm_unpacklo_epi64(b1, b5);
+	aRow[3] = _mm_unpackhi_epi64(b1, b5);
+	aRow[4] = _mm_unpacklo_epi64(b2, b6);
+	aRow[5] = _mm_unpackhi_epi64(b2, b6);
+	aRow[6] = _mm_unpacklo_epi64(b3, b7);
+	aRow[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+template <int NX, int NY>
+static void Idct(const short *aBlock, BYTE *aDest, LONG aStride)
+{
+	__m128i row[8];
+	for (int i = 0; i < 8; i++)
+	{
+		row[i] = i < NY ? _mm_loadu_si128((const __m128i*)(aBlock + i * 8)) : _mm_setzero_si128();
+	}
+
+	// Columns (each lane is a column), then rows
+	Idct1D_SSE2<NY, IDCT_PASS1_SHIFT>(row, _mm_set1_epi32(IDCT_PASS1_BIAS));
+	Transpose8x8(row);
+	Idct1D_SSE2<NX, IDCT_PASS2_SHIFT>(row, _mm_set1_epi32(IDCT_PASS2_BIAS));
+	Transpose8x8(row);
+
+	for (int i = 0; i < NY; i++, aDest += aStride)
+	{
+		__m128i pixels = _mm_packus_epi16(row[i], row[i]);
+		if (NX == 8)
+			_mm_storel_epi64((__m128i*)aDest, pixels);
+		else if (NX == 4)
+			StoreLow32(aDest, pixels);
+		else if (NX == 2)
+		{
+			WORD value = (WORD)_mm_cvtsi128_si32(pixels);
+			memcpy(aDest, &value, 2);
+		}
+		else
+			*aDest = (BYTE)_mm_cvtsi128_si32(pixels);
+	}
+}
+
+#else
+
+template <int NX, int NY>
+static void Idct(const short *aBlock, BYTE *aDest, LONG aStride)
+{
+	int in[64], temp[64], out[8];
+	for (int i = 0; i < 64; i++)
+	{
+		in[i] = aBlock[i];
+	}
+
+	for (int x = 0; x < NX; x++)
+	{
+		Idct1D<NY>(in + x, 8, out, IDCT_PASS1_BIAS, IDCT_PASS1_SHIFT);
+		for (int y = 0; y < NY; y++)
+		{
+			temp[y * 8 + x] = out[y];
+		}
+	}
+
+	for (int y = 0; y < NY; y++, aDest += aStride)
+	{
+		Idct1D<NX>(temp + y * 8, 1, out, IDCT_PASS2_BIAS, IDCT_PASS2_SHIFT);
+		for (int x = 0; x < NX; x++)
+		{
+			aDest[x] = ClipByte(out[x]);
+		}
+	}
+}
+
+#endif
+
+typedef void(*IDCT_FN)(const short *aBlock, BYTE *aDest, LONG aStride);
+
+// By log2 of the output height, then width
+static const IDCT_FN gIdct[4][4] =
+{
+	{ Idct<1, 1>, Idct<2, 1>, Idct<4, 1>, Idct<8, 1> },
+	{ Idct<1, 2>, Idct<2, 2>, Idct<4, 2>, Idct<8, 2> },
+	{ Idct<1, 4>, Idct<2, 4>, Idct<4, 4>, Idct<8, 4> },
+	{ Idct<1, 8>, Idct<2, 8>, Idct<4, 8>, Idct<8, 8> }
+};
+
+// A block with only a DC coefficient is flat.
+static __forceinline void FillBlock(const short *aBlock, BYTE *aDest, LONG aStride, int aWidth, int aHeight)
+{
+	BYTE value = ClipByte(((aBlock[0] + 4) >> 3) + 128);
+	for (int y = 0; y < aHeight; y++, aDest += aStride)
+	{
+		memset(aDest, value, aWidth);
+	}
+}
+
+
+MjpegDecoder::MjpegDecoder()
+{
+	mPlanes = 0;
+	mPlanesSize = 0;
+	mMaxSegments = 64;
+	mSegment = new const BYTE*[mMaxSegments];
+	mSegments = 0;
+	mFailed = 0;
+}
+
+MjpegDecoder::~MjpegDecoder()
+{
+	delete[] mPlanes;
+	delete[] mSegment;
+}
+
+DWORD MjpegDecoder::ScaledSize(DWORD aSize, int aScale)
+{
+	return (aSize + aScale - 1) / aScale;
+}
+
+int MjpegDecoder::ChooseScale(DWORD aWidth, DWORD aHeight, DWORD aTargetWidth, DWORD aTargetHeight)
+{
+	int scale = 8;
+	while (scale > 1 &&
+		(ScaledSize(aWidth, scale) < aTargetWidth || ScaledSize(aHeight, scale) < aTargetHeight))
+	{
+		scale /= 2;
+	}
+	return scale;
+}
+
+int MjpegDecoder::IsOutputFormat(int aFormat)
+{
+	return aFormat == CAPTURE_FORMAT_BGRA ||
+		aFormat == CAPTURE_FORMAT_RGBA ||
+		aFormat == CAPTURE_FORMAT_GRAY8;
+}
+
+void MjpegDecoder::setDefaultHuffman()
+{
+	BuildHuffman(&mDcTable[0], gDcLumaBits, gDcValues);
+	BuildHuffman(&mDcTable[1], gDcChromaBits, gDcValues);
+	BuildHuffman(&mAcTable[0], gAcLumaBits, gAcLumaValues);
+	BuildHuffman(&mAcTable[1], gAcChromaBits, gAcChromaValues);
+	mDcValid[0] = mDcValid[1] = mAcValid[0] = mAcValid[1] = 1;
+	mDcValid[2] = mDcValid[3] = mAcValid[2] = mAcValid[3] = 0;
+}
+
+// Reads everything up to the start of the scan data.
+int MjpegDecoder::parseHeaders(DWORD aWidth, DWORD aHeight)
+{
+	int frame = 0;
+
+	mQuantValid[0] = mQuantValid[1] = mQuantValid[2] = mQuantValid[3] = 0;
+	mRestartInterval = 0;
+	setDefaultHuffman();
+
+	if (mEnd - mPos < 2 || mPos[0] != 0xff || mPos[1] != 0xd8)
+		return 0;
+	mPos += 2;
+
+	for (;;)
+	{
+		while (mPos < mEnd && *mPos == 0xff)
+			mPos++;
+		if (mEnd - mPos < 3)
+			return 0;
+
+		int marker = *mPos++;
+		if (marker == 0xd9 || marker == 0xd8 || (marker >= 0xd0 && marker <= 0xd7))
+			return 0;
+
+		int length = (mPos[0] << 8) | mPos[1];
+		if (length < 2 || length > mEnd - mPos)
+			return 0;
+		const BYTE *segment = mPos + 2;
+		const BYTE *next = mPos + length;
+		length -= 2;
+
+		switch (marker)
+		{
+		case 0xc0: // Baseline
+		case 0xc1: // Extended sequential, Huffman
+		{
+			if (length < 6 || segment[0] != 8)
+				return 0;
+			DWORD height = (segment[1] << 8) | segment[2];
+			DWORD width = (segment[3] << 8) | segment[4];
+			mComponents = segment[5];
+			if (width != aWidth || height != aHeight ||
+				(mComponents != 1 && mComponents != 3) ||
+				length < 6 + mComponents * 3)
+				return 0;
+
+			mHMax = 1;
+			mVMax = 1;
+			for (int i = 0; i < mComponents; i++)
+			{
+				MjpegComponent &c = mComponent[i];
+				c.mId = segment[6 + i * 3];
+				c.mH = segment[7 + i * 3] >> 4;
+				c.mV = segment[7 + i * 3] & 15;
+				c.mQuant = segment[8 + i * 3];
+				if (c.mH < 1 || c.mH > 2 || c.mV < 1 || c.mV > 2 || c.mQuant > 3)
+					return 0;
+				if (mComponents == 1)
+					c.mH = c.mV = 1; // Non-interleaved; an MCU is one block
+				mHMax = c.mH > mHMax ? c.mH : mHMax;
+				mVMax = c.mV > mVMax ? c.mV : mVMax;
+			}
+			// Luma must be at full resolution
+			if (mComponent[0].mH != mHMax || mComponent[0].mV != mVMax)
+				return 0;
+
+			mMcusX = (aWidth + 8 * mHMax - 1) / (8 * mHMax);
+			mMcusY = (aHeight + 8 * mVMax - 1) / (8 * mVMax);
+			frame = 1;
+			break;
+		}
+
+		case 0xc4:
+			while (length > 0)
+			{
+				if (length < 17)
+					return 0;
+				int type = segment[0] >> 4;
+				int index = segment[0] & 15;
+				int count = 0;
+				for (int i = 0; i < 16; i++)
+					count += segment[1 + i];
+				if (type > 1 || index > 3 || count > 256 || length < 17 + count)
+					return 0;
+				MjpegHuffman *table = type ? &mAcTable[index] : &mDcTable[index];
+				if (!BuildHuffman(table, segment + 1, segment + 17))
+					return 0;
+				if (type)
+					mAcValid[index] = 1;
+				else
+					mDcValid[index] = 1;
+				segment += 17 + count;
+				length -= 17 + count;
+			}
+			break;
+
+		case 0xdb:
+			while (length > 0)
+			{
+				int precision = segment[0] >> 4;
+				int index = segment[0] & 15;
+				int size = precision ? 129 : 65;
+				if (index > 3 || precision > 1 || length < size)
+					return 0;
+				for (int i = 0; i < 64; i++)
+				{
+					mQuant[index][i] = precision ?
+						(short)((segment[1 + i * 2] << 8) | segment[2 + i * 2]) :
+						(short)segment[1 + i];
+				}
+				mQuantValid[index] = 1;
+				segment += size;
+				length -= size;
+			}
+			break;
+
+		case 0xdd:
+			if (length < 2)
+				return 0;
+			mRestartInterval = (segment[0] << 8) | segment[1];
+			break;
+
+		case 0xda:
+		{
+			if (!frame || length < 1)
+				return 0;
+			int count = segment[0];
+			if (count != mComponents || length < 4 + count * 2)
+				return 0;
+			for (int i = 0; i < count; i++)
+			{
+				int id = segment[1 + i * 2];
+				int tables = segment[2 + i * 2];
+				MjpegComponent &c = mComponent[i];
+				// Interleaved scans list the components in frame order
+				if (c.mId != id)
+					return 0;
+				c.mDc = tables >> 4;
+				c.mAc = tables & 15;
+				if (c.mDc > 3 || c.mAc > 3 || !mDcValid[c.mDc] || !mAcValid[c.mAc] || !mQuantValid[c.mQuant])
+					return 0;
+			}
+			mPos = next;
+			return 1;
+		}
+
+		case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7:
+		case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf:
+			// Progressive, lossless, hierarchical and arithmetic coding
+			return 0;
+
+		default:
+			// APPn, COM and friends
+			break;
+		}
+
+		mPos = next;
+	}
+}
+
+// Splits the scan data at the RSTn markers.
+int MjpegDecoder::findSegments()
+{
+	int expected = 1;
+	int mcus = mMcusX * mMcusY;
+	if (mRestartInterval)
+		expected = (mcus + mRestartInterval - 1) / mRestartInterval;
+
+	if (expected > mMaxSegments)
+	{
+		delete[] mSegment;
+		mMaxSegments = expected;
+		mSegment = new const BYTE*[mMaxSegments];
+	}
+
+	mSegment[0] = mPos;
+	mSegments = 1;
+	if (expected == 1)
+		return 1;
+
+	const BYTE *p = mPos;
+	while (mSegments < expected)
+	{
+		p = (const BYTE*)memchr(p, 0xff, mEnd - p);
+		if (p == 0 || p + 1 >= mEnd)
+			return 0;
+		p++;
+		if (*p >= 0xd0 && *p <= 0xd7)
+		{
+			mSegment[mSegments++] = p + 1;
+		}
+		else if (*p != 0 && *p != 0xff)
+		{
+			// Some other marker, most likely EOI of a truncated frame
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void MjpegDecoder::decodeSegments(int aJob)
+{
+	int first = aJob * mSegmentsPerJob;
+	int last = first + mSegmentsPerJob;
+	int mcus = mMcusX * mMcusY;
+	int interval = mRestartInterval ? mRestartInterval : mcus;
+	short block[64];
+
+	if (last > mSegments)
+		last = mSegments;
+
+	for (int s = first; s < last && !mFailed; s++)
+	{
+		BitReader bits(mSegment[s], mEnd);
+		int predictor[3] = { 0, 0, 0 };
+		int end = (s + 1) * interval;
+		if (end > mcus)
+			end = mcus;
+
+		for (int mcu = s * interval; mcu < end; mcu++)
+		{
+			int mx = mcu % mMcusX;
+			int my = mcu / mMcusX;
+
+			for (int i = 0; i < mComponents; i++)
+			{
+				const MjpegComponent &c = mComponent[i];
+				for (int by = 0; by < c.mV; by++)
+				{
+					for (int bx = 0; bx < c.mH; bx++)
+					{
+						memset(block, 0, sizeof(block));
+						int last = DecodeBlock(bits, block, mDcTable[c.mDc], mAcTable[c.mAc], mQuant[c.mQuant], predictor[i]);
+						if (last < 0)
+						{
+							mFailed = 1;
+							return;
+						}
+
+						BYTE *dest = c.mPlane +
+							c.mStride * (LONG)((my * c.mV + by) * c.mBlockHeight) +
+							(mx * c.mH + bx) * c.mBlockWidth;
+
+						if (last == 0)
+							FillBlock(block, dest, c.mStride, c.mBlockWidth, c.mBlockHeight);
+						else
+							gIdct[c.mIdctY][c.mIdctX](block, dest, c.mStride);
+					}
+				}
+			}
+		}
+	}
+}
+
+// Converts one row of decoded samples to 32 bit pixels. aShiftCb and
+// aShiftCr are the log2 of the output pixels per chroma sample.
+template <class COEF, class ORDER>
+static void ConvertRow(BYTE *aDest, const BYTE *aY, const BYTE *aCb, const BYTE *aCr, DWORD aWidth, int aShiftCb, int aShiftCr)
+{
+	DWORD x = 0;
+
+	if (aShiftCb != aShiftCr)
+	{
+		// Unusual; no fast path
+		for (; x < aWidth; x++)
+		{
+			StoreYCbCr<COEF, ORDER>(aDest + x * 4, aY[x], aCb[x >> aShiftCb], aCr[x >> aShiftCr]);
+		}
+		return;
+	}
+
+#ifdef ESCAPI_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= aWidth; x += 8)
+	{
+		__m128i valueY = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(aY + x)), zero);
+		__m128i valueCb, valueCr;
+		if (aShiftCb)
+		{
+			valueCb = _mm_unpacklo_epi8(LoadLow32(aCb + x / 2), zero);
+			valueCr = _mm_unpacklo_epi8(LoadLow32(aCr + x / 2), zero);
+			valueCb = _mm_unpacklo_epi16(valueCb, valueCb);
+			valueCr = _mm_unpacklo_epi16(valueCr, valueCr);
+		}
+		else
+		{
+			valueCb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(aCb + x)), zero);
+			valueCr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(aCr + x)), zero);
+		}
+		StoreYCbCr_SSE2<COEF, ORDER>(aDest + x * 4, valueY, valueCb, valueCr);
+	}
+#endif
+	for (; x < aWidth; x++)
+	{
+		StoreYCbCr<COEF, ORDER>(aDest + x * 4, aY[x], aCb[x >> aShiftCb], aCr[x >> aShiftCr]);
+	}
+}
+
+// Indexed by YCBCR_MATRIX, then RGBA (1) or BGRA (0) output
+static const MJPEG_ROW_FN gConvertRow[4][2] =
+{
+	{ ConvertRow<YCbCrBT601, OrderBGRA>, ConvertRow<YCbCrBT601, OrderRGBA> },
+	{ ConvertRow<YCbCrBT601Full, OrderBGRA>, ConvertRow<YCbCrBT601Full, OrderRGBA> },
+	{ ConvertRow<YCbCrBT709, OrderBGRA>, ConvertRow<YCbCrBT709, OrderRGBA> },
+	{ ConvertRow<YCbCrBT709Full, OrderBGRA>, ConvertRow<YCbCrBT709Full, OrderRGBA> }
+};
+
+void MjpegDecoder::convertRows(int aJob)
+{
+	DWORD first = aJob * mRowsPerJob;
+	DWORD last = first + mRowsPerJob;
+	if (last > mOutHeight)
+		last = mOutHeight;
+
+	const MjpegComponent &luma = mComponent[0];
+
+	for (DWORD y = first; y < last; y++)
+	{
+		BYTE *dest = mDest + mDestStride * (LONG)y;
+		const BYTE *lineY = luma.mPlane + luma.mStride * (LONG)y;
+
+		if (mFormat == CAPTURE_FORMAT_GRAY8)
+		{
+			memcpy(dest, lineY, mOutWidth);
+			continue;
+		}
+
+		if (mComponents == 1)
+		{
+			for (DWORD x = 0; x < mOutWidth; x++)
+			{
+				dest[x * 4 + 0] = dest[x * 4 + 1] = dest[x * 4 + 2] = lineY[x];
+				dest[x * 4 + 3] = 0xff;
+			}
+			continue;
+		}
+
+		const MjpegComponent &cb = mComponent[1];
+		const MjpegComponent &cr = mComponent[2];
+		mConvertRow(
+			dest,
+			lineY,
+			cb.mPlane + cb.mStride * (LONG)(y >> cb.mShiftY),
+			cr.mPlane + cr.mStride * (LONG)(y >> cr.mShiftY),
+			mOutWidth,
+			cb.mShiftX,
+			cr.mShiftX
+			);
+	}
+}
+
+static void DecodeSegmentsJob(void *aData, int aIndex)
+{
+	((MjpegDecoder*)aData)->decodeSegments(aIndex);
+}
+
+static void ConvertRowsJob(void *aData, int aIndex)
+{
+	((MjpegDecoder*)aData)->convertRows(aIndex);
+}
+
+int MjpegDecoder::decode(
+	BYTE*       aDest,
+	LONG        aDestStride,
+	int         aFormat,
+	int         aMatrix,
+	const BYTE* aData,
+	DWORD       aSize,
+	DWORD       aWidth,
+	DWORD       aHeight,
+	int         aScale
+	)
+{
+	if (!IsOutputFormat(aFormat) || (aScale != 1 && aScale != 2 && aScale != 4 && aScale != 8))
+		return 0;
+	if (aMatrix < YCBCR_BT601 || aMatrix > YCBCR_BT709_FULL)
+		return 0;
+
+	mPos = aData;
+	mEnd = aData + aSize;
+	if (!parseHeaders(aWidth, aHeight) || !findSegments())
+		return 0;
+
+	// Lay out the component planes, in whole MCUs. Subsampled components
+	// are decoded at a larger size when scaling down, rather than being
+	// upsampled later; this is both cheaper and better looking.
+	DWORD total = 0;
+	for (int i = 0; i < mComponents; i++)
+	{
+		MjpegComponent &c = mComponent[i];
+		// Output pixels per block along each axis, in log2
+		int log2Scale = aScale == 8 ? 3 : (aScale == 4 ? 2 : (aScale == 2 ? 1 : 0));
+		int spanX = 3 - log2Scale + (mHMax / c.mH - 1);
+		int spanY = 3 - log2Scale + (mVMax / c.mV - 1);
+
+		c.mIdctX = spanX > 3 ? 3 : spanX;
+		c.mIdctY = spanY > 3 ? 3 : spanY;
+		c.mShiftX = spanX - c.mIdctX;
+		c.mShiftY = spanY - c.mIdctY;
+		c.mBlockWidth = 1 << c.mIdctX;
+		c.mBlockHeight = 1 << c.mIdctY;
+		c.mStride = mMcusX * c.mH * c.mBlockWidth;
+		total += c.mStride * mMcusY * c.mV * c.mBlockHeight;
+	}
+	if (total > mPlanesSize)
+	{
+		delete[] mPlanes;
+		mPlanes = new BYTE[total];
+		mPlanesSize = total;
+	}
+	total = 0;
+	for (int i = 0; i < mComponents; i++)
+	{
+		MjpegComponent &c = mComponent[i];
+		c.mPlane = mPlanes + total;
+		total += c.mStride * mMcusY * c.mV * c.mBlockHeight;
+	}
+
+	JobPool &pool = SharedJobPool();
+
+	// A few segments per job keeps the threads busy without paying for
+	// the hand-off on every (often single MCU row) interval.
+	int jobs = pool.concurrency() * 4;
+	if (jobs > mSegments)
+		jobs = mSegments;
+	mSegmentsPerJob = (mSegments + jobs - 1) / jobs;
+	jobs = (mSegments + mSegmentsPerJob - 1) / mSegmentsPerJob;
+
+	mFailed = 0;
+	pool.run(DecodeSegmentsJob, this, jobs);
+	if (mFailed)
+		return 0;
+
+	mDest = aDest;
+	mDestStride = aDestStride;
+	mFormat = aFormat;
+	mConvertRow = gConvertRow[aMatrix][aFormat == CAPTURE_FORMAT_RGBA];
+	mOutWidth = ScaledSize(aWidth, aScale);
+	mOutHeight = ScaledSize(aHeight, aScale);
+
+	jobs = pool.concurrency();
+	mRowsPerJob = (mOutHeight + jobs - 1) / jobs;
+	jobs = (mOutHeight + mRowsPerJob - 1) / mRowsPerJob;
+	pool.run(ConvertRowsJob, this, jobs);
+
+	return 1;
+}
+
+
+// Encoder
+
+// Entropy coded data with 0xff byte stuffing
+struct BitWriter
+{
+	BYTE  *mPos;
+	DWORD mBits;
+	int   mCount;
+
+	__forceinline void put(DWORD aBits, int aSize)
+	{
+		mBits = (mBits << aSize) | (aBits & ((1u << aSize) - 1));
+		mCount += aSize;
+		while (mCount >= 8)
+		{
+			mCount -= 8;
+			BYTE b = (BYTE)(mBits >> mCount);
+			*mPos++ = b;
+			if (b == 0xff)
+				*mPos++ = 0;
+		}
+	}
+
+	// Pads the last byte with 1 bits, as the spec asks
+	void flush()
+	{
+		if (mCount)
+			put(0x7f, 8 - mCount);
+	}
+};
+
+static void BuildCodes(WORD *aCode, BYTE *aSize, const BYTE *aBits, const BYTE *aValues)
+{
+	DWORD code = 0;
+	int k = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		for (int j = 0; j < aBits[i]; j++)
+		{
+			aCode[aValues[k]] = (WORD)code++;
+			aSize[aValues[k]] = (BYTE)(i + 1);
+			k++;
+		}
+		code <<= 1;
+	}
+}
+
+// Scaled float DCT (AAN), as in libjpeg's jfdctflt.c; the scale of each
+// output is folded into the quantizer.
+static __forceinline void ForwardDct1D(float *aData, int aStep)
+{
+	float *d = aData;
+	float tmp0 = d[0] + d[7 * aStep];
+	float tmp7 = d[0] - d[7 * aStep];
+	float tmp1 = d[aStep] + d[6 * aStep];
+	float tmp6 = d[aStep] - d[6 * aStep];
+	float tmp2 = d[2 * aStep] + d[5 * aStep];
+	float tmp5 = d[2 * aStep] - d[5 * aStep];
+	float tmp3 = d[3 * aStep] + d[4 * aStep];
+	float tmp4 = d[3 * aStep] - d[4 * aStep];
+
+	float tmp10 = tmp0 + tmp3;
+	float tmp13 = tmp0 - tmp3;
+	float tmp11 = tmp1 + tmp2;
+	float tmp12 = tmp1 - tmp2;
+
+	d[0] = tmp10 + tmp11;
+	d[4 * aStep] = tmp10 - tmp11;
+
+	float z1 = (tmp12 + tmp13) * 0.707106781f;
+	d[2 * aStep] = tmp13 + z1;
+	d[6 * aStep] = tmp13 - z1;
+
+	tmp10 = tmp4 + tmp5;
+	tmp11 = tmp5 + tmp6;
+	tmp12 = tmp6 + tmp7;
+
+	float z5 = (tmp10 - tmp12) * 0.382683433f;
+	float z2 = 0.541196100f * tmp10 + z5;
+	float z4 = 1.306562965f * tmp12 + z5;
+	float z3 = tmp11 * 0.707106781f;
+
+	float z11 = tmp7 + z3;
+	float z13 = tmp7 - z3;
+
+	d[5 * aStep] = z13 + z2;
+	d[3 * aStep] = z13 - z2;
+	d[aStep] = z11 + z4;
+	d[7 * aStep] = z11 - z4;
+}
+
+static __forceinline int BitLength(int aValue)
+{
+	int bits = 0;
+	while (aValue)
+	{
+		bits++;
+		aValue >>= 1;
+	}
+	return bits;
+}
+
+// Transforms, quantizes and writes one block of samples, with the edges
+// of the image repeated into blocks that stick out of it.
+static void EncodeBlock(
+	BitWriter &aOut,
+	const BYTE *aPlane,
+	LONG aStride,
+	int aX,
+	int aY,
+	int aWidth,
+	int aHeight,
+	const float *aScale,
+	int &aDc,
+	const WORD *aDcCode,
+	const BYTE *aDcSize,
+	const WORD *aAcCode,
+	const BYTE *aAcSize)
+{
+	float block[64];
+	for (int y = 0; y < 8; y++)
+	{
+		int sy = aY + y < aHeight ? aY + y : aHeight - 1;
+		const BYTE *row = aPlane + sy * aStride;
+		for (int x = 0; x < 8; x++)
+		{
+			int sx = aX + x < aWidth ? aX + x : aWidth - 1;
+			block[y * 8 + x] = (float)row[sx] - 128.0f;
+		}
+	}
+
+	for (int i = 0; i < 8; i++)
+		ForwardDct1D(block + i * 8, 1);
+	for (int i = 0; i < 8; i++)
+		ForwardDct1D(block + i, 8);
+
+	int coef[64];
+	for (int i = 0; i < 64; i++)
+	{
+		float v = block[gZigzag[i]] * aScale[gZigzag[i]];
+		coef[i] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
+	}
+
+	int diff = coef[0] - aDc;
+	aDc = coef[0];
+	int bits = BitLength(diff < 0 ? -diff : diff);
+	aOut.put(aDcCode[bits], aDcSize[bits]);
+	if (bits)
+		aOut.put(diff < 0 ? diff - 1 : diff, bits);
+
+	int run = 0;
+	for (int i = 1; i < 64; i++)
+	{
+		int v = coef[i];
+		if (v == 0)
+		{
+			run++;
+			continue;
+		}
+		while (run > 15)
+		{
+			aOut.put(aAcCode[0xf0], aAcSize[0xf0]);
+			run -= 16;
+		}
+		bits = BitLength(v < 0 ? -v : v);
+		int rs = (run << 4) | bits;
+		aOut.put(aAcCode[rs], aAcSize[rs]);
+		aOut.put(v < 0 ? v - 1 : v, bits);
+		run = 0;
+	}
+	if (run)
+		aOut.put(aAcCode[0], aAcSize[0]);
+}
+
+static BYTE *PutWord(BYTE *aPos, int aValue)
+{
+	aPos[0] = (BYTE)(aValue >> 8);
+	aPos[1] = (BYTE)aValue;
+	return aPos + 2;
+}
+
+static BYTE *PutHuffmanTable(BYTE *aPos, int aClassId, const BYTE *aBits, const BYTE *aValues)
+{
+	int count = 0;
+	*aPos++ = (BYTE)aClassId;
+	for (int i = 0; i < 16; i++)
+	{
+		*aPos++ = aBits[i];
+		count += aBits[i];
+	}
+	memcpy(aPos, aValues, count);
+	return aPos + count;
+}
+
+MjpegEncoder::MjpegEncoder(int aQuality)
+{
+	static const float aanScale[8] =
+	{
+		1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+		1.0f, 0.785694958f, 0.541196100f, 0.275899379f
+	};
+
+	if (aQuality < 1)
+		aQuality = 1;
+	if (aQuality > 100)
+		aQuality = 100;
+	int percent = aQuality < 50 ? 5000 / aQuality : 200 - aQuality * 2;
+
+	for (int t = 0; t < 2; t++)
+	{
+		const BYTE *base = t ? gChromaQuant : gLumaQuant;
+		for (int i = 0; i < 64; i++)
+		{
+			int q = (base[i] * percent + 50) / 100;
+			q = q < 1 ? 1 : (q > 255 ? 255 : q);
+			mScale[t][i] = 1.0f / (q * aanScale[i >> 3] * aanScale[i & 7] * 8.0f);
+		}
+		for (int i = 0; i < 64; i++)
+		{
+			int q = (base[gZigzag[i]] * percent + 50) / 100;
+			mQuant[t][i] = (BYTE)(q < 1 ? 1 : (q > 255 ? 255 : q));
+		}
+	}
+
+	BuildCodes(mCode[0], mSize[0], gDcLumaBits, gDcValues);
+	BuildCodes(mCode[1], mSize[1], gDcChromaBits, gDcValues);
+	BuildCodes(mCode[2], mSize[2], gAcLumaBits, gAcLumaValues);
+	BuildCodes(mCode[3], mSize[3], gAcChromaBits, gAcChromaValues);
+}
+
+DWORD MjpegEncoder::encode(
+	BYTE*       aDest,
+	DWORD       aDestSize,
+	const BYTE* aY,
+	LONG        aStrideY,
+	const BYTE* aCb,
+	const BYTE* aCr,
+	LONG        aStrideC,
+	DWORD       aWidth,
+	DWORD       aHeight
+	)
+{
+	// Six blocks can't take more than this, stuffing included; the
+	// headers take 617 bytes.
+	const DWORD maxMcuBytes = 6 * 2 * (16 + 64 * (16 + 11)) / 8;
+	const DWORD headerBytes = 1024;
+
+	int mcusX = (int)(aWidth + 15) / 16;
+	int mcusY = (int)(aHeight + 15) / 16;
+	if (aWidth == 0 || aHeight == 0 || aWidth > 65535 || aHeight > 65535 || aDestSize < headerBytes)
+		return 0;
+
+	BYTE *p = aDest;
+	BYTE *end = aDest + aDestSize;
+
+	// SOI, and APP0 for JFIF
+	static const BYTE jfif[] = { 0xff, 0xd8, 0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+	memcpy(p, jfif, sizeof(jfif));
+	p += sizeof(jfif);
+
+	for (int t = 0; t < 2; t++)
+	{
+		p = PutWord(p, 0xffdb);
+		p = PutWord(p, 67);
+		*p++ = (BYTE)t;
+		memcpy(p, mQuant[t], 64);
+		p += 64;
+	}
+
+	// Baseline frame: luma at 2x2, chroma at 1x1 with the second table
+	static const BYTE sof[] = { 0xff, 0xc0, 0, 17, 8 };
+	memcpy(p, sof, sizeof(sof));
+	p += sizeof(sof);
+	p = PutWord(p, aHeight);
+	p = PutWord(p, aWidth);
+	static const BYTE components[] = { 3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1 };
+	memcpy(p, components, sizeof(components));
+	p += sizeof(components);
+
+	p = PutWord(p, 0xffc4);
+	p = PutWord(p, 2 + 4 * 17 + 2 * 12 + 2 * 162);
+	p = PutHuffmanTable(p, 0x00, gDcLumaBits, gDcValues);
+	p = PutHuffmanTable(p, 0x10, gAcLumaBits, gAcLumaValues);
+	p = PutHuffmanTable(p, 0x01, gDcChromaBits, gDcValues);
+	p = PutHuffmanTable(p, 0x11, gAcChromaBits, gAcChromaValues);
+
+	p = PutWord(p, 0xffdd);
+	p = PutWord(p, 4);
+	p = PutWord(p, mcusX);
+
+	static const BYTE sos[] = { 0xff, 0xda, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+	memcpy(p, sos, sizeof(sos));
+	p += sizeof(sos);
+
+	BitWriter out;
+	out.mPos = p;
+	out.mBits = 0;
+	out.mCount = 0;
+
+	int width = (int)aWidth;
+	int height = (int)aHeight;
+	int chromaWidth = (width + 1) / 2;
+	int chromaHeight = (height + 1) / 2;
+
+	for (int my = 0; my < mcusY; my++)
+	{
+		int dc[3] = { 0, 0, 0 };
+		for (int mx = 0; mx < mcusX; mx++)
+		{
+			if ((DWORD)(end - out.mPos) < maxMcuBytes + 4)
+				return 0;
+
+			int x = mx * 16;
+			int y = my * 16;
+			EncodeBlock(out, aY, aStrideY, x, y, width, height, mScale[0], dc[0], mCode[0], mSize[0], mCode[2], mSize[2]);
+			EncodeBlock(out, aY, aStrideY, x + 8, y, width, height, mScale[0], dc[0], mCode[0], mSize[0], mCode[2], mSize[2]);
+			EncodeBlock(out, aY, aStrideY, x, y + 8, width, height, mScale[0], dc[0], mCode[0], mSize[0], mCode[2], mSize[2]);
+			EncodeBlock(out, aY, aStrideY, x + 8, y + 8, width, height, mScale[0], dc[0], mCode[0], mSize[0], mCode[2], mSize[2]);
+			EncodeBlock(out, aCb, aStrideC, x / 2, y / 2, chromaWidth, chromaHeight, mScale[1], dc[1], mCode[1], mSize[1], mCode[3], mSize[3]);
+			EncodeBlock(out, aCr, aStrideC, x / 2, y / 2, chromaWidth, chromaHeight, mScale[1], dc[2], mCode[1], mSize[1], mCode[3], mSize[3]);
+		}
+
+		out.flush();
+		if (my + 1 < mcusY)
+		{
+			*out.mPos++ = 0xff;
+			*out.mPos++ = (BYTE)(0xd0 + (my & 7));
+		}
+	}
+
+	p = out.mPos;
+	if (end - p < 2)
+		return 0;
+	p = PutWord(p, 0xffd9);
+	return (DWORD)(p - aDest);
+}
+
+int CheckMjpeg()
+{
+	// The decoded test pattern against the RGB32 one, averaged over the
+	// same blocks as a scaled decode covers. Quality 85 gives about 43, 43,
+	// 39 and 37 dB; the floors leave 3 dB for rounding in other builds.
+	static const int scales[] = { 1, 2, 4, 8 };
+	static const double floors[] = { 40, 40, 36, 34 };
+	const DWORD width = 640;
+	const DWORD height = 480;
+	const DWORD frameNumber = 0x5a3c96e1;
+	int failures = 0;
+
+	TestPattern mjpg, rgb;
+	DWORD size = 0, rgbSize = 0;
+	const BYTE *frame = mjpg.init(SUBTYPE_MJPG, width, height) ? mjpg.render(frameNumber, size) : 0;
+	const BYTE *reference = rgb.init(SUBTYPE_RGB32, width, height) ? rgb.render(frameNumber, rgbSize) : 0;
+	if (!frame || !reference)
+		return 1;
+
+	MjpegDecoder decoder;
+	BYTE *dest = new BYTE[width * height * 4];
+	for (int s = 0; s < 4; s++)
+	{
+		int scale = scales[s];
+		DWORD outWidth = MjpegDecoder::ScaledSize(width, scale);
+		DWORD outHeight = MjpegDecoder::ScaledSize(height, scale);
+		LONG stride = outWidth * 4;
+		if (!decoder.decode(dest, stride, CAPTURE_FORMAT_BGRA, YCBCR_BT601_FULL, frame, size, width, height, scale))
+		{
+			failures++;
+			continue;
+		}
+
+		double error = 0;
+		for (DWORD y = 0; y < outHeight; y++)
+		{
+			for (DWORD x = 0; x < outWidth; x++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					int sum = 0;
+					for (int by = 0; by < scale; by++)
+					{
+						for (int bx = 0; bx < scale; bx++)
+							sum += reference[rgb.stride() * (LONG)(y * scale + by) + (x * scale + bx) * 4 + c];
+					}
+					double d = dest[stride * (LONG)y + x * 4 + c] - (double)sum / (scale * scale);
+					error += d * d;
+				}
+			}
+		}
+		error /= outWidth * outHeight * 3.0;
+		double psnr = error > 0 ? 10 * log10(255.0 * 255.0 / error) : 99;
+		if (psnr < floors[s] ||
+			TestPattern::ReadFrameNumber(dest, stride, outWidth, outHeight, CAPTURE_FORMAT_BGRA) != frameNumber)
+		{
+			failures++;
+		}
+	}
+	delete[] dest;
+	return failures;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+
+// Baseline JPEG decoder for MJPG capture. Decodes straight into a 32 bit or
+// luma-only image, optionally at 1/2, 1/4 or 1/8 size by only evaluating
+// the low frequency part of each block's IDCT. Restart intervals are
+// decoded in parallel when the stream has them.
+
+typedef void(*MJPEG_ROW_FN)(BYTE *aDest, const BYTE *aY, const BYTE *aCb, const BYTE *aCr, DWORD aWidth, int aShiftCb, int aShiftCr);
+
+struct MjpegHuffman
+{
+	BYTE  mFast[1 << 9];  // Symbol index for the next 9 bits, 255 = longer code
+	short mFastAc[1 << 9];// Value << 8 | run << 4 | bits used, for short AC codes
+	WORD  mCode[256];
+	BYTE  mValues[256];
+	BYTE  mSize[257];
+	DWORD mMaxCode[18];   // Largest code + 1 for each length, left aligned to 16 bits
+	int   mDelta[17];     // Symbol index minus code for each length
+};
+
+struct MjpegComponent
+{
+	int  mId;
+	int  mH;              // Sampling factors
+	int  mV;
+	int  mQuant;
+	int  mDc;             // Huffman table indices
+	int  mAc;
+	int  mBlockWidth;     // Decoded size of each block, 8 / scale or more
+	int  mBlockHeight;
+	int  mIdctX;          // log2 of the above
+	int  mIdctY;
+	int  mShiftX;         // log2 of the output pixels per sample
+	int  mShiftY;
+	BYTE *mPlane;         // Decoded samples, whole MCUs
+	LONG mStride;
+};
+
+class MjpegDecoder
+{
+public:
+	MjpegDecoder();
+	~MjpegDecoder();
+
+	// Decodes an aWidth x aHeight frame at 1/aScale size (1, 2, 4 or 8) into
+	// aDest, which is CAPTURE_FORMAT_BGRA, _RGBA or _GRAY8. aMatrix is the
+	// YCBCR_MATRIX to convert with; JPEG itself is YCBCR_BT601_FULL. Returns
+	// 0 if the frame is corrupt, has a different size, or uses JPEG features
+	// that cameras don't (progressive, arithmetic coding, 12 bit samples).
+	int decode(
+		BYTE*       aDest,
+		LONG        aDestStride,
+		int         aFormat,
+		int         aMatrix,
+		const BYTE* aData,
+		DWORD       aSize,
+		DWORD       aWidth,
+		DWORD       aHeight,
+		int         aScale
+		);
+
+	// Size of the decoded image along one axis.
+	static DWORD ScaledSize(DWORD aSize, int aScale);
+
+	// Picks the smallest decode size that still covers the target.
+	static int ChooseScale(DWORD aWidth, DWORD aHeight, DWORD aTargetWidth, DWORD aTargetHeight);
+
+	// Whether decode() can write the format itself.
+	static int IsOutputFormat(int aFormat);
+
+	// Called from the job pool.
+	void decodeSegments(int aJob);
+	void convertRows(int aJob);
+
+private:
+	int parseHeaders(DWORD aWidth, DWORD aHeight);
+	int findSegments();
+	void setDefaultHuffman();
+
+	const BYTE     *mPos;
+	const BYTE     *mEnd;
+
+	short          mQuant[4][64];     // In zigzag order
+	int            mQuantValid[4];
+	MjpegHuffman   mDcTable[4];
+	MjpegHuffman   mAcTable[4];
+	int            mDcValid[4];
+	int            mAcValid[4];
+
+	MjpegComponent mComponent[3];
+	int            mComponents;
+	int            mHMax;
+	int            mVMax;
+	int            mMcusX;
+	int            mMcusY;
+	int            mRestartInterval;
+
+	BYTE           *mPlanes;
+	DWORD          mPlanesSize;
+
+	const BYTE     **mSegment;        // Start of each restart interval
+	int            mSegments;
+	int            mMaxSegments;
+	int            mSegmentsPerJob;
+
+	BYTE           *mDest;
+	LONG           mDestStride;
+	int            mFormat;
+	MJPEG_ROW_FN   mConvertRow;
+	DWORD          mOutWidth;
+	DWORD          mOutHeight;
+	int            mRowsPerJob;
+	std::atomic<int> mFailed;
+};
+
+// Baseline JPEG encoder, the counterpart of MjpegDecoder for synthetic
+// MJPG frames (see TestPattern). Writes 4:2:0 with the example Huffman
+// tables and one restart interval per MCU row, like many cameras do.
+class MjpegEncoder
+{
+public:
+	// aQuality is 1..100, as in libjpeg
+	MjpegEncoder(int aQuality);
+
+	// Encodes full range YCbCr planes, with chroma at half size both ways.
+	// Returns the size of the JPEG, or 0 if it doesn't fit in aDestSize.
+	DWORD encode(
+		BYTE*       aDest,
+		DWORD       aDestSize,
+		const BYTE* aY,
+		LONG        aStrideY,
+		const BYTE* aCb,
+		const BYTE* aCr,
+		LONG        aStrideC,
+		DWORD       aWidth,
+		DWORD       aHeight
+		);
+
+private:
+	BYTE  mQuant[2][64];    // In zigzag order, for the DQT segment
+	float mScale[2][64];    // Reciprocal quantizer and DCT scale, natural order
+	WORD  mCode[4][256];    // DC luma, DC chroma, AC luma, AC chroma
+	BYTE  mSize[4][256];
+};
+
+// Decodes a test pattern frame at each scale and compares it with the
+// uncompressed pattern, by PSNR and by reading the frame number back.
+// Returns the number of scales that fail.
+int CheckMjpeg();
@@ -0,0 +1,253 @@
+#include "coretypes.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "simd.h"
+#include "scaling.h"
+#include "pyramid.h"
+
+
+// Levels start on 16 byte boundaries, for the SIMD loads of the next level.
+#define PYRAMID_ALIGN 16
+
+// Rounded average of a 2x2 block, channel by channel. Same result as the
+// SIMD versions below.
+template <int BPP>
+void HalveRow_Scalar(BYTE *aDest, const BYTE *aRow0, const BYTE *aRow1, DWORD aDestWidth)
+{
+	for (DWORD x = 0; x < aDestWidth; x++)
+	{
+		const BYTE *a = aRow0 + x * 2 * BPP;
+		const BYTE *b = aRow1 + x * 2 * BPP;
+		for (int c = 0; c < BPP; c++)
+		{
+			aDest[x * BPP + c] = (BYTE)((a[c] + a[c + BPP] + b[c] + b[c + BPP] + 2) >> 2);
+		}
+	}
+}
+
+#ifdef ESCAPI_SSE2
+// 16 bytes out of 32 bytes of each row. Horizontal pairs are summed by
+// adding the odd bytes to the even ones, as 16 bit values.
+static __forceinline __m128i PairSums8(__m128i aRow0, __m128i aRow1)
+{
+	const __m128i lowBytes = _mm_set1_epi16(0xff);
+	return _mm_add_epi16(
+		_mm_add_epi16(_mm_and_si128(aRow0, lowBytes), _mm_srli_epi16(aRow0, 8)),
+		_mm_add_epi16(_mm_and_si128(aRow1, lowBytes), _mm_srli_epi16(aRow1, 8)));
+}
+
+static void HalveRow1_SSE2(BYTE *aDest, const BYTE *aRow0, const BYTE *aRow1, DWORD aDestWidth)
+{
+	const __m128i two = _mm_set1_epi16(2);
+	DWORD x = 0;
+	for (; x + 16 <= aDestWidth; x += 16)
+	{
+		__m128i lo = PairSums8(
+			_mm_loadu_si128((const __m128i*)(aRow0 + x * 2)),
+			_mm_loadu_si128((const __m128i*)(aRow1 + x * 2)));
+		__m128i hi = PairSums8(
+			_mm_loadu_si128((const __m128i*)(aRow0 + x * 2 + 16)),
+			_mm_loadu_si128((const __m128i*)(aRow1 + x * 2 + 16)));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+		_mm_storeu_si128((__m128i*)(aDest + x), _mm_packus_epi16(lo, hi));
+	}
+	HalveRow_Scalar<1>(aDest + x, aRow0 + x * 2, aRow1 + x * 2, aDestWidth - x);
+}
+
+// Sums of two vertically adjacent pairs of 4 byte pixels, as 16 bit values
+static __forceinline __m128i PixelSums4(__m128i aRow0, __m128i aRow1, int aHigh)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = aHigh ? _mm_unpackhi_epi8(aRow0, zero) : _mm_unpacklo_epi8(aRow0, zero);
+	__m128i b = aHigh ? _mm_unpackhi_epi8(aRow1, zero) : _mm_unpacklo_epi8(aRow1, zero);
+	return _mm_add_epi16(a, b);
+}
+
+static void HalveRow4_SSE2(BYTE *aDest, const BYTE *aRow0, const BYTE *aRow1, DWORD aDestWidth)
+{
+	const __m128i two = _mm_set1_epi16(2);
+	DWORD x = 0;
+	for (; x + 4 <= aDestWidth; x += 4)
+	{
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(aRow0 + x * 8));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(aRow0 + x * 8 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(aRow1 + x * 8));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(aRow1 + x * 8 + 16));
+
+		// Each holds two source pixels; the output pixel is their sum.
+		__m128i s0 = PixelSums4(a0, b0, 0);
+		__m128i s1 = PixelSums4(a0, b0, 1);
+		__m128i s2 = PixelSums4(a1, b1, 0);
+		__m128i s3 = PixelSums4(a1, b1, 1);
+
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+		__m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+		_mm_storeu_si128((__m128i*)(aDest + x * 4), _mm_packus_epi16(lo, hi));
+	}
+	HalveRow_Scalar<4>(aDest + x * 4, aRow0 + x * 8, aRow1 + x * 8, aDestWidth - x);
+}
+#endif
+
+struct PyramidFunction
+{
+	int            mFormat;
+	PYRAMID_ROW_FN mHalve;
+	PYRAMID_ROW_FN mReference;
+};
+
+static const PyramidFunction gPyramidFunctions[] =
+{
+#ifdef ESCAPI_SSE2
+	{ CAPTURE_FORMAT_BGRA, HalveRow4_SSE2, HalveRow_Scalar<4> },
+	{ CAPTURE_FORMAT_RGBA, HalveRow4_SSE2, HalveRow_Scalar<4> },
+	{ CAPTURE_FORMAT_GRAY8, HalveRow1_SSE2, HalveRow_Scalar<1> },
+#else
+	{ CAPTURE_FORMAT_BGRA, HalveRow_Scalar<4>, HalveRow_Scalar<4> },
+	{ CAPTURE_FORMAT_RGBA, HalveRow_Scalar<4>, HalveRow_Scalar<4> },
+	{ CAPTURE_FORMAT_GRAY8, HalveRow_Scalar<1>, HalveRow_Scalar<1> },
+#endif
+	{ CAPTURE_FORMAT_RGB24, HalveRow_Scalar<3>, HalveRow_Scalar<3> }
+};
+
+static const int gPyramidFormats = sizeof(gPyramidFunctions) / sizeof(gPyramidFunctions[0]);
+
+static const PyramidFunction *FindPyramidFunction(int aFormat)
+{
+	for (int i = 0; i < gPyramidFormats; i++)
+	{
+		if (gPyramidFunctions[i].mFormat == aFormat)
+			return &gPyramidFunctions[i];
+	}
+	return 0;
+}
+
+int DescribePyramid(int aFormat, int aWidth, int aHeight, int aStride, int aLevels, struct CapturePyramidInfo *aInfo)
+{
+	if (!FindPyramidFunction(aFormat) || aLevels < 1 || aLevels > CAPTURE_MAX_PYRAMID_LEVELS ||
+		(aWidth >> (aLevels - 1)) < 1 || (aHeight >> (aLevels - 1)) < 1)
+		return 0;
+	int minstride = MinimumStride(aFormat, aWidth);
+	if (aStride == 0)
+		aStride = minstride;
+	if (aStride < minstride)
+		return 0;
+
+	memset(aInfo, 0, sizeof(*aInfo));
+	aInfo->mFormat = aFormat;
+	aInfo->mLevels = aLevels;
+	aInfo->mWidth[0] = aWidth;
+	aInfo->mHeight[0] = aHeight;
+	aInfo->mStride[0] = aStride;
+
+	unsigned long long end = (unsigned long long)aStride * aHeight;
+	for (int i = 1; i < aLevels; i++)
+	{
+		end = (end + PYRAMID_ALIGN - 1) & ~(unsigned long long)(PYRAMID_ALIGN - 1);
+		aInfo->mWidth[i] = aInfo->mWidth[i - 1] / 2;
+		aInfo->mHeight[i] = aInfo->mHeight[i - 1] / 2;
+		aInfo->mStride[i] = MinimumStride(aFormat, aInfo->mWidth[i]);
+		aInfo->mOffset[i] = (int)end;
+		end += (unsigned long long)aInfo->mStride[i] * aInfo->mHeight[i];
+	}
+	if (end > 0x7fffffff)
+		return 0;
+	aInfo->mSize = (int)end;
+	return 1;
+}
+
+PyramidBuilder::PyramidBuilder()
+{
+	mBuffer = 0;
+	mLevels = 0;
+	mRowFn = 0;
+}
+
+int PyramidBuilder::init(BYTE *aBuffer, const CapturePyramidInfo &aInfo)
+{
+	const PyramidFunction *function = FindPyramidFunction(aInfo.mFormat);
+	if (!function)
+		return 0;
+
+	mBuffer = aBuffer;
+	mLevels = aInfo.mLevels;
+	mRowFn = function->mHalve;
+	for (int i = 0; i < mLevels; i++)
+	{
+		mStride[i] = aInfo.mStride[i];
+		mOffset[i] = aInfo.mOffset[i];
+		mWidth[i] = aInfo.mWidth[i];
+		mHeight[i] = aInfo.mHeight[i];
+	}
+	begin();
+	return 1;
+}
+
+void PyramidBuilder::begin()
+{
+	for (int i = 0; i < mLevels; i++)
+		mRowsDone[i] = 0;
+}
+
+void PyramidBuilder::rowsReady(DWORD aRows)
+{
+	if (mLevels == 0)
+		return;
+	mRowsDone[0] = aRows < mHeight[0] ? aRows : mHeight[0];
+
+	// Each level goes as far as the one above allows, so a band trickles
+	// down through all the levels before the next band is converted.
+	for (int i = 1; i < mLevels; i++)
+	{
+		const BYTE *src = mBuffer + mOffset[i - 1];
+		BYTE *dst = mBuffer + mOffset[i];
+		DWORD y = mRowsDone[i];
+		for (; y < mHeight[i] && y * 2 + 2 <= mRowsDone[i - 1]; y++)
+		{
+			mRowFn(dst + mStride[i] * y, src + mStride[i - 1] * (y * 2), src + mStride[i - 1] * (y * 2 + 1), mWidth[i]);
+		}
+		mRowsDone[i] = y;
+	}
+}
+
+int CheckPyramid()
+{
+	const DWORD maxWidth = 53;
+	BYTE src[2][maxWidth * 2 * 4];
+	BYTE best[maxWidth * 4 + 16];
+	BYTE reference[maxWidth * 4 + 16];
+	DWORD seed = 1;
+	int failures = 0;
+
+	for (int r = 0; r < 2; r++)
+	{
+		for (DWORD i = 0; i < sizeof(src[r]); i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			src[r][i] = (BYTE)(seed >> 16);
+		}
+	}
+
+	// Widths that leave every remainder after the SIMD loops
+	static const DWORD widths[] = { 53, 32, 19, 4, 1 };
+	for (int i = 0; i < gPyramidFormats; i++)
+	{
+		for (int w = 0; w < 5; w++)
+		{
+			memset(best, 0xcd, sizeof(best));
+			memset(reference, 0xcd, sizeof(reference));
+			gPyramidFunctions[i].mHalve(best, src[0], src[1], widths[w]);
+			gPyramidFunctions[i].mReference(reference, src[0], src[1], widths[w]);
+			if (memcmp(best, reference, sizeof(best)))
+			{
+				failures++;
+				break;
+			}
+		}
+	}
+	return failures;
+}
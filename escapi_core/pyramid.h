@@ -0,0 +1,51 @@
+#pragma once
+
+// Image pyramids (CapturePyramidInfo): each level is the level above it
+// box filtered 2x2, down to half its width and height (rounded down).
+
+// Filters two rows of a level into one row of the next, aDestWidth
+// pixels wide.
+typedef void(*PYRAMID_ROW_FN)(
+	BYTE*       aDest,
+	const BYTE* aRow0,
+	const BYTE* aRow1,
+	DWORD       aDestWidth
+	);
+
+// Fills in the layout of a pyramid with aLevels levels, level 0 being the
+// image itself at aStride. Returns 0 if the format has no pyramid, or the
+// image is too small for that many levels.
+int DescribePyramid(int aFormat, int aWidth, int aHeight, int aStride, int aLevels, struct CapturePyramidInfo *aInfo);
+
+// Fills in the lower levels of a pyramid as rows of level 0 are written.
+// A conversion that works in bands of rows can call rowsReady after each
+// band, so the rows are filtered while they are still in cache; every
+// row of every level is written once, as soon as its source rows are.
+class PyramidBuilder
+{
+public:
+	PyramidBuilder();
+
+	// Returns 0 if the layout's format has no pyramid.
+	int init(BYTE *aBuffer, const struct CapturePyramidInfo &aInfo);
+
+	// Starts on a new frame
+	void begin();
+
+	// Level 0 is complete down to (not including) row aRows.
+	void rowsReady(DWORD aRows);
+
+private:
+	BYTE           *mBuffer;
+	int            mLevels;
+	PYRAMID_ROW_FN mRowFn;
+	LONG           mStride[CAPTURE_MAX_PYRAMID_LEVELS];
+	DWORD          mOffset[CAPTURE_MAX_PYRAMID_LEVELS];
+	DWORD          mWidth[CAPTURE_MAX_PYRAMID_LEVELS];
+	DWORD          mHeight[CAPTURE_MAX_PYRAMID_LEVELS];
+	DWORD          mRowsDone[CAPTURE_MAX_PYRAMID_LEVELS];
+};
+
+// Runs the SIMD row kernels against their scalar references on a few
+// widths. Returns the number of kernels that don't match.
+int CheckPyramid();
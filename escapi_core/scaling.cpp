@@ -0,0 +1,326 @@
+#include "coretypes.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "conversion.h"
+#include "scaling.h"
+
+
+// Walks through source indices (i * aSrcSize / aDestSize) for consecutive
+// destination indices i, without a division per step.
+struct SampleStep
+{
+	LONG  mIndex;
+	DWORD mRemainder;
+	LONG  mWhole;
+	DWORD mFraction;
+	DWORD mDestSize;
+
+	SampleStep(DWORD aSrcSize, DWORD aDestSize)
+	{
+		mIndex = 0;
+		mRemainder = 0;
+		mWhole = aSrcSize / aDestSize;
+		mFraction = aSrcSize % aDestSize;
+		mDestSize = aDestSize;
+	}
+
+	__forceinline void next()
+	{
+		mIndex += mWhole;
+		mRemainder += mFraction;
+		if (mRemainder >= mDestSize)
+		{
+			mRemainder -= mDestSize;
+			mIndex++;
+		}
+	}
+};
+
+
+// BT.601 limited range, same as the YCbCr to RGB conversion.
+__forceinline BYTE LumaFromBGRA(DWORD aPixel)
+{
+	int r = (aPixel >> 16) & 0xff;
+	int g = (aPixel >> 8) & 0xff;
+	int b = aPixel & 0xff;
+	return (BYTE)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+__forceinline BYTE CbFromBGRA(DWORD aPixel)
+{
+	int r = (aPixel >> 16) & 0xff;
+	int g = (aPixel >> 8) & 0xff;
+	int b = aPixel & 0xff;
+	return (BYTE)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+__forceinline BYTE CrFromBGRA(DWORD aPixel)
+{
+	int r = (aPixel >> 16) & 0xff;
+	int g = (aPixel >> 8) & 0xff;
+	int b = aPixel & 0xff;
+	return (BYTE)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+
+struct StoreRGBA
+{
+	enum { SIZE = 4 };
+	static __forceinline void store(BYTE *aDest, DWORD aPixel)
+	{
+		*(DWORD*)aDest = (aPixel & 0xff00ff00) | ((aPixel & 0xff) << 16) | ((aPixel >> 16) & 0xff);
+	}
+};
+
+struct StoreRGB24
+{
+	enum { SIZE = 3 };
+	static __forceinline void store(BYTE *aDest, DWORD aPixel)
+	{
+		aDest[0] = (BYTE)(aPixel >> 16);
+		aDest[1] = (BYTE)(aPixel >> 8);
+		aDest[2] = (BYTE)aPixel;
+	}
+};
+
+struct StoreGRAY8
+{
+	enum { SIZE = 1 };
+	static __forceinline void store(BYTE *aDest, DWORD aPixel)
+	{
+		*aDest = LumaFromBGRA(aPixel);
+	}
+};
+
+
+template <class STORE>
+void ScaleImage_Packed(
+	BYTE*       aDest,
+	LONG        aDestStride,
+	DWORD       aDestWidth,
+	DWORD       aDestHeight,
+	const BYTE* aSrc,
+	LONG        aSrcStride,
+	DWORD       aSrcWidth,
+	DWORD       aSrcHeight
+	)
+{
+	SampleStep row(aSrcHeight, aDestHeight);
+	for (DWORD y = 0; y < aDestHeight; y++, row.next())
+	{
+		const DWORD *srcPel = (const DWORD*)(aSrc + row.mIndex * aSrcStride);
+		BYTE *destPel = aDest;
+
+		SampleStep col(aSrcWidth, aDestWidth);
+		for (DWORD x = 0; x < aDestWidth; x++, col.next(), destPel += STORE::SIZE)
+		{
+			STORE::store(destPel, srcPel[col.mIndex]);
+		}
+
+		aDest += aDestStride;
+	}
+}
+
+
+// Source and destination are in the same packed format.
+template <int SIZE>
+void ScaleImage_Same(
+	BYTE*       aDest,
+	LONG        aDestStride,
+	DWORD       aDestWidth,
+	DWORD       aDestHeight,
+	const BYTE* aSrc,
+	LONG        aSrcStride,
+	DWORD       aSrcWidth,
+	DWORD       aSrcHeight
+	)
+{
+	SampleStep row(aSrcHeight, aDestHeight);
+	for (DWORD y = 0; y < aDestHeight; y++, row.next())
+	{
+		const BYTE *srcPel = aSrc + row.mIndex * aSrcStride;
+		BYTE *destPel = aDest;
+
+		SampleStep col(aSrcWidth, aDestWidth);
+		for (DWORD x = 0; x < aDestWidth; x++, col.next(), destPel += SIZE)
+		{
+			memcpy(destPel, srcPel + col.mIndex * SIZE, SIZE);
+		}
+
+		aDest += aDestStride;
+	}
+}
+
+
+// Chroma is point sampled from the top left pixel of each 2x2 block.
+template <int INTERLEAVED>
+void ScaleImage_YUV420(
+	BYTE*       aDest,
+	LONG        aDestStride,
+	DWORD       aDestWidth,
+	DWORD       aDestHeight,
+	const BYTE* aSrc,
+	LONG        aSrcStride,
+	DWORD       aSrcWidth,
+	DWORD       aSrcHeight
+	)
+{
+	Planes420 dst(aDest, aDestStride, aDestHeight, INTERLEAVED);
+	BYTE *lineY = dst.mY;
+	BYTE *planeU = dst.mU;
+	BYTE *planeV = dst.mV;
+
+	SampleStep row(aSrcHeight, aDestHeight);
+	for (DWORD y = 0; y < aDestHeight; y++, row.next())
+	{
+		const DWORD *srcPel = (const DWORD*)(aSrc + row.mIndex * aSrcStride);
+
+		SampleStep col(aSrcWidth, aDestWidth);
+		for (DWORD x = 0; x < aDestWidth; x++, col.next())
+		{
+			lineY[x] = LumaFromBGRA(srcPel[col.mIndex]);
+		}
+
+		if ((y & 1) == 0)
+		{
+			SampleStep chromaCol(aSrcWidth, aDestWidth);
+			for (DWORD x = 0; x < aDestWidth; x += 2, chromaCol.next(), chromaCol.next())
+			{
+				DWORD pixel = srcPel[chromaCol.mIndex];
+				planeU[(x / 2) * dst.mStepUV] = CbFromBGRA(pixel);
+				planeV[(x / 2) * dst.mStepUV] = CrFromBGRA(pixel);
+			}
+			planeU += dst.mStrideUV;
+			planeV += dst.mStrideUV;
+		}
+
+		lineY += dst.mStrideY;
+	}
+}
+
+// Source and destination are both I420 or both NV12; each plane is
+// sampled on its own.
+template <int INTERLEAVED>
+void ScaleImage_SameYUV420(
+	BYTE*       aDest,
+	LONG        aDestStride,
+	DWORD       aDestWidth,
+	DWORD       aDestHeight,
+	const BYTE* aSrc,
+	LONG        aSrcStride,
+	DWORD       aSrcWidth,
+	DWORD       aSrcHeight
+	)
+{
+	Planes420 dst(aDest, aDestStride, aDestHeight, INTERLEAVED);
+	Planes420 src((BYTE*)aSrc, aSrcStride, aSrcHeight, INTERLEAVED);
+
+	ScaleImage_Same<1>(dst.mY, dst.mStrideY, aDestWidth, aDestHeight, src.mY, src.mStrideY, aSrcWidth, aSrcHeight);
+
+	if (INTERLEAVED)
+	{
+		ScaleImage_Same<2>(dst.mU, dst.mStrideUV, aDestWidth / 2, aDestHeight / 2, src.mU, src.mStrideUV, aSrcWidth / 2, aSrcHeight / 2);
+	}
+	else
+	{
+		ScaleImage_Same<1>(dst.mU, dst.mStrideUV, aDestWidth / 2, aDestHeight / 2, src.mU, src.mStrideUV, aSrcWidth / 2, aSrcHeight / 2);
+		ScaleImage_Same<1>(dst.mV, dst.mStrideUV, aDestWidth / 2, aDestHeight / 2, src.mV, src.mStrideUV, aSrcWidth / 2, aSrcHeight / 2);
+	}
+}
+
+
+ScaleFunction gScaleFunctions[] =
+{
+	{ CAPTURE_FORMAT_BGRA, CAPTURE_FORMAT_BGRA, ScaleImage_Same<4> },
+	{ CAPTURE_FORMAT_BGRA, CAPTURE_FORMAT_RGBA, ScaleImage_Packed<StoreRGBA> },
+	{ CAPTURE_FORMAT_BGRA, CAPTURE_FORMAT_RGB24, ScaleImage_Packed<StoreRGB24> },
+	{ CAPTURE_FORMAT_BGRA, CAPTURE_FORMAT_GRAY8, ScaleImage_Packed<StoreGRAY8> },
+	{ CAPTURE_FORMAT_BGRA, CAPTURE_FORMAT_I420, ScaleImage_YUV420<0> },
+	{ CAPTURE_FORMAT_BGRA, CAPTURE_FORMAT_NV12, ScaleImage_YUV420<1> },
+	{ CAPTURE_FORMAT_RGBA, CAPTURE_FORMAT_RGBA, ScaleImage_Same<4> },
+	{ CAPTURE_FORMAT_GRAY8, CAPTURE_FORMAT_GRAY8, ScaleImage_Same<1> },
+	{ CAPTURE_FORMAT_I420, CAPTURE_FORMAT_I420, ScaleImage_SameYUV420<0> },
+	{ CAPTURE_FORMAT_NV12, CAPTURE_FORMAT_NV12, ScaleImage_SameYUV420<1> }
+};
+
+const DWORD gScaleFormats = 10;
+
+
+int MinimumStride(int aFormat, int aWidth)
+{
+	switch (aFormat)
+	{
+	case CAPTURE_FORMAT_BGRA:
+	case CAPTURE_FORMAT_RGBA:
+		return aWidth * 4;
+	case CAPTURE_FORMAT_RGB24:
+		return aWidth * 3;
+	case CAPTURE_FORMAT_GRAY8:
+	case CAPTURE_FORMAT_I420:
+	case CAPTURE_FORMAT_NV12:
+		return aWidth;
+	}
+	return 0;
+}
+
+void DescribeFrame(int aFormat, int aWidth, int aHeight, int aStride, struct CaptureFrameInfo *aInfo)
+{
+	memset(aInfo, 0, sizeof(struct CaptureFrameInfo));
+	aInfo->mFormat = aFormat;
+	aInfo->mWidth = aWidth;
+	aInfo->mHeight = aHeight;
+	aInfo->mPlanes = 1;
+	aInfo->mPlaneStride[0] = aStride;
+
+	switch (aFormat)
+	{
+	case CAPTURE_FORMAT_I420:
+		aInfo->mPlanes = 3;
+		aInfo->mPlaneOffset[1] = aStride * aHeight;
+		aInfo->mPlaneOffset[2] = aStride * aHeight + (aStride / 2) * (aHeight / 2);
+		aInfo->mPlaneStride[1] = aStride / 2;
+		aInfo->mPlaneStride[2] = aStride / 2;
+		break;
+	case CAPTURE_FORMAT_NV12:
+		aInfo->mPlanes = 2;
+		aInfo->mPlaneOffset[1] = aStride * aHeight;
+		aInfo->mPlaneStride[1] = aStride;
+		break;
+	}
+}
+
+DWORD PackedFrameSize(int aFormat, int aWidth, int aHeight)
+{
+	DWORD size = MinimumStride(aFormat, aWidth) * aHeight;
+	if (aFormat == CAPTURE_FORMAT_I420 || aFormat == CAPTURE_FORMAT_NV12)
+		size += size / 2;
+	return size;
+}
+
+void PackFrame(BYTE *aDst, const BYTE *aSrc, int aFormat, int aWidth, int aHeight, int aStride, int aFlip)
+{
+	struct CaptureFrameInfo src, dst;
+	DescribeFrame(aFormat, aWidth, aHeight, aStride, &src);
+	DescribeFrame(aFormat, aWidth, aHeight, MinimumStride(aFormat, aWidth), &dst);
+
+	for (int i = 0; i < src.mPlanes; i++)
+	{
+		int rows = i ? aHeight / 2 : aHeight;
+		const BYTE *s = aSrc + src.mPlaneOffset[i];
+		LONG stride = src.mPlaneStride[i];
+		if (aFlip)
+		{
+			s += stride * (rows - 1);
+			stride = -stride;
+		}
+		BYTE *d = aDst + dst.mPlaneOffset[i];
+		for (int y = 0; y < rows; y++)
+		{
+			memcpy(d, s, dst.mPlaneStride[i]);
+			d += dst.mPlaneStride[i];
+			s += stride;
+		}
+	}
+}
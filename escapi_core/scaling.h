@@ -0,0 +1,41 @@
+#pragma once
+
+// Point samples an image in the conversion output format into the
+// destination, storing the pixels in the destination's pixel format.
+// For planar formats, the chroma plane(s) follow the Y plane (see
+// SimpleCapParamsEx).
+typedef void(*IMAGE_SCALE_FN)(
+	BYTE*       aDest,
+	LONG        aDestStride,
+	DWORD       aDestWidth,
+	DWORD       aDestHeight,
+	const BYTE* aSrc,
+	LONG        aSrcStride,
+	DWORD       aSrcWidth,
+	DWORD       aSrcHeight
+	);
+
+struct ScaleFunction
+{
+	int            mSrcFormat;
+	int            mFormat;
+	IMAGE_SCALE_FN mScale;
+};
+
+extern ScaleFunction gScaleFunctions[];
+extern const DWORD gScaleFormats;
+
+// Minimum row pitch in bytes (of the Y plane for planar formats) for an
+// image of the given width, or 0 if the format is unknown.
+int MinimumStride(int aFormat, int aWidth);
+
+// Fills in the plane layout of a target buffer.
+void DescribeFrame(int aFormat, int aWidth, int aHeight, int aStride, struct CaptureFrameInfo *aInfo);
+
+// Size of an image with its rows tightly packed, as files and shared
+// memory store them.
+DWORD PackedFrameSize(int aFormat, int aWidth, int aHeight);
+
+// Copies a target buffer into a tightly packed image, top row first;
+// aFlip reads a bottom-up target.
+void PackFrame(BYTE *aDst, const BYTE *aSrc, int aFormat, int aWidth, int aHeight, int aStride, int aFlip);
@@ -0,0 +1,22 @@
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#include <string.h>
+#define ESCAPI_SSE2
+
+// 4 bytes at any address to or from the low lane. Going through an int
+// pointer instead would be a misaligned access.
+static __forceinline __m128i LoadLow32(const void *aSrc)
+{
+	int value;
+	memcpy(&value, aSrc, 4);
+	return _mm_cvtsi32_si128(value);
+}
+
+static __forceinline void StoreLow32(void *aDest, __m128i aValue)
+{
+	int value = _mm_cvtsi128_si32(aValue);
+	memcpy(aDest, &value, 4);
+}
+#endif
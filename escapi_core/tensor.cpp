@@ -0,0 +1,309 @@
+#include "coretypes.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "simd.h"
+#include "conversion.h"
+#include "jobpool.h"
+#include "tensor.h"
+
+
+WORD FloatToHalf(float aValue)
+{
+	DWORD bits;
+	memcpy(&bits, &aValue, sizeof(bits));
+	DWORD sign = (bits >> 16) & 0x8000;
+	DWORD magnitude = bits & 0x7fffffff;
+
+	if (magnitude >= 0x7f800000)
+	{
+		// Infinity, or NaN (kept quiet)
+		return (WORD)(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+	}
+	if (magnitude >= 0x477ff000)
+	{
+		// 65520 and up round past the largest float16
+		return (WORD)(sign | 0x7c00);
+	}
+	if (magnitude < 0x38800000)
+	{
+		// Below the smallest normal float16; up to 2^-25 rounds to 0
+		if (magnitude <= 0x33000000)
+			return (WORD)sign;
+		DWORD exponent = magnitude >> 23;
+		DWORD mantissa = (magnitude & 0x7fffff) | 0x800000;
+		int shift = 126 - exponent;
+		DWORD half = mantissa >> shift;
+		DWORD rest = mantissa & ((1u << shift) - 1);
+		DWORD halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return (WORD)(sign | half);
+	}
+
+	// Rebias the exponent; a carry out of the mantissa goes into it.
+	DWORD half = (magnitude - 0x38000000) >> 13;
+	DWORD rest = magnitude & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;
+	return (WORD)(sign | half);
+}
+
+TensorWriter::TensorWriter()
+{
+	mTarget = 0;
+	mWidth = 0;
+	mHeight = 0;
+	mType = 0;
+	mElementSize = 0;
+	mLetterbox = 0;
+	mSrcWidth = 0;
+	mSrcHeight = 0;
+	mLeft = 0;
+	mTop = 0;
+	mImageWidth = 0;
+	mImageHeight = 0;
+	mColumns = 0;
+	mColumnsSize = 0;
+	mSrc = 0;
+	mSrcStride = 0;
+	mConvertFn = 0;
+	mRowsPerJob = 0;
+	mScratch = 0;
+	mScratchSize = 0;
+}
+
+TensorWriter::~TensorWriter()
+{
+	delete[] mColumns;
+	delete[] mScratch;
+}
+
+int TensorWriter::ElementSize(int aType)
+{
+	switch (aType)
+	{
+	case CAPTURE_TENSOR_FLOAT32:
+		return 4;
+	case CAPTURE_TENSOR_FLOAT16:
+		return 2;
+	}
+	return 0;
+}
+
+int TensorWriter::init(const CaptureTensorParams &aParams)
+{
+	mElementSize = ElementSize(aParams.mType);
+	if (mElementSize == 0)
+		return 0;
+
+	mTarget = (BYTE *)aParams.mTargetBuf;
+	mWidth = aParams.mWidth;
+	mHeight = aParams.mHeight;
+	mType = aParams.mType;
+	mLetterbox = (aParams.mFlags & CAPTURE_TENSOR_FLAG_LETTERBOX) != 0;
+
+	// Bit positions of red, green and blue in a BGRA pixel
+	static const int rgb[3] = { 16, 8, 0 };
+	int bgr = (aParams.mFlags & CAPTURE_TENSOR_FLAG_BGR) != 0;
+	for (int c = 0; c < 3; c++)
+	{
+		if (!(aParams.mStd[c] != 0))
+			return 0;
+		mShift[c] = rgb[bgr ? 2 - c : c];
+		mScale[c] = 1.0f / (255.0f * aParams.mStd[c]);
+		mOffset[c] = -aParams.mMean[c] / aParams.mStd[c];
+		mPad[c] = (aParams.mPad[c] - aParams.mMean[c]) / aParams.mStd[c];
+		mHalfPad[c] = FloatToHalf(mPad[c]);
+		for (int i = 0; i < 256; i++)
+			mHalf[c][i] = FloatToHalf(i * mScale[c] + mOffset[c]);
+	}
+	mSrcWidth = 0;
+	mSrcHeight = 0;
+	return 1;
+}
+
+void TensorWriter::fill(DWORD aPlane, DWORD aOffset, DWORD aCount)
+{
+	BYTE *dst = mTarget + ((size_t)aPlane * mWidth * mHeight + aOffset) * mElementSize;
+	if (mType == CAPTURE_TENSOR_FLOAT16)
+	{
+		WORD *half = (WORD *)dst;
+		for (DWORD i = 0; i < aCount; i++)
+			half[i] = mHalfPad[aPlane];
+	}
+	else
+	{
+		float *value = (float *)dst;
+		for (DWORD i = 0; i < aCount; i++)
+			value[i] = mPad[aPlane];
+	}
+}
+
+void TensorWriter::begin(DWORD aSrcWidth, DWORD aSrcHeight)
+{
+	if (aSrcWidth != mSrcWidth || aSrcHeight != mSrcHeight)
+	{
+		mSrcWidth = aSrcWidth;
+		mSrcHeight = aSrcHeight;
+		mLeft = 0;
+		mTop = 0;
+		mImageWidth = mWidth;
+		mImageHeight = mHeight;
+
+		// The largest size of the source's shape that fits, centered
+		if (mLetterbox)
+		{
+			unsigned long long wide = (unsigned long long)mWidth * aSrcHeight;
+			unsigned long long tall = (unsigned long long)mHeight * aSrcWidth;
+			if (wide < tall)
+				mImageHeight = (DWORD)((wide + aSrcWidth / 2) / aSrcWidth);
+			else if (tall < wide)
+				mImageWidth = (DWORD)((tall + aSrcHeight / 2) / aSrcHeight);
+			if (mImageWidth == 0)
+				mImageWidth = 1;
+			if (mImageHeight == 0)
+				mImageHeight = 1;
+			mLeft = (mWidth - mImageWidth) / 2;
+			mTop = (mHeight - mImageHeight) / 2;
+		}
+
+		if (mColumnsSize < mImageWidth)
+		{
+			delete[] mColumns;
+			mColumnsSize = mImageWidth;
+			mColumns = new DWORD[mColumnsSize];
+		}
+		// Same columns as the scaling functions sample
+		for (DWORD x = 0; x < mImageWidth; x++)
+			mColumns[x] = (DWORD)((unsigned long long)x * aSrcWidth / mImageWidth);
+	}
+
+	DWORD below = mTop + mImageHeight;
+	for (int c = 0; c < 3; c++)
+	{
+		fill(c, 0, mWidth * mTop);
+		fill(c, mWidth * below, mWidth * (mHeight - below));
+	}
+}
+
+void TensorWriter::writeImage(const BYTE *aSrc, LONG aSrcStride)
+{
+	writeVideo(aSrc, aSrcStride, 0);
+}
+
+void TensorWriter::writeVideo(const BYTE *aSrc, LONG aSrcStride, IMAGE_TRANSFORM_FN aConvertFn)
+{
+	JobPool &pool = SharedJobPool();
+	int jobs = pool.concurrency();
+	mRowsPerJob = (mImageHeight + jobs - 1) / jobs;
+	jobs = (mImageHeight + mRowsPerJob - 1) / mRowsPerJob;
+
+	if (aConvertFn && mScratchSize < mSrcWidth * 4 * jobs)
+	{
+		delete[] mScratch;
+		mScratchSize = mSrcWidth * 4 * jobs;
+		mScratch = new BYTE[mScratchSize];
+	}
+
+	mSrc = aSrc;
+	mSrcStride = aSrcStride;
+	mConvertFn = aConvertFn;
+	pool.run(RowsJob, this, jobs);
+}
+
+void TensorWriter::RowsJob(void *aData, int aIndex)
+{
+	((TensorWriter *)aData)->writeRows(aIndex);
+}
+
+void TensorWriter::writeRows(int aJob)
+{
+	DWORD first = aJob * mRowsPerJob;
+	DWORD last = first + mRowsPerJob;
+	if (last > mImageHeight)
+		last = mImageHeight;
+
+	BYTE *scratch = mScratch + mSrcWidth * 4 * aJob;
+	DWORD converted = ~0u;
+	for (DWORD y = first; y < last; y++)
+	{
+		// Same rows as the scaling functions sample
+		DWORD srcY = (DWORD)((unsigned long long)y * mSrcHeight / mImageHeight);
+		const BYTE *row = mSrc + mSrcStride * (LONG)srcY;
+		if (mConvertFn)
+		{
+			if (srcY != converted)
+			{
+				mConvertFn(scratch, 0, row, mSrcStride, mSrcWidth, 1);
+				converted = srcY;
+			}
+			row = scratch;
+		}
+		writeRow(y, (const DWORD *)row);
+	}
+}
+
+void TensorWriter::writeRow(DWORD aRow, const DWORD *aSrc)
+{
+	DWORD y = mTop + aRow;
+	DWORD right = mLeft + mImageWidth;
+	for (int c = 0; c < 3; c++)
+	{
+		fill(c, mWidth * y, mLeft);
+		fill(c, mWidth * y + right, mWidth - right);
+	}
+
+	size_t start = (size_t)mWidth * y + mLeft;
+	size_t planeSize = (size_t)mWidth * mHeight;
+	if (mType == CAPTURE_TENSOR_FLOAT16)
+	{
+		// Every byte value has its float16 looked up already.
+		WORD *half0 = (WORD *)mTarget + start;
+		WORD *half1 = half0 + planeSize;
+		WORD *half2 = half1 + planeSize;
+		int shift0 = mShift[0], shift1 = mShift[1], shift2 = mShift[2];
+		for (DWORD x = 0; x < mImageWidth; x++)
+		{
+			DWORD pixel = aSrc[mColumns[x]];
+			half0[x] = mHalf[0][(pixel >> shift0) & 0xff];
+			half1[x] = mHalf[1][(pixel >> shift1) & 0xff];
+			half2[x] = mHalf[2][(pixel >> shift2) & 0xff];
+		}
+		return;
+	}
+
+	float *plane0 = (float *)mTarget + start;
+	float *plane1 = plane0 + planeSize;
+	float *plane2 = plane1 + planeSize;
+	DWORD x = 0;
+#ifdef ESCAPI_SSE2
+	// Four pixels at a time, each channel to its plane
+	const __m128i low = _mm_set1_epi32(0xff);
+	const __m128i shift0 = _mm_cvtsi32_si128(mShift[0]);
+	const __m128i shift1 = _mm_cvtsi32_si128(mShift[1]);
+	const __m128i shift2 = _mm_cvtsi32_si128(mShift[2]);
+	const __m128 scale0 = _mm_set1_ps(mScale[0]), offset0 = _mm_set1_ps(mOffset[0]);
+	const __m128 scale1 = _mm_set1_ps(mScale[1]), offset1 = _mm_set1_ps(mOffset[1]);
+	const __m128 scale2 = _mm_set1_ps(mScale[2]), offset2 = _mm_set1_ps(mOffset[2]);
+	for (; x + 4 <= mImageWidth; x += 4)
+	{
+		__m128i pixels = _mm_setr_epi32(
+			aSrc[mColumns[x]], aSrc[mColumns[x + 1]], aSrc[mColumns[x + 2]], aSrc[mColumns[x + 3]]);
+		__m128 v0 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(pixels, shift0), low));
+		__m128 v1 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(pixels, shift1), low));
+		__m128 v2 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(pixels, shift2), low));
+		_mm_storeu_ps(plane0 + x, _mm_add_ps(_mm_mul_ps(v0, scale0), offset0));
+		_mm_storeu_ps(plane1 + x, _mm_add_ps(_mm_mul_ps(v1, scale1), offset1));
+		_mm_storeu_ps(plane2 + x, _mm_add_ps(_mm_mul_ps(v2, scale2), offset2));
+	}
+#endif
+	for (; x < mImageWidth; x++)
+	{
+		DWORD pixel = aSrc[mColumns[x]];
+		plane0[x] = ((pixel >> mShift[0]) & 0xff) * mScale[0] + mOffset[0];
+		plane1[x] = ((pixel >> mShift[1]) & 0xff) * mScale[1] + mOffset[1];
+		plane2[x] = ((pixel >> mShift[2]) & 0xff) * mScale[2] + mOffset[2];
+	}
+}
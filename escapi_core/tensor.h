@@ -0,0 +1,67 @@
+#pragma once
+
+// Fills a planar CHW tensor (CaptureTensorParams) from BGRA rows: each row
+// is point sampled, split into channel planes and normalized in one go,
+// and the letterbox bars are filled in around the image.
+class TensorWriter
+{
+public:
+	TensorWriter();
+	~TensorWriter();
+
+	// Returns 0 if the type or the normalization can't be used.
+	int init(const struct CaptureTensorParams &aParams);
+
+	// Starts on a frame of the given source size, and fills in the bars.
+	void begin(DWORD aSrcWidth, DWORD aSrcHeight);
+
+	// Fills in the image from a BGRA image of the source size.
+	void writeImage(const BYTE *aSrc, LONG aSrcStride);
+
+	// Same from packed video of the source size, converting each row the
+	// image samples to BGRA with aConvertFn just before it is used.
+	void writeVideo(const BYTE *aSrc, LONG aSrcStride, IMAGE_TRANSFORM_FN aConvertFn);
+
+	// Element bytes of a CAPTURE_TENSOR_TYPES, or 0 if unknown
+	static int ElementSize(int aType);
+
+private:
+	static void RowsJob(void *aData, int aIndex);
+	void writeRows(int aJob);
+	void writeRow(DWORD aRow, const DWORD *aSrc);
+	void fill(DWORD aPlane, DWORD aOffset, DWORD aCount);
+
+	BYTE                *mTarget;
+	DWORD               mWidth;
+	DWORD               mHeight;
+	int                 mType;
+	int                 mElementSize;
+	int                 mShift[3];        // Of each plane's channel in a BGRA pixel
+	float               mScale[3];        // Channel byte to plane value is
+	float               mOffset[3];       // byte * mScale + mOffset
+	float               mPad[3];          // Plane values of the bars
+	WORD                mHalf[3][256];    // Plane values of each byte, for float16
+	WORD                mHalfPad[3];
+	int                 mLetterbox;
+
+	// Where the image goes, and which source column each of its columns samples
+	DWORD               mSrcWidth;
+	DWORD               mSrcHeight;
+	DWORD               mLeft;
+	DWORD               mTop;
+	DWORD               mImageWidth;
+	DWORD               mImageHeight;
+	DWORD               *mColumns;
+	DWORD               mColumnsSize;
+
+	// The source being written, and a converted row for each job
+	const BYTE          *mSrc;
+	LONG                mSrcStride;
+	IMAGE_TRANSFORM_FN  mConvertFn;
+	DWORD               mRowsPerJob;
+	BYTE                *mScratch;
+	DWORD               mScratchSize;
+};
+
+// Nearest float16 bit pattern of a float, rounding to even.
+WORD FloatToHalf(float aValue);
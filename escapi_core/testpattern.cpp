@@ -0,0 +1,305 @@
+#include "coretypes.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "conversion.h"
+#include "scaling.h"
+#include "ycbcr.h"
+#include "mjpeg.h"
+#include "testpattern.h"
+
+
+// 75% bars: white, yellow, cyan, green, magenta, red, blue, black
+static const DWORD gBarColours[8] =
+{
+	0xffbfbfbf, 0xffbfbf00, 0xff00bfbf, 0xff00bf00, 0xffbf00bf, 0xffbf0000, 0xff0000bf, 0xff000000
+};
+
+// RGB to YCbCr, BT.601 limited range as cameras deliver it
+static __forceinline BYTE LumaLimited(int aRed, int aGreen, int aBlue)
+{
+	return (BYTE)(((66 * aRed + 129 * aGreen + 25 * aBlue + 128) >> 8) + 16);
+}
+
+static __forceinline BYTE CbLimited(int aRed, int aGreen, int aBlue)
+{
+	return (BYTE)(((-38 * aRed - 74 * aGreen + 112 * aBlue + 128) >> 8) + 128);
+}
+
+static __forceinline BYTE CrLimited(int aRed, int aGreen, int aBlue)
+{
+	return (BYTE)(((112 * aRed - 94 * aGreen - 18 * aBlue + 128) >> 8) + 128);
+}
+
+// ...and full range, for JPEG
+static __forceinline BYTE LumaFull(int aRed, int aGreen, int aBlue)
+{
+	return (BYTE)((77 * aRed + 150 * aGreen + 29 * aBlue + 128) >> 8);
+}
+
+static __forceinline BYTE CbFull(int aRed, int aGreen, int aBlue)
+{
+	return ClipByte(((-43 * aRed - 85 * aGreen + 128 * aBlue + 128) >> 8) + 128);
+}
+
+static __forceinline BYTE CrFull(int aRed, int aGreen, int aBlue)
+{
+	return ClipByte(((128 * aRed - 107 * aGreen - 21 * aBlue + 128) >> 8) + 128);
+}
+
+static __forceinline int Red(DWORD aPixel)
+{
+	return (aPixel >> 16) & 0xff;
+}
+
+static __forceinline int Green(DWORD aPixel)
+{
+	return (aPixel >> 8) & 0xff;
+}
+
+static __forceinline int Blue(DWORD aPixel)
+{
+	return aPixel & 0xff;
+}
+
+
+TestPattern::TestPattern()
+{
+	mSubtype = 0;
+	mWidth = 0;
+	mHeight = 0;
+	mStride = 0;
+	mStripHeight = 0;
+	mFrame = 0;
+	mFrameSize = 0;
+	mBars = 0;
+	mRows = 0;
+	mPlanes = 0;
+	mEncoder = 0;
+}
+
+TestPattern::~TestPattern()
+{
+	delete[] mFrame;
+	delete[] mBars;
+	delete[] mRows;
+	delete[] mPlanes;
+	delete mEncoder;
+}
+
+int TestPattern::init(DWORD aSubtype, DWORD aWidth, DWORD aHeight)
+{
+	if (aWidth < 2 || aHeight < 2 || ((aWidth | aHeight) & 1) || aWidth > 16384 || aHeight > 16384)
+		return 0;
+
+	switch (aSubtype)
+	{
+	case SUBTYPE_RGB32:
+		mStride = aWidth * 4;
+		mFrameSize = mStride * aHeight;
+		break;
+	case SUBTYPE_RGB24:
+		// DWORD aligned, like bitmaps
+		mStride = (aWidth * 3 + 3) & ~3;
+		mFrameSize = mStride * aHeight;
+		break;
+	case SUBTYPE_YUY2:
+		mStride = aWidth * 2;
+		mFrameSize = mStride * aHeight;
+		break;
+	case SUBTYPE_NV12:
+		mStride = aWidth;
+		mFrameSize = mStride * aHeight * 3 / 2;
+		break;
+	case SUBTYPE_MJPG:
+		mStride = 0;
+		mFrameSize = aWidth * aHeight * 2 + 4096;
+		break;
+	default:
+		return 0;
+	}
+
+	delete[] mFrame;
+	delete[] mBars;
+	delete[] mRows;
+	delete[] mPlanes;
+	delete mEncoder;
+	mPlanes = 0;
+	mEncoder = 0;
+
+	mSubtype = aSubtype;
+	mWidth = aWidth;
+	mHeight = aHeight;
+	mStripHeight = aHeight / 16 ? aHeight / 16 : 1;
+	mFrame = new BYTE[mFrameSize];
+	mBars = new DWORD[aWidth * 2];
+	mRows = new DWORD[aWidth * 2];
+
+	for (DWORD x = 0; x < aWidth; x++)
+	{
+		mBars[x] = mBars[x + aWidth] = gBarColours[x * 8 / aWidth];
+	}
+
+	if (aSubtype == SUBTYPE_MJPG)
+	{
+		mPlanes = new BYTE[aWidth * aHeight * 3 / 2];
+		mEncoder = new MjpegEncoder(85);
+	}
+	return 1;
+}
+
+LONG TestPattern::stride() const
+{
+	return mStride;
+}
+
+void TestPattern::renderRow(DWORD aY, DWORD aFrame, DWORD *aRow)
+{
+	if (aY < mStripHeight)
+	{
+		for (DWORD i = 0; i < 32; i++)
+		{
+			DWORD colour = ((aFrame >> (31 - i)) & 1) ? 0xffffffff : 0xff000000;
+			for (DWORD x = i * mWidth / 32; x < (i + 1) * mWidth / 32; x++)
+			{
+				aRow[x] = colour;
+			}
+		}
+		return;
+	}
+
+	DWORD offset = (aFrame % mWidth) * 4 % mWidth;
+	memcpy(aRow, mBars + offset, mWidth * sizeof(DWORD));
+
+	DWORD size = mHeight / 4;
+	DWORD rangeX = mWidth - size;
+	DWORD rangeY = mHeight - mStripHeight - size;
+	DWORD x0 = rangeX ? (aFrame % (2 * rangeX)) * 3 % (2 * rangeX) : 0;
+	DWORD y0 = rangeY ? (aFrame % (2 * rangeY)) * 2 % (2 * rangeY) : 0;
+	if (x0 > rangeX)
+		x0 = 2 * rangeX - x0;
+	if (y0 > rangeY)
+		y0 = 2 * rangeY - y0;
+	y0 += mStripHeight;
+
+	if (aY >= y0 && aY < y0 + size)
+	{
+		for (DWORD x = x0; x < x0 + size; x++)
+		{
+			aRow[x] = 0xffffffff;
+		}
+	}
+}
+
+const BYTE *TestPattern::render(DWORD aFrame, DWORD &aSize)
+{
+	aSize = 0;
+	if (!mFrame)
+		return 0;
+
+	DWORD *top = mRows;
+	DWORD *bottom = mRows + mWidth;
+
+	for (DWORD y = 0; y < mHeight; y += 2)
+	{
+		renderRow(y, aFrame, top);
+		renderRow(y + 1, aFrame, bottom);
+
+		BYTE *row = mFrame + mStride * y;
+		switch (mSubtype)
+		{
+		case SUBTYPE_RGB32:
+			memcpy(row, top, mWidth * 4);
+			memcpy(row + mStride, bottom, mWidth * 4);
+			break;
+
+		case SUBTYPE_RGB24:
+			for (DWORD x = 0; x < mWidth; x++)
+			{
+				row[x * 3 + 0] = (BYTE)Blue(top[x]);
+				row[x * 3 + 1] = (BYTE)Green(top[x]);
+				row[x * 3 + 2] = (BYTE)Red(top[x]);
+				row[mStride + x * 3 + 0] = (BYTE)Blue(bottom[x]);
+				row[mStride + x * 3 + 1] = (BYTE)Green(bottom[x]);
+				row[mStride + x * 3 + 2] = (BYTE)Red(bottom[x]);
+			}
+			break;
+
+		case SUBTYPE_YUY2:
+			for (int r = 0; r < 2; r++)
+			{
+				const DWORD *src = r ? bottom : top;
+				BYTE *dest = row + mStride * r;
+				for (DWORD x = 0; x < mWidth; x += 2)
+				{
+					int red = Red(src[x]) + Red(src[x + 1]);
+					int green = Green(src[x]) + Green(src[x + 1]);
+					int blue = Blue(src[x]) + Blue(src[x + 1]);
+					dest[x * 2 + 0] = LumaLimited(Red(src[x]), Green(src[x]), Blue(src[x]));
+					dest[x * 2 + 1] = CbLimited(red / 2, green / 2, blue / 2);
+					dest[x * 2 + 2] = LumaLimited(Red(src[x + 1]), Green(src[x + 1]), Blue(src[x + 1]));
+					dest[x * 2 + 3] = CrLimited(red / 2, green / 2, blue / 2);
+				}
+			}
+			break;
+
+		case SUBTYPE_NV12:
+		case SUBTYPE_MJPG:
+		{
+			int full = mSubtype == SUBTYPE_MJPG;
+			BYTE *luma = full ? mPlanes + mWidth * y : row;
+			BYTE *cb = full ? mPlanes + mWidth * mHeight + (mWidth / 2) * (y / 2) : mFrame + mStride * mHeight + mStride * (y / 2);
+			BYTE *cr = full ? cb + (mWidth / 2) * (mHeight / 2) : cb + 1;
+			int step = full ? 1 : 2;
+
+			for (DWORD x = 0; x < mWidth; x++)
+			{
+				luma[x] = full ? LumaFull(Red(top[x]), Green(top[x]), Blue(top[x])) :
+					LumaLimited(Red(top[x]), Green(top[x]), Blue(top[x]));
+				luma[x + mWidth] = full ? LumaFull(Red(bottom[x]), Green(bottom[x]), Blue(bottom[x])) :
+					LumaLimited(Red(bottom[x]), Green(bottom[x]), Blue(bottom[x]));
+			}
+			for (DWORD x = 0; x < mWidth; x += 2)
+			{
+				int red = (Red(top[x]) + Red(top[x + 1]) + Red(bottom[x]) + Red(bottom[x + 1])) / 4;
+				int green = (Green(top[x]) + Green(top[x + 1]) + Green(bottom[x]) + Green(bottom[x + 1])) / 4;
+				int blue = (Blue(top[x]) + Blue(top[x + 1]) + Blue(bottom[x]) + Blue(bottom[x + 1])) / 4;
+				cb[x / 2 * step] = full ? CbFull(red, green, blue) : CbLimited(red, green, blue);
+				cr[x / 2 * step] = full ? CrFull(red, green, blue) : CrLimited(red, green, blue);
+			}
+			break;
+		}
+		}
+	}
+
+	if (mSubtype == SUBTYPE_MJPG)
+	{
+		BYTE *cb = mPlanes + mWidth * mHeight;
+		aSize = mEncoder->encode(mFrame, mFrameSize, mPlanes, mWidth, cb, cb + (mWidth / 2) * (mHeight / 2), mWidth / 2, mWidth, mHeight);
+	}
+	else
+	{
+		aSize = mFrameSize;
+	}
+	return aSize ? mFrame : 0;
+}
+
+DWORD TestPattern::ReadFrameNumber(const BYTE *aImage, LONG aStride, DWORD aWidth, DWORD aHeight, int aFormat)
+{
+	int bytes = MinimumStride(aFormat, 1);
+	if (!aImage || !bytes || aWidth < 64 || aHeight < 2)
+		return 0;
+
+	// Green, or luma, from the middle of each block
+	int channel = bytes > 1 ? 1 : 0;
+	DWORD strip = aHeight / 16 ? aHeight / 16 : 1;
+	const BYTE *row = aImage + aStride * (LONG)(strip / 2);
+	DWORD number = 0;
+	for (DWORD i = 0; i < 32; i++)
+	{
+		DWORD x = (2 * i + 1) * aWidth / 64;
+		number = (number << 1) | (row[x * bytes + channel] > 128);
+	}
+	return number;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+class MjpegEncoder;
+
+// Moving test frames in the subtypes cameras deliver, for running the
+// capture pipeline without a camera. The frame shows scrolling 75% colour
+// bars and a bouncing white square, with the frame number drawn across
+// the top as 32 black or white blocks, most significant bit first, so
+// that dropped or repeated frames can be spotted in the output.
+class TestPattern
+{
+public:
+	TestPattern();
+	~TestPattern();
+
+	// Sets up frames of aSubtype (SUBTYPE_YUY2, _NV12, _RGB24, _RGB32 or
+	// _MJPG). Width and height must be even. Returns 0 if unsupported.
+	int init(DWORD aSubtype, DWORD aWidth, DWORD aHeight);
+
+	// Renders frame number aFrame. The frame stays valid until the next
+	// call; aSize receives its size in bytes, which is 0 on failure.
+	const BYTE *render(DWORD aFrame, DWORD &aSize);
+
+	// Top-down row pitch of the uncompressed subtypes (of the Y plane for
+	// NV12, whose UV plane follows it)
+	LONG stride() const;
+
+	// Reads the frame number back from a captured image in one of
+	// CAPTURE_FORMATS (the Y plane for the planar ones).
+	static DWORD ReadFrameNumber(const BYTE *aImage, LONG aStride, DWORD aWidth, DWORD aHeight, int aFormat);
+
+private:
+	void renderRow(DWORD aY, DWORD aFrame, DWORD *aRow);
+
+	DWORD        mSubtype;
+	DWORD        mWidth;
+	DWORD        mHeight;
+	LONG         mStride;
+	DWORD        mStripHeight;  // Rows taken by the frame number
+	BYTE         *mFrame;
+	DWORD        mFrameSize;
+	DWORD        *mBars;        // Two periods of the colour bars, for scrolling
+	DWORD        *mRows;        // Two rows of 0xXXRRGGBB pixels
+	BYTE         *mPlanes;      // Full range 4:2:0 for the encoder
+	MjpegEncoder *mEncoder;
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "simd.h"
+
+// YCbCr to RGB coefficients in 8 bit fixed point:
+//   R = (Y * (y - Y_OFFSET) + R_CR * (cr - 128) + 128) >> 8
+//   G = (Y * (y - Y_OFFSET) + G_CB * (cb - 128) + G_CR * (cr - 128) + 128) >> 8
+//   B = (Y * (y - Y_OFFSET) + B_CB * (cb - 128) + 128) >> 8
+
+// Limited range scales luma by 255 / 219 and chroma by 255 / 224.
+
+// BT.601, limited range (what most cameras deliver)
+struct YCbCrBT601
+{
+	enum { Y_OFFSET = 16, Y = 298, R_CR = 409, G_CB = -100, G_CR = -208, B_CB = 516 };
+};
+
+// BT.601, full range (JFIF)
+struct YCbCrBT601Full
+{
+	enum { Y_OFFSET = 0, Y = 256, R_CR = 359, G_CB = -88, G_CR = -183, B_CB = 454 };
+};
+
+// BT.709, limited range (HD video)
+struct YCbCrBT709
+{
+	enum { Y_OFFSET = 16, Y = 298, R_CR = 459, G_CB = -55, G_CR = -136, B_CB = 541 };
+};
+
+// BT.709, full range
+struct YCbCrBT709Full
+{
+	enum { Y_OFFSET = 0, Y = 256, R_CR = 403, G_CB = -48, G_CR = -120, B_CB = 475 };
+};
+
+__forceinline BYTE ClipByte(int aValue)
+{
+	return (BYTE)(aValue < 0 ? 0 : (aValue > 255 ? 255 : aValue));
+}
+
+// Stores one 32 bit pixel with opaque alpha.
+template <class COEF, class ORDER>
+__forceinline void StoreYCbCr(BYTE *aDest, int aY, int aCb, int aCr)
+{
+	int c = (aY - COEF::Y_OFFSET) * COEF::Y + 128;
+	int d = aCb - 128;
+	int e = aCr - 128;
+
+	aDest[ORDER::R] = ClipByte((c + COEF::R_CR * e) >> 8);
+	aDest[ORDER::G] = ClipByte((c + COEF::G_CB * d + COEF::G_CR * e) >> 8);
+	aDest[ORDER::B] = ClipByte((c + COEF::B_CB * d) >> 8);
+	aDest[ORDER::A] = 0xff;
+}
+
+#ifdef ESCAPI_SSE2
+// Stores 8 pixels from 16 bit R, G and B values as 32 bit pixels with
+// opaque alpha. The saturating packs do the clipping.
+template <class ORDER>
+__forceinline void StorePixels_SSE2(BYTE *aDest, __m128i aRed, __m128i aGreen, __m128i aBlue)
+{
+	const __m128i alpha = _mm_set1_epi8((char)0xff);
+
+	__m128i red = _mm_packus_epi16(aRed, aRed);
+	__m128i green = _mm_packus_epi16(aGreen, aGreen);
+	__m128i blue = _mm_packus_epi16(aBlue, aBlue);
+
+	__m128i first = ORDER::R == 0 ? red : blue;
+	__m128i third = ORDER::R == 0 ? blue : red;
+	__m128i lo = _mm_unpacklo_epi8(first, green);
+	__m128i hi = _mm_unpacklo_epi8(third, alpha);
+	_mm_storeu_si128((__m128i*)aDest, _mm_unpacklo_epi16(lo, hi));
+	_mm_storeu_si128((__m128i*)(aDest + 16), _mm_unpackhi_epi16(lo, hi));
+}
+
+// Converts 8 pixels from 16 bit Y, Cb and Cr values (chroma already
+// repeated for each pixel) to 32 bit pixels with opaque alpha. Same math
+// as StoreYCbCr, in 32 bit precision, so the results are identical.
+template <class COEF, class ORDER>
+__forceinline void StoreYCbCr_SSE2(BYTE *aDest, __m128i aY, __m128i aCb, __m128i aCr)
+{
+	const __m128i coefRed = _mm_setr_epi16(COEF::Y, COEF::R_CR, COEF::Y, COEF::R_CR, COEF::Y, COEF::R_CR, COEF::Y, COEF::R_CR);
+	const __m128i coefGreen = _mm_setr_epi16(COEF::Y, COEF::G_CB, COEF::Y, COEF::G_CB, COEF::Y, COEF::G_CB, COEF::Y, COEF::G_CB);
+	const __m128i coefGreenCr = _mm_setr_epi16(COEF::G_CR, 128, COEF::G_CR, 128, COEF::G_CR, 128, COEF::G_CR, 128);
+	const __m128i coefBlue = _mm_setr_epi16(COEF::Y, COEF::B_CB, COEF::Y, COEF::B_CB, COEF::Y, COEF::B_CB, COEF::Y, COEF::B_CB);
+	const __m128i round = _mm_set1_epi32(128);
+	const __m128i one = _mm_set1_epi16(1);
+
+	__m128i c = _mm_sub_epi16(aY, _mm_set1_epi16(COEF::Y_OFFSET));
+	__m128i d = _mm_sub_epi16(aCb, _mm_set1_epi16(128));
+	__m128i e = _mm_sub_epi16(aCr, _mm_set1_epi16(128));
+
+	__m128i ceLo = _mm_unpacklo_epi16(c, e);
+	__m128i ceHi = _mm_unpackhi_epi16(c, e);
+	__m128i cdLo = _mm_unpacklo_epi16(c, d);
+	__m128i cdHi = _mm_unpackhi_epi16(c, d);
+	__m128i e1Lo = _mm_unpacklo_epi16(e, one);
+	__m128i e1Hi = _mm_unpackhi_epi16(e, one);
+
+	__m128i red = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceLo, coefRed), round), 8),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceHi, coefRed), round), 8));
+	__m128i green = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdLo, coefGreen), _mm_madd_epi16(e1Lo, coefGreenCr)), 8),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdHi, coefGreen), _mm_madd_epi16(e1Hi, coefGreenCr)), 8));
+	__m128i blue = _mm_packs_epi32(
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdLo, coefBlue), round), 8),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdHi, coefBlue), round), 8));
+
+	StorePixels_SSE2<ORDER>(aDest, red, green, blue);
+}
+#endif
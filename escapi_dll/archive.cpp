@@ -0,0 +1,142 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include <string.h>
+#include "archive.h"
+
+DWORD ArchiveRecordSize(DWORD aFrameBytes)
+{
+	return (sizeof(ArchiveRecord) + aFrameBytes + ARCHIVE_ALIGN - 1) & ~(DWORD)(ARCHIVE_ALIGN - 1);
+}
+
+HRESULT ArchiveReader::open(const char *aFilename)
+{
+	mHeader = 0;
+	mIndex = 0;
+	mFrameCount = 0;
+
+	HRESULT hr = mFile.open(aFilename);
+	if (FAILED(hr))
+		return hr;
+
+	const BYTE *data = mFile.mData;
+	size_t size = mFile.mSize;
+	const ArchiveHeader *header = (const ArchiveHeader *)data;
+	if (size < ARCHIVE_ALIGN ||
+		memcmp(header->mMagic, ARCHIVE_MAGIC, 8) ||
+		header->mVersion != ARCHIVE_VERSION ||
+		header->mRecordSize == 0 ||
+		header->mRecordSize % ARCHIVE_ALIGN ||
+		header->mFrameBytes > header->mRecordSize - sizeof(ArchiveRecord))
+	{
+		mFile.close();
+		return MF_E_INVALIDMEDIATYPE;
+	}
+	mHeader = header;
+
+	// Without a valid trailer, the archive ends with its last whole record.
+	size_t records = (size - ARCHIVE_ALIGN) / header->mRecordSize;
+	mFrameCount = (int)(records > 0x7fffffff ? 0x7fffffff : records);
+
+	if (size >= ARCHIVE_ALIGN + sizeof(ArchiveTrailer))
+	{
+		const ArchiveTrailer *trailer = (const ArchiveTrailer *)(data + size - sizeof(ArchiveTrailer));
+		unsigned long long count = trailer->mFrameCount;
+		unsigned long long offset = trailer->mIndexOffset;
+		if (!memcmp(trailer->mMagic, ARCHIVE_TRAILER_MAGIC, 8) &&
+			count <= (unsigned long long)mFrameCount &&
+			offset >= ARCHIVE_ALIGN + count * header->mRecordSize &&
+			offset + count * sizeof(ArchiveIndexEntry) + sizeof(ArchiveTrailer) == size)
+		{
+			mIndex = (const ArchiveIndexEntry *)(data + offset);
+			mFrameCount = (int)count;
+		}
+	}
+	return S_OK;
+}
+
+const ArchiveRecord *ArchiveReader::record(int aFrame) const
+{
+	return (const ArchiveRecord *)(mFile.mData + ARCHIVE_ALIGN + (size_t)aFrame * mHeader->mRecordSize);
+}
+
+long long ArchiveReader::timestamp(int aFrame) const
+{
+	if (mIndex)
+		return mIndex[aFrame].mTimestamp;
+	return record(aFrame)->mTimestamp;
+}
+
+int ArchiveReader::find(long long aTimestamp) const
+{
+	// Frames are in capture order, so their times only go up. The search
+	// only touches the index pages (or one record header per step).
+	int lo = 0, hi = mFrameCount;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (timestamp(mid) <= aTimestamp)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+int ArchiveReader::getFrame(int aFrame, CaptureArchiveFrame &aInfo) const
+{
+	if (aFrame < 0 || aFrame >= mFrameCount)
+		return 0;
+
+	const ArchiveRecord *rec = record(aFrame);
+	aInfo.mTimestamp = rec->mTimestamp;
+	aInfo.mSequence = rec->mSequence;
+	aInfo.mFormat = mHeader->mFormat;
+	aInfo.mWidth = mHeader->mWidth;
+	aInfo.mHeight = mHeader->mHeight;
+	aInfo.mStride = mHeader->mStride;
+	aInfo.mData = rec + 1;
+	aInfo.mLength = rec->mLength < mHeader->mFrameBytes ? rec->mLength : mHeader->mFrameBytes;
+	return 1;
+}
+
+struct CaptureArchive *OpenArchive(const char *aFilename)
+{
+	if (!aFilename)
+		return 0;
+	ArchiveReader *reader = new ArchiveReader;
+	if (FAILED(reader->open(aFilename)))
+	{
+		delete reader;
+		return 0;
+	}
+	return (struct CaptureArchive *)reader;
+}
+
+void CloseArchive(struct CaptureArchive *aArchive)
+{
+	delete (ArchiveReader *)aArchive;
+}
+
+int GetArchiveFrameCount(struct CaptureArchive *aArchive)
+{
+	if (!aArchive)
+		return 0;
+	return ((ArchiveReader *)aArchive)->frameCount();
+}
+
+int FindArchiveFrame(struct CaptureArchive *aArchive, long long aTimestamp)
+{
+	if (!aArchive)
+		return -1;
+	return ((ArchiveReader *)aArchive)->find(aTimestamp);
+}
+
+int GetArchiveFrame(struct CaptureArchive *aArchive, int aFrame, struct CaptureArchiveFrame *aInfo)
+{
+	if (!aArchive || !aInfo)
+		return 0;
+	return ((ArchiveReader *)aArchive)->getFrame(aFrame, *aInfo);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "mappedfile.h"
+
+// Frame archive (CAPTURE_RECORD_ARCHIVE), laid out so that a reader can
+// map it and find a frame without reading more than the index:
+//
+//   ArchiveHeader, padded to ARCHIVE_ALIGN bytes
+//   Frame records of mRecordSize bytes each: ArchiveRecord, then the image
+//   ArchiveIndexEntry for each record
+//   ArchiveTrailer, at the very end
+//
+// An archive that wasn't closed has no index or trailer; its complete
+// records can still be read, and searched through their own headers.
+// All fields are little endian.
+
+#define ARCHIVE_MAGIC "ESCAPIAR"
+#define ARCHIVE_TRAILER_MAGIC "ESCAPIIX"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_ALIGN 4096
+
+struct ArchiveHeader
+{
+	char      mMagic[8];          // ARCHIVE_MAGIC
+	DWORD     mVersion;
+	DWORD     mRecordSize;        // A multiple of ARCHIVE_ALIGN
+	DWORD     mFormat;            // CAPTURE_FORMATS of the images
+	DWORD     mWidth;
+	DWORD     mHeight;
+	DWORD     mStride;            // Of the first plane; rows are tightly packed
+	DWORD     mFrameBytes;        // Size of each image
+	DWORD     mReserved;
+	long long mStartTime;         // Microseconds since 1970-01-01 UTC
+	BYTE      mPadding[16];
+};
+
+struct ArchiveRecord
+{
+	long long mTimestamp;         // Microseconds since 1970-01-01 UTC
+	DWORD     mSequence;          // Frames captured before this one in the recording
+	DWORD     mLength;            // Bytes of image after this header
+	BYTE      mPadding[48];
+};
+
+struct ArchiveIndexEntry
+{
+	long long mTimestamp;
+	DWORD     mSequence;
+	DWORD     mReserved;
+};
+
+struct ArchiveTrailer
+{
+	char      mMagic[8];          // ARCHIVE_TRAILER_MAGIC
+	long long mIndexOffset;
+	DWORD     mFrameCount;
+	DWORD     mReserved;
+	long long mPadding;
+};
+
+static_assert(sizeof(ArchiveHeader) == 64, "archive header layout");
+static_assert(sizeof(ArchiveRecord) == 64, "archive record layout");
+static_assert(sizeof(ArchiveIndexEntry) == 16, "archive index layout");
+static_assert(sizeof(ArchiveTrailer) == 32, "archive trailer layout");
+
+// Size of a record holding an image of aFrameBytes
+DWORD ArchiveRecordSize(DWORD aFrameBytes);
+
+// Read side of the exported archive functions
+class ArchiveReader
+{
+public:
+	HRESULT open(const char *aFilename);
+	int frameCount() const { return mFrameCount; }
+	long long timestamp(int aFrame) const;
+	// Last frame at or before aTimestamp, or -1 if there is none
+	int find(long long aTimestamp) const;
+	int getFrame(int aFrame, struct CaptureArchiveFrame &aInfo) const;
+
+private:
+	const ArchiveRecord *record(int aFrame) const;
+
+	MappedFile              mFile;
+	const ArchiveHeader     *mHeader;
+	const ArchiveIndexEntry *mIndex;      // 0 if the archive has no index
+	int                     mFrameCount;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+class CaptureClass;
+
+// The native mode a stream delivers frames in
+struct VideoFormat
+{
+	DWORD mSubtype;   // One of VIDEO_SUBTYPES
+	DWORD mWidth;
+	DWORD mHeight;
+	int   mMatrix;    // YCBCR_MATRIX the device reports (YCBCR_BT601 if it doesn't)
+};
+
+// One open capture device. start() picks the native mode that suits the
+// target best (CaptureClass::isFormatSupported and SizeError), hands it
+// to CaptureClass::setVideoFormat, and starts streaming. Each frame is
+// then passed to CaptureClass::deliverFrame, with the capture's critical
+// section held, straight from the backend's buffer.
+class CaptureStream
+{
+public:
+	virtual ~CaptureStream() {}
+	virtual HRESULT start(CaptureClass *aCapture) = 0;
+	// Stops streaming; start() may be called again after this.
+	virtual void stop() = 0;
+	// Same as setCaptureProperty / getCaptureProperty*; 0 and 1 if unsupported.
+	virtual int setProperty(int aProperty, float aValue, int aAuto) = 0;
+	virtual int getProperty(int aProperty, float &aValue, int &aAuto) = 0;
+};
+
+// A kind of capture device: Media Foundation or V4L2 cameras, the test
+// pattern. The devices of all backends are numbered one after the other.
+class CaptureBackend
+{
+public:
+	virtual ~CaptureBackend() {}
+	virtual int countDevices() = 0;
+	virtual void getDeviceName(int aDevice, char *aNamebuffer, int aBufferlength) = 0;
+	virtual CaptureStream *createStream(int aDevice) = 0;
+};
+
+// The backends in device order
+extern CaptureBackend *gBackends[];
+extern const int gBackendCount;
+
+// Creates a stream for a device number across all backends, or returns 0
+CaptureStream *CreateCaptureStream(int aDevice);
@@ -0,0 +1,30 @@
+#pragma once
+
+// What a client of the frame broker (broker/main.cpp) and the broker
+// say to each other over the Unix domain socket. The client sends a
+// BrokerRequest; the broker answers with a BrokerReply, and if it could
+// serve the request, passes the memfd of a frame ring (framering.h) with
+// it. The client keeps the connection open for as long as it reads the
+// ring; the broker stops producing the variant when the last one closes.
+
+#define BROKER_MAGIC "ESCAPIBR"
+#define BROKER_VERSION 1
+#define BROKER_DEFAULT_SOCKET "/tmp/escapi-broker"
+
+struct BrokerRequest
+{
+	char  mMagic[8];     // BROKER_MAGIC
+	DWORD mVersion;
+	DWORD mDevice;
+	DWORD mWidth;
+	DWORD mHeight;
+	DWORD mFormat;       // CAPTURE_FORMATS
+	DWORD mReserved;
+};
+
+struct BrokerReply
+{
+	char  mMagic[8];     // BROKER_MAGIC
+	int   mResult;       // 1 with a ring attached, 0 if the request can't be served
+	DWORD mReserved;
+};
@@ -1,382 +1,525 @@
-#include <mfapi.h>
-#include <mfidl.h>
-#include <mfreadwrite.h>
-#include <mferror.h>
-
-#include <shlwapi.h> // QITAB and friends
-#include <objbase.h> // IID_PPV_ARGS and friends
-#include <dshow.h> // IAMVideoProcAmp and friends
-
-#include <math.h>
+#include "platform.h"
 
 #define ESCAPI_DEFINITIONS_ONLY
 #include "escapi.h"
 
+#include <chrono>
 #include "conversion.h"
+#include "scaling.h"
+#include "pyramid.h"
+#include "tensor.h"
+#include "mjpeg.h"
 #include "capture.h"
-#include "scopedrelease.h"
-#include "videobufferlock.h"
-#include "choosedeviceparam.h"
+#include "recorder.h"
+#include "framering.h"
+#include "cropbatch.h"
+#include "capturegroup.h"
+#include "capturetrace.h"
 
-extern struct SimpleCapParams gParams[];
+extern struct SimpleCapParamsEx gParams[];
 extern int gDoCapture[];
 extern int gOptions[];
+extern int gPyramidLevels[];
+extern struct CaptureTensorParams gTensors[];
+
+// Span names in the trace, by CAPTURE_STAGES
+static const char *gStageNames[CAPTURE_STAGE_COUNT] =
+{
+	"lock",
+	"convert",
+	"scale",
+	"batch",
+	"handoff",
+	"latency"
+};
+
+// Rows converted at a time when filling a pyramid, so that the rows are
+// still in cache when they are filtered into the next level
+#define PYRAMID_BAND_ROWS 16
 
 #define DO_OR_DIE { if (mErrorLine) return hr; if (!SUCCEEDED(hr)) { mErrorLine = __LINE__; mErrorCode = hr; return hr; } }
-#define DO_OR_DIE_CRITSECTION { if (mErrorLine) { LeaveCriticalSection(&mCritsec); return hr;} if (!SUCCEEDED(hr)) { LeaveCriticalSection(&mCritsec); mErrorLine = __LINE__; mErrorCode = hr; return hr; } }
 
 CaptureClass::CaptureClass()
 {
-	mRefCount = 1;
-	mReader = 0;
+	mStream = 0;
 	InitializeCriticalSection(&mCritsec);
+	mConvertFn = 0;
+	mConvertFormat = CAPTURE_FORMAT_BGRA;
+	mScaleFn = 0;
 	mCaptureBuffer = 0;
 	mCaptureBufferWidth = 0;
 	mCaptureBufferHeight = 0;
+	mCaptureBufferSize = 0;
+	mSubtype = 0;
+	memset(mRegion, 0, sizeof(mRegion));
+	memset(mFrameRegion, 0, sizeof(mFrameRegion));
+	mSourceLeft = 0;
+	mSourceTop = 0;
+	mScaleLeft = 0;
+	mScaleTop = 0;
+	mScaleWidth = 0;
+	mScaleHeight = 0;
+	mDirectConvert = 0;
+	mMatrix = YCBCR_BT601;
+	mMjpeg = 0;
+	mMjpegScale = 1;
+	mFrameWidth = 0;
+	mFrameHeight = 0;
 	mErrorLine = 0;
 	mErrorCode = 0;
-	mBadIndices = 0;
-	mMaxBadIndices = 16;
-	mBadIndex = new unsigned int[mMaxBadIndices];
+	mWhoAmI = 0;
 	mRedoFromStart = 0;
+	mRecorder = 0;
+	mPublisher = 0;
+	memset(mSinks, 0, sizeof(mSinks));
+	mSinkCount = 0;
+	mPyramid = 0;
+	mBandRows = 0;
+	mBatch = 0;
+	mBatchConvertFn = 0;
+	mTensor = 0;
+	mGroup = 0;
+	mGroupIndex = 0;
+	mFrame = 0;
 }
 
 CaptureClass::~CaptureClass()
 {
+	delete mStream;
+	delete mRecorder;
+	delete mPublisher;
 	DeleteCriticalSection(&mCritsec);
-	delete[] mBadIndex;
+	delete mMjpeg;
+	delete mPyramid;
+	delete mBatch;
+	delete mTensor;
 }
 
-// IUnknown methods
-STDMETHODIMP CaptureClass::QueryInterface(REFIID aRiid, void** aPpv)
+int CaptureClass::wantsFrame() const
 {
-	static const QITAB qit[] =
-	{
-		QITABENT(CaptureClass, IMFSourceReaderCallback),
-		{ 0 },
-	};
-	return QISearch(this, qit, aRiid, aPpv);
+	return wantsImage() || (mBatch && mBatch->mDoCapture == -1);
 }
 
-STDMETHODIMP_(ULONG) CaptureClass::AddRef()
+// Whether the target buffer, a group or a sink asked for a frame
+int CaptureClass::wantsImage() const
 {
-	return InterlockedIncrement(&mRefCount);
+	return gDoCapture[mWhoAmI] == -1 || mGroup || sinkWantsImage();
 }
 
-STDMETHODIMP_(ULONG) CaptureClass::Release()
+int CaptureClass::sinkWantsImage() const
 {
-	ULONG count = InterlockedDecrement(&mRefCount);
-	if (count == 0)
+	for (int i = 0; i < mSinkCount; i++)
 	{
-		delete this;
+		if (mSinks[i].mParams.mTargetBuf && mSinks[i].mDoCapture == -1)
+			return 1;
 	}
-	// For thread safety, return a temporary variable.
-	return count;
+	return 0;
 }
 
-// IMFSourceReaderCallback methods
-STDMETHODIMP CaptureClass::OnReadSample(
-	HRESULT aStatus,
-	DWORD aStreamIndex,
-	DWORD aStreamFlags,
-	LONGLONG aTimestamp,
-	IMFSample *aSample
-	)
+// Called after anything that makes wantsFrame() true: doCapture, a sink's
+// or a batch's request, or a group starting.
+void CaptureClass::requestMade()
 {
-	HRESULT hr = S_OK;
-	IMFMediaBuffer *mediabuffer = NULL;
+	std::lock_guard<std::mutex> lock(mRequestLock);
+	mRequested.notify_all();
+}
 
-	if (FAILED(aStatus))
+// Blocks until wantsFrame() or aQuit, for streams that only make frames
+// on request. A stream's stop() sets aQuit and calls requestMade().
+void CaptureClass::waitForRequest(const std::atomic<int> &aQuit)
+{
+	std::unique_lock<std::mutex> lock(mRequestLock);
+	while (!aQuit && !wantsFrame())
+		mRequested.wait(lock);
+}
+
+int CaptureClass::deliverFrame(const BYTE *aData, DWORD aLength, const BYTE *aScanline0, LONG aStride, long long aTimestamp)
+{
+	long long frameStart = StatsClock();
+	long long start = frameStart;
+	int batch = mBatch && mBatch->mDoCapture == -1;
+	if (batch)
 	{
-		// Bug workaround: some resolutions may just return error.
-		// http://stackoverflow.com/questions/22788043/imfsourcereader-giving-error-0x80070491-for-some-resolutions
-		// we fix by marking the resolution bad and retrying, which should use the next best match.
-		mRedoFromStart = 1;
-		if (mBadIndices == mMaxBadIndices)
+		deliverBatch(aData, aLength, aScanline0, aStride);
+		start = stageDone(CAPTURE_STAGE_BATCH, start);
+	}
+
+	// The frame isn't converted for a batch alone.
+	if (!wantsImage())
+	{
+		// A batch still pending couldn't be decoded.
+		if (batch && mBatch->mDoCapture == -1)
+			mStats.dropped(1);
+		else if (batch)
+			frameDone(aTimestamp, frameStart);
+		return 1;
+	}
+
+	// Draw the frame. If the native mode matches the target, convert
+	// straight into it, otherwise into the capture buffer for scaling.
+
+	BYTE *dst = (BYTE *)mCaptureBuffer;
+	LONG dstStride = MinimumStride(mConvertFormat, mCaptureBufferWidth);
+	if (mDirectConvert)
+	{
+		dst = (BYTE *)gParams[mWhoAmI].mTargetBuf;
+		dstStride = gParams[mWhoAmI].mStride;
+		if (gParams[mWhoAmI].mFlags & CAPTURE_FLAG_FLIP_VERTICAL)
 		{
-			unsigned int *t = new unsigned int[mMaxBadIndices * 2];
-			memcpy(t, mBadIndex, mMaxBadIndices * sizeof(unsigned int));
-			delete[] mBadIndex;
-			mBadIndex = t;
-			mMaxBadIndices *= 2;
+			dst += dstStride * (mCaptureBufferHeight - 1);
+			dstStride = -dstStride;
 		}
-		mBadIndex[mBadIndices] = mUsedIndex;
-		mBadIndices++;
-		return aStatus;
 	}
 
-	EnterCriticalSection(&mCritsec);
+	// Packed video is only converted inside the region.
+	const BYTE *src = aScanline0 + aStride * (LONG)mSourceTop + mSourceLeft * PackedSubtypeBytes(mSubtype);
+
+	int converted = 1;
+	int requested = gDoCapture[mWhoAmI] == -1;
+	int primary = requested || mGroup;
+
+	if (primary && mPyramid)
+		mPyramid->begin();
+
+	// Packed video goes into a tensor in one pass, each row it samples
+	// converted as it is needed; nothing else has to be converted then
+	// unless a sink wants the frame too.
+	int tensorDone = 0;
+	if (primary && mTensor && mBatchConvertFn && PackedSubtypeBytes(mSubtype))
+	{
+		mTensor->begin(mCaptureBufferWidth, mCaptureBufferHeight);
+		mTensor->writeVideo(src, aStride, mBatchConvertFn);
+		tensorDone = 1;
+	}
+
+	if (mMjpeg)
+	{
+		// A corrupt frame leaves the request pending for the next one.
+		converted = mMjpeg->decode(
+			dst,
+			dstStride,
+			mConvertFormat,
+			mMatrix,
+			aData,
+			aLength,
+			mFrameWidth,
+			mFrameHeight,
+			mMjpegScale
+			);
+	}
+	else if (mBandRows)
+	{
+		// Straight into level 0 of the pyramid; each band goes down all
+		// the levels before the next one is converted.
+		for (DWORD y = 0; y < mCaptureBufferHeight; y += mBandRows)
+		{
+			DWORD rows = mCaptureBufferHeight - y < (DWORD)mBandRows ? mCaptureBufferHeight - y : mBandRows;
+			mConvertFn(
+				dst + dstStride * (LONG)y,
+				dstStride,
+				src + aStride * (LONG)y,
+				aStride,
+				mCaptureBufferWidth,
+				rows
+				);
+			mPyramid->rowsReady(y + rows);
+		}
+	}
+	else if (mConvertFn && (!tensorDone || sinkWantsImage()))
+	{
+		mConvertFn(
+			dst,
+			dstStride,
+			src,
+			aStride,
+			mCaptureBufferWidth,
+			mCaptureBufferHeight
+			);
+	}
+	else if (gOptions[mWhoAmI] & CAPTURE_OPTION_RAWDATA)
+	{
+		// No convert function, as raw data was requested, so let's copy it then.
+		const BYTE *scanline0 = aScanline0;
+		LONG stride = aStride;
+		if (stride < 0)
+		{
+			scanline0 += stride * mCaptureBufferHeight;
+			stride = -stride;
+		}
+		LONG bytes = stride * mCaptureBufferHeight;
+		CopyMemory(mCaptureBuffer, scanline0, bytes);
+	}
+
+	long long convertDone = stageDone(CAPTURE_STAGE_CONVERT, start);
 
-	if (SUCCEEDED(aStatus))
+	// Each output that asked for the frame gets it scaled from the one
+	// conversion. Sinks are only served through the capture buffer.
+	if (converted && !mDirectConvert)
 	{
-		if (gDoCapture[mWhoAmI] == -1)
+		if (primary && mTensor && !tensorDone)
+		{
+			LONG stride = MinimumStride(CAPTURE_FORMAT_BGRA, mCaptureBufferWidth);
+			mTensor->begin(mScaleWidth, mScaleHeight);
+			mTensor->writeImage((BYTE *)mCaptureBuffer + stride * (LONG)mScaleTop + mScaleLeft * 4, stride);
+		}
+		else if (primary && !mTensor)
+		{
+			scaleTo(gParams[mWhoAmI], mScaleFn);
+		}
+
+		for (int i = 0; i < mSinkCount; i++)
 		{
-			if (aSample)
+			CaptureSink &sink = mSinks[i];
+			if (sink.mParams.mTargetBuf && sink.mDoCapture == -1)
 			{
-				// Get the video frame buffer from the sample.
-
-				hr = aSample->GetBufferByIndex(0, &mediabuffer);
-				ScopedRelease<IMFMediaBuffer> mediabuffer_s(mediabuffer);
-
-				DO_OR_DIE_CRITSECTION;
-
-				// Draw the frame.
-
-				if (mConvertFn)
-				{
-					VideoBufferLock buffer(mediabuffer);    // Helper object to lock the video buffer.
-
-					BYTE *scanline0 = NULL;
-					LONG stride = 0;
-					hr = buffer.LockBuffer(mDefaultStride, mCaptureBufferHeight, &scanline0, &stride);
-
-					DO_OR_DIE_CRITSECTION;
-
-					mConvertFn(
-						(BYTE *)mCaptureBuffer,
-						mCaptureBufferWidth * 4,
-						scanline0,
-						stride,
-						mCaptureBufferWidth,
-						mCaptureBufferHeight
-						);
-				}
-				else
-				{
-					// No convert function?
-					if (gOptions[mWhoAmI] & CAPTURE_OPTION_RAWDATA)
-					{
-						// Ah ok, raw data was requested, so let's copy it then.
-
-						VideoBufferLock buffer(mediabuffer);    // Helper object to lock the video buffer.
-						BYTE *scanline0 = NULL;
-						LONG stride = 0;
-						hr = buffer.LockBuffer(mDefaultStride, mCaptureBufferHeight, &scanline0, &stride);
-						if (stride < 0)
-						{
-							scanline0 += stride * mCaptureBufferHeight;
-							stride = -stride;
-						}
-						LONG bytes = stride * mCaptureBufferHeight;
-						CopyMemory(mCaptureBuffer, scanline0, bytes);
-					}
-				}
-
-				int i, j;
-				int *dst = (int*)gParams[mWhoAmI].mTargetBuf;
-				int *src = (int*)mCaptureBuffer;
-				for (i = 0; i < gParams[mWhoAmI].mHeight; i++)
-				{
-					for (j = 0; j < gParams[mWhoAmI].mWidth; j++, dst++)
-					{
-						*dst = src[
-							(i * mCaptureBufferHeight / gParams[mWhoAmI].mHeight) * mCaptureBufferWidth +
-								(j * mCaptureBufferWidth / gParams[mWhoAmI].mWidth)];
-					}
-				}
-				gDoCapture[mWhoAmI] = 1;
+				scaleTo(sink.mParams, sink.mScaleFn);
+				sink.mDoCapture = 1;
 			}
 		}
+		stageDone(CAPTURE_STAGE_SCALE, convertDone);
 	}
 
-	// Request the next frame.
-	hr = mReader->ReadSample(
-		(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-		0,
-		NULL,   // actual
-		NULL,   // flags
-		NULL,   // timestamp
-		NULL    // sample
-		);
-
-	DO_OR_DIE_CRITSECTION;
+	if (!converted)
+	{
+		// Couldn't be decoded
+		mStats.dropped(1);
+		return 0;
+	}
 
-	LeaveCriticalSection(&mCritsec);
+	// The rest is for the target buffer only, not when only sinks wanted
+	// the frame.
+	if (primary)
+	{
+		long long handoff = StatsClock();
+		if (mPyramid)
+		{
+			// Whatever levels the conversion didn't already fill in
+			mPyramid->rowsReady(gParams[mWhoAmI].mHeight);
+		}
+		if (mGroup)
+		{
+			mGroup->push(mGroupIndex, (const BYTE *)gParams[mWhoAmI].mTargetBuf, aTimestamp);
+		}
 
-	return hr;
+		// And this for doCapture, not when only the group wanted it
+		if (requested && mRecorder)
+		{
+			// Copied before the request completes, so the caller can't
+			// change the target buffer under it.
+			if (mRecorder->flags() & CAPTURE_RECORD_NATIVE)
+				mRecorder->pushFrame(aData, aLength, aTimestamp);
+			else
+				mRecorder->pushImage(gParams[mWhoAmI], aTimestamp);
+		}
+		if (requested && mPublisher)
+		{
+			mPublisher->publish(gParams[mWhoAmI], CaptureClockToUtc(aTimestamp));
+		}
+		if (requested)
+		{
+			gDoCapture[mWhoAmI] = 1;
+		}
+		stageDone(CAPTURE_STAGE_HANDOFF, handoff);
+	}
+	frameDone(aTimestamp, frameStart);
+	return 1;
 }
 
-STDMETHODIMP CaptureClass::OnEvent(DWORD, IMFMediaEvent *)
+// Called by the backends for every frame from the camera, wanted or not
+void CaptureClass::frameArrived(long long aTimestamp)
 {
-	return S_OK;
+	mStats.arrived(aTimestamp);
+	mFrame++;
+	if (TraceEnabled())
+		TraceInstant("arrived", mWhoAmI, mFrame);
 }
 
-STDMETHODIMP CaptureClass::OnFlush(DWORD)
+// The frame that deliverFrame started on at aStart went everywhere it
+// was asked for.
+void CaptureClass::frameDone(long long aTimestamp, long long aStart)
 {
-	return S_OK;
+	long long now = StatsClock();
+	long long latency = now - aTimestamp * 1000;
+	mStats.delivered();
+	mStats.stage(CAPTURE_STAGE_LATENCY, latency);
+	if (TraceEnabled())
+		TraceSpan("frame", aStart, now, mWhoAmI, mFrame, latency / 1000);
 }
 
-int CaptureClass::escapiPropToMFProp(int aProperty)
-{
-	int prop = 0;
-	switch (aProperty)
-	{
-		//case CAPTURE_BRIGHTNESS:
-	default:
-		prop = VideoProcAmp_Brightness;
-		break;
-	case CAPTURE_CONTRAST:
-		prop = VideoProcAmp_Contrast;
-		break;
-	case CAPTURE_HUE:
-		prop = VideoProcAmp_Hue;
-		break;
-	case CAPTURE_SATURATION:
-		prop = VideoProcAmp_Saturation;
-		break;
-	case CAPTURE_SHARPNESS:
-		prop = VideoProcAmp_Sharpness;
-		break;
-	case CAPTURE_GAMMA:
-		prop = VideoProcAmp_Gamma;
-		break;
-	case CAPTURE_COLORENABLE:
-		prop = VideoProcAmp_ColorEnable;
-		break;
-	case CAPTURE_WHITEBALANCE:
-		prop = VideoProcAmp_WhiteBalance;
-		break;
-	case CAPTURE_BACKLIGHTCOMPENSATION:
-		prop = VideoProcAmp_BacklightCompensation;
-		break;
-	case CAPTURE_GAIN:
-		prop = VideoProcAmp_Gain;
-		break;
-	case CAPTURE_PAN:
-		prop = CameraControl_Pan;
-		break;
-	case CAPTURE_TILT:
-		prop = CameraControl_Tilt;
-		break;
-	case CAPTURE_ROLL:
-		prop = CameraControl_Roll;
-		break;
-	case CAPTURE_ZOOM:
-		prop = CameraControl_Zoom;
-		break;
-	case CAPTURE_EXPOSURE:
-		prop = CameraControl_Exposure;
-		break;
-	case CAPTURE_IRIS:
-		prop = CameraControl_Iris;
-		break;
-	case CAPTURE_FOCUS:
-		prop = CameraControl_Focus;
-		break;
-	}
-	return prop;
+// Times a stage that began at aStart, and returns when it ended
+long long CaptureClass::stageDone(int aStage, long long aStart)
+{
+	long long now = StatsClock();
+	mStats.stage(aStage, now - aStart);
+	if (TraceEnabled())
+		TraceSpan(gStageNames[aStage], aStart, now, mWhoAmI, mFrame, -1);
+	return now;
 }
 
-int CaptureClass::setProperty(int aProperty, float aValue, int aAuto)
+void CaptureClass::deliverBatch(const BYTE *aData, DWORD aLength, const BYTE *aScanline0, LONG aStride)
 {
-	HRESULT hr;
-	IAMVideoProcAmp *procAmp = NULL;
-	IAMCameraControl *control = NULL;
-
-	int prop = escapiPropToMFProp(aProperty);
-
-	if (aProperty < CAPTURE_PAN)
+	// Packed video is cropped straight from the frame. Anything else is
+	// converted whole to BGRA first, and cropped from that.
+	int pixelBytes = PackedSubtypeBytes(mSubtype);
+	if (pixelBytes && mBatchConvertFn)
 	{
-		hr = mSource->QueryInterface(IID_PPV_ARGS(&procAmp));
-		if (SUCCEEDED(hr))
-		{
-			long min, max, step, def, caps;
-			hr = procAmp->GetRange(prop, &min, &max, &step, &def, &caps);
+		mBatch->cropVideo(aScanline0, aStride, pixelBytes, mBatchConvertFn, mFrameWidth, mFrameHeight);
+		return;
+	}
 
-			if (SUCCEEDED(hr))
-			{
-				LONG val = (long)floor(min + (max - min) * aValue);
-				if (aAuto)
-					val = def;
-				hr = procAmp->Set(prop, val, aAuto ? VideoProcAmp_Flags_Auto : VideoProcAmp_Flags_Manual);
-			}
-			procAmp->Release();
-			return !!SUCCEEDED(hr);
-		}
+	BYTE *frame = mBatch->frameBuffer(mFrameWidth, mFrameHeight);
+	if (mMjpeg)
+	{
+		// A corrupt frame leaves the batch pending for the next one.
+		if (!mMjpeg->decode(frame, mFrameWidth * 4, CAPTURE_FORMAT_BGRA, mMatrix, aData, aLength,
+			mFrameWidth, mFrameHeight, 1))
+			return;
+	}
+	else if (mBatchConvertFn)
+	{
+		mBatchConvertFn(frame, mFrameWidth * 4, aScanline0, aStride, mFrameWidth, mFrameHeight);
 	}
 	else
 	{
-		hr = mSource->QueryInterface(IID_PPV_ARGS(&control));
-		if (SUCCEEDED(hr))
-		{
-			long min, max, step, def, caps;
-			hr = control->GetRange(prop, &min, &max, &step, &def, &caps);
-
-			if (SUCCEEDED(hr))
-			{
-				LONG val = (long)floor(min + (max - min) * aValue);
-				if (aAuto)
-					val = def;
-				hr = control->Set(prop, val, aAuto ? VideoProcAmp_Flags_Auto : VideoProcAmp_Flags_Manual);
-			}
-			control->Release();
-			return !!SUCCEEDED(hr);
-		}
+		return;
 	}
-
-	return 1;
+	mBatch->cropImage(frame, mFrameWidth * 4, mFrameWidth, mFrameHeight);
 }
 
-int CaptureClass::getProperty(int aProperty, float &aValue, int &aAuto)
+void CaptureClass::scaleTo(const SimpleCapParamsEx &aParams, IMAGE_SCALE_FN aScaleFn)
 {
-	HRESULT hr;
-	IAMVideoProcAmp *procAmp = NULL;
-	IAMCameraControl *control = NULL;
+	// Scale straight into the target buffer, in the target's format.
+	// Vertical flip is done by reading the source bottom-up.
 
-	aAuto = 0;
-	aValue = -1;
+	LONG srcStride = MinimumStride(mConvertFormat, mCaptureBufferWidth);
+	BYTE *src = (BYTE*)mCaptureBuffer + srcStride * (LONG)mScaleTop + MinimumStride(mConvertFormat, mScaleLeft);
+	if (aParams.mFlags & CAPTURE_FLAG_FLIP_VERTICAL)
+	{
+		src += srcStride * (LONG)(mScaleHeight - 1);
+		srcStride = -srcStride;
+	}
 
-	int prop = escapiPropToMFProp(aProperty);
+	aScaleFn(
+		(BYTE *)aParams.mTargetBuf,
+		aParams.mStride,
+		aParams.mWidth,
+		aParams.mHeight,
+		src,
+		srcStride,
+		mScaleWidth,
+		mScaleHeight
+		);
+}
 
-	if (aProperty < CAPTURE_PAN)
+int CaptureClass::addSink(const SimpleCapParamsEx &aParams)
+{
+	// The free slot is found under the lock, so that two sinks added at
+	// once can't both take it.
+	EnterCriticalSection(&mCritsec);
+	int sink = 0;
+	while (sink < CAPTURE_MAX_SINKS && mSinks[sink].mParams.mTargetBuf)
+		sink++;
+	if (sink == CAPTURE_MAX_SINKS)
 	{
-		hr = mSource->QueryInterface(IID_PPV_ARGS(&procAmp));
-		if (SUCCEEDED(hr))
-		{
-			long min, max, step, def, caps;
-			hr = procAmp->GetRange(prop, &min, &max, &step, &def, &caps);
-
-			if (SUCCEEDED(hr))
-			{
-				long v = 0, f = 0;
-				hr = procAmp->Get(prop, &v, &f);
-				if (SUCCEEDED(hr))
-				{
-					aValue = (v - min) / (float)(max - min);
-					aAuto = !!(f & VideoProcAmp_Flags_Auto);
-				}
-			}
-			procAmp->Release();
-			return 0;
-		}
+		LeaveCriticalSection(&mCritsec);
+		return 0;
 	}
+
+	mSinks[sink].mParams = aParams;
+	mSinks[sink].mScaleFn = FindScaleFunction(mConvertFormat, aParams.mFormat);
+	mSinks[sink].mDoCapture = 0;
+	if (sink >= mSinkCount)
+		mSinkCount = sink + 1;
+
+	// The stream has to start over if it converts into the target buffer,
+	// to a format the sink can't be scaled from, or in a mode smaller than
+	// the sink. Otherwise MJPG may just need decoding at a larger size.
+	if (mDirectConvert || !mSinks[sink].mScaleFn ||
+		(DWORD)aParams.mWidth > mFrameWidth || (DWORD)aParams.mHeight > mFrameHeight)
+		mRedoFromStart = 1;
 	else
+		updateRegion();
+	LeaveCriticalSection(&mCritsec);
+	return sink + 1;
+}
+
+int CaptureClass::removeSink(int aSink)
+{
+	EnterCriticalSection(&mCritsec);
+	if (aSink < 1 || aSink > mSinkCount || !mSinks[aSink - 1].mParams.mTargetBuf)
 	{
-		hr = mSource->QueryInterface(IID_PPV_ARGS(&control));
-		if (SUCCEEDED(hr))
-		{
-			long min, max, step, def, caps;
-			hr = control->GetRange(prop, &min, &max, &step, &def, &caps);
+		LeaveCriticalSection(&mCritsec);
+		return 0;
+	}
 
-			if (SUCCEEDED(hr))
-			{
-				long v = 0, f = 0;
-				hr = control->Get(prop, &v, &f);
-				if (SUCCEEDED(hr))
-				{
-					aValue = (v - min) / (float)(max - min);
-					aAuto = !!(f & VideoProcAmp_Flags_Auto);
-				}
-			}
-			control->Release();
-			return 0;
-		}
+	memset(&mSinks[aSink - 1], 0, sizeof(CaptureSink));
+	while (mSinkCount > 0 && !mSinks[mSinkCount - 1].mParams.mTargetBuf)
+		mSinkCount--;
+	LeaveCriticalSection(&mCritsec);
+	return 1;
+}
+
+void CaptureClass::getTargetSize(DWORD &aWidth, DWORD &aHeight) const
+{
+	// The largest of all the outputs, which the native mode should cover
+	aWidth = gParams[mWhoAmI].mWidth;
+	aHeight = gParams[mWhoAmI].mHeight;
+	for (int i = 0; i < mSinkCount; i++)
+	{
+		if (!mSinks[i].mParams.mTargetBuf)
+			continue;
+		if ((DWORD)mSinks[i].mParams.mWidth > aWidth)
+			aWidth = mSinks[i].mParams.mWidth;
+		if ((DWORD)mSinks[i].mParams.mHeight > aHeight)
+			aHeight = mSinks[i].mParams.mHeight;
 	}
+}
 
+int CaptureClass::sinksCanScaleFrom(int aSrcFormat) const
+{
+	for (int i = 0; i < mSinkCount; i++)
+	{
+		if (mSinks[i].mParams.mTargetBuf && !FindScaleFunction(aSrcFormat, mSinks[i].mParams.mFormat))
+			return 0;
+	}
 	return 1;
 }
 
-BOOL CaptureClass::isFormatSupported(REFGUID aSubtype) const
+int CaptureClass::requestBatch(const CaptureRect *aRects, int aCount, const SimpleCapParamsEx &aParams)
+{
+	EnterCriticalSection(&mCritsec);
+	if (!mBatch)
+		mBatch = new CropBatch;
+	int ok = mBatch->request(aRects, aCount, aParams);
+	LeaveCriticalSection(&mCritsec);
+	if (ok)
+		requestMade();
+	return ok;
+}
+
+int CaptureClass::isBatchDone()
+{
+	return mBatch && mBatch->mDoCapture == 1;
+}
+
+int CaptureClass::setProperty(int aProperty, float aValue, int aAuto)
+{
+	if (!mStream)
+		return 0;
+	return mStream->setProperty(aProperty, aValue, aAuto);
+}
+
+int CaptureClass::getProperty(int aProperty, float &aValue, int &aAuto)
+{
+	aAuto = 0;
+	aValue = -1;
+
+	if (!mStream)
+		return 1;
+	return mStream->getProperty(aProperty, aValue, aAuto);
+}
+
+BOOL CaptureClass::isFormatSupported(DWORD aSubtype) const
 {
 	int i;
 	for (i = 0; i < (signed)gConversionFormats; i++)
@@ -386,32 +529,76 @@ BOOL CaptureClass::isFormatSupported(REFGUID aSubtype) const
 			return TRUE;
 		}
 	}
+	// Decoded by MjpegDecoder, unless the caller wants the raw frames.
+	if (aSubtype == SUBTYPE_MJPG && !(gOptions[mWhoAmI] & CAPTURE_OPTION_RAWDATA))
+	{
+		return TRUE;
+	}
 	return FALSE;
 }
 
-HRESULT CaptureClass::getFormat(DWORD aIndex, GUID *aSubtype) const
+int CaptureClass::getYCbCrMatrix(const VideoFormat &aFormat) const
 {
-	if (aIndex < gConversionFormats)
+	int bt709 = aFormat.mMatrix == YCBCR_BT709 || aFormat.mMatrix == YCBCR_BT709_FULL;
+	int fullRange = aFormat.mMatrix == YCBCR_BT601_FULL || aFormat.mMatrix == YCBCR_BT709_FULL;
+
+	if (aFormat.mSubtype == SUBTYPE_MJPG)
 	{
-		*aSubtype = gFormatConversions[aIndex].mSubtype;
-		return S_OK;
+		// JFIF defines the encoding; what cameras report for MJPG modes
+		// describes their raw sensor format, if anything.
+		bt709 = 0;
+		fullRange = 1;
 	}
-	return MF_E_NO_MORE_TYPES;
+
+	unsigned int flags = gParams[mWhoAmI].mFlags;
+	if (flags & CAPTURE_FLAG_BT601)
+		bt709 = 0;
+	if (flags & CAPTURE_FLAG_BT709)
+		bt709 = 1;
+	if (flags & CAPTURE_FLAG_LIMITED_RANGE)
+		fullRange = 0;
+	if (flags & CAPTURE_FLAG_FULL_RANGE)
+		fullRange = 1;
+
+	if (bt709)
+		return fullRange ? YCBCR_BT709_FULL : YCBCR_BT709;
+	return fullRange ? YCBCR_BT601_FULL : YCBCR_BT601;
 }
 
-HRESULT CaptureClass::setConversionFunction(REFGUID aSubtype)
+HRESULT CaptureClass::setConversionFunction(DWORD aSubtype)
 {
 	mConvertFn = NULL;
+	delete mMjpeg;
+	mMjpeg = NULL;
+	mConvertFormat = CAPTURE_FORMAT_BGRA;
 
 	// If raw data is desired, skip conversion
 	if (gOptions[mWhoAmI] & CAPTURE_OPTION_RAWDATA)
-		return S_OK; 
+		return S_OK;
 
-	for (DWORD i = 0; i < gConversionFormats; i++)
+	if (aSubtype == SUBTYPE_MJPG)
+	{
+		// The decoder writes 32 bit and luma-only images itself; anything
+		// else goes through BGRA.
+		mMjpeg = new MjpegDecoder;
+		if (MjpegDecoder::IsOutputFormat(gParams[mWhoAmI].mFormat) && sinksCanScaleFrom(gParams[mWhoAmI].mFormat))
+			mConvertFormat = gParams[mWhoAmI].mFormat;
+		return S_OK;
+	}
+
+	// Prefer converting straight to the target format, and fall back
+	// to BGRA (which the scaling stage can turn into any format). With
+	// sinks, the target format has to be one they can all be scaled from.
+	int formats[2] = { gParams[mWhoAmI].mFormat, CAPTURE_FORMAT_BGRA };
+
+	for (int f = 0; f < 2; f++)
 	{
-		if (gFormatConversions[i].mSubtype == aSubtype)
+		if (!sinksCanScaleFrom(formats[f]))
+			continue;
+		mConvertFn = FindConversionFunction(aSubtype, formats[f], mMatrix);
+		if (mConvertFn)
 		{
-			mConvertFn = gFormatConversions[i].mXForm;
+			mConvertFormat = formats[f];
 			return S_OK;
 		}
 	}
@@ -419,302 +606,305 @@ HRESULT CaptureClass::setConversionFunction(REFGUID aSubtype)
 	return MF_E_INVALIDMEDIATYPE;
 }
 
-HRESULT CaptureClass::setVideoType(IMFMediaType *aType)
+IMAGE_TRANSFORM_FN CaptureClass::FindConversionFunction(DWORD aSubtype, int aFormat, int aMatrix)
 {
-	HRESULT hr = S_OK;
-	GUID subtype = { 0 };
-
-	// Find the video subtype.
-	hr = aType->GetGUID(MF_MT_SUBTYPE, &subtype);
-
-	DO_OR_DIE;
-
-	// Choose a conversion function.
-	// (This also validates the format type.)
-
-	hr = setConversionFunction(subtype);
-
-	DO_OR_DIE;
-
-	//
-	// Get some video attributes.
-	//
-
-	subtype = GUID_NULL;
-
-	UINT32 width = 0;
-	UINT32 height = 0;
-
-	// Get the subtype and the image size.
-	hr = aType->GetGUID(MF_MT_SUBTYPE, &subtype);
-
-	DO_OR_DIE;
-
-	hr = MFGetAttributeSize(aType, MF_MT_FRAME_SIZE, &width, &height);
-
-	DO_OR_DIE;
-
-	hr = MFGetStrideForBitmapInfoHeader(subtype.Data1, width, &mDefaultStride);
-
-	mCaptureBuffer = new unsigned int[width * height];
-	mCaptureBufferWidth = width;
-	mCaptureBufferHeight = height;
-
-	DO_OR_DIE;
-
-	return hr;
+	for (DWORD i = 0; i < gConversionFormats; i++)
+	{
+		if (gFormatConversions[i].mSubtype == aSubtype &&
+			gFormatConversions[i].mFormat == aFormat &&
+			(gFormatConversions[i].mMatrix == YCBCR_ANY || gFormatConversions[i].mMatrix == aMatrix))
+		{
+			return gFormatConversions[i].mXForm;
+		}
+	}
+	return NULL;
 }
 
-int CaptureClass::isMediaOk(IMFMediaType *aType, int aIndex)
+IMAGE_SCALE_FN CaptureClass::FindScaleFunction(int aSrcFormat, int aFormat)
 {
-	HRESULT hr = S_OK;
-
-	int i;
-	for (i = 0; i < (signed)mBadIndices; i++)
-		if (mBadIndex[i] == aIndex)
-			return FALSE;
-
-	BOOL found = FALSE;
-	GUID subtype = { 0 };
-
-	hr = aType->GetGUID(MF_MT_SUBTYPE, &subtype);
-
-	DO_OR_DIE;
-
-	// Do we support this type directly?
-	if (isFormatSupported(subtype))
-	{
-		found = TRUE;
-	}
-	else
+	for (DWORD i = 0; i < gScaleFormats; i++)
 	{
-		// Can we decode this media type to one of our supported
-		// output formats?
-
-		for (i = 0;; i++)
+		if (gScaleFunctions[i].mSrcFormat == aSrcFormat &&
+			gScaleFunctions[i].mFormat == aFormat)
 		{
-			// Get the i'th format.
-			hr = getFormat(i, &subtype);
-
-			if (FAILED(hr)) { break; }
-
-			hr = aType->SetGUID(MF_MT_SUBTYPE, subtype);
-
-			if (FAILED(hr)) { break; }
-
-			// Try to set this type on the source reader.
-			hr = mReader->SetCurrentMediaType(
-				(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-				NULL,
-				aType
-				);
-
-			if (SUCCEEDED(hr))
-			{
-				found = TRUE;
-				break;
-			}
+			return gScaleFunctions[i].mScale;
 		}
 	}
-	return found;
+	return NULL;
 }
 
-int CaptureClass::scanMediaTypes(unsigned int aWidth, unsigned int aHeight)
+HRESULT CaptureClass::setScaleFunction(int aSrcFormat, int aFormat)
 {
-	HRESULT hr;
-	HRESULT nativeTypeErrorCode = S_OK;
-	DWORD count = 0;
-	int besterror = 0xfffffff;
-	int bestfit = 0;
+	mScaleFn = FindScaleFunction(aSrcFormat, aFormat);
+	if (!mScaleFn)
+		return MF_E_INVALIDMEDIATYPE;
 
-	while (nativeTypeErrorCode == S_OK && besterror)
+	// setConversionFunction made sure every sink can be scaled to.
+	for (int i = 0; i < mSinkCount; i++)
 	{
-		IMFMediaType * nativeType = NULL;
-		nativeTypeErrorCode = mReader->GetNativeMediaType(
-			(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-			count,
-			&nativeType);
-		ScopedRelease<IMFMediaType> nativeType_s(nativeType);
-
-		if (nativeTypeErrorCode != S_OK) continue;
-
-		// get the media type 
-		GUID nativeGuid = { 0 };
-		hr = nativeType->GetGUID(MF_MT_SUBTYPE, &nativeGuid);
-
-		if (FAILED(hr)) return bestfit;
-
-		if (isMediaOk(nativeType, count))
-		{
-			UINT32 width, height;
-			hr = MFGetAttributeSize(nativeType, MF_MT_FRAME_SIZE, &width, &height);
-
-			if (FAILED(hr)) return bestfit;
-
-			int error = 0;
-
-			// prefer (hugely) to get too much than too little data..
-
-			if (aWidth < width) error += (width - aWidth);
-			if (aHeight < height) error += (height - aHeight);
-			if (aWidth > width) error += (aWidth - width) * 2;
-			if (aHeight > height) error += (aHeight - height) * 2;
-
-			if (aWidth == width && aHeight == height) // ..but perfect match is a perfect match
-				error = 0;
-
-			if (besterror > error)
-			{
-				besterror = error;
-				bestfit = count;
-			}
-			/*
-			char temp[1024];
-			sprintf(temp, "%d x %d, %x:%x:%x:%x %d %d\n", width, height, nativeGuid.Data1, nativeGuid.Data2, nativeGuid.Data3, nativeGuid.Data4, bestfit == count, besterror);
-			OutputDebugStringA(temp);
-			*/
-		}
-
-		count++;
+		if (mSinks[i].mParams.mTargetBuf)
+			mSinks[i].mScaleFn = FindScaleFunction(aSrcFormat, mSinks[i].mParams.mFormat);
 	}
-	return bestfit;
+	return S_OK;
 }
 
-HRESULT CaptureClass::initCapture(int aDevice)
+HRESULT CaptureClass::setVideoFormat(const VideoFormat &aFormat)
 {
-	mWhoAmI = aDevice;
-	HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
-
-	DO_OR_DIE;
+	HRESULT hr = S_OK;
 
-	hr = MFStartup(MF_VERSION);
+	// Choose a conversion function for the video's YCbCr encoding.
+	// (This also validates the format type.)
 
-	DO_OR_DIE;
+	mMatrix = getYCbCrMatrix(aFormat);
 
-	// choose device
-	IMFAttributes *attributes = NULL;
-	hr = MFCreateAttributes(&attributes, 1);
-	ScopedRelease<IMFAttributes> attributes_s(attributes);
+	hr = setConversionFunction(aFormat.mSubtype);
 
 	DO_OR_DIE;
 
-	hr = attributes->SetGUID(
-		MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
-		MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID
-		);
+	hr = setScaleFunction(mConvertFormat, gParams[mWhoAmI].mFormat);
 
 	DO_OR_DIE;
 
-	ChooseDeviceParam param = { 0 };
-	hr = MFEnumDeviceSources(attributes, &param.mDevices, &param.mCount);
+	mFrameWidth = aFormat.mWidth;
+	mFrameHeight = aFormat.mHeight;
+	mSubtype = aFormat.mSubtype;
+	mBatchConvertFn = (gOptions[mWhoAmI] & CAPTURE_OPTION_RAWDATA) ? NULL :
+		FindConversionFunction(aFormat.mSubtype, CAPTURE_FORMAT_BGRA, mMatrix);
 
-	DO_OR_DIE;
-
-	if ((signed)param.mCount > aDevice)
+	delete mPyramid;
+	mPyramid = 0;
+	mBandRows = 0;
+	if (gPyramidLevels[mWhoAmI] > 1)
 	{
-		// use param.ppDevices[0]
-		IMFAttributes   *attributes = NULL;
-		IMFMediaType    *type = NULL;
-		EnterCriticalSection(&mCritsec);
-
-		hr = param.mDevices[aDevice]->ActivateObject(
-			__uuidof(IMFMediaSource),
-			(void**)&mSource
-			);
-
-		DO_OR_DIE_CRITSECTION;
-
-		hr = MFCreateAttributes(&attributes, 3);
-		ScopedRelease<IMFAttributes> attributes_s(attributes);
+		CapturePyramidInfo info;
+		mPyramid = new PyramidBuilder;
+		if (!DescribePyramid(gParams[mWhoAmI].mFormat, gParams[mWhoAmI].mWidth, gParams[mWhoAmI].mHeight,
+			gParams[mWhoAmI].mStride, gPyramidLevels[mWhoAmI], &info) ||
+			!mPyramid->init((BYTE *)gParams[mWhoAmI].mTargetBuf, info))
+		{
+			hr = E_INVALIDARG;
+		}
 
-		DO_OR_DIE_CRITSECTION;
+		DO_OR_DIE;
+	}
 
-		hr = attributes->SetUINT32(MF_READWRITE_DISABLE_CONVERTERS, TRUE);
+	delete mTensor;
+	mTensor = 0;
+	if (gTensors[mWhoAmI].mTargetBuf)
+	{
+		mTensor = new TensorWriter;
+		if (!mTensor->init(gTensors[mWhoAmI]))
+			hr = E_INVALIDARG;
 
-		DO_OR_DIE_CRITSECTION;
+		DO_OR_DIE;
+	}
 
-		hr = attributes->SetUnknown(
-			MF_SOURCE_READER_ASYNC_CALLBACK,
-			this
-			);
+	delete[] mCaptureBuffer;
+	mCaptureBuffer = 0;
+	mCaptureBufferSize = 0;
 
-		DO_OR_DIE_CRITSECTION;
+	// A region that doesn't suit the new mode is dropped.
+	if (!updateRegion())
+	{
+		mRegion[2] = 0;
+		updateRegion();
+	}
 
-		hr = MFCreateSourceReaderFromMediaSource(
-			mSource,
-			attributes,
-			&mReader
-			);
+	return hr;
+}
 
-		DO_OR_DIE_CRITSECTION;
+int CaptureClass::setRegion(int aLeft, int aTop, int aWidth, int aHeight)
+{
+	EnterCriticalSection(&mCritsec);
+	int previous[4] = { mRegion[0], mRegion[1], mRegion[2], mRegion[3] };
+	mRegion[0] = aLeft;
+	mRegion[1] = aTop;
+	mRegion[2] = aWidth;
+	mRegion[3] = aHeight;
+
+	// Applied to the mode the stream is in, if it has one yet
+	int ok = mFrameWidth == 0 || updateRegion();
+	if (!ok)
+	{
+		memcpy(mRegion, previous, sizeof(mRegion));
+		updateRegion();
+	}
+	LeaveCriticalSection(&mCritsec);
+	return ok;
+}
 
-		int preferredmode = scanMediaTypes(gParams[mWhoAmI].mWidth, gParams[mWhoAmI].mHeight);
-		mUsedIndex = preferredmode;
+int CaptureClass::getRegion(struct CaptureRegion &aRegion)
+{
+	EnterCriticalSection(&mCritsec);
+	int ok = mFrameWidth != 0;
+	aRegion.mLeft = mFrameRegion[0];
+	aRegion.mTop = mFrameRegion[1];
+	aRegion.mWidth = mFrameRegion[2];
+	aRegion.mHeight = mFrameRegion[3];
+	aRegion.mFrameWidth = mFrameWidth;
+	aRegion.mFrameHeight = mFrameHeight;
+	LeaveCriticalSection(&mCritsec);
+	return ok;
+}
 
-		hr = mReader->GetNativeMediaType(
-			(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-			preferredmode,
-			&type
-			);
-		ScopedRelease<IMFMediaType> type_s(type);
+int CaptureClass::updateRegion()
+{
+	// The region in frame coordinates, rounded out to even ones for the
+	// chroma of YUV video and of the I420 and NV12 formats
+	DWORD left = 0, top = 0, right = mFrameWidth, bottom = mFrameHeight;
+	if (mRegion[2] > 0 && !(gOptions[mWhoAmI] & CAPTURE_OPTION_RAWDATA))
+	{
+		left = (DWORD)mRegion[0] & ~1;
+		top = (DWORD)mRegion[1] & ~1;
+		right = ((DWORD)mRegion[0] + mRegion[2] + 1) & ~1;
+		bottom = ((DWORD)mRegion[1] + mRegion[3] + 1) & ~1;
+		if (right > mFrameWidth)
+			right = mFrameWidth;
+		if (bottom > mFrameHeight)
+			bottom = mFrameHeight;
+		if (left >= right || top >= bottom)
+			return 0;
+	}
+	DWORD width = right - left;
+	DWORD height = bottom - top;
+
+	// Packed video is converted only inside the region. 4:2:0 video and
+	// MJPG are converted whole and the region cut out of the result, which
+	// the planar formats don't allow.
+	int crop = mConvertFn != NULL && PackedSubtypeBytes(mSubtype) != 0;
+	int whole = width == mFrameWidth && height == mFrameHeight;
+	if (!crop && !whole && (mConvertFormat == CAPTURE_FORMAT_I420 || mConvertFormat == CAPTURE_FORMAT_NV12))
+		return 0;
+
+	mFrameRegion[0] = left;
+	mFrameRegion[1] = top;
+	mFrameRegion[2] = width;
+	mFrameRegion[3] = height;
+	mSourceLeft = crop ? left : 0;
+	mSourceTop = crop ? top : 0;
+	mMjpegScale = 1;
+	if (crop)
+	{
+		mCaptureBufferWidth = width;
+		mCaptureBufferHeight = height;
+		mScaleLeft = 0;
+		mScaleTop = 0;
+		mScaleWidth = width;
+		mScaleHeight = height;
+	}
+	else if (mMjpeg)
+	{
+		// Decode at the smallest DCT scale at which the region still covers
+		// the target, which skips most of the IDCT work for small targets.
+		DWORD targetWidth, targetHeight;
+		getTargetSize(targetWidth, targetHeight);
+		mMjpegScale = MjpegDecoder::ChooseScale(width, height, targetWidth, targetHeight);
+		mCaptureBufferWidth = MjpegDecoder::ScaledSize(mFrameWidth, mMjpegScale);
+		mCaptureBufferHeight = MjpegDecoder::ScaledSize(mFrameHeight, mMjpegScale);
+		mScaleLeft = left / mMjpegScale;
+		mScaleTop = top / mMjpegScale;
+		mScaleWidth = MjpegDecoder::ScaledSize(width, mMjpegScale);
+		mScaleHeight = MjpegDecoder::ScaledSize(height, mMjpegScale);
+		if (mScaleWidth > mCaptureBufferWidth - mScaleLeft)
+			mScaleWidth = mCaptureBufferWidth - mScaleLeft;
+		if (mScaleHeight > mCaptureBufferHeight - mScaleTop)
+			mScaleHeight = mCaptureBufferHeight - mScaleTop;
+	}
+	else
+	{
+		mCaptureBufferWidth = mFrameWidth;
+		mCaptureBufferHeight = mFrameHeight;
+		mScaleLeft = left;
+		mScaleTop = top;
+		mScaleWidth = width;
+		mScaleHeight = height;
+	}
 
-		DO_OR_DIE_CRITSECTION;
+	// If what's scaled matches the target exactly (which the streams
+	// prefer), the conversion can write into the target buffer directly and
+	// no intermediate buffer is needed.
+	mDirectConvert = (mConvertFn != NULL || mMjpeg != NULL) && mSinkCount == 0 && !mTensor &&
+		mScaleWidth == mCaptureBufferWidth && mScaleHeight == mCaptureBufferHeight &&
+		mCaptureBufferWidth == (unsigned int)gParams[mWhoAmI].mWidth &&
+		mCaptureBufferHeight == (unsigned int)gParams[mWhoAmI].mHeight &&
+		gParams[mWhoAmI].mFormat == mConvertFormat;
+
+	// The buffer only grows, as the region can change with every frame.
+	if (!mDirectConvert && mCaptureBufferSize < mCaptureBufferWidth * mCaptureBufferHeight)
+	{
+		delete[] mCaptureBuffer;
+		mCaptureBufferSize = mCaptureBufferWidth * mCaptureBufferHeight;
+		mCaptureBuffer = new unsigned int[mCaptureBufferSize];
+	}
 
-		hr = setVideoType(type);
+	// Packed video converted into the target can be done in bands.
+	mBandRows = mPyramid && mDirectConvert && crop ? PYRAMID_BAND_ROWS : 0;
+	return 1;
+}
 
-		DO_OR_DIE_CRITSECTION;
+int CaptureClass::SizeError(DWORD aWidth, DWORD aHeight, DWORD aTargetWidth, DWORD aTargetHeight)
+{
+	int error = 0;
 
-		hr = mReader->SetCurrentMediaType(
-			(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-			NULL,
-			type
-			);
+	// prefer (hugely) to get too much than too little data..
 
-		DO_OR_DIE_CRITSECTION;
+	if (aTargetWidth < aWidth) error += (aWidth - aTargetWidth);
+	if (aTargetHeight < aHeight) error += (aHeight - aTargetHeight);
+	if (aTargetWidth > aWidth) error += (aTargetWidth - aWidth) * 2;
+	if (aTargetHeight > aHeight) error += (aTargetHeight - aHeight) * 2;
 
-		hr = mReader->ReadSample(
-			(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-			0,
-			NULL,
-			NULL,
-			NULL,
-			NULL
-			);
+	return error;
+}
 
-		DO_OR_DIE_CRITSECTION;
+HRESULT CaptureClass::initCapture(int aDevice)
+{
+	mWhoAmI = aDevice;
+	HRESULT hr = S_OK;
 
-		LeaveCriticalSection(&mCritsec);
-	}
-	else
+	// The stream outlives deinitCapture, so that a restart can remember
+	// what went wrong the last time.
+	if (!mStream)
 	{
-		return MF_E_INVALIDINDEX;
+		mStream = CreateCaptureStream(aDevice);
+		if (!mStream)
+			return MF_E_INVALIDINDEX;
 	}
 
-	/*
-	for (i = 0; i < 16; i++)
-	{
-	char temp[128];
-	float v;
-	int f;
-	int r = GetProperty(i, v, f);
-	sprintf(temp, "%d: %3.3f %d (%d)\n", i, v, f, r);
-	OutputDebugStringA(temp);
-	}
-	*/
+	hr = mStream->start(this);
+
+	DO_OR_DIE;
 
 	return 0;
 }
 
 void CaptureClass::deinitCapture()
 {
-	EnterCriticalSection(&mCritsec);
-
-	mReader->Release();
+	// Stopped before taking the lock, as the stream's thread may be
+	// waiting for it to deliver a frame.
+	if (mStream)
+		mStream->stop();
 
-	mSource->Shutdown();
-	mSource->Release();
+	EnterCriticalSection(&mCritsec);
 
 	delete[] mCaptureBuffer;
+	mCaptureBuffer = 0;
+	mCaptureBufferSize = 0;
+
+	delete mMjpeg;
+	mMjpeg = 0;
 
 	LeaveCriticalSection(&mCritsec);
 }
+
+long long CaptureClock()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long CaptureClockToUtc(long long aTimestamp)
+{
+	long long now = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	return now - (CaptureClock() - aTimestamp);
+}
@@ -1,53 +1,113 @@
 #pragma once
 
+#include <condition_variable>
+#include <mutex>
+#include "backend.h"
+#include "capturestats.h"
 
-class CaptureClass : public IMFSourceReaderCallback
+class CaptureGroup;
+class CropBatch;
+class MjpegDecoder;
+class PyramidBuilder;
+class TensorWriter;
+class Recorder;
+class FrameRingPublisher;
+
+// A further output of a device (addCaptureSink), scaled from the same
+// converted frame as gParams
+struct CaptureSink
+{
+	SimpleCapParamsEx       mParams;       // mTargetBuf is 0 for an unused sink
+	IMAGE_SCALE_FN          mScaleFn;
+	int                     mDoCapture;    // Same as gDoCapture
+};
+
+// The ESCAPI side of a capture device: turns the frames of whichever
+// backend stream drives it into the format, size and buffer requested
+// in gParams.
+class CaptureClass
 {
 public:
 
 	CaptureClass();
 	~CaptureClass();
-	STDMETHODIMP QueryInterface(REFIID aRiid, void** aPpv);
-	STDMETHODIMP_(ULONG) AddRef();
-	STDMETHODIMP_(ULONG) Release();
-	STDMETHODIMP OnReadSample(
-		HRESULT aStatus,
-		DWORD aStreamIndex,
-		DWORD aStreamFlags,
-		LONGLONG aTimestamp,
-		IMFSample *aSample
-		);
-	STDMETHODIMP OnEvent(DWORD, IMFMediaEvent *);
-	STDMETHODIMP OnFlush(DWORD);
-	int escapiPropToMFProp(int aProperty);
+	int wantsFrame() const;
+	int wantsImage() const;
+	int sinkWantsImage() const;
+	void requestMade();
+	void waitForRequest(const std::atomic<int> &aQuit);
+	int deliverFrame(const BYTE *aData, DWORD aLength, const BYTE *aScanline0, LONG aStride, long long aTimestamp);
+	void deliverBatch(const BYTE *aData, DWORD aLength, const BYTE *aScanline0, LONG aStride);
+	void frameArrived(long long aTimestamp);
+	void frameDone(long long aTimestamp, long long aStart);
+	long long stageDone(int aStage, long long aStart);
+	void scaleTo(const SimpleCapParamsEx &aParams, IMAGE_SCALE_FN aScaleFn);
+	int addSink(const SimpleCapParamsEx &aParams);
+	int removeSink(int aSink);
+	void getTargetSize(DWORD &aWidth, DWORD &aHeight) const;
+	int sinksCanScaleFrom(int aSrcFormat) const;
+	int setRegion(int aLeft, int aTop, int aWidth, int aHeight);
+	int getRegion(struct CaptureRegion &aRegion);
+	int requestBatch(const CaptureRect *aRects, int aCount, const SimpleCapParamsEx &aParams);
+	int isBatchDone();
+	int updateRegion();
 	int setProperty(int aProperty, float aValue, int aAuto);
 	int getProperty(int aProperty, float &aValue, int &aAuto);
-	BOOL isFormatSupported(REFGUID aSubtype) const;
-	HRESULT getFormat(DWORD aIndex, GUID *aSubtype) const;
-	HRESULT setConversionFunction(REFGUID aSubtype);
-	HRESULT setVideoType(IMFMediaType *aType);
-	int isMediaOk(IMFMediaType *aType, int aIndex);
-	int scanMediaTypes(unsigned int aWidth, unsigned int aHeight);
+	BOOL isFormatSupported(DWORD aSubtype) const;
+	int getYCbCrMatrix(const VideoFormat &aFormat) const;
+	HRESULT setConversionFunction(DWORD aSubtype);
+	HRESULT setScaleFunction(int aSrcFormat, int aFormat);
+	HRESULT setVideoFormat(const VideoFormat &aFormat);
 	HRESULT initCapture(int aDevice);
 	void deinitCapture();
 
-	long                    mRefCount;        // Reference count.
-	CRITICAL_SECTION        mCritsec;
+	// How badly a native mode fits the target; 0 for a perfect match.
+	static int SizeError(DWORD aWidth, DWORD aHeight, DWORD aTargetWidth, DWORD aTargetHeight);
+	static IMAGE_SCALE_FN FindScaleFunction(int aSrcFormat, int aFormat);
+	static IMAGE_TRANSFORM_FN FindConversionFunction(DWORD aSubtype, int aFormat, int aMatrix);
 
-	IMFSourceReader         *mReader;
-	IMFMediaSource			*mSource;
+	CRITICAL_SECTION        mCritsec;
+	CaptureStream           *mStream;
 
-	LONG                    mDefaultStride;
-	IMAGE_TRANSFORM_FN      mConvertFn;    // Function to convert the video to RGB32
+	IMAGE_TRANSFORM_FN      mConvertFn;    // Function to convert the video to mConvertFormat
+	int                     mConvertFormat;
+	int                     mMatrix;       // YCbCr encoding of the video, one of YCBCR_MATRIX
+	IMAGE_SCALE_FN          mScaleFn;      // Function to scale mConvertFormat to the target format
+	MjpegDecoder            *mMjpeg;       // Used instead of mConvertFn for MJPG
+	int                     mMjpegScale;   // MJPG is decoded at 1/mMjpegScale size
 
 	unsigned int			*mCaptureBuffer;
 	unsigned int			mCaptureBufferWidth, mCaptureBufferHeight;
+	unsigned int			mCaptureBufferSize;        // Allocated pixels, at least width * height
+	unsigned int			mFrameWidth, mFrameHeight; // Native size, before MJPG downscaling
+	DWORD					mSubtype;                  // Of the native mode
+	int						mRegion[4];                // setCaptureRegion's rectangle, or 0 width for none
+	unsigned int			mFrameRegion[4];           // The part of the frame used, after rounding and clipping
+	unsigned int			mSourceLeft, mSourceTop;   // Where the converted part of the frame starts
+	unsigned int			mScaleLeft, mScaleTop, mScaleWidth, mScaleHeight; // Part of the capture buffer scaled
+	int						mDirectConvert;
 	int						mErrorLine;
 	int						mErrorCode;
 	int						mWhoAmI;
-	unsigned int			*mBadIndex;
-	unsigned int			mBadIndices;
-	unsigned int			mMaxBadIndices;
-	unsigned int			mUsedIndex;
-	int						mRedoFromStart;
+	int						mRedoFromStart;  // Set by a stream that needs to be restarted
+	Recorder				*mRecorder;      // Gets each captured frame, if recording
+	FrameRingPublisher		*mPublisher;     // And so does this, if publishing
+	CaptureSink				mSinks[CAPTURE_MAX_SINKS];  // Sink n is mSinks[n - 1]
+	int						mSinkCount;
+	PyramidBuilder			*mPyramid;       // Fills in the levels below the target, if it's a pyramid
+	int						mBandRows;       // Rows converted at a time for the pyramid, or 0 for all at once
+	CropBatch				*mBatch;         // The last doCaptureBatch, if any
+	IMAGE_TRANSFORM_FN		mBatchConvertFn; // mSubtype to BGRA, for the batches and the tensor
+	TensorWriter			*mTensor;        // Fills in the target instead of scaling, if it's a tensor
+	CaptureGroup			*mGroup;         // Gets every frame while a captureGroup waits on the device
+	int						mGroupIndex;     // Of the device in mGroup
+	StatsCounters			mStats;          // For getCaptureStats; the backends count arrivals and drops
+	unsigned int			mFrame;          // Arrivals so far, numbering the frames in the trace
+	std::mutex				mRequestLock;    // With mRequested, wakes streams that wait for a request
+	std::condition_variable	mRequested;
 };
+
+// Microseconds of the steady clock that frame timestamps are given in
+long long CaptureClock();
+// A CaptureClock time in microseconds since 1970-01-01 UTC
+long long CaptureClockToUtc(long long aTimestamp);
@@ -0,0 +1,148 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include <chrono>
+#include "capturegroup.h"
+
+CaptureGroup::CaptureGroup()
+{
+	mCount = 0;
+	mDone = 0;
+}
+
+void CaptureGroup::setMember(int aIndex, const GroupLayout &aLayout)
+{
+	Member &member = mMembers[aIndex];
+	member.mLayout = aLayout;
+	member.mBytes = 0;
+	for (int i = 0; i < aLayout.mPlanes; i++)
+		member.mBytes += aLayout.mRowBytes[i] * aLayout.mRows[i];
+	for (int i = 0; i < CAPTURE_GROUP_FRAMES; i++)
+	{
+		member.mFrames[i].resize(member.mBytes);
+		member.mTimestamps[i] = -1;
+	}
+	member.mNext = 0;
+	member.mChosen = -1;
+	if (aIndex >= mCount)
+		mCount = aIndex + 1;
+}
+
+void CaptureGroup::push(int aIndex, const BYTE *aTarget, long long aTimestamp)
+{
+	// The oldest frame makes way. It can't be matched while it is being
+	// written, so the copy is made without holding the lock.
+	Member &member = mMembers[aIndex];
+	int slot;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		if (mDone)
+			return;
+		slot = member.mNext;
+		member.mNext = (slot + 1) % CAPTURE_GROUP_FRAMES;
+		member.mTimestamps[slot] = -1;
+	}
+
+	const GroupLayout &layout = member.mLayout;
+	BYTE *dst = member.mFrames[slot].data();
+	for (int i = 0; i < layout.mPlanes; i++)
+	{
+		const BYTE *src = aTarget + layout.mOffset[i];
+		for (DWORD y = 0; y < layout.mRows[i]; y++)
+		{
+			memcpy(dst, src + layout.mStride[i] * (LONG)y, layout.mRowBytes[i]);
+			dst += layout.mRowBytes[i];
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		member.mTimestamps[slot] = aTimestamp;
+	}
+	mPushed.notify_one();
+}
+
+int CaptureGroup::match(long long aTolerance)
+{
+	// Each frame in turn is taken as the earliest of a set, and every other
+	// member adds its earliest frame from then on. The set that spans the
+	// least is then among those tried.
+	long long bestSpan = aTolerance + 1;
+	int best[CAPTURE_MAX_GROUP];
+	for (int i = 0; i < mCount; i++)
+	{
+		for (int s = 0; s < CAPTURE_GROUP_FRAMES; s++)
+		{
+			long long first = mMembers[i].mTimestamps[s];
+			if (first < 0)
+				continue;
+
+			int set[CAPTURE_MAX_GROUP];
+			long long last = first;
+			int complete = 1;
+			for (int j = 0; j < mCount && complete; j++)
+			{
+				set[j] = -1;
+				for (int t = 0; t < CAPTURE_GROUP_FRAMES; t++)
+				{
+					long long time = mMembers[j].mTimestamps[t];
+					if (time >= first && (set[j] < 0 || time < mMembers[j].mTimestamps[set[j]]))
+						set[j] = t;
+				}
+				if (set[j] < 0)
+					complete = 0;
+				else if (mMembers[j].mTimestamps[set[j]] > last)
+					last = mMembers[j].mTimestamps[set[j]];
+			}
+			if (complete && last - first < bestSpan)
+			{
+				bestSpan = last - first;
+				memcpy(best, set, sizeof(int) * mCount);
+			}
+		}
+	}
+	if (bestSpan > aTolerance)
+		return 0;
+
+	for (int i = 0; i < mCount; i++)
+		mMembers[i].mChosen = best[i];
+	mDone = 1;
+	return 1;
+}
+
+int CaptureGroup::wait(long long aTolerance, int aTimeout)
+{
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(aTimeout);
+	std::unique_lock<std::mutex> lock(mLock);
+	while (!match(aTolerance))
+	{
+		if (mPushed.wait_until(lock, deadline) == std::cv_status::timeout)
+		{
+			// One last look, then no more frames are wanted.
+			int found = match(aTolerance);
+			mDone = 1;
+			return found;
+		}
+	}
+	return 1;
+}
+
+long long CaptureGroup::restore(int aIndex, BYTE *aTarget)
+{
+	const Member &member = mMembers[aIndex];
+	const GroupLayout &layout = member.mLayout;
+	const BYTE *src = member.mFrames[member.mChosen].data();
+	for (int i = 0; i < layout.mPlanes; i++)
+	{
+		BYTE *dst = aTarget + layout.mOffset[i];
+		for (DWORD y = 0; y < layout.mRows[i]; y++)
+		{
+			memcpy(dst + layout.mStride[i] * (LONG)y, src, layout.mRowBytes[i]);
+			src += layout.mRowBytes[i];
+		}
+	}
+	return member.mTimestamps[member.mChosen];
+}
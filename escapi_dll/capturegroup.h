@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Frames kept per device while a group looks for a match
+#define CAPTURE_GROUP_FRAMES 4
+
+// Most planes in a GroupLayout: the levels of a pyramid
+#define CAPTURE_GROUP_PLANES CAPTURE_MAX_PYRAMID_LEVELS
+
+// Where a device's image lies in its target buffer, as rows of bytes in
+// one or more planes. Only these bytes are kept and put back, as targets
+// may share a buffer (multicap draws all its cameras into one screen).
+struct GroupLayout
+{
+	int    mPlanes;
+	DWORD  mOffset[CAPTURE_GROUP_PLANES];
+	LONG   mStride[CAPTURE_GROUP_PLANES];
+	DWORD  mRowBytes[CAPTURE_GROUP_PLANES];
+	DWORD  mRows[CAPTURE_GROUP_PLANES];
+};
+
+// A captureGroup call: the last few frames of each device in the group,
+// with their timestamps, kept until there is one of each close enough in
+// time to the others. The devices push their frames from their own
+// threads; the caller waits for all of them at once.
+class CaptureGroup
+{
+public:
+	CaptureGroup();
+
+	// Sets up member aIndex, whose images lie in its target as aLayout says
+	void setMember(int aIndex, const GroupLayout &aLayout);
+
+	// Keeps a copy of a member's target buffer; called from deliverFrame.
+	void push(int aIndex, const BYTE *aTarget, long long aTimestamp);
+
+	// Waits until there is a frame of each member, all within aTolerance
+	// microseconds, or aTimeout milliseconds pass. The set that spans the
+	// least is chosen, and no further frames are kept. Returns 0 on timeout.
+	int wait(long long aTolerance, int aTimeout);
+
+	// Puts the chosen frame of a member back into its target buffer, and
+	// returns its timestamp.
+	long long restore(int aIndex, BYTE *aTarget);
+
+private:
+	int match(long long aTolerance);
+
+	struct Member
+	{
+		GroupLayout             mLayout;
+		DWORD                   mBytes;
+		std::vector<BYTE>       mFrames[CAPTURE_GROUP_FRAMES];
+		long long               mTimestamps[CAPTURE_GROUP_FRAMES];  // -1 while empty or being written
+		int                     mNext;       // Slot the next frame goes to
+		int                     mChosen;     // Slot of the matched frame
+	};
+
+	Member                  mMembers[CAPTURE_MAX_GROUP];
+	int                     mCount;
+	int                     mDone;           // A set was chosen
+	std::mutex              mLock;
+	std::condition_variable mPushed;
+};
@@ -0,0 +1,103 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include <chrono>
+#include "capturestats.h"
+
+StatsCounters::StatsCounters()
+{
+	reset();
+}
+
+void StatsCounters::reset()
+{
+	mArrived.store(0, std::memory_order_relaxed);
+	mDelivered.store(0, std::memory_order_relaxed);
+	mDropped.store(0, std::memory_order_relaxed);
+	mLastArrival.store(0, std::memory_order_relaxed);
+	mInterval.store(0, std::memory_order_relaxed);
+	for (int i = 0; i < CAPTURE_STAGE_COUNT; i++)
+	{
+		Stage &stage = mStages[i];
+		stage.mCount.store(0, std::memory_order_relaxed);
+		stage.mTotal.store(0, std::memory_order_relaxed);
+		stage.mMax.store(0, std::memory_order_relaxed);
+		for (int b = 0; b < CAPTURE_STATS_BUCKETS; b++)
+			stage.mHistogram[b].store(0, std::memory_order_relaxed);
+	}
+}
+
+void StatsCounters::arrived(long long aTimestamp)
+{
+	mArrived.fetch_add(1, std::memory_order_relaxed);
+
+	// The frame rate follows a moving average of the time between frames,
+	// each new interval weighing 1/16.
+	long long last = mLastArrival.exchange(aTimestamp, std::memory_order_relaxed);
+	if (last == 0 || aTimestamp <= last)
+		return;
+	long long interval = (aTimestamp - last) * 16;
+	long long average = mInterval.load(std::memory_order_relaxed);
+	mInterval.store(average ? average + (interval - average) / 16 : interval, std::memory_order_relaxed);
+}
+
+void StatsCounters::delivered()
+{
+	mDelivered.fetch_add(1, std::memory_order_relaxed);
+}
+
+void StatsCounters::dropped(unsigned int aFrames)
+{
+	mDropped.fetch_add(aFrames, std::memory_order_relaxed);
+}
+
+void StatsCounters::stage(int aStage, long long aNanoseconds)
+{
+	if (aNanoseconds < 0)
+		aNanoseconds = 0;
+	Stage &stage = mStages[aStage];
+	stage.mCount.fetch_add(1, std::memory_order_relaxed);
+	stage.mTotal.fetch_add(aNanoseconds, std::memory_order_relaxed);
+	if ((unsigned long long)aNanoseconds > stage.mMax.load(std::memory_order_relaxed))
+		stage.mMax.store(aNanoseconds, std::memory_order_relaxed);
+
+	// Bucket i holds times of i significant bits of microseconds
+	unsigned long long micro = aNanoseconds / 1000;
+	int bucket = 0;
+	while (micro && bucket < CAPTURE_STATS_BUCKETS - 1)
+	{
+		micro >>= 1;
+		bucket++;
+	}
+	stage.mHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void StatsCounters::get(CaptureStats &aStats) const
+{
+	memset(&aStats, 0, sizeof(aStats));
+	aStats.mFramesArrived = mArrived.load(std::memory_order_relaxed);
+	aStats.mFramesDelivered = mDelivered.load(std::memory_order_relaxed);
+	aStats.mFramesDropped = mDropped.load(std::memory_order_relaxed);
+	long long interval = mInterval.load(std::memory_order_relaxed);
+	if (interval > 0)
+		aStats.mFps = (float)(16e6 / interval);
+
+	for (int i = 0; i < CAPTURE_STAGE_COUNT; i++)
+	{
+		const Stage &stage = mStages[i];
+		CaptureStageStats &out = aStats.mStages[i];
+		out.mCount = stage.mCount.load(std::memory_order_relaxed);
+		out.mTotalMicroseconds = stage.mTotal.load(std::memory_order_relaxed) / 1000;
+		out.mMaxMicroseconds = (unsigned int)(stage.mMax.load(std::memory_order_relaxed) / 1000);
+		for (int b = 0; b < CAPTURE_STATS_BUCKETS; b++)
+			out.mHistogram[b] = stage.mHistogram[b].load(std::memory_order_relaxed);
+	}
+}
+
+long long StatsClock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+
+// The counters behind getCaptureStats. Only the device's capture thread
+// adds to them, so each counter is a relaxed atomic that readers (and
+// resets) on other threads can touch without taking a lock.
+class StatsCounters
+{
+public:
+	StatsCounters();
+
+	void reset();
+
+	// A frame came from the camera at aTimestamp (CaptureClock)
+	void arrived(long long aTimestamp);
+	void delivered();
+	void dropped(unsigned int aFrames);
+
+	// A stage of CAPTURE_STAGES took aNanoseconds
+	void stage(int aStage, long long aNanoseconds);
+
+	void get(struct CaptureStats &aStats) const;
+
+private:
+	struct Stage
+	{
+		std::atomic<unsigned long long> mCount;
+		std::atomic<unsigned long long> mTotal;       // Nanoseconds
+		std::atomic<unsigned long long> mMax;
+		std::atomic<unsigned int>       mHistogram[CAPTURE_STATS_BUCKETS];
+	};
+
+	std::atomic<unsigned long long> mArrived;
+	std::atomic<unsigned long long> mDelivered;
+	std::atomic<unsigned long long> mDropped;
+	std::atomic<long long>          mLastArrival;  // Microseconds, 0 before the first frame
+	std::atomic<long long>          mInterval;     // Between arrivals, averaged; in 1/16 microseconds
+	Stage                           mStages[CAPTURE_STAGE_COUNT];
+};
+
+// Nanoseconds of the steady clock, for timing the stages
+long long StatsClock();
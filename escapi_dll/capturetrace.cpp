@@ -0,0 +1,284 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include <stdio.h>
+#include <mutex>
+#include <vector>
+#include "capturestats.h"
+#include "capturetrace.h"
+
+std::atomic<int> gTraceEnabled(0);
+
+namespace
+{
+	struct TraceEvent
+	{
+		const char              *mName;
+		long long               mBegin;      // Nanoseconds (StatsClock)
+		long long               mEnd;
+		long long               mLatency;    // Microseconds, or -1
+		int                     mDevice;     // -1 for none
+		unsigned int            mFrame;      // 0 for none
+		char                    mPhase;      // As in the JSON: X, i, B or E
+	};
+
+	// Only its thread writes events into a buffer, and only while holding
+	// gTraceLock does it take the buffer up for a new trace. Buffers are
+	// never freed, as a thread may be about to write to one at any time;
+	// those left by threads that ended are reused instead.
+	struct TraceBuffer
+	{
+		TraceEvent              *mEvents;
+		unsigned int            mCapacity;
+		std::atomic<unsigned int> mCount;    // Published after each event is written
+		std::atomic<unsigned int> mLost;     // Events that didn't fit
+		std::atomic<int>        mDevice;     // Whose frames the thread handled: -2 none yet, -1 several
+		std::atomic<int>        mInUse;      // Its thread hasn't ended
+		unsigned int            mTrace;      // Trace the events belong to
+		int                     mId;         // Thread id in the JSON
+		std::vector<char *>     mNames;      // Copies of the caller's span names
+	};
+
+	struct TraceThread
+	{
+		TraceBuffer             *mBuffer;
+
+		~TraceThread()
+		{
+			if (mBuffer)
+				mBuffer->mInUse.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	std::mutex                  gTraceLock;
+	std::vector<TraceBuffer *>  gTraceBuffers;
+	std::atomic<unsigned int>   gTraceNumber(0);   // Of the current trace, 0 before the first
+	unsigned int                gTraceEvents = 0;  // Per thread
+	long long                   gTraceStart = 0;   // Time 0 in the JSON
+	int                         gTraceThreads = 0;
+
+	thread_local TraceThread    tTraceThread;
+}
+
+int TraceStart(int aEvents)
+{
+	if (aEvents < 0)
+		return 0;
+	if (aEvents == 0)
+		aEvents = CAPTURE_TRACE_DEFAULT_EVENTS;
+
+	std::lock_guard<std::mutex> lock(gTraceLock);
+	gTraceEvents = aEvents;
+	gTraceStart = StatsClock();
+	gTraceThreads = 0;
+	gTraceNumber.fetch_add(1, std::memory_order_release);
+	gTraceEnabled.store(1, std::memory_order_relaxed);
+	return 1;
+}
+
+void TraceStop()
+{
+	gTraceEnabled.store(0, std::memory_order_relaxed);
+}
+
+// The calling thread's buffer for the current trace, taken up on its
+// first event of the trace
+static TraceBuffer *ThreadBuffer()
+{
+	TraceBuffer *buffer = tTraceThread.mBuffer;
+	if (buffer && buffer->mTrace == gTraceNumber.load(std::memory_order_acquire))
+		return buffer;
+
+	std::lock_guard<std::mutex> lock(gTraceLock);
+	unsigned int trace = gTraceNumber.load(std::memory_order_relaxed);
+	if (buffer && buffer->mCapacity != gTraceEvents)
+	{
+		buffer->mInUse.store(0, std::memory_order_relaxed);
+		buffer = 0;
+	}
+	for (size_t i = 0; !buffer && i < gTraceBuffers.size(); i++)
+	{
+		TraceBuffer *unused = gTraceBuffers[i];
+		if (!unused->mInUse.load(std::memory_order_relaxed) && unused->mTrace != trace &&
+			unused->mCapacity == gTraceEvents)
+			buffer = unused;
+	}
+	if (!buffer)
+	{
+		buffer = new TraceBuffer;
+		buffer->mEvents = new TraceEvent[gTraceEvents];
+		buffer->mCapacity = gTraceEvents;
+		gTraceBuffers.push_back(buffer);
+	}
+
+	for (size_t i = 0; i < buffer->mNames.size(); i++)
+		delete[] buffer->mNames[i];
+	buffer->mNames.clear();
+	buffer->mCount.store(0, std::memory_order_relaxed);
+	buffer->mLost.store(0, std::memory_order_relaxed);
+	buffer->mDevice.store(-2, std::memory_order_relaxed);
+	buffer->mInUse.store(1, std::memory_order_relaxed);
+	buffer->mTrace = trace;
+	buffer->mId = ++gTraceThreads;
+	tTraceThread.mBuffer = buffer;
+	return buffer;
+}
+
+static void Record(TraceBuffer *aBuffer, char aPhase, const char *aName, long long aBegin, long long aEnd, int aDevice, unsigned int aFrame, long long aLatency)
+{
+	unsigned int count = aBuffer->mCount.load(std::memory_order_relaxed);
+	if (count == aBuffer->mCapacity)
+	{
+		aBuffer->mLost.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	TraceEvent &event = aBuffer->mEvents[count];
+	event.mName = aName;
+	event.mBegin = aBegin;
+	event.mEnd = aEnd;
+	event.mLatency = aLatency;
+	event.mDevice = aDevice;
+	event.mFrame = aFrame;
+	event.mPhase = aPhase;
+
+	// Only the threads that handle frames are named for devices.
+	int device = aBuffer->mDevice.load(std::memory_order_relaxed);
+	if (aFrame && device != aDevice && device != -1)
+		aBuffer->mDevice.store(device == -2 ? aDevice : -1, std::memory_order_relaxed);
+	aBuffer->mCount.store(count + 1, std::memory_order_release);
+}
+
+void TraceSpan(const char *aName, long long aBegin, long long aEnd, int aDevice, unsigned int aFrame, long long aLatency)
+{
+	if (TraceEnabled())
+		Record(ThreadBuffer(), 'X', aName, aBegin, aEnd, aDevice, aFrame, aLatency);
+}
+
+void TraceInstant(const char *aName, int aDevice, unsigned int aFrame)
+{
+	if (!TraceEnabled())
+		return;
+	long long now = StatsClock();
+	Record(ThreadBuffer(), 'i', aName, now, now, aDevice, aFrame, -1);
+}
+
+void TraceBegin(const char *aName)
+{
+	if (!TraceEnabled())
+		return;
+
+	// The caller's name is copied once per trace and thread, and the copy
+	// used for every span of that name after.
+	TraceBuffer *buffer = ThreadBuffer();
+	const char *name = 0;
+	for (size_t i = 0; !name && i < buffer->mNames.size(); i++)
+	{
+		if (strcmp(buffer->mNames[i], aName) == 0)
+			name = buffer->mNames[i];
+	}
+	if (!name)
+	{
+		char *copy = new char[strlen(aName) + 1];
+		strcpy(copy, aName);
+		buffer->mNames.push_back(copy);
+		name = copy;
+	}
+
+	long long now = StatsClock();
+	Record(buffer, 'B', name, now, now, -1, 0, -1);
+}
+
+void TraceEnd()
+{
+	if (!TraceEnabled())
+		return;
+	long long now = StatsClock();
+	Record(ThreadBuffer(), 'E', 0, now, now, -1, 0, -1);
+}
+
+static void WriteString(FILE *aFile, const char *aText)
+{
+	fputc('"', aFile);
+	for (const unsigned char *c = (const unsigned char *)aText; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			fprintf(aFile, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(aFile, "\\u%04x", *c);
+		else
+			fputc(*c, aFile);
+	}
+	fputc('"', aFile);
+}
+
+static void WriteEvent(FILE *aFile, const TraceEvent &aEvent, int aThread)
+{
+	fprintf(aFile, "{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f", aEvent.mPhase, aThread, (aEvent.mBegin - gTraceStart) / 1000.0);
+	if (aEvent.mPhase == 'X')
+		fprintf(aFile, ",\"dur\":%.3f", (aEvent.mEnd - aEvent.mBegin) / 1000.0);
+	else if (aEvent.mPhase == 'i')
+		fprintf(aFile, ",\"s\":\"t\"");
+	if (aEvent.mName)
+	{
+		fprintf(aFile, ",\"cat\":\"%s\",\"name\":", aEvent.mPhase == 'B' ? "application" : "capture");
+		WriteString(aFile, aEvent.mName);
+	}
+	if (aEvent.mDevice >= 0)
+	{
+		fprintf(aFile, ",\"args\":{\"device\":%d", aEvent.mDevice);
+		if (aEvent.mFrame)
+			fprintf(aFile, ",\"frame\":%u", aEvent.mFrame);
+		if (aEvent.mLatency >= 0)
+			fprintf(aFile, ",\"latency_us\":%lld", aEvent.mLatency);
+		fputc('}', aFile);
+	}
+	fputc('}', aFile);
+}
+
+int TraceSave(const char *aFilename)
+{
+	std::lock_guard<std::mutex> lock(gTraceLock);
+	unsigned int trace = gTraceNumber.load(std::memory_order_relaxed);
+	if (trace == 0)
+		return 0;
+	FILE *f = fopen(aFilename, "w");
+	if (!f)
+		return 0;
+
+	// Each thread is named for the device it handled, if just the one.
+	// Events still being written by the threads are left out.
+	unsigned long long lost = 0;
+	fprintf(f, "{\"traceEvents\":[\n");
+	fprintf(f, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"escapi\"}}");
+	for (size_t i = 0; i < gTraceBuffers.size(); i++)
+	{
+		const TraceBuffer *buffer = gTraceBuffers[i];
+		if (buffer->mTrace != trace)
+			continue;
+		unsigned int count = buffer->mCount.load(std::memory_order_acquire);
+		lost += buffer->mLost.load(std::memory_order_relaxed);
+
+		char name[32];
+		int device = buffer->mDevice.load(std::memory_order_relaxed);
+		if (device >= 0)
+			sprintf(name, "device %d", device);
+		else
+			sprintf(name, device == -1 ? "capture %d" : "thread %d", buffer->mId);
+		fprintf(f, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}", buffer->mId, name);
+
+		for (unsigned int e = 0; e < count; e++)
+		{
+			fprintf(f, ",\n");
+			WriteEvent(f, buffer->mEvents[e], buffer->mId);
+		}
+	}
+	fprintf(f, "\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\"lostEvents\":%llu}}\n", lost);
+
+	int ok = !ferror(f);
+	if (fclose(f) != 0)
+		ok = 0;
+	return ok;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+
+// Events a thread keeps when startCaptureTrace is given 0
+#define CAPTURE_TRACE_DEFAULT_EVENTS 65536
+
+// The tracer behind startCaptureTrace. Each thread that records gets a
+// buffer of its own that only it writes to, so recording takes no lock;
+// the buffers are only looked at together when the trace is saved.
+// Everything is skipped but one load of gTraceEnabled while it's off.
+extern std::atomic<int> gTraceEnabled;
+
+static inline int TraceEnabled()
+{
+	return gTraceEnabled.load(std::memory_order_relaxed);
+}
+
+// Starts a new trace of up to aEvents per thread, dropping the last one
+int TraceStart(int aEvents);
+void TraceStop();
+
+// Writes the events as Chrome trace JSON, which Perfetto reads as well
+int TraceSave(const char *aFilename);
+
+// A span from aBegin to aEnd nanoseconds (StatsClock) of frame aFrame
+// of aDevice, or of no device if aDevice is -1. aLatency (microseconds,
+// or -1 for none) goes with it. aName is kept, not copied.
+void TraceSpan(const char *aName, long long aBegin, long long aEnd, int aDevice, unsigned int aFrame, long long aLatency);
+
+// A moment of no length, such as a frame's arrival
+void TraceInstant(const char *aName, int aDevice, unsigned int aFrame);
+
+// The caller's own spans, opened and closed in order; aName is copied
+void TraceBegin(const char *aName);
+void TraceEnd();
@@ -0,0 +1,150 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "conversion.h"
+#include "scaling.h"
+#include "jobpool.h"
+#include "capture.h"
+#include "cropbatch.h"
+
+CropBatch::CropBatch()
+{
+	mDoCapture = 0;
+	mCount = 0;
+	memset(&mParams, 0, sizeof(mParams));
+	mScaleFn = 0;
+	mScratch = 0;
+	mScratchRow = 0;
+	mScratchSize = 0;
+	mFrame = 0;
+	mFrameSize = 0;
+	mSrc = 0;
+	mSrcStride = 0;
+	mSrcPixelBytes = 0;
+	mConvertFn = 0;
+	mSrcWidth = 0;
+	mSrcHeight = 0;
+}
+
+CropBatch::~CropBatch()
+{
+	delete[] mScratch;
+	delete[] mFrame;
+}
+
+int CropBatch::request(const CaptureRect *aRects, int aCount, const SimpleCapParamsEx &aParams)
+{
+	// Crops are scaled a row at a time, which the planar formats can't be.
+	IMAGE_SCALE_FN scale = CaptureClass::FindScaleFunction(CAPTURE_FORMAT_BGRA, aParams.mFormat);
+	if (!scale || aParams.mFormat == CAPTURE_FORMAT_I420 || aParams.mFormat == CAPTURE_FORMAT_NV12)
+		return 0;
+
+	DWORD widest = 0;
+	for (int i = 0; i < aCount; i++)
+	{
+		if ((DWORD)aRects[i].mWidth > widest)
+			widest = aRects[i].mWidth;
+	}
+	// Rows are converted from an even column, so a crop's row may take
+	// a pixel more on either side.
+	DWORD row = (widest + 2) * 4;
+	if (mScratchSize < row * aCount)
+	{
+		delete[] mScratch;
+		mScratchSize = row * aCount;
+		mScratch = new BYTE[mScratchSize];
+	}
+
+	memcpy(mRects, aRects, sizeof(CaptureRect) * aCount);
+	mCount = aCount;
+	mParams = aParams;
+	mScaleFn = scale;
+	mScratchRow = row;
+	mDoCapture = -1;
+	return 1;
+}
+
+BYTE *CropBatch::frameBuffer(DWORD aWidth, DWORD aHeight)
+{
+	if (mFrameSize < aWidth * aHeight * 4)
+	{
+		delete[] mFrame;
+		mFrameSize = aWidth * aHeight * 4;
+		mFrame = new BYTE[mFrameSize];
+	}
+	return mFrame;
+}
+
+void CropBatch::cropVideo(const BYTE *aScanline0, LONG aStride, int aPixelBytes, IMAGE_TRANSFORM_FN aConvertFn,
+	DWORD aFrameWidth, DWORD aFrameHeight)
+{
+	mSrc = aScanline0;
+	mSrcStride = aStride;
+	mSrcPixelBytes = aPixelBytes;
+	mConvertFn = aConvertFn;
+	mSrcWidth = aFrameWidth;
+	mSrcHeight = aFrameHeight;
+	SharedJobPool().run(CropJob, this, mCount);
+	mDoCapture = 1;
+}
+
+void CropBatch::cropImage(const BYTE *aImage, LONG aStride, DWORD aFrameWidth, DWORD aFrameHeight)
+{
+	cropVideo(aImage, aStride, 4, 0, aFrameWidth, aFrameHeight);
+}
+
+void CropBatch::CropJob(void *aData, int aIndex)
+{
+	((CropBatch *)aData)->crop(aIndex);
+}
+
+void CropBatch::crop(int aIndex)
+{
+	const CaptureRect &rect = mRects[aIndex];
+	LONG stride = mParams.mStride;
+	DWORD width = mParams.mWidth;
+	DWORD height = mParams.mHeight;
+	BYTE *dst = (BYTE *)mParams.mTargetBuf + stride * (LONG)height * aIndex;
+
+	// Clipped to the frame
+	DWORD left = (DWORD)rect.mLeft < mSrcWidth ? rect.mLeft : mSrcWidth;
+	DWORD top = (DWORD)rect.mTop < mSrcHeight ? rect.mTop : mSrcHeight;
+	DWORD right = (DWORD)(rect.mLeft + rect.mWidth) < mSrcWidth ? rect.mLeft + rect.mWidth : mSrcWidth;
+	DWORD bottom = (DWORD)(rect.mTop + rect.mHeight) < mSrcHeight ? rect.mTop + rect.mHeight : mSrcHeight;
+	if (left >= right || top >= bottom)
+	{
+		for (DWORD y = 0; y < height; y++)
+			memset(dst + stride * (LONG)y, 0, MinimumStride(mParams.mFormat, width));
+		return;
+	}
+
+	if (!mConvertFn)
+	{
+		mScaleFn(dst, stride, width, height, mSrc + mSrcStride * (LONG)top + left * 4, mSrcStride,
+			right - left, bottom - top);
+		return;
+	}
+
+	// Pairs of pixels share their chroma in 4:2:2 video, so rows are
+	// converted from an even column. Only the rows the scaling samples
+	// (the same ones as the scaling functions) are converted at all.
+	DWORD first = left & ~1;
+	DWORD last = (right + 1) & ~1;
+	if (last > mSrcWidth)
+		last = mSrcWidth;
+	BYTE *row = mScratch + mScratchRow * aIndex;
+	const BYTE *pixels = row + (left - first) * 4;
+	DWORD converted = ~0u;
+	for (DWORD y = 0; y < height; y++)
+	{
+		DWORD srcY = top + (DWORD)((unsigned long long)y * (bottom - top) / height);
+		if (srcY != converted)
+		{
+			mConvertFn(row, 0, mSrc + mSrcStride * (LONG)srcY + first * mSrcPixelBytes, mSrcStride, last - first, 1);
+			converted = srcY;
+		}
+		mScaleFn(dst + stride * (LONG)y, stride, width, 1, pixels, 0, right - left, 1);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// A doCaptureBatch request: crops cut out of one frame, each scaled to the
+// same size and stored one after another in one buffer. The crops are made
+// in parallel on the shared job pool.
+class CropBatch
+{
+public:
+	CropBatch();
+	~CropBatch();
+
+	// Takes on a request; returns 0 if the crops can't be made in their format.
+	int request(const CaptureRect *aRects, int aCount, const SimpleCapParamsEx &aParams);
+
+	// Crops packed video, converting each sampled row of a crop with
+	// aConvertFn (to BGRA) just before it is scaled.
+	void cropVideo(const BYTE *aScanline0, LONG aStride, int aPixelBytes, IMAGE_TRANSFORM_FN aConvertFn,
+		DWORD aFrameWidth, DWORD aFrameHeight);
+
+	// Crops a frame already converted to BGRA.
+	void cropImage(const BYTE *aImage, LONG aStride, DWORD aFrameWidth, DWORD aFrameHeight);
+
+	// A BGRA buffer for cropImage, for video that can only be converted whole
+	BYTE *frameBuffer(DWORD aWidth, DWORD aHeight);
+
+	int                     mDoCapture;    // Same as gDoCapture
+
+private:
+	static void CropJob(void *aData, int aIndex);
+	void crop(int aIndex);
+
+	CaptureRect             mRects[CAPTURE_MAX_BATCH];
+	int                     mCount;
+	SimpleCapParamsEx       mParams;
+	IMAGE_SCALE_FN          mScaleFn;      // BGRA to the crops' format
+	BYTE                    *mScratch;     // A converted row for each crop
+	DWORD                   mScratchRow;
+	DWORD                   mScratchSize;
+	BYTE                    *mFrame;
+	DWORD                   mFrameSize;
+
+	// The frame being cropped
+	const BYTE              *mSrc;
+	LONG                    mSrcStride;
+	int                     mSrcPixelBytes;
+	IMAGE_TRANSFORM_FN      mConvertFn;    // 0 if mSrc is BGRA already
+	DWORD                   mSrcWidth;
+	DWORD                   mSrcHeight;
+};
@@ -1,25 +1,64 @@
-#include "windows.h"
+#include "platform.h"
 #define ESCAPI_DEFINITIONS_ONLY
 #include "escapi.h"
+#include "scaling.h"
+#include "pyramid.h"
+#include "conversion.h"
+#include "tensor.h"
+#include "capturetrace.h"
 
 
 #define MAXDEVICES 16
 
-extern struct SimpleCapParams gParams[];
+extern struct SimpleCapParamsEx gParams[];
 extern int gDoCapture[];
 extern int gOptions[];
+extern int gPyramidLevels[];
+extern struct CaptureTensorParams gTensors[];
 
 extern HRESULT InitDevice(int device);
 extern void CleanupDevice(int device);
 extern int CountCaptureDevices();
 extern void GetCaptureDeviceName(int deviceno, char * namebuffer, int bufferlength);
 extern void CheckForFail(int device);
+extern void CaptureRequested(int device);
 extern int GetErrorCode(int device);
 extern int GetErrorLine(int device);
+extern int GetFrameInfo(int device, struct CaptureFrameInfo *info);
 extern float GetProperty(int device, int prop);
 extern int GetPropertyAuto(int device, int prop);
 extern int SetProperty(int device, int prop, float value, int autoval);
+extern int SetTestPatternDevice(int enable, int width, int height, int fps, int format);
+extern int GetTestPatternFrameNumber(int device);
+extern int SetFileDevice(const char *filename, int width, int height, int fps, int format);
+extern int StartRecording(int device, const char *filename, int container, int queueframes, unsigned int flags);
+extern int StopRecording(int device);
+extern int GetRecordingStats(int device, struct CaptureRecordingStats *stats);
+extern struct CaptureArchive *OpenArchive(const char *filename);
+extern void CloseArchive(struct CaptureArchive *archive);
+extern int GetArchiveFrameCount(struct CaptureArchive *archive);
+extern int FindArchiveFrame(struct CaptureArchive *archive, long long timestamp);
+extern int GetArchiveFrame(struct CaptureArchive *archive, int frame, struct CaptureArchiveFrame *info);
+extern int StartPublishing(int device, const char *name, int slots);
+extern int StopPublishing(int device);
+extern struct CaptureRing *OpenCaptureRing(const char *name);
+extern void CloseCaptureRing(struct CaptureRing *ring);
+extern int GetRingFrame(struct CaptureRing *ring, unsigned long long next, struct CaptureRingFrame *frame);
+extern int CheckRingFrame(struct CaptureRing *ring, const struct CaptureRingFrame *frame);
+extern struct CaptureRing *OpenBrokerRing(const char *socketpath, int deviceno, int width, int height, int format);
+extern int AddCaptureSink(int device, const struct SimpleCapParamsEx *params);
+extern int RemoveCaptureSink(int device, int sink);
+extern void DoCaptureSink(int device, int sink);
+extern int IsCaptureSinkDone(int device, int sink);
+extern int SetCaptureRegion(int device, int left, int top, int width, int height);
+extern int GetCaptureRegion(int device, struct CaptureRegion *region);
+extern int DoCaptureBatch(int device, const struct CaptureRect *rects, int count, const struct SimpleCapParamsEx *params);
+extern int IsCaptureBatchDone(int device);
+extern int CaptureGroupFrames(const unsigned int *devices, int count, long long tolerance, int timeout, long long *timestamps);
+extern int GetCaptureStats(int device, struct CaptureStats *stats);
+extern void ResetCaptureStats(int device);
 
+#ifdef _WIN32
 BOOL APIENTRY DllMain(HANDLE hModule,
 	DWORD  ul_reason_for_call,
 	LPVOID lpReserved
@@ -27,11 +66,12 @@ BOOL APIENTRY DllMain(HANDLE hModule,
 {
 	return TRUE;
 }
+#endif
 
 
 extern "C" void __declspec(dllexport) getCaptureDeviceName(unsigned int deviceno, char *namebuffer, int bufferlength)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return;
 
 	GetCaptureDeviceName(deviceno, namebuffer, bufferlength);
@@ -44,7 +84,7 @@ extern "C" int __declspec(dllexport) ESCAPIDLLVersion()
 
 extern "C" int __declspec(dllexport) ESCAPIVersion()
 {
-	return 0x301; // ...and let's hope this one works better
+	return 0x302; // ...and let's hope this one works better
 }
 
 extern "C" int __declspec(dllexport) countCaptureDevices()
@@ -55,40 +95,52 @@ extern "C" int __declspec(dllexport) countCaptureDevices()
 
 extern "C" void __declspec(dllexport) initCOM()
 {
+#ifdef _WIN32
 	CoInitialize(NULL);
+#endif
 }
 
 extern "C" int __declspec(dllexport) initCapture(unsigned int deviceno, struct SimpleCapParams *aParams)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return 0;
 	if (aParams == NULL || aParams->mHeight <= 0 || aParams->mWidth <= 0 || aParams->mTargetBuf == 0)
 		return 0;
 	gDoCapture[deviceno] = 0;
-	gParams[deviceno] = *aParams;
+	gParams[deviceno].mTargetBuf = aParams->mTargetBuf;
+	gParams[deviceno].mWidth = aParams->mWidth;
+	gParams[deviceno].mHeight = aParams->mHeight;
+	gParams[deviceno].mStride = aParams->mWidth * 4;
+	gParams[deviceno].mFormat = CAPTURE_FORMAT_BGRA;
+	gParams[deviceno].mFlags = 0;
 	gOptions[deviceno] = 0;
+	gPyramidLevels[deviceno] = 1;
+	gTensors[deviceno].mTargetBuf = 0;
 	if (FAILED(InitDevice(deviceno))) return 0;
 	return 1;
 }
 
 extern "C" void __declspec(dllexport) deinitCapture(unsigned int deviceno)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return;
 	CleanupDevice(deviceno);
 }
 
 extern "C" void __declspec(dllexport) doCapture(unsigned int deviceno)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return;
 	CheckForFail(deviceno);
 	gDoCapture[deviceno] = -1;
+	CaptureRequested(deviceno);
+	if (TraceEnabled())
+		TraceInstant("doCapture", deviceno, 0);
 }
 
 extern "C" int __declspec(dllexport) isCaptureDone(unsigned int deviceno)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return 0;
 	CheckForFail(deviceno);
 	if (gDoCapture[deviceno] == 1)
@@ -98,51 +150,411 @@ extern "C" int __declspec(dllexport) isCaptureDone(unsigned int deviceno)
 
 extern "C" int __declspec(dllexport) getCaptureErrorLine(unsigned int deviceno)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return 0;
 	return GetErrorLine(deviceno);
 }
 
 extern "C" int __declspec(dllexport) getCaptureErrorCode(unsigned int deviceno)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return 0;
 	return GetErrorCode(deviceno);
 }
 
 extern "C" float __declspec(dllexport) getCapturePropertyValue(unsigned int deviceno, int prop)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return 0;
 	return GetProperty(deviceno, prop);
 }
 
 extern "C" int __declspec(dllexport) getCapturePropertyAuto(unsigned int deviceno, int prop)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return 0;
 	return GetPropertyAuto(deviceno, prop);
 }
 
 extern "C" int __declspec(dllexport) setCaptureProperty(unsigned int deviceno, int prop, float value, int autoval)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return 0;
 	return SetProperty(deviceno, prop, value, autoval);
 }
 
 extern "C" int __declspec(dllexport) initCaptureWithOptions(unsigned int deviceno, struct SimpleCapParams *aParams, unsigned int aOptions)
 {
-	if (deviceno > MAXDEVICES)
+	if (deviceno >= MAXDEVICES)
 		return 0;
 	if (aParams == NULL || aParams->mHeight <= 0 || aParams->mWidth <= 0 || aParams->mTargetBuf == 0)
 		return 0;
 	if ((aOptions & CAPTURE_OPTIONS_MASK) != aOptions)
 		return 0;
+	if ((aOptions & CAPTURE_OPTION_RAWDATA) && (aOptions & CAPTURE_OPTION_RGBA))
+		return 0;
+	gDoCapture[deviceno] = 0;
+	gParams[deviceno].mTargetBuf = aParams->mTargetBuf;
+	gParams[deviceno].mWidth = aParams->mWidth;
+	gParams[deviceno].mHeight = aParams->mHeight;
+	gParams[deviceno].mStride = aParams->mWidth * 4;
+	gParams[deviceno].mFormat = (aOptions & CAPTURE_OPTION_RGBA) ? CAPTURE_FORMAT_RGBA : CAPTURE_FORMAT_BGRA;
+	gParams[deviceno].mFlags = 0;
+	gOptions[deviceno] = aOptions;
+	gPyramidLevels[deviceno] = 1;
+	gTensors[deviceno].mTargetBuf = 0;
+	if (FAILED(InitDevice(deviceno))) return 0;
+	return 1;
+}
+
+static int InitCaptureEx(unsigned int deviceno, struct SimpleCapParamsEx *aParams, unsigned int aOptions, int aLevels,
+	const struct CaptureTensorParams *aTensor)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	if (aParams == NULL || aParams->mHeight <= 0 || aParams->mWidth <= 0 || aParams->mTargetBuf == 0)
+		return 0;
+	if ((aOptions & CAPTURE_OPTIONS_MASK) != aOptions || (aOptions & CAPTURE_OPTION_RGBA))
+		return 0;
+	if ((aParams->mFlags & CAPTURE_FLAGS_MASK) != aParams->mFlags)
+		return 0;
+	if ((aParams->mFlags & CAPTURE_FLAG_BT601) && (aParams->mFlags & CAPTURE_FLAG_BT709))
+		return 0;
+	if ((aParams->mFlags & CAPTURE_FLAG_LIMITED_RANGE) && (aParams->mFlags & CAPTURE_FLAG_FULL_RANGE))
+		return 0;
+	int minstride = MinimumStride(aParams->mFormat, aParams->mWidth);
+	if (minstride == 0)
+		return 0;
+	if (aParams->mStride != 0 && aParams->mStride < minstride)
+		return 0;
+	if ((aParams->mFormat == CAPTURE_FORMAT_I420 || aParams->mFormat == CAPTURE_FORMAT_NV12) &&
+		((aParams->mWidth | aParams->mHeight) & 1))
+		return 0;
+	if ((aOptions & CAPTURE_OPTION_RAWDATA) && aParams->mFormat != CAPTURE_FORMAT_BGRA)
+		return 0;
 	gDoCapture[deviceno] = 0;
 	gParams[deviceno] = *aParams;
+	if (gParams[deviceno].mStride == 0)
+		gParams[deviceno].mStride = minstride;
 	gOptions[deviceno] = aOptions;
+	gPyramidLevels[deviceno] = aLevels;
+	if (aTensor)
+		gTensors[deviceno] = *aTensor;
+	else
+		gTensors[deviceno].mTargetBuf = 0;
 	if (FAILED(InitDevice(deviceno))) return 0;
 	return 1;
 }
 
+extern "C" int __declspec(dllexport) initCaptureEx(unsigned int deviceno, struct SimpleCapParamsEx *aParams, unsigned int aOptions)
+{
+	return InitCaptureEx(deviceno, aParams, aOptions, 1, NULL);
+}
+
+extern "C" int __declspec(dllexport) getCapturePyramidLayout(int format, int width, int height, int stride, int levels, struct CapturePyramidInfo *info)
+{
+	if (info == NULL || width <= 0 || height <= 0)
+		return 0;
+	return DescribePyramid(format, width, height, stride, levels, info);
+}
+
+extern "C" int __declspec(dllexport) initCapturePyramid(unsigned int deviceno, struct SimpleCapParamsEx *aParams, unsigned int aOptions, int levels)
+{
+	struct CapturePyramidInfo info;
+	if (aParams == NULL || (aParams->mFlags & CAPTURE_FLAG_FLIP_VERTICAL) || (aOptions & CAPTURE_OPTION_RAWDATA))
+		return 0;
+	if (!getCapturePyramidLayout(aParams->mFormat, aParams->mWidth, aParams->mHeight, aParams->mStride, levels, &info))
+		return 0;
+	return InitCaptureEx(deviceno, aParams, aOptions, levels, NULL);
+}
+
+extern "C" int __declspec(dllexport) initCaptureTensor(unsigned int deviceno, struct CaptureTensorParams *aParams, unsigned int aOptions)
+{
+	if (aParams == NULL || aParams->mHeight <= 0 || aParams->mWidth <= 0 || aParams->mTargetBuf == 0)
+		return 0;
+	if (TensorWriter::ElementSize(aParams->mType) == 0 || (aOptions & CAPTURE_OPTION_RAWDATA))
+		return 0;
+	if ((aParams->mFlags & CAPTURE_TENSOR_FLAGS_MASK) != aParams->mFlags)
+		return 0;
+	if (!(aParams->mStd[0] != 0 && aParams->mStd[1] != 0 && aParams->mStd[2] != 0))
+		return 0;
+
+	// The device sees a BGRA target of the tensor's size, which the
+	// tensor is filled from instead of being scaled into.
+	struct SimpleCapParamsEx params;
+	params.mTargetBuf = aParams->mTargetBuf;
+	params.mWidth = aParams->mWidth;
+	params.mHeight = aParams->mHeight;
+	params.mStride = 0;
+	params.mFormat = CAPTURE_FORMAT_BGRA;
+	params.mFlags = 0;
+	return InitCaptureEx(deviceno, &params, aOptions, 1, aParams);
+}
+
+extern "C" int __declspec(dllexport) getCaptureFrameInfo(unsigned int deviceno, struct CaptureFrameInfo *aInfo)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return GetFrameInfo(deviceno, aInfo);
+}
+
+extern "C" int __declspec(dllexport) addCaptureSink(unsigned int deviceno, struct SimpleCapParamsEx *aParams)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	if (aParams == NULL || aParams->mHeight <= 0 || aParams->mWidth <= 0 || aParams->mTargetBuf == 0)
+		return 0;
+	if ((aParams->mFlags & CAPTURE_FLAG_FLIP_VERTICAL) != aParams->mFlags)
+		return 0;
+	int minstride = MinimumStride(aParams->mFormat, aParams->mWidth);
+	if (minstride == 0)
+		return 0;
+	if (aParams->mStride != 0 && aParams->mStride < minstride)
+		return 0;
+	if ((aParams->mFormat == CAPTURE_FORMAT_I420 || aParams->mFormat == CAPTURE_FORMAT_NV12) &&
+		((aParams->mWidth | aParams->mHeight) & 1))
+		return 0;
+	struct SimpleCapParamsEx params = *aParams;
+	if (params.mStride == 0)
+		params.mStride = minstride;
+	return AddCaptureSink(deviceno, &params);
+}
+
+extern "C" int __declspec(dllexport) removeCaptureSink(unsigned int deviceno, int sink)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return RemoveCaptureSink(deviceno, sink);
+}
+
+extern "C" void __declspec(dllexport) doCaptureSink(unsigned int deviceno, int sink)
+{
+	if (deviceno >= MAXDEVICES)
+		return;
+	if (sink == 0)
+	{
+		doCapture(deviceno);
+		return;
+	}
+	CheckForFail(deviceno);
+	DoCaptureSink(deviceno, sink);
+}
+
+extern "C" int __declspec(dllexport) isCaptureSinkDone(unsigned int deviceno, int sink)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	if (sink == 0)
+		return isCaptureDone(deviceno);
+	CheckForFail(deviceno);
+	return IsCaptureSinkDone(deviceno, sink);
+}
+
+extern "C" int __declspec(dllexport) setCaptureRegion(unsigned int deviceno, int left, int top, int width, int height)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	if (left < 0 || top < 0 || width < 0 || height < 0 || (width == 0) != (height == 0))
+		return 0;
+	return SetCaptureRegion(deviceno, left, top, width, height);
+}
+
+extern "C" int __declspec(dllexport) getCaptureRegion(unsigned int deviceno, struct CaptureRegion *region)
+{
+	if (deviceno >= MAXDEVICES || region == NULL)
+		return 0;
+	return GetCaptureRegion(deviceno, region);
+}
+
+extern "C" int __declspec(dllexport) doCaptureBatch(unsigned int deviceno, const struct CaptureRect *rects, int count, struct SimpleCapParamsEx *crops)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	if (rects == NULL || count < 1 || count > CAPTURE_MAX_BATCH)
+		return 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (rects[i].mLeft < 0 || rects[i].mTop < 0 || rects[i].mWidth <= 0 || rects[i].mHeight <= 0 ||
+			rects[i].mWidth > 0x7fffffff - rects[i].mLeft || rects[i].mHeight > 0x7fffffff - rects[i].mTop)
+			return 0;
+	}
+	if (crops == NULL || crops->mHeight <= 0 || crops->mWidth <= 0 || crops->mTargetBuf == 0 || crops->mFlags != 0)
+		return 0;
+	int minstride = MinimumStride(crops->mFormat, crops->mWidth);
+	if (minstride == 0)
+		return 0;
+	if (crops->mStride != 0 && crops->mStride < minstride)
+		return 0;
+
+	struct SimpleCapParamsEx params = *crops;
+	if (params.mStride == 0)
+		params.mStride = minstride;
+	return DoCaptureBatch(deviceno, rects, count, &params);
+}
+
+extern "C" int __declspec(dllexport) isCaptureBatchDone(unsigned int deviceno)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return IsCaptureBatchDone(deviceno);
+}
+
+extern "C" int __declspec(dllexport) captureGroup(const unsigned int *devices, int count, int tolerance, int timeout, long long *timestamps)
+{
+	if (devices == NULL || count < 1 || count > CAPTURE_MAX_GROUP || tolerance < 0 || timeout < 0)
+		return 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (devices[i] >= MAXDEVICES)
+			return 0;
+		for (int j = 0; j < i; j++)
+		{
+			if (devices[j] == devices[i])
+				return 0;
+		}
+	}
+	return CaptureGroupFrames(devices, count, tolerance, timeout, timestamps);
+}
+
+extern "C" int __declspec(dllexport) getCaptureStats(unsigned int deviceno, struct CaptureStats *stats)
+{
+	if (deviceno >= MAXDEVICES || stats == NULL)
+		return 0;
+	return GetCaptureStats(deviceno, stats);
+}
+
+extern "C" void __declspec(dllexport) resetCaptureStats(unsigned int deviceno)
+{
+	if (deviceno >= MAXDEVICES)
+		return;
+	ResetCaptureStats(deviceno);
+}
+
+extern "C" int __declspec(dllexport) startCaptureTrace(int events)
+{
+	return TraceStart(events);
+}
+
+extern "C" void __declspec(dllexport) stopCaptureTrace()
+{
+	TraceStop();
+}
+
+extern "C" int __declspec(dllexport) saveCaptureTrace(const char *filename)
+{
+	if (filename == NULL)
+		return 0;
+	return TraceSave(filename);
+}
+
+extern "C" void __declspec(dllexport) traceCaptureSpan(const char *name, int begin)
+{
+	if (!begin)
+		TraceEnd();
+	else if (name)
+		TraceBegin(name);
+}
+
+extern "C" int __declspec(dllexport) setTestPatternDevice(int enable, int width, int height, int fps, int format)
+{
+	return SetTestPatternDevice(enable, width, height, fps, format);
+}
+
+extern "C" int __declspec(dllexport) getTestPatternFrameNumber(unsigned int deviceno)
+{
+	if (deviceno >= MAXDEVICES)
+		return -1;
+	return GetTestPatternFrameNumber(deviceno);
+}
+
+extern "C" int __declspec(dllexport) setFileDevice(const char *filename, int width, int height, int fps, int format)
+{
+	return SetFileDevice(filename, width, height, fps, format);
+}
+
+extern "C" int __declspec(dllexport) startRecording(unsigned int deviceno, const char *filename, int container, int queueframes, unsigned int flags)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return StartRecording(deviceno, filename, container, queueframes, flags);
+}
+
+extern "C" int __declspec(dllexport) stopRecording(unsigned int deviceno)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return StopRecording(deviceno);
+}
+
+extern "C" int __declspec(dllexport) getRecordingStats(unsigned int deviceno, struct CaptureRecordingStats *stats)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return GetRecordingStats(deviceno, stats);
+}
+
+extern "C" __declspec(dllexport) struct CaptureArchive *openArchive(const char *filename)
+{
+	return OpenArchive(filename);
+}
+
+extern "C" void __declspec(dllexport) closeArchive(struct CaptureArchive *archive)
+{
+	CloseArchive(archive);
+}
+
+extern "C" int __declspec(dllexport) getArchiveFrameCount(struct CaptureArchive *archive)
+{
+	return GetArchiveFrameCount(archive);
+}
+
+extern "C" int __declspec(dllexport) findArchiveFrame(struct CaptureArchive *archive, long long timestamp)
+{
+	return FindArchiveFrame(archive, timestamp);
+}
+
+extern "C" int __declspec(dllexport) getArchiveFrame(struct CaptureArchive *archive, int frame, struct CaptureArchiveFrame *info)
+{
+	return GetArchiveFrame(archive, frame, info);
+}
+
+extern "C" int __declspec(dllexport) startPublishing(unsigned int deviceno, const char *name, int slots)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return StartPublishing(deviceno, name, slots);
+}
+
+extern "C" int __declspec(dllexport) stopPublishing(unsigned int deviceno)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return StopPublishing(deviceno);
+}
+
+extern "C" __declspec(dllexport) struct CaptureRing *openCaptureRing(const char *name)
+{
+	return OpenCaptureRing(name);
+}
+
+extern "C" void __declspec(dllexport) closeCaptureRing(struct CaptureRing *ring)
+{
+	CloseCaptureRing(ring);
+}
+
+extern "C" int __declspec(dllexport) getRingFrame(struct CaptureRing *ring, unsigned long long next, struct CaptureRingFrame *frame)
+{
+	return GetRingFrame(ring, next, frame);
+}
+
+extern "C" int __declspec(dllexport) checkRingFrame(struct CaptureRing *ring, const struct CaptureRingFrame *frame)
+{
+	return CheckRingFrame(ring, frame);
+}
+
+extern "C" __declspec(dllexport) struct CaptureRing *openBrokerRing(const char *socketpath, unsigned int deviceno, int width, int height, int format)
+{
+	if (deviceno >= MAXDEVICES)
+		return 0;
+	return OpenBrokerRing(socketpath, deviceno, width, height, format);
+}
@@ -0,0 +1,346 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "conversion.h"
+#include "scaling.h"
+#include "capture.h"
+#include "filebackend.h"
+
+FileSettings gFile = { 0, "", 0, 0, -1, CAPTURE_FILE_Y4M };
+FileBackend gFileBackend;
+
+#define DO_OR_DIE { if (mCapture->mErrorLine) return hr; if (!SUCCEEDED(hr)) { mCapture->mErrorLine = __LINE__; mCapture->mErrorCode = hr; return hr; } }
+#define DO_OR_DIE_CRITSECTION { if (mCapture->mErrorLine) { LeaveCriticalSection(&mCapture->mCritsec); return hr;} if (!SUCCEEDED(hr)) { LeaveCriticalSection(&mCapture->mCritsec); mCapture->mErrorLine = __LINE__; mCapture->mErrorCode = hr; return hr; } }
+
+struct FileFormat
+{
+	const char *mName;
+	DWORD mSubtype;
+	int mBytesPerPixel;  // Of the first plane
+	int mChromaPlanes;   // Bytes of the chroma planes, in quarters of the first one
+};
+
+// Indexed by CAPTURE_FILE_FORMATS
+static const FileFormat gFileFormats[CAPTURE_FILE_MAX] =
+{
+	{ "Y4M", SUBTYPE_I420, 1, 2 },
+	{ "YUY2", SUBTYPE_YUY2, 2, 0 },
+	{ "NV12", SUBTYPE_NV12, 1, 2 },
+	{ "I420", SUBTYPE_I420, 1, 2 }
+};
+
+// Raw files have no frame rate of their own
+#define RAW_FILE_FPS 30
+
+static const char gY4MSignature[] = "YUV4MPEG2 ";
+
+// setFileDevice takes precedence over the environment
+static int gFileConfigured = 0;
+
+
+int SetFileDevice(const char *aPath, int aWidth, int aHeight, int aFps, int aFormat)
+{
+	if (aPath)
+	{
+		if (strlen(aPath) >= sizeof(gFile.mPath) || aFps < -1 || aFormat < 0 || aFormat >= CAPTURE_FILE_MAX)
+			return 0;
+		if (aFormat != CAPTURE_FILE_Y4M &&
+			(aWidth < 2 || aHeight < 2 || aWidth > 16384 || aHeight > 16384 || ((aWidth | aHeight) & 1)))
+			return 0;
+		strcpy(gFile.mPath, aPath);
+		gFile.mWidth = aWidth;
+		gFile.mHeight = aHeight;
+		gFile.mFps = aFps;
+		gFile.mFormat = aFormat;
+	}
+	gFile.mEnabled = aPath ? 1 : 0;
+	gFileConfigured = 1;
+	return 1;
+}
+
+// ESCAPI_FILE is the file name. ESCAPI_FILE_FORMAT may add "@FPS" for a
+// Y4M file, or "WIDTHxHEIGHT[@FPS][,FORMAT]" for a raw one, for example
+// "1280x720@0,NV12".
+static void ReadFileEnvironment()
+{
+	if (gFileConfigured)
+		return;
+	gFileConfigured = 1;
+
+	char path[sizeof(gFile.mPath)];
+	DWORD len = GetEnvironmentVariableA("ESCAPI_FILE", path, sizeof(path));
+	if (len == 0 || len >= sizeof(path))
+		return;
+
+	char value[64] = "";
+	len = GetEnvironmentVariableA("ESCAPI_FILE_FORMAT", value, sizeof(value));
+	if (len >= sizeof(value))
+		return;
+
+	int width = 0, height = 0, fps = -1, format = CAPTURE_FILE_Y4M;
+	if (value[0] == '@')
+	{
+		sscanf(value, "@%d", &fps);
+	}
+	else if (value[0])
+	{
+		char name[16] = "";
+		const char *rest = strchr(value, ',');
+		if (sscanf(value, "%dx%d@%d", &width, &height, &fps) < 2)
+			return;
+		format = CAPTURE_FILE_YUY2;
+		if (rest && sscanf(rest + 1, "%15s", name) == 1)
+		{
+			for (format = 0; format < CAPTURE_FILE_MAX; format++)
+			{
+				if (!_stricmp(name, gFileFormats[format].mName))
+					break;
+			}
+		}
+	}
+	SetFileDevice(path, width, height, fps, format);
+}
+
+int FileBackend::countDevices()
+{
+	ReadFileEnvironment();
+	return gFile.mEnabled;
+}
+
+void FileBackend::getDeviceName(int aDevice, char *aNamebuffer, int aBufferlength)
+{
+	const char *name = gFile.mPath;
+	for (const char *c = gFile.mPath; *c; c++)
+	{
+		if (*c == '/' || *c == '\\')
+			name = c + 1;
+	}
+	snprintf(aNamebuffer, aBufferlength, "ESCAPI file %s", name);
+}
+
+CaptureStream *FileBackend::createStream(int aDevice)
+{
+	return new FileStream;
+}
+
+FileStream::FileStream()
+{
+	mCapture = 0;
+	mFrameSize = 0;
+	mStride = 0;
+	mFps = 0;
+	mQuit = 0;
+}
+
+FileStream::~FileStream()
+{
+	stop();
+}
+
+// YUV4MPEG2: a header line of space separated tags, then each frame as a
+// "FRAME" line followed by the planes. Only the 4:2:0 colour spaces are
+// supported, which are I420 in memory.
+HRESULT FileStream::parseY4M(VideoFormat &aFormat)
+{
+	const char *text = (const char *)mFile.mData;
+	size_t size = mFile.mSize;
+	size_t pos = sizeof(gY4MSignature) - 1;
+
+	if (size < pos || memcmp(text, gY4MSignature, pos))
+		return MF_E_INVALIDMEDIATYPE;
+
+	int width = 0, height = 0, rate = 0, scale = 0, range = 0;
+	BOOL supported = TRUE;
+	while (pos < size && text[pos] != '\n')
+	{
+		char tag[32];
+		size_t len = 0;
+		while (pos < size && text[pos] != ' ' && text[pos] != '\n')
+		{
+			if (len < sizeof(tag) - 1)
+				tag[len++] = text[pos];
+			pos++;
+		}
+		tag[len] = 0;
+		if (pos < size && text[pos] == ' ')
+			pos++;
+
+		switch (tag[0])
+		{
+		case 'W': width = atoi(tag + 1); break;
+		case 'H': height = atoi(tag + 1); break;
+		case 'F': sscanf(tag + 1, "%d:%d", &rate, &scale); break;
+		case 'C':
+			// 8 bit 4:2:0 in any chroma siting; C420p10 and the like aren't
+			supported = !strcmp(tag + 1, "420") || !strcmp(tag + 1, "420jpeg") ||
+				!strcmp(tag + 1, "420paldv") || !strcmp(tag + 1, "420mpeg2");
+			break;
+		case 'X': range = !strcmp(tag + 1, "COLORRANGE=FULL"); break;
+		}
+	}
+	pos++;
+
+	if (!supported || width < 2 || height < 2 || width > 16384 || height > 16384 || ((width | height) & 1))
+		return MF_E_INVALIDMEDIATYPE;
+
+	aFormat.mSubtype = SUBTYPE_I420;
+	aFormat.mWidth = width;
+	aFormat.mHeight = height;
+	aFormat.mMatrix = range ? YCBCR_BT601_FULL : YCBCR_BT601;
+	mStride = width;
+	mFrameSize = width * height * 3 / 2;
+	mFps = rate > 0 && scale > 0 ? (double)rate / scale : RAW_FILE_FPS;
+
+	// Frame headers may carry tags too, so each one has to be found; a
+	// cut off frame at the end is left out.
+	while (pos + 5 < size && !memcmp(text + pos, "FRAME", 5))
+	{
+		const char *end = (const char *)memchr(text + pos, '\n', size - pos);
+		if (!end)
+			break;
+		pos = end - text + 1;
+		if (size - pos < mFrameSize)
+			break;
+		mFrames.push_back(pos);
+		pos += mFrameSize;
+	}
+	return S_OK;
+}
+
+HRESULT FileStream::indexRaw(VideoFormat &aFormat)
+{
+	const FileFormat &format = gFileFormats[gFile.mFormat];
+	aFormat.mSubtype = format.mSubtype;
+	aFormat.mWidth = gFile.mWidth;
+	aFormat.mHeight = gFile.mHeight;
+	aFormat.mMatrix = YCBCR_BT601;
+	mStride = gFile.mWidth * format.mBytesPerPixel;
+	mFrameSize = mStride * gFile.mHeight * (4 + format.mChromaPlanes) / 4;
+	mFps = RAW_FILE_FPS;
+
+	for (size_t pos = 0; mFile.mSize - pos >= mFrameSize; pos += mFrameSize)
+	{
+		mFrames.push_back(pos);
+	}
+	return S_OK;
+}
+
+HRESULT FileStream::start(CaptureClass *aCapture)
+{
+	HRESULT hr = S_OK;
+	mCapture = aCapture;
+
+	VideoFormat format;
+	mFrames.clear();
+	hr = mFile.open(gFile.mPath);
+
+	DO_OR_DIE;
+
+	if (mFile.mSize >= sizeof(gY4MSignature) - 1 && !memcmp(mFile.mData, gY4MSignature, sizeof(gY4MSignature) - 1))
+	{
+		hr = parseY4M(format);
+	}
+	else if (gFile.mFormat != CAPTURE_FILE_Y4M)
+	{
+		hr = indexRaw(format);
+	}
+	else
+	{
+		hr = MF_E_INVALIDMEDIATYPE;
+	}
+
+	DO_OR_DIE;
+
+	if (mFrames.empty() || !mCapture->isFormatSupported(format.mSubtype))
+	{
+		hr = MF_E_INVALIDMEDIATYPE;
+	}
+
+	DO_OR_DIE;
+
+	if (gFile.mFps >= 0)
+	{
+		mFps = gFile.mFps;
+	}
+
+	EnterCriticalSection(&mCapture->mCritsec);
+
+	hr = mCapture->setVideoFormat(format);
+
+	DO_OR_DIE_CRITSECTION;
+
+	mQuit = 0;
+	mThread = std::thread(&FileStream::run, this);
+
+	LeaveCriticalSection(&mCapture->mCritsec);
+
+	return hr;
+}
+
+void FileStream::stop()
+{
+	if (mThread.joinable())
+	{
+		mQuit = 1;
+		mCapture->requestMade();
+		mThread.join();
+	}
+	mFile.close();
+}
+
+int FileStream::setProperty(int aProperty, float aValue, int aAuto)
+{
+	// Recordings have no properties
+	return 0;
+}
+
+int FileStream::getProperty(int aProperty, float &aValue, int &aAuto)
+{
+	return 1;
+}
+
+void FileStream::run()
+{
+	std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(mFps ? 1.0 / mFps : 0));
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	size_t frame = 0;
+
+	while (!mQuit)
+	{
+		if (mFps)
+		{
+			// Same pacing as the test pattern: frames are dropped while
+			// nobody asks for them, and a stall doesn't make up for them.
+			std::this_thread::sleep_until(next);
+			next += period;
+			if (std::chrono::steady_clock::now() > next)
+				next = std::chrono::steady_clock::now();
+		}
+		else
+		{
+			mCapture->waitForRequest(mQuit);
+			if (mQuit)
+				break;
+		}
+
+		EnterCriticalSection(&mCapture->mCritsec);
+		long long timestamp = CaptureClock();
+		mCapture->frameArrived(timestamp);
+		if (mCapture->wantsFrame())
+		{
+			const BYTE *data = mFile.mData + mFrames[frame];
+			mCapture->deliverFrame(data, mFrameSize, data, mStride, timestamp);
+		}
+		LeaveCriticalSection(&mCapture->mCritsec);
+
+		if (++frame == mFrames.size())
+			frame = 0;
+	}
+}
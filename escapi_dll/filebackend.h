@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "backend.h"
+#include "mappedfile.h"
+
+// The virtual device that setFileDevice (or the ESCAPI_FILE environment
+// variable) adds after the test pattern, which replays recorded frames
+struct FileSettings
+{
+	int   mEnabled;
+	char  mPath[1024];
+	int   mWidth;     // Of raw files; Y4M files have it in their header
+	int   mHeight;
+	int   mFps;       // 0 delivers a frame for each request, -1 uses the file's own rate
+	int   mFormat;    // One of CAPTURE_FILE_FORMATS
+};
+
+extern FileSettings gFile;
+
+// Delivers the frames of a mapped file on its own thread, from the start
+// again after the last one
+class FileStream : public CaptureStream
+{
+public:
+	FileStream();
+	~FileStream();
+	HRESULT start(CaptureClass *aCapture);
+	void stop();
+	int setProperty(int aProperty, float aValue, int aAuto);
+	int getProperty(int aProperty, float &aValue, int &aAuto);
+	HRESULT parseY4M(VideoFormat &aFormat);
+	HRESULT indexRaw(VideoFormat &aFormat);
+	void run();
+
+	CaptureClass            *mCapture;
+	MappedFile              mFile;
+	std::vector<size_t>     mFrames;       // Offset of each frame's pixels in the file
+	DWORD                   mFrameSize;
+	LONG                    mStride;
+	double                  mFps;
+	std::thread             mThread;
+	std::atomic<int>        mQuit;
+};
+
+class FileBackend : public CaptureBackend
+{
+public:
+	int countDevices();
+	void getDeviceName(int aDevice, char *aNamebuffer, int aBufferlength);
+	CaptureStream *createStream(int aDevice);
+};
+
+extern FileBackend gFileBackend;
+
+int SetFileDevice(const char *aPath, int aWidth, int aHeight, int aFps, int aFormat);
@@ -0,0 +1,509 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+#include "scaling.h"
+#include "framering.h"
+#include "brokerprotocol.h"
+
+// Ring names become "Local\escapi_NAME" file mappings on Windows, and
+// "/escapi_NAME" POSIX shared memory elsewhere.
+static int RingObjectName(char *aBuffer, size_t aSize, const char *aName)
+{
+	size_t len = aName ? strlen(aName) : 0;
+	if (len == 0 || len > 64 || strchr(aName, '/') || strchr(aName, '\\'))
+		return 0;
+#ifdef _WIN32
+	snprintf(aBuffer, aSize, "Local\\escapi_%s", aName);
+#else
+	snprintf(aBuffer, aSize, "/escapi_%s", aName);
+#endif
+	return 1;
+}
+
+SharedMemory::SharedMemory()
+{
+	mData = 0;
+	mSize = 0;
+#ifdef _WIN32
+	mMapping = 0;
+#else
+	mName[0] = 0;
+	mFd = -1;
+#endif
+}
+
+SharedMemory::~SharedMemory()
+{
+	close();
+}
+
+#ifdef _WIN32
+HRESULT SharedMemory::create(const char *aName, size_t aSize)
+{
+	char name[80];
+	if (!RingObjectName(name, sizeof(name), aName))
+		return E_INVALIDARG;
+
+	mMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE,
+		(DWORD)((unsigned long long)aSize >> 32), (DWORD)aSize, name);
+	if (!mMapping)
+		return HRESULT_FROM_WIN32(GetLastError());
+	if (GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		// Another process publishes under this name
+		close();
+		return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+	}
+
+	mData = (BYTE *)MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, aSize);
+	if (!mData)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		close();
+		return hr;
+	}
+	mSize = aSize;
+	return S_OK;
+}
+
+HRESULT SharedMemory::open(const char *aName)
+{
+	char name[80];
+	if (!RingObjectName(name, sizeof(name), aName))
+		return E_INVALIDARG;
+
+	mMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if (!mMapping)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	mData = (BYTE *)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+	if (!mData || !VirtualQuery(mData, &info, sizeof(info)))
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		close();
+		return hr;
+	}
+	mSize = info.RegionSize;
+	return S_OK;
+}
+
+void SharedMemory::close()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+	if (mMapping)
+		CloseHandle(mMapping);
+	mData = 0;
+	mSize = 0;
+	mMapping = 0;
+}
+#else
+// Unlinks shared memory left behind under aName by a publisher that is
+// gone, and returns 1 if it did. A live publisher keeps it locked, and
+// only a holder of the lock unlinks the name, so the name can't be taken
+// over between checking that it still refers to the locked memory and
+// unlinking it. Memory of no size yet is a publisher that hasn't locked
+// it yet.
+static int ReclaimName(const char *aName)
+{
+	int fd = shm_open(aName, O_RDWR, 0);
+	if (fd < 0)
+		return errno == ENOENT;
+
+	int reclaimed = 0;
+	if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+	{
+		struct stat locked, named;
+		int again = shm_open(aName, O_RDONLY, 0);
+		if (again >= 0 && fstat(fd, &locked) == 0 && fstat(again, &named) == 0 &&
+			locked.st_size > 0 && locked.st_dev == named.st_dev && locked.st_ino == named.st_ino)
+			reclaimed = shm_unlink(aName) == 0;
+		if (again >= 0)
+			::close(again);
+	}
+	::close(fd);
+	if (!reclaimed)
+		errno = EEXIST;
+	return reclaimed;
+}
+
+HRESULT SharedMemory::create(const char *aName, size_t aSize)
+{
+	if (!RingObjectName(mName, sizeof(mName), aName))
+		return E_INVALIDARG;
+
+	// The publisher holds a lock on its memory for as long as it lives, so
+	// the name is only taken over from one that is gone (crashed, as it
+	// unlinks the name on close).
+	int fd = shm_open(mName, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 && errno == EEXIST && ReclaimName(mName))
+		fd = shm_open(mName, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+	{
+		mName[0] = 0;
+		return HRESULT_FROM_ERRNO(errno);
+	}
+	mFd = fd;
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		HRESULT hr = HRESULT_FROM_ERRNO(errno);
+		close();
+		return hr;
+	}
+
+	void *data = MAP_FAILED;
+	if (ftruncate(fd, aSize) == 0)
+		data = mmap(0, aSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		HRESULT hr = HRESULT_FROM_ERRNO(errno);
+		close();
+		return hr;
+	}
+	mData = (BYTE *)data;
+	mSize = aSize;
+	return S_OK;
+}
+
+HRESULT SharedMemory::open(const char *aName)
+{
+	char name[80];
+	if (!RingObjectName(name, sizeof(name), aName))
+		return E_INVALIDARG;
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return HRESULT_FROM_ERRNO(errno);
+
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	HRESULT hr = data == MAP_FAILED ? HRESULT_FROM_ERRNO(errno) : S_OK;
+	::close(fd);
+	if (FAILED(hr))
+		return hr;
+	mData = (BYTE *)data;
+	mSize = st.st_size;
+	return S_OK;
+}
+
+#ifdef __linux__
+HRESULT SharedMemory::createAnonymous(size_t aSize)
+{
+	mFd = memfd_create("escapi_ring", MFD_CLOEXEC);
+	if (mFd < 0)
+		return HRESULT_FROM_ERRNO(errno);
+
+	void *data = MAP_FAILED;
+	if (ftruncate(mFd, aSize) == 0)
+		data = mmap(0, aSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+	if (data == MAP_FAILED)
+	{
+		HRESULT hr = HRESULT_FROM_ERRNO(errno);
+		close();
+		return hr;
+	}
+	mData = (BYTE *)data;
+	mSize = aSize;
+	return S_OK;
+}
+
+HRESULT SharedMemory::attach(int aFd)
+{
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (fstat(aFd, &st) == 0 && st.st_size > 0)
+		data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, aFd, 0);
+	if (data == MAP_FAILED)
+		return HRESULT_FROM_ERRNO(errno);
+	mData = (BYTE *)data;
+	mSize = st.st_size;
+	return S_OK;
+}
+#endif
+
+void SharedMemory::close()
+{
+	if (mData)
+		munmap(mData, mSize);
+	// Readers keep their mappings; the name goes away with the publisher,
+	// before its lock on the memory does.
+	if (mName[0])
+		shm_unlink(mName);
+	if (mFd >= 0)
+		::close(mFd);
+	mData = 0;
+	mSize = 0;
+	mName[0] = 0;
+	mFd = -1;
+}
+#endif
+
+HRESULT FrameRingPublisher::open(const char *aName, int aSlots, int aFormat, int aWidth, int aHeight)
+{
+	if (aSlots == 0)
+		aSlots = RING_DEFAULT_SLOTS;
+	if (aSlots < 2 || aSlots > RING_MAX_SLOTS)
+		return E_INVALIDARG;
+
+	DWORD frameBytes = PackedFrameSize(aFormat, aWidth, aHeight);
+	DWORD slotSize = (sizeof(RingSlot) + frameBytes + RING_ALIGN - 1) & ~(DWORD)(RING_ALIGN - 1);
+	size_t size = RING_ALIGN + (size_t)slotSize * aSlots;
+#ifdef __linux__
+	HRESULT hr = aName ? mMemory.create(aName, size) : mMemory.createAnonymous(size);
+#else
+	HRESULT hr = mMemory.create(aName, size);
+#endif
+	if (FAILED(hr))
+		return hr;
+
+	// New shared memory is zeroed: every slot is empty at version 0.
+	mHeader = (RingHeader *)mMemory.mData;
+	mHeader->mVersion = RING_VERSION;
+	mHeader->mSlotCount = aSlots;
+	mHeader->mSlotSize = slotSize;
+	mHeader->mFormat = aFormat;
+	mHeader->mWidth = aWidth;
+	mHeader->mHeight = aHeight;
+	mHeader->mStride = MinimumStride(aFormat, aWidth);
+	mHeader->mFrameBytes = frameBytes;
+	mHeader->mPublished.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(mHeader->mMagic, RING_MAGIC, 8);
+	mSlot = 0;
+	mSlotVersion = 0;
+	mPublished = 0;
+	return S_OK;
+}
+
+BYTE *FrameRingPublisher::beginFrame()
+{
+	mSlot = (RingSlot *)(mMemory.mData + RING_ALIGN + (size_t)(mPublished % mHeader->mSlotCount) * mHeader->mSlotSize);
+
+	mSlotVersion = mSlot->mVersion.load(std::memory_order_relaxed);
+	mSlot->mVersion.store(mSlotVersion + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	return (BYTE *)(mSlot + 1);
+}
+
+void FrameRingPublisher::endFrame(long long aTimestamp)
+{
+	mSlot->mLength.store(mHeader->mFrameBytes, std::memory_order_relaxed);
+	mSlot->mSequence.store(mPublished, std::memory_order_relaxed);
+	mSlot->mTimestamp.store(aTimestamp, std::memory_order_relaxed);
+
+	mSlot->mVersion.store(mSlotVersion + 2, std::memory_order_release);
+	mHeader->mPublished.store(++mPublished, std::memory_order_release);
+}
+
+void FrameRingPublisher::publish(const SimpleCapParamsEx &aParams, long long aTimestamp)
+{
+	PackFrame(beginFrame(), (const BYTE *)aParams.mTargetBuf, aParams.mFormat, aParams.mWidth, aParams.mHeight,
+		aParams.mStride, aParams.mFlags & CAPTURE_FLAG_FLIP_VERTICAL);
+	endFrame(aTimestamp);
+}
+
+FrameRingReader::FrameRingReader()
+{
+	mHeader = 0;
+#ifndef _WIN32
+	mSocket = -1;
+#endif
+}
+
+FrameRingReader::~FrameRingReader()
+{
+#ifndef _WIN32
+	if (mSocket >= 0)
+		::close(mSocket);
+#endif
+}
+
+HRESULT FrameRingReader::open(const char *aName)
+{
+	HRESULT hr = mMemory.open(aName);
+	if (FAILED(hr))
+		return hr;
+	return validate();
+}
+
+#ifdef __linux__
+HRESULT FrameRingReader::connect(const char *aSocket, int aDevice, int aWidth, int aHeight, int aFormat)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (!aSocket)
+		aSocket = BROKER_DEFAULT_SOCKET;
+	if (strlen(aSocket) >= sizeof(address.sun_path))
+		return E_INVALIDARG;
+	strcpy(address.sun_path, aSocket);
+
+	mSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (mSocket < 0 || ::connect(mSocket, (struct sockaddr *)&address, sizeof(address)) < 0)
+		return HRESULT_FROM_ERRNO(errno);
+
+	BrokerRequest request;
+	memset(&request, 0, sizeof(request));
+	memcpy(request.mMagic, BROKER_MAGIC, 8);
+	request.mVersion = BROKER_VERSION;
+	request.mDevice = aDevice;
+	request.mWidth = aWidth;
+	request.mHeight = aHeight;
+	request.mFormat = aFormat;
+	if (send(mSocket, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request))
+		return HRESULT_FROM_ERRNO(errno);
+
+	// The ring comes as ancillary data with the reply.
+	BrokerReply reply;
+	union
+	{
+		char mBuffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr mAlign;
+	} control;
+	struct iovec iov = { &reply, sizeof(reply) };
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control.mBuffer;
+	message.msg_controllen = sizeof(control.mBuffer);
+	ssize_t len = recvmsg(mSocket, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+
+	int fd = -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	HRESULT hr = E_FAIL;
+	if (len == sizeof(reply) && !memcmp(reply.mMagic, BROKER_MAGIC, 8) && reply.mResult == 1 && fd >= 0)
+		hr = mMemory.attach(fd);
+	if (fd >= 0)
+		::close(fd);
+	if (FAILED(hr))
+		return hr;
+	return validate();
+}
+#endif
+
+HRESULT FrameRingReader::validate()
+{
+	const RingHeader *header = (const RingHeader *)mMemory.mData;
+	if (mMemory.mSize < RING_ALIGN ||
+		memcmp(header->mMagic, RING_MAGIC, 8) ||
+		header->mVersion != RING_VERSION ||
+		header->mSlotCount < 2 || header->mSlotCount > RING_MAX_SLOTS ||
+		header->mSlotSize == 0 || header->mSlotSize % RING_ALIGN ||
+		header->mFrameBytes > header->mSlotSize - sizeof(RingSlot) ||
+		mMemory.mSize < RING_ALIGN + (size_t)header->mSlotSize * header->mSlotCount)
+	{
+		mMemory.close();
+		return MF_E_INVALIDMEDIATYPE;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	mHeader = header;
+	return S_OK;
+}
+
+const RingSlot *FrameRingReader::slot(unsigned long long aSequence) const
+{
+	return (const RingSlot *)(mMemory.mData + RING_ALIGN + (size_t)(aSequence % mHeader->mSlotCount) * mHeader->mSlotSize);
+}
+
+int FrameRingReader::getFrame(unsigned long long aNext, CaptureRingFrame &aFrame) const
+{
+	unsigned long long published = mHeader->mPublished.load(std::memory_order_acquire);
+	if (published == 0 || published <= aNext)
+		return 0;
+
+	// The newest frame is only being overwritten if the publisher went
+	// round the whole ring since reading mPublished; then it's a miss.
+	unsigned long long sequence = published - 1;
+	const RingSlot *s = slot(sequence);
+	DWORD version = s->mVersion.load(std::memory_order_acquire);
+	if (version & 1)
+		return 0;
+
+	aFrame.mSequence = s->mSequence.load(std::memory_order_relaxed);
+	aFrame.mTimestamp = s->mTimestamp.load(std::memory_order_relaxed);
+	aFrame.mLength = s->mLength.load(std::memory_order_relaxed);
+	aFrame.mFormat = mHeader->mFormat;
+	aFrame.mWidth = mHeader->mWidth;
+	aFrame.mHeight = mHeader->mHeight;
+	aFrame.mStride = mHeader->mStride;
+	aFrame.mData = s + 1;
+	aFrame.mSlot = (unsigned int)(sequence % mHeader->mSlotCount);
+	aFrame.mVersion = version;
+
+	return aFrame.mSequence == sequence && checkFrame(aFrame);
+}
+
+int FrameRingReader::checkFrame(const CaptureRingFrame &aFrame) const
+{
+	if (aFrame.mSlot >= mHeader->mSlotCount)
+		return 0;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot(aFrame.mSlot)->mVersion.load(std::memory_order_relaxed) == aFrame.mVersion;
+}
+
+struct CaptureRing *OpenBrokerRing(const char *aSocket, int aDevice, int aWidth, int aHeight, int aFormat)
+{
+#ifdef __linux__
+	FrameRingReader *reader = new FrameRingReader;
+	if (FAILED(reader->connect(aSocket, aDevice, aWidth, aHeight, aFormat)))
+	{
+		delete reader;
+		return 0;
+	}
+	return (struct CaptureRing *)reader;
+#else
+	// The broker needs Unix domain sockets and memfd
+	return 0;
+#endif
+}
+
+struct CaptureRing *OpenCaptureRing(const char *aName)
+{
+	FrameRingReader *reader = new FrameRingReader;
+	if (FAILED(reader->open(aName)))
+	{
+		delete reader;
+		return 0;
+	}
+	return (struct CaptureRing *)reader;
+}
+
+void CloseCaptureRing(struct CaptureRing *aRing)
+{
+	delete (FrameRingReader *)aRing;
+}
+
+int GetRingFrame(struct CaptureRing *aRing, unsigned long long aNext, struct CaptureRingFrame *aFrame)
+{
+	if (!aRing || !aFrame)
+		return 0;
+	return ((FrameRingReader *)aRing)->getFrame(aNext, *aFrame);
+}
+
+int CheckRingFrame(struct CaptureRing *aRing, const struct CaptureRingFrame *aFrame)
+{
+	if (!aRing || !aFrame)
+		return 0;
+	return ((FrameRingReader *)aRing)->checkFrame(*aFrame);
+}
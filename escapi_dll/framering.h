@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+
+struct SimpleCapParamsEx;
+
+// Shared memory frame ring (startPublishing), laid out as:
+//
+//   RingHeader, padded to RING_ALIGN bytes
+//   mSlotCount slots of mSlotSize bytes each: RingSlot, then the image
+//
+// Frame n goes to slot n % mSlotCount. Each slot is a seqlock: the
+// publisher makes mVersion odd, writes the slot, and makes it even again,
+// so a reader knows a frame is intact if mVersion was even and unchanged
+// from before it looked at the frame until after.
+
+#define RING_MAGIC "ESCAPIRG"
+#define RING_VERSION 1
+#define RING_ALIGN 4096
+#define RING_DEFAULT_SLOTS 4
+#define RING_MAX_SLOTS 64
+
+struct RingHeader
+{
+	char      mMagic[8];          // RING_MAGIC
+	DWORD     mVersion;
+	DWORD     mSlotCount;
+	DWORD     mSlotSize;          // A multiple of RING_ALIGN
+	DWORD     mFormat;            // CAPTURE_FORMATS of the images
+	DWORD     mWidth;
+	DWORD     mHeight;
+	DWORD     mStride;            // Of the first plane; rows are tightly packed
+	DWORD     mFrameBytes;
+	std::atomic<unsigned long long> mPublished;  // Frames so far; the newest is mPublished - 1
+	BYTE      mPadding[16];
+};
+
+struct RingSlot
+{
+	std::atomic<DWORD>              mVersion;     // Odd while being written
+	std::atomic<DWORD>              mLength;
+	std::atomic<unsigned long long> mSequence;
+	std::atomic<long long>          mTimestamp;   // Microseconds since 1970-01-01 UTC
+	BYTE      mPadding[40];
+};
+
+static_assert(sizeof(RingHeader) == 64, "ring header layout");
+static_assert(sizeof(RingSlot) == 64, "ring slot layout");
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "shared memory needs lock free atomics");
+
+// A named block of shared memory, or on Linux an unnamed one (memfd)
+// that is handed to other processes as a file descriptor
+class SharedMemory
+{
+public:
+	SharedMemory();
+	~SharedMemory();
+	HRESULT create(const char *aName, size_t aSize);
+	HRESULT open(const char *aName);
+#ifdef __linux__
+	HRESULT createAnonymous(size_t aSize);
+	HRESULT attach(int aFd);
+#endif
+	void close();
+
+	BYTE   *mData;
+	size_t mSize;
+#ifndef _WIN32
+	int    mFd;           // Kept open: to be passed on (createAnonymous), or locked while the name is ours (create)
+#endif
+private:
+#ifdef _WIN32
+	HANDLE mMapping;
+#else
+	char   mName[80];     // Unlinked on close, if created here
+#endif
+};
+
+// Publishes the frames of one device (or of one broker variant)
+class FrameRingPublisher
+{
+public:
+	// A NULL name creates an anonymous ring, whose memory.mFd is passed
+	// to the readers.
+	HRESULT open(const char *aName, int aSlots, int aFormat, int aWidth, int aHeight);
+	// aTimestamp is when the frame was taken, in microseconds since 1970
+	void publish(const SimpleCapParamsEx &aParams, long long aTimestamp);
+
+	// publish() in two halves, for writing the image straight into the
+	// slot: beginFrame returns where it goes, with rows of mHeader->mStride.
+	BYTE *beginFrame();
+	void endFrame(long long aTimestamp);
+
+	const SharedMemory &memory() const { return mMemory; }
+
+private:
+	SharedMemory            mMemory;
+	RingHeader              *mHeader;
+	RingSlot                *mSlot;       // Between beginFrame and endFrame
+	DWORD                   mSlotVersion;
+	unsigned long long      mPublished;
+};
+
+// Read side of the exported ring functions
+class FrameRingReader
+{
+public:
+	FrameRingReader();
+	~FrameRingReader();
+	HRESULT open(const char *aName);
+#ifdef __linux__
+	// Asks the broker at aSocket for a variant, and maps the ring it sends
+	HRESULT connect(const char *aSocket, int aDevice, int aWidth, int aHeight, int aFormat);
+#endif
+	int getFrame(unsigned long long aNext, struct CaptureRingFrame &aFrame) const;
+	int checkFrame(const struct CaptureRingFrame &aFrame) const;
+
+private:
+	const RingSlot *slot(unsigned long long aSequence) const;
+	HRESULT validate();
+
+	SharedMemory            mMemory;
+	const RingHeader        *mHeader;
+#ifndef _WIN32
+	int                     mSocket;      // Connection to the broker, if any
+#endif
+};
@@ -1,22 +1,78 @@
+#include "platform.h"
+
+#ifdef _WIN32
 #include <mfapi.h>
 #include <mfidl.h>
 #include <mfreadwrite.h>
+#endif
 
 #define ESCAPI_DEFINITIONS_ONLY
 #include "escapi.h"
 
 #include "conversion.h"
+#include "scaling.h"
+#include "pyramid.h"
+#include "mjpeg.h"
+#include "testpattern.h"
 #include "capture.h"
-#include "scopedrelease.h"
-#include "choosedeviceparam.h"
+#include "recorder.h"
+#include "framering.h"
+#include "tensor.h"
+#include "capturegroup.h"
+#include "capturetrace.h"
+#ifdef _WIN32
+#include "mfbackend.h"
+#endif
+#ifdef __linux__
+#include "v4l2backend.h"
+#endif
+#include "testpatternbackend.h"
+#include "filebackend.h"
 
 #define MAXDEVICES 16
 
-struct SimpleCapParams gParams[MAXDEVICES];
+struct SimpleCapParamsEx gParams[MAXDEVICES];
 CaptureClass *gDevice[MAXDEVICES] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 int gDoCapture[MAXDEVICES];
 int gOptions[MAXDEVICES];
+int gPyramidLevels[MAXDEVICES];     // 1 without a pyramid
+struct CaptureTensorParams gTensors[MAXDEVICES];  // mTargetBuf 0 without a tensor
+
+// The virtual devices come after the cameras, and work without any
+CaptureBackend *gBackends[] =
+{
+#ifdef _WIN32
+	&gMFBackend,
+#endif
+#ifdef __linux__
+	&gV4L2Backend,
+#endif
+	&gTestPatternBackend,
+	&gFileBackend
+};
+
+const int gBackendCount = sizeof(gBackends) / sizeof(gBackends[0]);
+
+// Finds the backend of a device, and turns aDevice into its number there.
+static CaptureBackend *FindBackend(int &aDevice)
+{
+	for (int i = 0; i < gBackendCount; i++)
+	{
+		int count = gBackends[i]->countDevices();
+		if (aDevice < count)
+			return gBackends[i];
+		aDevice -= count;
+	}
+	return 0;
+}
 
+CaptureStream *CreateCaptureStream(int aDevice)
+{
+	CaptureBackend *backend = FindBackend(aDevice);
+	if (!backend)
+		return 0;
+	return backend->createStream(aDevice);
+}
 
 void CleanupDevice(int aDevice)
 {
@@ -29,6 +85,15 @@ void CleanupDevice(int aDevice)
 }
 HRESULT InitDevice(int aDevice)
 {
+#ifdef _DEBUG
+	// The SIMD kernels must match their scalar references exactly.
+	static int checked = 0;
+	if (!checked && (CheckConversions() != 0 || CheckPyramid() != 0 || CheckMjpeg() != 0))
+	{
+		OutputDebugStringA("ESCAPI: conversion or decoding kernels don't match their references\n");
+	}
+	checked = 1;
+#endif
 	if (gDevice[aDevice])
 	{
 		CleanupDevice(aDevice);
@@ -47,92 +112,30 @@ HRESULT InitDevice(int aDevice)
 
 int CountCaptureDevices()
 {
-	HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
-
-	if (FAILED(hr)) return 0;
-
-	hr = MFStartup(MF_VERSION);
-
-	if (FAILED(hr)) return 0;
-
-	// choose device
-	IMFAttributes *attributes = NULL;
-	hr = MFCreateAttributes(&attributes, 1);
-	ScopedRelease<IMFAttributes> attributes_s(attributes);
-
-	if (FAILED(hr)) return 0;
-
-	hr = attributes->SetGUID(
-		MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
-		MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID
-		);
-	if (FAILED(hr)) return 0;
-
-	ChooseDeviceParam param = { 0 };
-	hr = MFEnumDeviceSources(attributes, &param.mDevices, &param.mCount);
-
-	if (FAILED(hr)) return 0;
-
-	return param.mCount;
+	int count = 0;
+	for (int i = 0; i < gBackendCount; i++)
+	{
+		count += gBackends[i]->countDevices();
+	}
+	return count;
 }
 
 void GetCaptureDeviceName(int aDevice, char * aNamebuffer, int aBufferlength)
 {
-	int i;
 	if (!aNamebuffer || aBufferlength <= 0)
 		return;
 
 	aNamebuffer[0] = 0;
 
-	HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
-
-	if (FAILED(hr)) return;
-
-	hr = MFStartup(MF_VERSION);
-
-	if (FAILED(hr)) return;
-
-	// choose device
-	IMFAttributes *attributes = NULL;
-	hr = MFCreateAttributes(&attributes, 1);
-	ScopedRelease<IMFAttributes> attributes_s(attributes);
-
-	if (FAILED(hr)) return;
-
-	hr = attributes->SetGUID(
-		MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
-		MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID
-		);
-
-	if (FAILED(hr)) return;
-
-	ChooseDeviceParam param = { 0 };
-	hr = MFEnumDeviceSources(attributes, &param.mDevices, &param.mCount);
-
-	if (FAILED(hr)) return;
+	CaptureBackend *backend = FindBackend(aDevice);
+	if (backend)
+		backend->getDeviceName(aDevice, aNamebuffer, aBufferlength);
+}
 
-	if (aDevice < (signed)param.mCount)
-	{
-		WCHAR *name = 0;
-		UINT32 namelen = 255;
-		hr = param.mDevices[aDevice]->GetAllocatedString(
-			MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME,
-			&name,
-			&namelen
-			);
-		if (SUCCEEDED(hr) && name)
-		{
-			i = 0;
-			while (i < aBufferlength - 1 && i < (signed)namelen && name[i] != 0)
-			{
-				aNamebuffer[i] = (char)name[i];
-				i++;
-			}
-			aNamebuffer[i] = 0;
-
-			CoTaskMemFree(name);
-		}
-	}
+void CaptureRequested(int aDevice)
+{
+	if (gDevice[aDevice])
+		gDevice[aDevice]->requestMade();
 }
 
 void CheckForFail(int aDevice)
@@ -168,6 +171,36 @@ int GetErrorLine(int aDevice)
 	return gDevice[aDevice]->mErrorLine;
 }
 
+int GetFrameInfo(int aDevice, struct CaptureFrameInfo *aInfo)
+{
+	if (!gDevice[aDevice] || !aInfo || gTensors[aDevice].mTargetBuf)
+		return 0;
+	DescribeFrame(
+		gParams[aDevice].mFormat,
+		gParams[aDevice].mWidth,
+		gParams[aDevice].mHeight,
+		gParams[aDevice].mStride,
+		aInfo);
+	return 1;
+}
+
+int GetTestPatternFrameNumber(int aDevice)
+{
+	if (!gDevice[aDevice] || !dynamic_cast<TestPatternStream *>(gDevice[aDevice]->mStream) ||
+		(gOptions[aDevice] & CAPTURE_OPTION_RAWDATA) || gTensors[aDevice].mTargetBuf)
+		return -1;
+
+	const SimpleCapParamsEx &params = gParams[aDevice];
+	const BYTE *image = (const BYTE *)params.mTargetBuf;
+	LONG stride = params.mStride;
+	if (params.mFlags & CAPTURE_FLAG_FLIP_VERTICAL)
+	{
+		// The strip is at the bottom of flipped images
+		image += stride * (LONG)(params.mHeight - 1);
+		stride = -stride;
+	}
+	return (int)TestPattern::ReadFrameNumber(image, stride, params.mWidth, params.mHeight, params.mFormat);
+}
 
 float GetProperty(int aDevice, int aProp)
 {
@@ -198,3 +231,298 @@ int SetProperty(int aDevice, int aProp, float aValue, int aAutoval)
 		return 0;
 	return gDevice[aDevice]->setProperty(aProp, aValue, aAutoval);
 }
+
+int StartRecording(int aDevice, const char *aFilename, int aContainer, int aQueueFrames, unsigned int aFlags)
+{
+	if (!gDevice[aDevice] || gDevice[aDevice]->mRecorder)
+		return 0;
+	// A tensor is no image to record, but the camera's frames still are.
+	if (gTensors[aDevice].mTargetBuf && !(aFlags & CAPTURE_RECORD_NATIVE))
+		return 0;
+
+	const SimpleCapParamsEx &params = gParams[aDevice];
+	Recorder *recorder = new Recorder;
+	if (FAILED(recorder->open(aFilename, aContainer, aQueueFrames, aFlags, params.mFormat, params.mWidth, params.mHeight)))
+	{
+		delete recorder;
+		return 0;
+	}
+
+	EnterCriticalSection(&gDevice[aDevice]->mCritsec);
+	gDevice[aDevice]->mRecorder = recorder;
+	LeaveCriticalSection(&gDevice[aDevice]->mCritsec);
+	return 1;
+}
+
+int StopRecording(int aDevice)
+{
+	if (!gDevice[aDevice])
+		return 0;
+
+	EnterCriticalSection(&gDevice[aDevice]->mCritsec);
+	Recorder *recorder = gDevice[aDevice]->mRecorder;
+	gDevice[aDevice]->mRecorder = 0;
+	LeaveCriticalSection(&gDevice[aDevice]->mCritsec);
+	if (!recorder)
+		return 0;
+
+	// Draining the queue may take a while, so the capture goes on meanwhile.
+	int ok = recorder->close();
+	delete recorder;
+	return ok;
+}
+
+int GetRecordingStats(int aDevice, struct CaptureRecordingStats *aStats)
+{
+	if (!gDevice[aDevice] || !aStats)
+		return 0;
+
+	// StopRecording deletes the recorder once it's taken out, so it's
+	// only looked at under the lock.
+	EnterCriticalSection(&gDevice[aDevice]->mCritsec);
+	Recorder *recorder = gDevice[aDevice]->mRecorder;
+	if (recorder)
+		recorder->getStats(*aStats);
+	LeaveCriticalSection(&gDevice[aDevice]->mCritsec);
+	return recorder != 0;
+}
+
+int StartPublishing(int aDevice, const char *aName, int aSlots)
+{
+	if (!gDevice[aDevice] || gDevice[aDevice]->mPublisher || gTensors[aDevice].mTargetBuf)
+		return 0;
+
+	const SimpleCapParamsEx &params = gParams[aDevice];
+	FrameRingPublisher *publisher = new FrameRingPublisher;
+	if (FAILED(publisher->open(aName, aSlots, params.mFormat, params.mWidth, params.mHeight)))
+	{
+		delete publisher;
+		return 0;
+	}
+
+	EnterCriticalSection(&gDevice[aDevice]->mCritsec);
+	gDevice[aDevice]->mPublisher = publisher;
+	LeaveCriticalSection(&gDevice[aDevice]->mCritsec);
+	return 1;
+}
+
+int StopPublishing(int aDevice)
+{
+	if (!gDevice[aDevice] || !gDevice[aDevice]->mPublisher)
+		return 0;
+
+	EnterCriticalSection(&gDevice[aDevice]->mCritsec);
+	FrameRingPublisher *publisher = gDevice[aDevice]->mPublisher;
+	gDevice[aDevice]->mPublisher = 0;
+	LeaveCriticalSection(&gDevice[aDevice]->mCritsec);
+
+	delete publisher;
+	return 1;
+}
+
+int AddCaptureSink(int aDevice, const struct SimpleCapParamsEx *aParams)
+{
+	CheckForFail(aDevice);
+	if (!gDevice[aDevice] || (gOptions[aDevice] & CAPTURE_OPTION_RAWDATA))
+		return 0;
+
+	int sink = gDevice[aDevice]->addSink(*aParams);
+
+	// Restarts the stream if the sink asked for that
+	CheckForFail(aDevice);
+	if (!gDevice[aDevice])
+		return 0;
+	return sink;
+}
+
+int RemoveCaptureSink(int aDevice, int aSink)
+{
+	if (!gDevice[aDevice])
+		return 0;
+	return gDevice[aDevice]->removeSink(aSink);
+}
+
+static CaptureSink *FindSink(int aDevice, int aSink)
+{
+	if (!gDevice[aDevice] || aSink < 1 || aSink > gDevice[aDevice]->mSinkCount)
+		return 0;
+	CaptureSink *sink = &gDevice[aDevice]->mSinks[aSink - 1];
+	return sink->mParams.mTargetBuf ? sink : 0;
+}
+
+void DoCaptureSink(int aDevice, int aSink)
+{
+	CaptureSink *sink = FindSink(aDevice, aSink);
+	if (sink)
+	{
+		sink->mDoCapture = -1;
+		gDevice[aDevice]->requestMade();
+	}
+}
+
+int IsCaptureSinkDone(int aDevice, int aSink)
+{
+	CaptureSink *sink = FindSink(aDevice, aSink);
+	return sink && sink->mDoCapture == 1;
+}
+
+int SetCaptureRegion(int aDevice, int aLeft, int aTop, int aWidth, int aHeight)
+{
+	CheckForFail(aDevice);
+	if (!gDevice[aDevice] || (gOptions[aDevice] & CAPTURE_OPTION_RAWDATA))
+		return 0;
+	return gDevice[aDevice]->setRegion(aLeft, aTop, aWidth, aHeight);
+}
+
+int GetCaptureRegion(int aDevice, struct CaptureRegion *aRegion)
+{
+	CheckForFail(aDevice);
+	if (!gDevice[aDevice])
+		return 0;
+	return gDevice[aDevice]->getRegion(*aRegion);
+}
+
+int DoCaptureBatch(int aDevice, const struct CaptureRect *aRects, int aCount, const struct SimpleCapParamsEx *aParams)
+{
+	CheckForFail(aDevice);
+	if (!gDevice[aDevice] || (gOptions[aDevice] & CAPTURE_OPTION_RAWDATA))
+		return 0;
+	return gDevice[aDevice]->requestBatch(aRects, aCount, *aParams);
+}
+
+int IsCaptureBatchDone(int aDevice)
+{
+	CheckForFail(aDevice);
+	if (!gDevice[aDevice])
+		return 0;
+	return gDevice[aDevice]->isBatchDone();
+}
+
+// Where the image of a device lies in its target buffer
+static void DescribeTarget(int aDevice, GroupLayout &aLayout)
+{
+	const SimpleCapParamsEx &params = gParams[aDevice];
+	memset(&aLayout, 0, sizeof(aLayout));
+	if (gTensors[aDevice].mTargetBuf)
+	{
+		const CaptureTensorParams &tensor = gTensors[aDevice];
+		aLayout.mPlanes = 1;
+		aLayout.mRowBytes[0] = 3 * tensor.mWidth * tensor.mHeight * TensorWriter::ElementSize(tensor.mType);
+		aLayout.mRows[0] = 1;
+	}
+	else if (gPyramidLevels[aDevice] > 1)
+	{
+		CapturePyramidInfo info;
+		DescribePyramid(params.mFormat, params.mWidth, params.mHeight, params.mStride, gPyramidLevels[aDevice], &info);
+		aLayout.mPlanes = info.mLevels;
+		for (int i = 0; i < info.mLevels; i++)
+		{
+			aLayout.mOffset[i] = info.mOffset[i];
+			aLayout.mStride[i] = info.mStride[i];
+			aLayout.mRowBytes[i] = MinimumStride(params.mFormat, info.mWidth[i]);
+			aLayout.mRows[i] = info.mHeight[i];
+		}
+	}
+	else
+	{
+		CaptureFrameInfo info;
+		DescribeFrame(params.mFormat, params.mWidth, params.mHeight, params.mStride, &info);
+		aLayout.mPlanes = info.mPlanes;
+		for (int i = 0; i < info.mPlanes; i++)
+		{
+			int rowBytes = MinimumStride(params.mFormat, params.mWidth);
+			aLayout.mOffset[i] = info.mPlaneOffset[i];
+			aLayout.mStride[i] = info.mPlaneStride[i];
+			aLayout.mRowBytes[i] = i && params.mFormat == CAPTURE_FORMAT_I420 ? rowBytes / 2 : rowBytes;
+			aLayout.mRows[i] = i ? params.mHeight / 2 : params.mHeight;
+		}
+	}
+}
+
+int CaptureGroupFrames(const unsigned int *aDevices, int aCount, long long aTolerance, int aTimeout, long long *aTimestamps)
+{
+	for (int i = 0; i < aCount; i++)
+	{
+		CheckForFail(aDevices[i]);
+		if (!gDevice[aDevices[i]])
+			return 0;
+	}
+
+	CaptureGroup *group = new CaptureGroup;
+	for (int i = 0; i < aCount; i++)
+	{
+		GroupLayout layout;
+		DescribeTarget(aDevices[i], layout);
+		group->setMember(i, layout);
+	}
+
+	// Whether a device is already in another thread's group is checked
+	// under the same lock as it joins this one, so two calls can't both
+	// take it.
+	int attached = 0;
+	for (; attached < aCount; attached++)
+	{
+		CaptureClass *device = gDevice[aDevices[attached]];
+		EnterCriticalSection(&device->mCritsec);
+		int busy = device->mGroup != 0;
+		if (!busy)
+		{
+			device->mGroup = group;
+			device->mGroupIndex = attached;
+		}
+		LeaveCriticalSection(&device->mCritsec);
+		if (busy)
+			break;
+	}
+	if (attached < aCount)
+	{
+		for (int i = 0; i < attached; i++)
+		{
+			CaptureClass *device = gDevice[aDevices[i]];
+			EnterCriticalSection(&device->mCritsec);
+			device->mGroup = 0;
+			LeaveCriticalSection(&device->mCritsec);
+		}
+		delete group;
+		return 0;
+	}
+	for (int i = 0; i < aCount; i++)
+		gDevice[aDevices[i]]->requestMade();
+
+	long long waitStart = StatsClock();
+	int found = group->wait(aTolerance, aTimeout);
+	if (TraceEnabled())
+		TraceSpan(found ? "captureGroup" : "captureGroup timeout", waitStart, StatsClock(), -1, 0, -1);
+
+	// Once no device writes its target for the group any more, the
+	// chosen frames go back in.
+	for (int i = 0; i < aCount; i++)
+	{
+		CaptureClass *device = gDevice[aDevices[i]];
+		EnterCriticalSection(&device->mCritsec);
+		device->mGroup = 0;
+		LeaveCriticalSection(&device->mCritsec);
+	}
+	for (int i = 0; found && i < aCount; i++)
+	{
+		long long timestamp = group->restore(i, (BYTE *)gParams[aDevices[i]].mTargetBuf);
+		if (aTimestamps)
+			aTimestamps[i] = timestamp;
+	}
+	delete group;
+	return found;
+}
+
+int GetCaptureStats(int aDevice, struct CaptureStats *aStats)
+{
+	if (!gDevice[aDevice])
+		return 0;
+	gDevice[aDevice]->mStats.get(*aStats);
+	return 1;
+}
+
+void ResetCaptureStats(int aDevice)
+{
+	if (gDevice[aDevice])
+		gDevice[aDevice]->mStats.reset();
+}
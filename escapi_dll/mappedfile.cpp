@@ -0,0 +1,101 @@
+#include "platform.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "mappedfile.h"
+
+MappedFile::MappedFile()
+{
+	mData = 0;
+	mSize = 0;
+#ifdef _WIN32
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = 0;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+HRESULT MappedFile::open(const char *aPath)
+{
+	close();
+	mFile = CreateFileA(aPath, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (mFile == INVALID_HANDLE_VALUE)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0 || (ULONGLONG)size.QuadPart > (SIZE_T)-1)
+	{
+		close();
+		return MF_E_INVALIDMEDIATYPE;
+	}
+	mSize = (size_t)size.QuadPart;
+
+	mMapping = CreateFileMappingA(mFile, 0, PAGE_READONLY, 0, 0, 0);
+	if (mMapping)
+		mData = (const BYTE *)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mData)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		close();
+		return hr;
+	}
+	return S_OK;
+}
+
+void MappedFile::close()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+	if (mMapping)
+		CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+	mData = 0;
+	mSize = 0;
+	mMapping = 0;
+	mFile = INVALID_HANDLE_VALUE;
+}
+#else
+HRESULT MappedFile::open(const char *aPath)
+{
+	close();
+	int fd = ::open(aPath, O_RDONLY);
+	if (fd < 0)
+		return HRESULT_FROM_ERRNO(errno);
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return MF_E_INVALIDMEDIATYPE;
+	}
+
+	void *data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	HRESULT hr = data == MAP_FAILED ? HRESULT_FROM_ERRNO(errno) : S_OK;
+	::close(fd);
+	if (FAILED(hr))
+		return hr;
+
+	mData = (const BYTE *)data;
+	mSize = st.st_size;
+	return S_OK;
+}
+
+void MappedFile::close()
+{
+	if (mData)
+		munmap((void *)mData, mSize);
+	mData = 0;
+	mSize = 0;
+}
+#endif
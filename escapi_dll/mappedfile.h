@@ -0,0 +1,18 @@
+#pragma once
+
+// A read only view of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	HRESULT open(const char *aPath);
+	void close();
+
+	const BYTE *mData;
+	size_t mSize;
+#ifdef _WIN32
+	HANDLE mFile;
+	HANDLE mMapping;
+#endif
+};
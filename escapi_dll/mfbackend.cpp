@@ -0,0 +1,757 @@
+#include <mfapi.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <mferror.h>
+
+#include <shlwapi.h> // QITAB and friends
+#include <objbase.h> // IID_PPV_ARGS and friends
+#include <dshow.h> // IAMVideoProcAmp and friends
+
+#include <math.h>
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "conversion.h"
+#include "scaling.h"
+#include "capture.h"
+#include "mfbackend.h"
+#include "scopedrelease.h"
+#include "videobufferlock.h"
+#include "choosedeviceparam.h"
+
+extern int gOptions[];
+
+MFCaptureBackend gMFBackend;
+
+// Errors are recorded in the CaptureClass, for getCaptureErrorLine / Code
+#define DO_OR_DIE { if (mCapture->mErrorLine) return hr; if (!SUCCEEDED(hr)) { mCapture->mErrorLine = __LINE__; mCapture->mErrorCode = hr; return hr; } }
+#define DO_OR_DIE_CRITSECTION { if (mCapture->mErrorLine) { LeaveCriticalSection(&mCapture->mCritsec); return hr;} if (!SUCCEEDED(hr)) { LeaveCriticalSection(&mCapture->mCritsec); mCapture->mErrorLine = __LINE__; mCapture->mErrorCode = hr; return hr; } }
+
+// The VIDEO_SUBTYPES code of a Media Foundation subtype, or 0 if it isn't
+// one of the MFVideoFormat_Base based ones.
+static DWORD SubtypeCode(REFGUID aSubtype)
+{
+	GUID base = aSubtype;
+	base.Data1 = 0;
+	return base == MFVideoFormat_Base ? aSubtype.Data1 : 0;
+}
+
+// Lists the video capture devices.
+static HRESULT EnumerateDevices(ChooseDeviceParam &aParam)
+{
+	HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+
+	if (FAILED(hr)) return hr;
+
+	hr = MFStartup(MF_VERSION);
+
+	if (FAILED(hr)) return hr;
+
+	// choose device
+	IMFAttributes *attributes = NULL;
+	hr = MFCreateAttributes(&attributes, 1);
+	ScopedRelease<IMFAttributes> attributes_s(attributes);
+
+	if (FAILED(hr)) return hr;
+
+	hr = attributes->SetGUID(
+		MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
+		MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID
+		);
+
+	if (FAILED(hr)) return hr;
+
+	return MFEnumDeviceSources(attributes, &aParam.mDevices, &aParam.mCount);
+}
+
+int MFCaptureBackend::countDevices()
+{
+	ChooseDeviceParam param = { 0 };
+	HRESULT hr = EnumerateDevices(param);
+
+	if (FAILED(hr)) return 0;
+
+	return param.mCount;
+}
+
+void MFCaptureBackend::getDeviceName(int aDevice, char * aNamebuffer, int aBufferlength)
+{
+	int i;
+	ChooseDeviceParam param = { 0 };
+	HRESULT hr = EnumerateDevices(param);
+
+	if (FAILED(hr)) return;
+
+	if (aDevice < (signed)param.mCount)
+	{
+		WCHAR *name = 0;
+		UINT32 namelen = 255;
+		hr = param.mDevices[aDevice]->GetAllocatedString(
+			MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME,
+			&name,
+			&namelen
+			);
+		if (SUCCEEDED(hr) && name)
+		{
+			i = 0;
+			while (i < aBufferlength - 1 && i < (signed)namelen && name[i] != 0)
+			{
+				aNamebuffer[i] = (char)name[i];
+				i++;
+			}
+			aNamebuffer[i] = 0;
+
+			CoTaskMemFree(name);
+		}
+	}
+}
+
+CaptureStream *MFCaptureBackend::createStream(int aDevice)
+{
+	return new MFCaptureStream(aDevice);
+}
+
+MFCaptureStream::MFCaptureStream(int aDevice)
+{
+	mRefCount = 1;
+	mCapture = 0;
+	mDevice = aDevice;
+	mReader = 0;
+	mSource = 0;
+	mDefaultStride = 0;
+	mFrameHeight = 0;
+	mCompressed = 0;
+	mBadIndices = 0;
+	mMaxBadIndices = 16;
+	mBadIndex = new unsigned int[mMaxBadIndices];
+	mUsedIndex = 0;
+}
+
+MFCaptureStream::~MFCaptureStream()
+{
+	delete[] mBadIndex;
+}
+
+// IUnknown methods
+STDMETHODIMP MFCaptureStream::QueryInterface(REFIID aRiid, void** aPpv)
+{
+	static const QITAB qit[] =
+	{
+		QITABENT(MFCaptureStream, IMFSourceReaderCallback),
+		{ 0 },
+	};
+	return QISearch(this, qit, aRiid, aPpv);
+}
+
+STDMETHODIMP_(ULONG) MFCaptureStream::AddRef()
+{
+	return InterlockedIncrement(&mRefCount);
+}
+
+STDMETHODIMP_(ULONG) MFCaptureStream::Release()
+{
+	ULONG count = InterlockedDecrement(&mRefCount);
+	if (count == 0)
+	{
+		delete this;
+	}
+	// For thread safety, return a temporary variable.
+	return count;
+}
+
+// IMFSourceReaderCallback methods
+STDMETHODIMP MFCaptureStream::OnReadSample(
+	HRESULT aStatus,
+	DWORD aStreamIndex,
+	DWORD aStreamFlags,
+	LONGLONG aTimestamp,
+	IMFSample *aSample
+	)
+{
+	HRESULT hr = S_OK;
+	IMFMediaBuffer *mediabuffer = NULL;
+
+	if (FAILED(aStatus))
+	{
+		// Bug workaround: some resolutions may just return error.
+		// http://stackoverflow.com/questions/22788043/imfsourcereader-giving-error-0x80070491-for-some-resolutions
+		// we fix by marking the resolution bad and retrying, which should use the next best match.
+		mCapture->mRedoFromStart = 1;
+		if (mBadIndices == mMaxBadIndices)
+		{
+			unsigned int *t = new unsigned int[mMaxBadIndices * 2];
+			memcpy(t, mBadIndex, mMaxBadIndices * sizeof(unsigned int));
+			delete[] mBadIndex;
+			mBadIndex = t;
+			mMaxBadIndices *= 2;
+		}
+		mBadIndex[mBadIndices] = mUsedIndex;
+		mBadIndices++;
+		return aStatus;
+	}
+
+	EnterCriticalSection(&mCapture->mCritsec);
+
+	// The sample times run on the source's own clock, which can't be
+	// compared between devices, so frames are timed as they arrive.
+	long long timestamp = CaptureClock();
+	if (aSample)
+		mCapture->frameArrived(timestamp);
+
+	// A stream tick stands for frames the source didn't deliver.
+	if (aStreamFlags & MF_SOURCE_READERF_STREAMTICK)
+		mCapture->mStats.dropped(1);
+
+	if (SUCCEEDED(aStatus))
+	{
+		if (mCapture->wantsFrame())
+		{
+			if (aSample)
+			{
+				// Get the video frame buffer from the sample.
+
+				hr = aSample->GetBufferByIndex(0, &mediabuffer);
+				ScopedRelease<IMFMediaBuffer> mediabuffer_s(mediabuffer);
+
+				DO_OR_DIE_CRITSECTION;
+
+				if (mCompressed)
+				{
+					// Compressed frames aren't 2D buffers, so lock them as bytes.
+					BYTE *data = NULL;
+					DWORD length = 0;
+					long long lockStart = StatsClock();
+					hr = mediabuffer->Lock(&data, NULL, &length);
+					mCapture->stageDone(CAPTURE_STAGE_LOCK, lockStart);
+
+					DO_OR_DIE_CRITSECTION;
+
+					mCapture->deliverFrame(data, length, NULL, 0, timestamp);
+
+					mediabuffer->Unlock();
+				}
+				else
+				{
+					VideoBufferLock buffer(mediabuffer);    // Helper object to lock the video buffer.
+
+					BYTE *scanline0 = NULL;
+					LONG stride = 0;
+					long long lockStart = StatsClock();
+					hr = buffer.LockBuffer(mDefaultStride, mFrameHeight, &scanline0, &stride);
+					mCapture->stageDone(CAPTURE_STAGE_LOCK, lockStart);
+
+					DO_OR_DIE_CRITSECTION;
+
+					// The frame's bytes as they lie in memory, from the first
+					// row there and with the chroma rows of 4:2:0 after, for
+					// native recording
+					DWORD rows = PackedSubtypeBytes(mCapture->mSubtype) ? mFrameHeight : mFrameHeight * 3 / 2;
+					LONG pitch = stride < 0 ? -stride : stride;
+					const BYTE *data = stride < 0 ? scanline0 + stride * (LONG)(mFrameHeight - 1) : scanline0;
+					mCapture->deliverFrame(data, pitch * rows, scanline0, stride, timestamp);
+				}
+			}
+		}
+	}
+
+	// Request the next frame.
+	hr = mReader->ReadSample(
+		(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+		0,
+		NULL,   // actual
+		NULL,   // flags
+		NULL,   // timestamp
+		NULL    // sample
+		);
+
+	DO_OR_DIE_CRITSECTION;
+
+	LeaveCriticalSection(&mCapture->mCritsec);
+
+	return hr;
+}
+
+STDMETHODIMP MFCaptureStream::OnEvent(DWORD, IMFMediaEvent *)
+{
+	return S_OK;
+}
+
+STDMETHODIMP MFCaptureStream::OnFlush(DWORD)
+{
+	return S_OK;
+}
+
+int MFCaptureStream::escapiPropToMFProp(int aProperty)
+{
+	int prop = 0;
+	switch (aProperty)
+	{
+		//case CAPTURE_BRIGHTNESS:
+	default:
+		prop = VideoProcAmp_Brightness;
+		break;
+	case CAPTURE_CONTRAST:
+		prop = VideoProcAmp_Contrast;
+		break;
+	case CAPTURE_HUE:
+		prop = VideoProcAmp_Hue;
+		break;
+	case CAPTURE_SATURATION:
+		prop = VideoProcAmp_Saturation;
+		break;
+	case CAPTURE_SHARPNESS:
+		prop = VideoProcAmp_Sharpness;
+		break;
+	case CAPTURE_GAMMA:
+		prop = VideoProcAmp_Gamma;
+		break;
+	case CAPTURE_COLORENABLE:
+		prop = VideoProcAmp_ColorEnable;
+		break;
+	case CAPTURE_WHITEBALANCE:
+		prop = VideoProcAmp_WhiteBalance;
+		break;
+	case CAPTURE_BACKLIGHTCOMPENSATION:
+		prop = VideoProcAmp_BacklightCompensation;
+		break;
+	case CAPTURE_GAIN:
+		prop = VideoProcAmp_Gain;
+		break;
+	case CAPTURE_PAN:
+		prop = CameraControl_Pan;
+		break;
+	case CAPTURE_TILT:
+		prop = CameraControl_Tilt;
+		break;
+	case CAPTURE_ROLL:
+		prop = CameraControl_Roll;
+		break;
+	case CAPTURE_ZOOM:
+		prop = CameraControl_Zoom;
+		break;
+	case CAPTURE_EXPOSURE:
+		prop = CameraControl_Exposure;
+		break;
+	case CAPTURE_IRIS:
+		prop = CameraControl_Iris;
+		break;
+	case CAPTURE_FOCUS:
+		prop = CameraControl_Focus;
+		break;
+	}
+	return prop;
+}
+
+int MFCaptureStream::setProperty(int aProperty, float aValue, int aAuto)
+{
+	HRESULT hr;
+	IAMVideoProcAmp *procAmp = NULL;
+	IAMCameraControl *control = NULL;
+
+	int prop = escapiPropToMFProp(aProperty);
+
+	if (!mSource)
+		return 0;
+
+	if (aProperty < CAPTURE_PAN)
+	{
+		hr = mSource->QueryInterface(IID_PPV_ARGS(&procAmp));
+		if (SUCCEEDED(hr))
+		{
+			long min, max, step, def, caps;
+			hr = procAmp->GetRange(prop, &min, &max, &step, &def, &caps);
+
+			if (SUCCEEDED(hr))
+			{
+				LONG val = (long)floor(min + (max - min) * aValue);
+				if (aAuto)
+					val = def;
+				hr = procAmp->Set(prop, val, aAuto ? VideoProcAmp_Flags_Auto : VideoProcAmp_Flags_Manual);
+			}
+			procAmp->Release();
+			return !!SUCCEEDED(hr);
+		}
+	}
+	else
+	{
+		hr = mSource->QueryInterface(IID_PPV_ARGS(&control));
+		if (SUCCEEDED(hr))
+		{
+			long min, max, step, def, caps;
+			hr = control->GetRange(prop, &min, &max, &step, &def, &caps);
+
+			if (SUCCEEDED(hr))
+			{
+				LONG val = (long)floor(min + (max - min) * aValue);
+				if (aAuto)
+					val = def;
+				hr = control->Set(prop, val, aAuto ? VideoProcAmp_Flags_Auto : VideoProcAmp_Flags_Manual);
+			}
+			control->Release();
+			return !!SUCCEEDED(hr);
+		}
+	}
+
+	return 1;
+}
+
+int MFCaptureStream::getProperty(int aProperty, float &aValue, int &aAuto)
+{
+	HRESULT hr;
+	IAMVideoProcAmp *procAmp = NULL;
+	IAMCameraControl *control = NULL;
+
+	aAuto = 0;
+	aValue = -1;
+
+	int prop = escapiPropToMFProp(aProperty);
+
+	if (!mSource)
+		return 1;
+
+	if (aProperty < CAPTURE_PAN)
+	{
+		hr = mSource->QueryInterface(IID_PPV_ARGS(&procAmp));
+		if (SUCCEEDED(hr))
+		{
+			long min, max, step, def, caps;
+			hr = procAmp->GetRange(prop, &min, &max, &step, &def, &caps);
+
+			if (SUCCEEDED(hr))
+			{
+				long v = 0, f = 0;
+				hr = procAmp->Get(prop, &v, &f);
+				if (SUCCEEDED(hr))
+				{
+					aValue = (v - min) / (float)(max - min);
+					aAuto = !!(f & VideoProcAmp_Flags_Auto);
+				}
+			}
+			procAmp->Release();
+			return 0;
+		}
+	}
+	else
+	{
+		hr = mSource->QueryInterface(IID_PPV_ARGS(&control));
+		if (SUCCEEDED(hr))
+		{
+			long min, max, step, def, caps;
+			hr = control->GetRange(prop, &min, &max, &step, &def, &caps);
+
+			if (SUCCEEDED(hr))
+			{
+				long v = 0, f = 0;
+				hr = control->Get(prop, &v, &f);
+				if (SUCCEEDED(hr))
+				{
+					aValue = (v - min) / (float)(max - min);
+					aAuto = !!(f & VideoProcAmp_Flags_Auto);
+				}
+			}
+			control->Release();
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+HRESULT MFCaptureStream::getFormat(DWORD aIndex, GUID *aSubtype) const
+{
+	if (aIndex < gConversionFormats)
+	{
+		*aSubtype = MFVideoFormat_Base;
+		aSubtype->Data1 = gFormatConversions[aIndex].mSubtype;
+		return S_OK;
+	}
+	return MF_E_NO_MORE_TYPES;
+}
+
+// What the camera reports; CaptureClass applies the caller's overrides.
+int MFCaptureStream::getYCbCrMatrix(IMFMediaType *aType)
+{
+	int bt709 = 0;
+	int fullRange = 0;
+	UINT32 value = 0;
+
+	if (SUCCEEDED(aType->GetUINT32(MF_MT_YUV_MATRIX, &value)))
+		bt709 = value == MFVideoTransferMatrix_BT709;
+	if (SUCCEEDED(aType->GetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, &value)))
+		fullRange = value == MFNominalRange_0_255;
+
+	if (bt709)
+		return fullRange ? YCBCR_BT709_FULL : YCBCR_BT709;
+	return fullRange ? YCBCR_BT601_FULL : YCBCR_BT601;
+}
+
+HRESULT MFCaptureStream::setVideoType(IMFMediaType *aType)
+{
+	HRESULT hr = S_OK;
+	GUID subtype = { 0 };
+	UINT32 width = 0;
+	UINT32 height = 0;
+
+	// Get the subtype and the image size.
+	hr = aType->GetGUID(MF_MT_SUBTYPE, &subtype);
+
+	DO_OR_DIE;
+
+	hr = MFGetAttributeSize(aType, MF_MT_FRAME_SIZE, &width, &height);
+
+	DO_OR_DIE;
+
+	VideoFormat format;
+	format.mSubtype = SubtypeCode(subtype);
+	format.mWidth = width;
+	format.mHeight = height;
+	format.mMatrix = getYCbCrMatrix(aType);
+
+	hr = mCapture->setVideoFormat(format);
+
+	DO_OR_DIE;
+
+	mFrameHeight = height;
+	mCompressed = subtype == MFVideoFormat_MJPG;
+	if (!mCompressed)
+	{
+		hr = MFGetStrideForBitmapInfoHeader(subtype.Data1, width, &mDefaultStride);
+	}
+
+	return hr;
+}
+
+int MFCaptureStream::isMediaOk(IMFMediaType *aType, int aIndex)
+{
+	HRESULT hr = S_OK;
+
+	int i;
+	for (i = 0; i < (signed)mBadIndices; i++)
+		if (mBadIndex[i] == aIndex)
+			return FALSE;
+
+	BOOL found = FALSE;
+	GUID subtype = { 0 };
+
+	hr = aType->GetGUID(MF_MT_SUBTYPE, &subtype);
+
+	DO_OR_DIE;
+
+	// Do we support this type directly?
+	if (mCapture->isFormatSupported(SubtypeCode(subtype)))
+	{
+		found = TRUE;
+	}
+	else
+	{
+		// Can we decode this media type to one of our supported
+		// output formats?
+
+		for (i = 0;; i++)
+		{
+			// Get the i'th format.
+			hr = getFormat(i, &subtype);
+
+			if (FAILED(hr)) { break; }
+
+			hr = aType->SetGUID(MF_MT_SUBTYPE, subtype);
+
+			if (FAILED(hr)) { break; }
+
+			// Try to set this type on the source reader.
+			hr = mReader->SetCurrentMediaType(
+				(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+				NULL,
+				aType
+				);
+
+			if (SUCCEEDED(hr))
+			{
+				found = TRUE;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+int MFCaptureStream::scanMediaTypes(unsigned int aWidth, unsigned int aHeight)
+{
+	HRESULT hr;
+	HRESULT nativeTypeErrorCode = S_OK;
+	DWORD count = 0;
+	int besterror = 0xfffffff;
+	int bestfit = 0;
+
+	while (nativeTypeErrorCode == S_OK && besterror)
+	{
+		IMFMediaType * nativeType = NULL;
+		nativeTypeErrorCode = mReader->GetNativeMediaType(
+			(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+			count,
+			&nativeType);
+		ScopedRelease<IMFMediaType> nativeType_s(nativeType);
+
+		if (nativeTypeErrorCode != S_OK) continue;
+
+		// get the media type
+		GUID nativeGuid = { 0 };
+		hr = nativeType->GetGUID(MF_MT_SUBTYPE, &nativeGuid);
+
+		if (FAILED(hr)) return bestfit;
+
+		if (isMediaOk(nativeType, count))
+		{
+			UINT32 width, height;
+			hr = MFGetAttributeSize(nativeType, MF_MT_FRAME_SIZE, &width, &height);
+
+			if (FAILED(hr)) return bestfit;
+
+			int error = CaptureClass::SizeError(width, height, aWidth, aHeight);
+
+			if (besterror > error)
+			{
+				besterror = error;
+				bestfit = count;
+			}
+			/*
+			char temp[1024];
+			sprintf(temp, "%d x %d, %x:%x:%x:%x %d %d\n", width, height, nativeGuid.Data1, nativeGuid.Data2, nativeGuid.Data3, nativeGuid.Data4, bestfit == count, besterror);
+			OutputDebugStringA(temp);
+			*/
+		}
+
+		count++;
+	}
+	return bestfit;
+}
+
+HRESULT MFCaptureStream::start(CaptureClass *aCapture)
+{
+	mCapture = aCapture;
+
+	ChooseDeviceParam param = { 0 };
+	HRESULT hr = EnumerateDevices(param);
+
+	DO_OR_DIE;
+
+	if ((signed)param.mCount > mDevice)
+	{
+		// use param.ppDevices[0]
+		IMFAttributes   *attributes = NULL;
+		IMFMediaType    *type = NULL;
+		EnterCriticalSection(&mCapture->mCritsec);
+
+		hr = param.mDevices[mDevice]->ActivateObject(
+			__uuidof(IMFMediaSource),
+			(void**)&mSource
+			);
+
+		DO_OR_DIE_CRITSECTION;
+
+		hr = MFCreateAttributes(&attributes, 3);
+		ScopedRelease<IMFAttributes> attributes_s(attributes);
+
+		DO_OR_DIE_CRITSECTION;
+
+		hr = attributes->SetUINT32(MF_READWRITE_DISABLE_CONVERTERS, TRUE);
+
+		DO_OR_DIE_CRITSECTION;
+
+		hr = attributes->SetUnknown(
+			MF_SOURCE_READER_ASYNC_CALLBACK,
+			this
+			);
+
+		DO_OR_DIE_CRITSECTION;
+
+		hr = MFCreateSourceReaderFromMediaSource(
+			mSource,
+			attributes,
+			&mReader
+			);
+
+		DO_OR_DIE_CRITSECTION;
+
+		DWORD width, height;
+		mCapture->getTargetSize(width, height);
+		int preferredmode = scanMediaTypes(width, height);
+		mUsedIndex = preferredmode;
+
+		hr = mReader->GetNativeMediaType(
+			(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+			preferredmode,
+			&type
+			);
+		ScopedRelease<IMFMediaType> type_s(type);
+
+		DO_OR_DIE_CRITSECTION;
+
+		hr = setVideoType(type);
+
+		DO_OR_DIE_CRITSECTION;
+
+		hr = mReader->SetCurrentMediaType(
+			(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+			NULL,
+			type
+			);
+
+		DO_OR_DIE_CRITSECTION;
+
+		hr = mReader->ReadSample(
+			(DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+			0,
+			NULL,
+			NULL,
+			NULL,
+			NULL
+			);
+
+		DO_OR_DIE_CRITSECTION;
+
+		LeaveCriticalSection(&mCapture->mCritsec);
+	}
+	else
+	{
+		return MF_E_INVALIDINDEX;
+	}
+
+	/*
+	for (i = 0; i < 16; i++)
+	{
+	char temp[128];
+	float v;
+	int f;
+	int r = GetProperty(i, v, f);
+	sprintf(temp, "%d: %3.3f %d (%d)\n", i, v, f, r);
+	OutputDebugStringA(temp);
+	}
+	*/
+
+	return 0;
+}
+
+void MFCaptureStream::stop()
+{
+	if (!mCapture)
+		return;
+
+	EnterCriticalSection(&mCapture->mCritsec);
+
+	if (mReader)
+	{
+		mReader->Release();
+		mReader = 0;
+	}
+
+	if (mSource)
+	{
+		mSource->Shutdown();
+		mSource->Release();
+		mSource = 0;
+	}
+
+	LeaveCriticalSection(&mCapture->mCritsec);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "backend.h"
+
+// Cameras through Media Foundation's source reader
+class MFCaptureStream : public CaptureStream, public IMFSourceReaderCallback
+{
+public:
+
+	MFCaptureStream(int aDevice);
+	~MFCaptureStream();
+	STDMETHODIMP QueryInterface(REFIID aRiid, void** aPpv);
+	STDMETHODIMP_(ULONG) AddRef();
+	STDMETHODIMP_(ULONG) Release();
+	STDMETHODIMP OnReadSample(
+		HRESULT aStatus,
+		DWORD aStreamIndex,
+		DWORD aStreamFlags,
+		LONGLONG aTimestamp,
+		IMFSample *aSample
+		);
+	STDMETHODIMP OnEvent(DWORD, IMFMediaEvent *);
+	STDMETHODIMP OnFlush(DWORD);
+	HRESULT start(CaptureClass *aCapture);
+	void stop();
+	int escapiPropToMFProp(int aProperty);
+	int setProperty(int aProperty, float aValue, int aAuto);
+	int getProperty(int aProperty, float &aValue, int &aAuto);
+	HRESULT getFormat(DWORD aIndex, GUID *aSubtype) const;
+	int getYCbCrMatrix(IMFMediaType *aType);
+	HRESULT setVideoType(IMFMediaType *aType);
+	int isMediaOk(IMFMediaType *aType, int aIndex);
+	int scanMediaTypes(unsigned int aWidth, unsigned int aHeight);
+
+	long                    mRefCount;        // Reference count.
+	CaptureClass            *mCapture;
+	int                     mDevice;          // Among the Media Foundation devices
+
+	IMFSourceReader         *mReader;
+	IMFMediaSource			*mSource;
+
+	LONG                    mDefaultStride;
+	unsigned int			mFrameHeight;
+	int						mCompressed;      // Frames are locked as bytes rather than 2D buffers
+	unsigned int			*mBadIndex;
+	unsigned int			mBadIndices;
+	unsigned int			mMaxBadIndices;
+	unsigned int			mUsedIndex;
+};
+
+class MFCaptureBackend : public CaptureBackend
+{
+public:
+	int countDevices();
+	void getDeviceName(int aDevice, char *aNamebuffer, int aBufferlength);
+	CaptureStream *createStream(int aDevice);
+};
+
+extern MFCaptureBackend gMFBackend;
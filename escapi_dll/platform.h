@@ -0,0 +1,81 @@
+#pragma once
+
+// The device-independent parts of ESCAPI (capture.cpp, interface.cpp and
+// escapi_dll.cpp) are written against the Windows API. Elsewhere, this
+// supplies the little of it that they use, so the same code builds into
+// libescapi.so with the V4L2 backend.
+#include "coretypes.h"
+
+#ifdef _WIN32
+#include <mferror.h>
+#else
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef int32_t HRESULT;
+
+#define S_OK           ((HRESULT)0)
+#define S_FALSE        ((HRESULT)1)
+#define E_NOTIMPL      ((HRESULT)0x80004001)
+#define E_FAIL         ((HRESULT)0x80004005)
+#define E_OUTOFMEMORY  ((HRESULT)0x8007000E)
+#define E_INVALIDARG   ((HRESULT)0x80070057)
+#define SUCCEEDED(hr)  (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)     (((HRESULT)(hr)) < 0)
+
+// Same codes as on Windows, for getCaptureErrorCode
+#define MF_E_INVALIDMEDIATYPE ((HRESULT)0xC00D36B4)
+#define MF_E_INVALIDINDEX     ((HRESULT)0xC00D36BF)
+
+// errno values as HRESULTs, like HRESULT_FROM_WIN32 does for Win32 errors
+#define HRESULT_FROM_ERRNO(e) ((HRESULT)(((e) & 0xffff) | 0x80070000))
+
+#define __declspec(x) __attribute__((visibility("default")))
+#define CopyMemory memcpy
+#define _stricmp strcasecmp
+
+// Recursive, like the real thing
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+static inline void InitializeCriticalSection(CRITICAL_SECTION *aSection)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(aSection, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static inline void DeleteCriticalSection(CRITICAL_SECTION *aSection)
+{
+	pthread_mutex_destroy(aSection);
+}
+
+static inline void EnterCriticalSection(CRITICAL_SECTION *aSection)
+{
+	pthread_mutex_lock(aSection);
+}
+
+static inline void LeaveCriticalSection(CRITICAL_SECTION *aSection)
+{
+	pthread_mutex_unlock(aSection);
+}
+
+static inline DWORD GetEnvironmentVariableA(const char *aName, char *aBuffer, DWORD aSize)
+{
+	const char *value = getenv(aName);
+	if (!value)
+		return 0;
+	DWORD len = (DWORD)strlen(value);
+	if (len >= aSize)
+		return len + 1;
+	memcpy(aBuffer, value, len + 1);
+	return len;
+}
+
+static inline void OutputDebugStringA(const char *)
+{
+}
+#endif
@@ -0,0 +1,465 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "scaling.h"
+#include "archive.h"
+#include "recorder.h"
+
+// Writes are whole chunks, except for the last one. Unbuffered I/O needs
+// sector aligned memory, offsets and sizes; 4096 covers every disk.
+#define CHUNK_SIZE (4 << 20)
+#define SECTOR_SIZE 4096
+#define DEFAULT_QUEUE_FRAMES 16
+#define MAX_QUEUE_FRAMES 1024
+
+Recorder::Recorder()
+{
+	mContainer = CAPTURE_RECORD_RAW;
+	mFlags = 0;
+	mFormat = 0;
+	mWidth = 0;
+	mHeight = 0;
+	mStart = 0;
+	mStartTime = 0;
+	mFrameBytes = 0;
+	mRecordSize = 0;
+	mQuit = 0;
+	mFramesCaptured = 0;
+	mFramesWritten = 0;
+	mFramesDropped = 0;
+	mQueueHighWater = 0;
+	mBytesWritten = 0;
+	mBlockedMicroseconds = 0;
+	mWriteMaxMicroseconds = 0;
+	mError = 0;
+#ifdef _WIN32
+	mFile = INVALID_HANDLE_VALUE;
+#else
+	mFile = -1;
+#endif
+	mIndex = 0;
+	mChunkMemory = 0;
+	mChunk = 0;
+	mChunkUsed = 0;
+	mFileSize = 0;
+	mFrameNumber = 0;
+}
+
+Recorder::~Recorder()
+{
+	close();
+}
+
+HRESULT Recorder::open(const char *aFilename, int aContainer, int aQueueFrames, unsigned int aFlags,
+	int aFormat, int aWidth, int aHeight)
+{
+	if (!aFilename || aContainer < 0 || aContainer >= CAPTURE_RECORD_MAX ||
+		aQueueFrames < 0 || aQueueFrames > MAX_QUEUE_FRAMES ||
+		(aFlags & CAPTURE_RECORD_FLAGS_MASK) != aFlags ||
+		((aFlags & CAPTURE_RECORD_DROP_OLDEST) && (aFlags & CAPTURE_RECORD_BLOCK)))
+		return E_INVALIDARG;
+
+	// Y4M only has the YCbCr layouts, and a fixed frame size; archives
+	// need the fixed size too.
+	if (aContainer == CAPTURE_RECORD_Y4M &&
+		((aFlags & CAPTURE_RECORD_NATIVE) || (aFormat != CAPTURE_FORMAT_I420 && aFormat != CAPTURE_FORMAT_GRAY8)))
+		return E_INVALIDARG;
+	if (aContainer == CAPTURE_RECORD_ARCHIVE && (aFlags & CAPTURE_RECORD_NATIVE))
+		return E_INVALIDARG;
+
+	mContainer = aContainer;
+	mFlags = aFlags;
+	mFormat = aFormat;
+	mWidth = aWidth;
+	mHeight = aHeight;
+
+	int unbuffered = (aFlags & CAPTURE_RECORD_UNBUFFERED) != 0;
+#ifdef _WIN32
+	mFile = CreateFileA(aFilename, GENERIC_WRITE, 0, 0, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | (unbuffered ? FILE_FLAG_NO_BUFFERING : 0), 0);
+	if (mFile == INVALID_HANDLE_VALUE)
+		return HRESULT_FROM_WIN32(GetLastError());
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (unbuffered)
+	{
+		// Some file systems (tmpfs) don't do direct I/O; write through the
+		// cache there rather than fail.
+		mFile = ::open(aFilename, flags | O_DIRECT, 0644);
+	}
+#endif
+	if (mFile < 0)
+		mFile = ::open(aFilename, flags, 0644);
+	if (mFile < 0)
+		return HRESULT_FROM_ERRNO(errno);
+#endif
+
+	// The index is small, and written through stdio.
+	if (mContainer != CAPTURE_RECORD_ARCHIVE)
+	{
+		char indexname[1040];
+		snprintf(indexname, sizeof(indexname), "%s.idx", aFilename);
+		mIndex = fopen(indexname, "w");
+		if (!mIndex)
+		{
+			close();
+			return E_FAIL;
+		}
+		fprintf(mIndex, "# frame offset bytes microseconds\n");
+	}
+
+	mChunkMemory = new BYTE[CHUNK_SIZE + SECTOR_SIZE];
+	mChunk = (BYTE *)(((size_t)mChunkMemory + SECTOR_SIZE - 1) & ~(size_t)(SECTOR_SIZE - 1));
+	mChunkUsed = 0;
+	mFileSize = 0;
+	mFrameNumber = 0;
+
+	if (mContainer == CAPTURE_RECORD_Y4M)
+	{
+		// The real frame times are in the index.
+		char header[128];
+		int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F30:1 Ip A1:1 %s\n",
+			aWidth, aHeight, aFormat == CAPTURE_FORMAT_GRAY8 ? "Cmono" : "C420jpeg");
+		append(header, len);
+	}
+
+	mStart = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	mStartTime = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	if (mContainer == CAPTURE_RECORD_ARCHIVE)
+	{
+		mFrameBytes = PackedFrameSize(aFormat, aWidth, aHeight);
+		mRecordSize = ArchiveRecordSize(mFrameBytes);
+
+		ArchiveHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.mMagic, ARCHIVE_MAGIC, 8);
+		header.mVersion = ARCHIVE_VERSION;
+		header.mRecordSize = mRecordSize;
+		header.mFormat = aFormat;
+		header.mWidth = aWidth;
+		header.mHeight = aHeight;
+		header.mStride = MinimumStride(aFormat, aWidth);
+		header.mFrameBytes = mFrameBytes;
+		header.mStartTime = mStartTime;
+		append(&header, sizeof(header));
+		pad(ARCHIVE_ALIGN - sizeof(header));
+	}
+
+	mSlots.resize(aQueueFrames ? aQueueFrames : DEFAULT_QUEUE_FRAMES);
+	for (size_t i = 0; i < mSlots.size(); i++)
+	{
+		mFreeSlots.push_back(&mSlots[i]);
+	}
+
+	mQuit = 0;
+	mThread = std::thread(&Recorder::writer, this);
+	return S_OK;
+}
+
+int Recorder::close()
+{
+	if (mThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			mQuit = 1;
+		}
+		mReady.notify_one();
+		mFree.notify_all();
+		mThread.join();
+	}
+
+#ifdef _WIN32
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+	mFile = INVALID_HANDLE_VALUE;
+#else
+	if (mFile >= 0)
+		::close(mFile);
+	mFile = -1;
+#endif
+	if (mIndex && fclose(mIndex) != 0 && !mError)
+		mError = E_FAIL;
+	mIndex = 0;
+
+	delete[] mChunkMemory;
+	mChunkMemory = 0;
+	mChunk = 0;
+	mSlots.clear();
+	mFreeSlots.clear();
+	mQueue.clear();
+	mArchiveIndex.clear();
+	return mError == 0;
+}
+
+Recorder::Slot *Recorder::acquire(long long aTimestamp)
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	DWORD sequence = mFramesCaptured++;
+
+	while (mFreeSlots.empty() && !mError && !mQuit)
+	{
+		if (mFlags & CAPTURE_RECORD_BLOCK)
+		{
+			// Backpressure: the capture waits for the disk.
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			mFree.wait(lock);
+			mBlockedMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count();
+		}
+		else if ((mFlags & CAPTURE_RECORD_DROP_OLDEST) && !mQueue.empty())
+		{
+			mFreeSlots.push_back(mQueue.front());
+			mQueue.erase(mQueue.begin());
+			mFramesDropped++;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (mFreeSlots.empty() || mError || mQuit)
+	{
+		mFramesDropped++;
+		return 0;
+	}
+
+	Slot *slot = mFreeSlots.back();
+	mFreeSlots.pop_back();
+	slot->mSequence = sequence;
+	slot->mTime = aTimestamp - mStart;
+	return slot;
+}
+
+void Recorder::submit(Slot *aSlot)
+{
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mQueue.push_back(aSlot);
+		if (mQueue.size() > mQueueHighWater)
+			mQueueHighWater = (unsigned int)mQueue.size();
+	}
+	mReady.notify_one();
+}
+
+void Recorder::pushFrame(const BYTE *aData, DWORD aLength, long long aTimestamp)
+{
+	if (!aData || aLength == 0)
+		return;
+	Slot *slot = acquire(aTimestamp);
+	if (!slot)
+		return;
+	if (slot->mData.size() < aLength)
+		slot->mData.resize(aLength);
+	memcpy(slot->mData.data(), aData, aLength);
+	slot->mLength = aLength;
+	submit(slot);
+}
+
+void Recorder::pushImage(const SimpleCapParamsEx &aParams, long long aTimestamp)
+{
+	Slot *slot = acquire(aTimestamp);
+	if (!slot)
+		return;
+
+	// Bottom-up images are stored top-down, like in any other file.
+	DWORD length = PackedFrameSize(aParams.mFormat, aParams.mWidth, aParams.mHeight);
+	if (slot->mData.size() < length)
+		slot->mData.resize(length);
+	PackFrame(slot->mData.data(), (const BYTE *)aParams.mTargetBuf, aParams.mFormat, aParams.mWidth, aParams.mHeight,
+		aParams.mStride, aParams.mFlags & CAPTURE_FLAG_FLIP_VERTICAL);
+
+	slot->mLength = length;
+	submit(slot);
+}
+
+void Recorder::getStats(CaptureRecordingStats &aStats)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+	aStats.mFramesCaptured = mFramesCaptured;
+	aStats.mFramesWritten = mFramesWritten;
+	aStats.mFramesDropped = mFramesDropped;
+	aStats.mQueueDepth = (unsigned int)mQueue.size();
+	aStats.mQueueHighWater = mQueueHighWater;
+	aStats.mQueueFrames = (unsigned int)mSlots.size();
+	aStats.mBytesWritten = mBytesWritten;
+	aStats.mBlockedMicroseconds = mBlockedMicroseconds;
+	aStats.mWriteMaxMicroseconds = mWriteMaxMicroseconds;
+	aStats.mError = mError;
+}
+
+void Recorder::writer()
+{
+	std::unique_lock<std::mutex> lock(mLock);
+	for (;;)
+	{
+		while (mQueue.empty() && !mQuit)
+		{
+			mReady.wait(lock);
+		}
+		if (mQueue.empty())
+			break;
+
+		Slot *slot = mQueue.front();
+		mQueue.erase(mQueue.begin());
+		lock.unlock();
+
+		if (mContainer == CAPTURE_RECORD_ARCHIVE)
+		{
+			ArchiveRecord record;
+			memset(&record, 0, sizeof(record));
+			record.mTimestamp = mStartTime + slot->mTime;
+			record.mSequence = slot->mSequence;
+			record.mLength = slot->mLength;
+			append(&record, sizeof(record));
+			append(slot->mData.data(), slot->mLength);
+			pad(mRecordSize - sizeof(record) - slot->mLength);
+
+			ArchiveIndexEntry entry;
+			entry.mTimestamp = record.mTimestamp;
+			entry.mSequence = record.mSequence;
+			entry.mReserved = 0;
+			mArchiveIndex.push_back(entry);
+		}
+		else
+		{
+			if (mContainer == CAPTURE_RECORD_Y4M)
+				append("FRAME\n", 6);
+			unsigned long long offset = mFileSize + mChunkUsed;
+			append(slot->mData.data(), slot->mLength);
+			fprintf(mIndex, "%u %llu %lu %lld\n", mFrameNumber++, offset, (unsigned long)slot->mLength, slot->mTime);
+		}
+
+		lock.lock();
+		if (!mError)
+			mFramesWritten++;
+		else
+			mFramesDropped++;
+		mFreeSlots.push_back(slot);
+		mFree.notify_one();
+	}
+	lock.unlock();
+
+	if (mContainer == CAPTURE_RECORD_ARCHIVE)
+	{
+		ArchiveTrailer trailer;
+		memset(&trailer, 0, sizeof(trailer));
+		memcpy(trailer.mMagic, ARCHIVE_TRAILER_MAGIC, 8);
+		trailer.mIndexOffset = mFileSize + mChunkUsed;
+		trailer.mFrameCount = (DWORD)mArchiveIndex.size();
+		if (!mArchiveIndex.empty())
+			append(mArchiveIndex.data(), mArchiveIndex.size() * sizeof(ArchiveIndexEntry));
+		append(&trailer, sizeof(trailer));
+	}
+
+	flush(1);
+}
+
+void Recorder::append(const void *aData, size_t aLength)
+{
+	const BYTE *src = (const BYTE *)aData;
+	while (aLength)
+	{
+		size_t len = CHUNK_SIZE - mChunkUsed;
+		if (len > aLength)
+			len = aLength;
+		memcpy(mChunk + mChunkUsed, src, len);
+		mChunkUsed += len;
+		src += len;
+		aLength -= len;
+		if (mChunkUsed == CHUNK_SIZE)
+			flush(0);
+	}
+}
+
+void Recorder::pad(size_t aLength)
+{
+	while (aLength)
+	{
+		size_t len = CHUNK_SIZE - mChunkUsed;
+		if (len > aLength)
+			len = aLength;
+		memset(mChunk + mChunkUsed, 0, len);
+		mChunkUsed += len;
+		aLength -= len;
+		if (mChunkUsed == CHUNK_SIZE)
+			flush(0);
+	}
+}
+
+void Recorder::flush(int aFinal)
+{
+	size_t used = mChunkUsed;
+	size_t len = used;
+	mChunkUsed = 0;
+	if (!len || mError)
+		return;
+
+	// The last chunk is padded to whole sectors, and cut back afterwards.
+	if (aFinal && (mFlags & CAPTURE_RECORD_UNBUFFERED))
+	{
+		len = (len + SECTOR_SIZE - 1) & ~(size_t)(SECTOR_SIZE - 1);
+		memset(mChunk + used, 0, len - used);
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	HRESULT hr = S_OK;
+#ifdef _WIN32
+	DWORD written = 0;
+	if (!WriteFile(mFile, mChunk, (DWORD)len, &written, 0) || written != len)
+		hr = HRESULT_FROM_WIN32(GetLastError());
+	if (SUCCEEDED(hr) && len != used)
+	{
+		LARGE_INTEGER end;
+		end.QuadPart = mFileSize + used;
+		if (!SetFilePointerEx(mFile, end, 0, FILE_BEGIN) || !SetEndOfFile(mFile))
+			hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+#else
+	const BYTE *src = mChunk;
+	size_t left = len;
+	while (left && SUCCEEDED(hr))
+	{
+		ssize_t written = write(mFile, src, left);
+		if (written > 0)
+		{
+			src += written;
+			left -= written;
+		}
+		else if (written == 0 || errno != EINTR)
+		{
+			hr = HRESULT_FROM_ERRNO(written == 0 ? EIO : errno);
+		}
+	}
+	if (SUCCEEDED(hr) && len != used && ftruncate(mFile, mFileSize + used) != 0)
+		hr = HRESULT_FROM_ERRNO(errno);
+#endif
+	unsigned int us = (unsigned int)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+
+	std::lock_guard<std::mutex> lock(mLock);
+	if (FAILED(hr))
+	{
+		// Frames after a failed write are dropped, and the capture goes on.
+		mError = hr;
+		mFree.notify_all();
+		return;
+	}
+	mFileSize += used;
+	mBytesWritten += used;
+	if (us > mWriteMaxMicroseconds)
+		mWriteMaxMicroseconds = us;
+}
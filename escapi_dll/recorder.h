@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SimpleCapParamsEx;
+struct CaptureRecordingStats;
+struct ArchiveIndexEntry;
+
+// Writes the frames of one device to disk on its own thread, so that the
+// capture thread only pays for a copy into a queue slot. The file is
+// written in large aligned chunks, which also suits unbuffered I/O.
+class Recorder
+{
+public:
+	Recorder();
+	~Recorder();
+
+	// Opens the file (and the index next to it) and starts the writer.
+	// aFormat is the CAPTURE_FORMATS of the frames, for the Y4M header.
+	HRESULT open(const char *aFilename, int aContainer, int aQueueFrames, unsigned int aFlags,
+		int aFormat, int aWidth, int aHeight);
+	// Writes out what is queued and closes the files; 0 if anything failed.
+	int close();
+
+	// Queue a frame as the camera delivered it, taken at aTimestamp
+	// (microseconds of the steady clock, as CaptureClock gives)
+	void pushFrame(const BYTE *aData, DWORD aLength, long long aTimestamp);
+	// Queue the image in a target buffer, with the rows tightly packed
+	void pushImage(const SimpleCapParamsEx &aParams, long long aTimestamp);
+
+	void getStats(CaptureRecordingStats &aStats);
+	unsigned int flags() const { return mFlags; }
+
+private:
+	struct Slot
+	{
+		std::vector<BYTE> mData;
+		DWORD mLength;
+		DWORD mSequence;     // mFramesCaptured before this frame
+		long long mTime;     // Capture time, in microseconds since the recording started
+	};
+
+	Slot *acquire(long long aTimestamp);
+	void submit(Slot *aSlot);
+	void writer();
+	void append(const void *aData, size_t aLength);
+	void pad(size_t aLength);
+	void flush(int aFinal);
+
+	int                     mContainer;
+	unsigned int            mFlags;
+	int                     mFormat;
+	int                     mWidth;
+	int                     mHeight;
+	long long               mStart;       // Steady clock microseconds when recording started
+	long long               mStartTime;   // mStart in microseconds since 1970
+	DWORD                   mFrameBytes;  // Of the images, in archives
+	DWORD                   mRecordSize;
+
+	// Queue, guarded by mLock
+	std::mutex              mLock;
+	std::condition_variable mReady;       // A slot was submitted, or mQuit set
+	std::condition_variable mFree;        // A slot was written
+	std::vector<Slot>       mSlots;
+	std::vector<Slot *>     mFreeSlots;
+	std::vector<Slot *>     mQueue;       // Oldest first
+	int                     mQuit;
+
+	// Statistics, guarded by mLock
+	unsigned int            mFramesCaptured;
+	unsigned int            mFramesWritten;
+	unsigned int            mFramesDropped;
+	unsigned int            mQueueHighWater;
+	unsigned long long      mBytesWritten;
+	unsigned long long      mBlockedMicroseconds;
+	unsigned int            mWriteMaxMicroseconds;
+	int                     mError;
+
+	// Output, used by the writer thread only
+	std::thread             mThread;
+#ifdef _WIN32
+	HANDLE                  mFile;
+#else
+	int                     mFile;
+#endif
+	FILE                    *mIndex;      // Text index of raw and Y4M files
+	std::vector<ArchiveIndexEntry> mArchiveIndex;
+	BYTE                    *mChunkMemory;
+	BYTE                    *mChunk;      // Aligned to the sector size
+	size_t                  mChunkUsed;
+	unsigned long long      mFileSize;
+	unsigned int            mFrameNumber;
+};
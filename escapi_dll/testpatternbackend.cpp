@@ -0,0 +1,237 @@
+#include "platform.h"
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "conversion.h"
+#include "scaling.h"
+#include "testpattern.h"
+#include "capture.h"
+#include "testpatternbackend.h"
+
+TestPatternSettings gTestPattern = { 0, 640, 480, 30, SUBTYPE_YUY2 };
+TestPatternBackend gTestPatternBackend;
+
+#define DO_OR_DIE { if (mCapture->mErrorLine) return hr; if (!SUCCEEDED(hr)) { mCapture->mErrorLine = __LINE__; mCapture->mErrorCode = hr; return hr; } }
+#define DO_OR_DIE_CRITSECTION { if (mCapture->mErrorLine) { LeaveCriticalSection(&mCapture->mCritsec); return hr;} if (!SUCCEEDED(hr)) { LeaveCriticalSection(&mCapture->mCritsec); mCapture->mErrorLine = __LINE__; mCapture->mErrorCode = hr; return hr; } }
+
+struct TestPatternFormat
+{
+	const char *mName;
+	DWORD mSubtype;
+};
+
+// Indexed by CAPTURE_TESTPATTERN_FORMATS
+static const TestPatternFormat gTestPatternFormats[CAPTURE_TESTPATTERN_MAX] =
+{
+	{ "YUY2", SUBTYPE_YUY2 },
+	{ "NV12", SUBTYPE_NV12 },
+	{ "RGB24", SUBTYPE_RGB24 },
+	{ "RGB32", SUBTYPE_RGB32 },
+	{ "MJPG", SUBTYPE_MJPG }
+};
+
+static const char gTestPatternName[] = "ESCAPI test pattern";
+
+// setTestPatternDevice takes precedence over the environment
+static int gTestPatternConfigured = 0;
+
+
+int SetTestPatternDevice(int aEnable, int aWidth, int aHeight, int aFps, int aFormat)
+{
+	if (aEnable)
+	{
+		if (aWidth < 2 || aHeight < 2 || aWidth > 16384 || aHeight > 16384 || ((aWidth | aHeight) & 1) ||
+			aFps < 0 || aFormat < 0 || aFormat >= CAPTURE_TESTPATTERN_MAX)
+			return 0;
+		gTestPattern.mWidth = aWidth;
+		gTestPattern.mHeight = aHeight;
+		gTestPattern.mFps = aFps;
+		gTestPattern.mSubtype = gTestPatternFormats[aFormat].mSubtype;
+	}
+	gTestPattern.mEnabled = aEnable ? 1 : 0;
+	gTestPatternConfigured = 1;
+	return 1;
+}
+
+// ESCAPI_TESTPATTERN is "1" for the defaults, or "WIDTHxHEIGHT[@FPS][,FORMAT]",
+// for example "1280x720@0,MJPG".
+static void ReadTestPatternEnvironment()
+{
+	if (gTestPatternConfigured)
+		return;
+	gTestPatternConfigured = 1;
+
+	char value[64];
+	DWORD len = GetEnvironmentVariableA("ESCAPI_TESTPATTERN", value, sizeof(value));
+	if (len == 0 || len >= sizeof(value) || !strcmp(value, "0"))
+		return;
+
+	if (!strcmp(value, "1"))
+	{
+		gTestPattern.mEnabled = 1;
+		return;
+	}
+
+	int width = 0, height = 0, fps = 30, format = CAPTURE_TESTPATTERN_YUY2;
+	char name[16] = "";
+	const char *rest = strchr(value, ',');
+	if (sscanf(value, "%dx%d@%d", &width, &height, &fps) < 2)
+		return;
+	if (rest && sscanf(rest + 1, "%15s", name) == 1)
+	{
+		for (format = 0; format < CAPTURE_TESTPATTERN_MAX; format++)
+		{
+			if (!_stricmp(name, gTestPatternFormats[format].mName))
+				break;
+		}
+	}
+	SetTestPatternDevice(1, width, height, fps, format);
+}
+
+int TestPatternBackend::countDevices()
+{
+	ReadTestPatternEnvironment();
+	return gTestPattern.mEnabled;
+}
+
+void TestPatternBackend::getDeviceName(int aDevice, char *aNamebuffer, int aBufferlength)
+{
+	int i;
+	for (i = 0; i < aBufferlength - 1 && gTestPatternName[i]; i++)
+	{
+		aNamebuffer[i] = gTestPatternName[i];
+	}
+	aNamebuffer[i] = 0;
+}
+
+CaptureStream *TestPatternBackend::createStream(int aDevice)
+{
+	return new TestPatternStream;
+}
+
+TestPatternStream::TestPatternStream()
+{
+	mCapture = 0;
+	mPattern = 0;
+	mFps = 0;
+	mQuit = 0;
+}
+
+TestPatternStream::~TestPatternStream()
+{
+	stop();
+	delete mPattern;
+}
+
+HRESULT TestPatternStream::start(CaptureClass *aCapture)
+{
+	HRESULT hr = S_OK;
+	mCapture = aCapture;
+
+	// Describe the frames like a camera would, so that they go through
+	// the same conversion and scaling setup.
+	VideoFormat format;
+	format.mSubtype = gTestPattern.mSubtype;
+	format.mWidth = gTestPattern.mWidth;
+	format.mHeight = gTestPattern.mHeight;
+	format.mMatrix = YCBCR_BT601;
+
+	if (!mCapture->isFormatSupported(format.mSubtype))
+	{
+		hr = MF_E_INVALIDMEDIATYPE;
+	}
+
+	DO_OR_DIE;
+
+	EnterCriticalSection(&mCapture->mCritsec);
+
+	hr = mCapture->setVideoFormat(format);
+
+	DO_OR_DIE_CRITSECTION;
+
+	delete mPattern;
+	mPattern = new TestPattern;
+	if (!mPattern->init(format.mSubtype, format.mWidth, format.mHeight))
+	{
+		hr = E_INVALIDARG;
+	}
+
+	DO_OR_DIE_CRITSECTION;
+
+	mFps = gTestPattern.mFps;
+	mQuit = 0;
+	mThread = std::thread(&TestPatternStream::run, this);
+
+	LeaveCriticalSection(&mCapture->mCritsec);
+
+	return hr;
+}
+
+void TestPatternStream::stop()
+{
+	if (mThread.joinable())
+	{
+		mQuit = 1;
+		mCapture->requestMade();
+		mThread.join();
+	}
+}
+
+int TestPatternStream::setProperty(int aProperty, float aValue, int aAuto)
+{
+	// The test pattern has no properties
+	return 0;
+}
+
+int TestPatternStream::getProperty(int aProperty, float &aValue, int &aAuto)
+{
+	return 1;
+}
+
+void TestPatternStream::run()
+{
+	std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(mFps ? 1.0 / mFps : 0));
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	DWORD frame = 0;
+
+	while (!mQuit)
+	{
+		if (mFps)
+		{
+			// Frames come at the frame rate whether they're wanted or not,
+			// like from a camera, but don't catch up after a stall.
+			std::this_thread::sleep_until(next);
+			next += period;
+			if (std::chrono::steady_clock::now() > next)
+				next = std::chrono::steady_clock::now();
+		}
+		else
+		{
+			// Without a frame rate, each request gets the next frame at once.
+			mCapture->waitForRequest(mQuit);
+			if (mQuit)
+				break;
+		}
+
+		EnterCriticalSection(&mCapture->mCritsec);
+		long long timestamp = CaptureClock();
+		mCapture->frameArrived(timestamp);
+		if (mCapture->wantsFrame())
+		{
+			DWORD size = 0;
+			const BYTE *data = mPattern->render(frame, size);
+			if (data)
+			{
+				mCapture->deliverFrame(data, size, data, mPattern->stride(), timestamp);
+			}
+		}
+		LeaveCriticalSection(&mCapture->mCritsec);
+
+		frame++;
+	}
+}
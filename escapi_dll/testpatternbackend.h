@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "backend.h"
+
+class TestPattern;
+
+// The virtual device that setTestPatternDevice (or the ESCAPI_TESTPATTERN
+// environment variable) adds after the real ones
+struct TestPatternSettings
+{
+	int   mEnabled;
+	int   mWidth;
+	int   mHeight;
+	int   mFps;      // 0 renders a frame for each request, as fast as possible
+	DWORD mSubtype;  // One of VIDEO_SUBTYPES
+};
+
+extern TestPatternSettings gTestPattern;
+
+// Renders frames on its own thread, like a camera driver would deliver them
+class TestPatternStream : public CaptureStream
+{
+public:
+	TestPatternStream();
+	~TestPatternStream();
+	HRESULT start(CaptureClass *aCapture);
+	void stop();
+	int setProperty(int aProperty, float aValue, int aAuto);
+	int getProperty(int aProperty, float &aValue, int &aAuto);
+	void run();
+
+	CaptureClass            *mCapture;
+	TestPattern             *mPattern;
+	int                     mFps;
+	std::thread             mThread;
+	std::atomic<int>        mQuit;
+};
+
+class TestPatternBackend : public CaptureBackend
+{
+public:
+	int countDevices();
+	void getDeviceName(int aDevice, char *aNamebuffer, int aBufferlength);
+	CaptureStream *createStream(int aDevice);
+};
+
+extern TestPatternBackend gTestPatternBackend;
+
+int SetTestPatternDevice(int aEnable, int aWidth, int aHeight, int aFps, int aFormat);
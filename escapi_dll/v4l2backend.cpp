@@ -0,0 +1,573 @@
+#include "platform.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+
+#define ESCAPI_DEFINITIONS_ONLY
+#include "escapi.h"
+
+#include "conversion.h"
+#include "scaling.h"
+#include "capture.h"
+#include "v4l2backend.h"
+
+V4L2CaptureBackend gV4L2Backend;
+
+#define DO_OR_DIE { if (mCapture->mErrorLine) return hr; if (!SUCCEEDED(hr)) { mCapture->mErrorLine = __LINE__; mCapture->mErrorCode = hr; return hr; } }
+#define DO_OR_DIE_CRITSECTION { if (mCapture->mErrorLine) { LeaveCriticalSection(&mCapture->mCritsec); return hr;} if (!SUCCEEDED(hr)) { LeaveCriticalSection(&mCapture->mCritsec); mCapture->mErrorLine = __LINE__; mCapture->mErrorCode = hr; return hr; } }
+
+// Number of buffers to ask the driver for; it may give more or fewer.
+#define V4L2_BUFFERS 4
+
+struct V4L2Format
+{
+	__u32 mPixelFormat;
+	DWORD mSubtype;
+};
+
+// Pixel formats that have a VIDEO_SUBTYPES equivalent, with the same
+// layout in memory
+static const V4L2Format gV4L2Formats[] =
+{
+	{ V4L2_PIX_FMT_YUYV, SUBTYPE_YUY2 },
+	{ V4L2_PIX_FMT_UYVY, SUBTYPE_UYVY },
+	{ V4L2_PIX_FMT_YVYU, SUBTYPE_YVYU },
+	{ V4L2_PIX_FMT_NV12, SUBTYPE_NV12 },
+	{ V4L2_PIX_FMT_YUV420, SUBTYPE_I420 },
+	{ V4L2_PIX_FMT_YVU420, SUBTYPE_YV12 },
+	{ V4L2_PIX_FMT_BGR24, SUBTYPE_RGB24 },
+	{ V4L2_PIX_FMT_XBGR32, SUBTYPE_RGB32 },
+	{ V4L2_PIX_FMT_ABGR32, SUBTYPE_RGB32 },
+	{ V4L2_PIX_FMT_BGR32, SUBTYPE_RGB32 },
+	{ V4L2_PIX_FMT_MJPEG, SUBTYPE_MJPG },
+	{ V4L2_PIX_FMT_JPEG, SUBTYPE_MJPG }
+};
+
+static const int gV4L2FormatCount = sizeof(gV4L2Formats) / sizeof(gV4L2Formats[0]);
+
+struct V4L2Control
+{
+	__u32 mId;
+	__u32 mAutoId;     // Control that turns on automatic mode, or 0
+	__s32 mAutoOn;     // Its values for automatic and manual
+	__s32 mAutoOff;
+};
+
+// Indexed by CAPTURE_PROPETIES; 0 where V4L2 has no equivalent
+static const V4L2Control gV4L2Controls[CAPTURE_PROP_MAX] =
+{
+	{ V4L2_CID_BRIGHTNESS, 0, 0, 0 },
+	{ V4L2_CID_CONTRAST, 0, 0, 0 },
+	{ V4L2_CID_HUE, V4L2_CID_HUE_AUTO, 1, 0 },
+	{ V4L2_CID_SATURATION, 0, 0, 0 },
+	{ V4L2_CID_SHARPNESS, 0, 0, 0 },
+	{ V4L2_CID_GAMMA, 0, 0, 0 },
+	{ 0, 0, 0, 0 },
+	{ V4L2_CID_WHITE_BALANCE_TEMPERATURE, V4L2_CID_AUTO_WHITE_BALANCE, 1, 0 },
+	{ V4L2_CID_BACKLIGHT_COMPENSATION, 0, 0, 0 },
+	{ V4L2_CID_GAIN, V4L2_CID_AUTOGAIN, 1, 0 },
+	{ V4L2_CID_PAN_ABSOLUTE, 0, 0, 0 },
+	{ V4L2_CID_TILT_ABSOLUTE, 0, 0, 0 },
+	{ 0, 0, 0, 0 },
+	{ V4L2_CID_ZOOM_ABSOLUTE, 0, 0, 0 },
+	// UVC cameras only offer aperture priority as the automatic mode
+	{ V4L2_CID_EXPOSURE_ABSOLUTE, V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_APERTURE_PRIORITY, V4L2_EXPOSURE_MANUAL },
+	{ V4L2_CID_IRIS_ABSOLUTE, 0, 0, 0 },
+	{ V4L2_CID_FOCUS_ABSOLUTE, V4L2_CID_FOCUS_AUTO, 1, 0 }
+};
+
+// ioctl, restarted if a signal interrupts it
+static int Ioctl(int aFd, unsigned long aRequest, void *aArg)
+{
+	int r;
+	do
+	{
+		r = ioctl(aFd, aRequest, aArg);
+	} while (r == -1 && errno == EINTR);
+	return r;
+}
+
+// Walks the /dev/video nodes that can stream video capture. With aDevice
+// -1, returns how many there are; otherwise returns 1 and fills in the
+// path and capabilities of that one, or returns 0 if it doesn't exist.
+static int ScanDevices(int aDevice, char *aPath, struct v4l2_capability *aCap)
+{
+	int count = 0;
+	for (int i = 0; i < 64; i++)
+	{
+		char path[32];
+		sprintf(path, "/dev/video%d", i);
+		int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		struct v4l2_capability cap;
+		memset(&cap, 0, sizeof(cap));
+		int ok = Ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0;
+		close(fd);
+
+		// Metadata nodes of the same camera share its capabilities
+		__u32 caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+		if (!ok || !(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+			continue;
+
+		if (count == aDevice)
+		{
+			strcpy(aPath, path);
+			*aCap = cap;
+			return 1;
+		}
+		count++;
+	}
+	return aDevice < 0 ? count : 0;
+}
+
+int V4L2CaptureBackend::countDevices()
+{
+	return ScanDevices(-1, 0, 0);
+}
+
+void V4L2CaptureBackend::getDeviceName(int aDevice, char *aNamebuffer, int aBufferlength)
+{
+	char path[32];
+	struct v4l2_capability cap;
+	if (!ScanDevices(aDevice, path, &cap))
+		return;
+
+	int i;
+	for (i = 0; i < aBufferlength - 1 && i < (int)sizeof(cap.card) && cap.card[i]; i++)
+	{
+		aNamebuffer[i] = (char)cap.card[i];
+	}
+	aNamebuffer[i] = 0;
+}
+
+CaptureStream *V4L2CaptureBackend::createStream(int aDevice)
+{
+	char path[32];
+	struct v4l2_capability cap;
+	if (!ScanDevices(aDevice, path, &cap))
+		return 0;
+	return new V4L2CaptureStream(path);
+}
+
+V4L2CaptureStream::V4L2CaptureStream(const char *aPath)
+{
+	mCapture = 0;
+	strcpy(mPath, aPath);
+	mFd = -1;
+	mBuffers = 0;
+	mBufferCount = 0;
+	mStride = 0;
+	mSequence = 0;
+	mHaveSequence = 0;
+	mQuit = 0;
+}
+
+V4L2CaptureStream::~V4L2CaptureStream()
+{
+	stop();
+}
+
+static DWORD SubtypeOf(__u32 aPixelFormat)
+{
+	for (int i = 0; i < gV4L2FormatCount; i++)
+	{
+		if (gV4L2Formats[i].mPixelFormat == aPixelFormat)
+			return gV4L2Formats[i].mSubtype;
+	}
+	return 0;
+}
+
+// Rounds a size into a stepwise range
+static DWORD Clamp(DWORD aSize, __u32 aMin, __u32 aMax, __u32 aStep)
+{
+	if (aSize < aMin)
+		return aMin;
+	if (aSize > aMax)
+		return aMax;
+	if (aStep > 1)
+		aSize = aMin + (aSize - aMin + aStep / 2) / aStep * aStep;
+	return aSize > aMax ? aMax : aSize;
+}
+
+HRESULT V4L2CaptureStream::setFormat(DWORD aWidth, DWORD aHeight)
+{
+	HRESULT hr = S_OK;
+	int besterror = 0xfffffff;
+	__u32 bestformat = 0;
+	DWORD bestwidth = 0;
+	DWORD bestheight = 0;
+
+	// Same choice as with Media Foundation: the first mode of the size
+	// closest to the target, in the order the driver lists them.
+	struct v4l2_fmtdesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	for (desc.index = 0; besterror && Ioctl(mFd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++)
+	{
+		if (!mCapture->isFormatSupported(SubtypeOf(desc.pixelformat)))
+			continue;
+
+		struct v4l2_frmsizeenum size;
+		memset(&size, 0, sizeof(size));
+		size.pixel_format = desc.pixelformat;
+		for (size.index = 0; besterror && Ioctl(mFd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++)
+		{
+			DWORD width, height;
+			if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+			{
+				width = size.discrete.width;
+				height = size.discrete.height;
+			}
+			else
+			{
+				width = Clamp(aWidth, size.stepwise.min_width, size.stepwise.max_width, size.stepwise.step_width);
+				height = Clamp(aHeight, size.stepwise.min_height, size.stepwise.max_height, size.stepwise.step_height);
+			}
+
+			int error = CaptureClass::SizeError(width, height, aWidth, aHeight);
+			if (besterror > error)
+			{
+				besterror = error;
+				bestformat = desc.pixelformat;
+				bestwidth = width;
+				bestheight = height;
+			}
+
+			if (size.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+				break;
+		}
+
+		// Drivers that can't list sizes get asked for the target size.
+		if (size.index == 0 && !bestformat)
+		{
+			bestformat = desc.pixelformat;
+			bestwidth = aWidth;
+			bestheight = aHeight;
+		}
+	}
+
+	if (!bestformat)
+	{
+		hr = MF_E_INVALIDMEDIATYPE;
+	}
+
+	DO_OR_DIE;
+
+	struct v4l2_format fmt;
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width = bestwidth;
+	fmt.fmt.pix.height = bestheight;
+	fmt.fmt.pix.pixelformat = bestformat;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (Ioctl(mFd, VIDIOC_S_FMT, &fmt) < 0)
+	{
+		hr = HRESULT_FROM_ERRNO(errno);
+	}
+
+	DO_OR_DIE;
+
+	// The driver may have adjusted anything.
+	VideoFormat format;
+	format.mSubtype = SubtypeOf(fmt.fmt.pix.pixelformat);
+	format.mWidth = fmt.fmt.pix.width;
+	format.mHeight = fmt.fmt.pix.height;
+
+	int bt709 = fmt.fmt.pix.ycbcr_enc == V4L2_YCBCR_ENC_709 ||
+		(fmt.fmt.pix.ycbcr_enc == V4L2_YCBCR_ENC_DEFAULT && fmt.fmt.pix.colorspace == V4L2_COLORSPACE_REC709);
+	int fullRange = fmt.fmt.pix.quantization == V4L2_QUANTIZATION_FULL_RANGE ||
+		(fmt.fmt.pix.quantization == V4L2_QUANTIZATION_DEFAULT && fmt.fmt.pix.colorspace == V4L2_COLORSPACE_JPEG);
+	if (bt709)
+		format.mMatrix = fullRange ? YCBCR_BT709_FULL : YCBCR_BT709;
+	else
+		format.mMatrix = fullRange ? YCBCR_BT601_FULL : YCBCR_BT601;
+
+	mStride = fmt.fmt.pix.bytesperline;
+
+	if (!mCapture->isFormatSupported(format.mSubtype))
+	{
+		hr = MF_E_INVALIDMEDIATYPE;
+	}
+
+	DO_OR_DIE;
+
+	hr = mCapture->setVideoFormat(format);
+
+	DO_OR_DIE;
+
+	return hr;
+}
+
+HRESULT V4L2CaptureStream::mapBuffers()
+{
+	HRESULT hr = S_OK;
+
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count = V4L2_BUFFERS;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (Ioctl(mFd, VIDIOC_REQBUFS, &req) < 0)
+	{
+		hr = HRESULT_FROM_ERRNO(errno);
+	}
+	else if (req.count < 2)
+	{
+		hr = E_OUTOFMEMORY;
+	}
+
+	DO_OR_DIE;
+
+	mBuffers = new Buffer[req.count];
+	memset(mBuffers, 0, sizeof(Buffer) * req.count);
+	mBufferCount = req.count;
+
+	for (unsigned int i = 0; i < mBufferCount; i++)
+	{
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (Ioctl(mFd, VIDIOC_QUERYBUF, &buf) < 0)
+		{
+			hr = HRESULT_FROM_ERRNO(errno);
+		}
+
+		DO_OR_DIE;
+
+		void *data = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, buf.m.offset);
+		if (data == MAP_FAILED)
+		{
+			hr = HRESULT_FROM_ERRNO(errno);
+		}
+
+		DO_OR_DIE;
+
+		mBuffers[i].mData = data;
+		mBuffers[i].mLength = buf.length;
+
+		if (Ioctl(mFd, VIDIOC_QBUF, &buf) < 0)
+		{
+			hr = HRESULT_FROM_ERRNO(errno);
+		}
+
+		DO_OR_DIE;
+	}
+
+	return hr;
+}
+
+void V4L2CaptureStream::unmapBuffers()
+{
+	for (unsigned int i = 0; i < mBufferCount; i++)
+	{
+		if (mBuffers[i].mData)
+			munmap(mBuffers[i].mData, mBuffers[i].mLength);
+	}
+	delete[] mBuffers;
+	mBuffers = 0;
+	mBufferCount = 0;
+
+	// Frees the driver's buffers
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	Ioctl(mFd, VIDIOC_REQBUFS, &req);
+}
+
+HRESULT V4L2CaptureStream::start(CaptureClass *aCapture)
+{
+	HRESULT hr = S_OK;
+	mCapture = aCapture;
+
+	mFd = open(mPath, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (mFd < 0)
+	{
+		hr = HRESULT_FROM_ERRNO(errno);
+	}
+
+	DO_OR_DIE;
+
+	EnterCriticalSection(&mCapture->mCritsec);
+
+	DWORD width, height;
+	mCapture->getTargetSize(width, height);
+	hr = setFormat(width, height);
+
+	DO_OR_DIE_CRITSECTION;
+
+	hr = mapBuffers();
+
+	DO_OR_DIE_CRITSECTION;
+
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (Ioctl(mFd, VIDIOC_STREAMON, &type) < 0)
+	{
+		hr = HRESULT_FROM_ERRNO(errno);
+	}
+
+	DO_OR_DIE_CRITSECTION;
+
+	mHaveSequence = 0;
+	mQuit = 0;
+	mThread = std::thread(&V4L2CaptureStream::run, this);
+
+	LeaveCriticalSection(&mCapture->mCritsec);
+
+	return hr;
+}
+
+void V4L2CaptureStream::stop()
+{
+	if (mThread.joinable())
+	{
+		mQuit = 1;
+		mThread.join();
+	}
+
+	if (mFd < 0)
+		return;
+
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	Ioctl(mFd, VIDIOC_STREAMOFF, &type);
+	unmapBuffers();
+	close(mFd);
+	mFd = -1;
+}
+
+void V4L2CaptureStream::run()
+{
+	while (!mQuit)
+	{
+		// Wakes up now and then to check for stop()
+		struct pollfd pfd;
+		pfd.fd = mFd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (Ioctl(mFd, VIDIOC_DQBUF, &buf) < 0)
+		{
+			if (errno == EAGAIN)
+				continue;
+
+			// Most likely unplugged
+			EnterCriticalSection(&mCapture->mCritsec);
+			if (!mCapture->mErrorLine)
+			{
+				mCapture->mErrorLine = __LINE__;
+				mCapture->mErrorCode = HRESULT_FROM_ERRNO(errno);
+			}
+			LeaveCriticalSection(&mCapture->mCritsec);
+			break;
+		}
+
+		// Monotonic driver timestamps (of the start of the frame, usually)
+		// are on the same clock as CaptureClock.
+		long long timestamp = CaptureClock();
+		if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+			timestamp = (long long)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+
+		EnterCriticalSection(&mCapture->mCritsec);
+		mCapture->frameArrived(timestamp);
+
+		// The driver numbers the frames, so a gap is frames it dropped.
+		if (mHaveSequence && buf.sequence - mSequence > 1)
+			mCapture->mStats.dropped(buf.sequence - mSequence - 1);
+		if (buf.flags & V4L2_BUF_FLAG_ERROR)
+			mCapture->mStats.dropped(1);
+		mSequence = buf.sequence;
+		mHaveSequence = 1;
+
+		if (mCapture->wantsFrame() && buf.index < mBufferCount && buf.bytesused &&
+			!(buf.flags & V4L2_BUF_FLAG_ERROR))
+		{
+			const BYTE *data = (const BYTE *)mBuffers[buf.index].mData;
+			mCapture->deliverFrame(data, buf.bytesused, data, mStride, timestamp);
+		}
+		LeaveCriticalSection(&mCapture->mCritsec);
+
+		Ioctl(mFd, VIDIOC_QBUF, &buf);
+	}
+}
+
+int V4L2CaptureStream::setProperty(int aProperty, float aValue, int aAuto)
+{
+	if (mFd < 0 || aProperty < 0 || aProperty >= CAPTURE_PROP_MAX || !gV4L2Controls[aProperty].mId)
+		return 0;
+
+	const V4L2Control &control = gV4L2Controls[aProperty];
+	struct v4l2_queryctrl query;
+	memset(&query, 0, sizeof(query));
+	query.id = control.mId;
+	if (Ioctl(mFd, VIDIOC_QUERYCTRL, &query) < 0 || (query.flags & V4L2_CTRL_FLAG_DISABLED))
+		return 0;
+
+	struct v4l2_control ctrl;
+
+	// Manual values are ignored (or refused) while in automatic mode.
+	if (control.mAutoId && !aAuto)
+	{
+		ctrl.id = control.mAutoId;
+		ctrl.value = control.mAutoOff;
+		Ioctl(mFd, VIDIOC_S_CTRL, &ctrl);
+	}
+
+	ctrl.id = control.mId;
+	ctrl.value = aAuto ? query.default_value : (__s32)floor(query.minimum + (query.maximum - query.minimum) * aValue);
+	int ok = Ioctl(mFd, VIDIOC_S_CTRL, &ctrl) == 0;
+
+	if (control.mAutoId && aAuto)
+	{
+		ctrl.id = control.mAutoId;
+		ctrl.value = control.mAutoOn;
+		ok = Ioctl(mFd, VIDIOC_S_CTRL, &ctrl) == 0;
+	}
+	return ok;
+}
+
+int V4L2CaptureStream::getProperty(int aProperty, float &aValue, int &aAuto)
+{
+	if (mFd < 0 || aProperty < 0 || aProperty >= CAPTURE_PROP_MAX || !gV4L2Controls[aProperty].mId)
+		return 1;
+
+	const V4L2Control &control = gV4L2Controls[aProperty];
+	struct v4l2_queryctrl query;
+	memset(&query, 0, sizeof(query));
+	query.id = control.mId;
+	if (Ioctl(mFd, VIDIOC_QUERYCTRL, &query) < 0 || (query.flags & V4L2_CTRL_FLAG_DISABLED))
+		return 1;
+
+	struct v4l2_control ctrl;
+	ctrl.id = control.mId;
+	ctrl.value = 0;
+	if (Ioctl(mFd, VIDIOC_G_CTRL, &ctrl) < 0)
+		return 1;
+
+	if (query.maximum > query.minimum)
+		aValue = (ctrl.value - query.minimum) / (float)(query.maximum - query.minimum);
+
+	if (control.mAutoId)
+	{
+		ctrl.id = control.mAutoId;
+		if (Ioctl(mFd, VIDIOC_G_CTRL, &ctrl) == 0)
+			aAuto = ctrl.value != control.mAutoOff;
+	}
+	return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "backend.h"
+
+// Cameras through Video4Linux2. Frames are streamed into driver buffers
+// mapped with mmap, which are handed to the converters as they are.
+class V4L2CaptureStream : public CaptureStream
+{
+public:
+	V4L2CaptureStream(const char *aPath);
+	~V4L2CaptureStream();
+	HRESULT start(CaptureClass *aCapture);
+	void stop();
+	int setProperty(int aProperty, float aValue, int aAuto);
+	int getProperty(int aProperty, float &aValue, int &aAuto);
+	HRESULT setFormat(DWORD aWidth, DWORD aHeight);
+	HRESULT mapBuffers();
+	void unmapBuffers();
+	void run();
+
+	struct Buffer
+	{
+		void   *mData;
+		size_t mLength;
+	};
+
+	CaptureClass            *mCapture;
+	char                    mPath[32];
+	int                     mFd;
+	Buffer                  *mBuffers;
+	unsigned int            mBufferCount;
+	LONG                    mStride;       // Of the uncompressed formats (of the Y plane for planar ones)
+	unsigned int            mSequence;     // Of the last frame, to count the ones the driver dropped
+	int                     mHaveSequence;
+	std::thread             mThread;
+	std::atomic<int>        mQuit;
+};
+
+class V4L2CaptureBackend : public CaptureBackend
+{
+public:
+	int countDevices();
+	void getDeviceName(int aDevice, char *aNamebuffer, int aBufferlength);
+	CaptureStream *createStream(int aDevice);
+};
+
+extern V4L2CaptureBackend gV4L2Backend;
@@ -18,11 +18,14 @@ int font_x, font_y, font_comp;
 unsigned int *font = 0;
 
 // Capture structures
-struct SimpleCapParams capture[4];
+struct SimpleCapParamsEx capture[4];
 
 // Number of devices
 int devices = 0;
 
+// Device numbers, for captureGroup
+unsigned int deviceno[4] = { 0, 1, 2, 3 };
+
 // Device names (overwritten with what's queried from devices)
 char devicenames[4][24] = { "device 1", "device 2", "device 3", "device 4" };
 
@@ -90,40 +93,20 @@ void drawstring(char * string, int x, int y)
 // Main rendering function
 void render()
 {
-	// Declare a couple of variables
-	int i, j, k;
+	int k;
 
-	for (k = 0; k < devices; k++)
+	// Captures go straight to their place in the grid in gSdlScreenPixels,
+	// one frame of each device, taken within 20ms of each other. Waits for
+	// them at most 100ms, so a stalled camera doesn't stall the window.
+	if (captureGroup(deviceno, devices, 20000, 100, NULL))
 	{
-		if (isCaptureDone(k))
+		for (k = 0; k < devices; k++)
 		{
-			int linofs = 0;
-			// Arrange devices in a grid
-			int xofs = (k & 1) ? 320 : 0;
-			int yofs = (k & 2) ? (240 * 640) : 0;
-			int ofs;
-
-			// Draw to gSdlScreenTexture
-			for (i = 0; i < 240; i++)
-			{
-				for (j = 0, ofs = yofs + xofs; j < 320; j++, ofs++, linofs++)
-				{
-					gSdlScreenPixels[ofs] = capture[k].mTargetBuf[linofs];
-				}
-				yofs += 640;
-			}
-
-			// Ask for another frame
-			doCapture(k);
-
 			// Draw the device's name over the captured image
-			drawstring(devicenames[k], xofs, (k & 2) ? 240 : 0);
+			drawstring(devicenames[k], (k & 1) ? 320 : 0, (k & 2) ? 240 : 0);
 		}
 	}
 
-	// Don't hog all CPU time
-	SDL_Delay(1);
-
 	SDL_UpdateTexture(gSdlScreenTexture, NULL, gSdlScreenPixels, 640 * sizeof(Uint32));
 	SDL_RenderCopy(gSdlRenderer, gSdlScreenTexture, NULL, NULL);
 
@@ -160,15 +143,21 @@ int main(int argc, char *argv[])
 	if (devices > 4)
 		devices = 4;
 
-	// Set up capture for the available devices (and ask for data)
+	gSdlScreenPixels = new unsigned int[640 * 480];
+
+	// Set up capture for the available devices.
+	// Each device captures directly into its own quarter of the screen,
+	// arranged in a grid.
 	for (int i = 0; i < devices; i++)
 	{
 		capture[i].mWidth = 320;
 		capture[i].mHeight = 240;
-		capture[i].mTargetBuf = new int[320 * 240];
+		capture[i].mStride = 640 * sizeof(unsigned int);
+		capture[i].mFormat = CAPTURE_FORMAT_BGRA;
+		capture[i].mFlags = 0;
+		capture[i].mTargetBuf = gSdlScreenPixels + ((i & 2) ? 240 * 640 : 0) + ((i & 1) ? 320 : 0);
 		getCaptureDeviceName(i, devicenames[i], 24);
-		initCapture(i, &capture[i]);
-		doCapture(i);
+		initCaptureEx(i, &capture[i], 0);
 	}
 
 	// Attempt to create a 640x480 gSdlWindow with 32bit gSdlScreenPixels.
@@ -192,8 +181,6 @@ int main(int argc, char *argv[])
 		SDL_TEXTUREACCESS_STREAMING,
 		640, 480);
 
-	gSdlScreenPixels = new unsigned int[640 * 480];
-
 	// load font
 	font = (unsigned int *)stbi_load("font14x24.png", &font_x, &font_y, &font_comp, 4);
 
@@ -50,12 +50,6 @@ void render()
 	
 	if (isCaptureDone(device))
 	{
-		// OpenGL red and blue are swapped, so we'll need to do some converting here..
-		for (i = 0; i < 512 * 512; i++)
-			capture.mTargetBuf[i] = (capture.mTargetBuf[i] & 0xff00ff00) |
-			                        ((capture.mTargetBuf[i] & 0xff) << 16) |
-									((capture.mTargetBuf[i] & 0xff0000) >> 16);
-
 		// Load up the new data
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 512, 512, 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)capture.mTargetBuf);
 		
@@ -85,7 +79,8 @@ int main(int argc, char *argv[])
 	capture.mWidth = 512;
 	capture.mHeight = 512;
 	capture.mTargetBuf = new int[512 * 512];
-	initCapture(device,&capture);
+	// Ask for RGBA byte order, which is what OpenGL wants.
+	initCaptureWithOptions(device, &capture, CAPTURE_OPTION_RGBA);
 	doCapture(device);
 
 
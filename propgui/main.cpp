@@ -21,7 +21,8 @@ void toggle(int device)
 	}
 	else
 	{
-		initCapture(device, &capture[device]);
+		// Ask for RGBA byte order, which is what OpenGL wants.
+		initCaptureWithOptions(device, &capture[device], CAPTURE_OPTION_RGBA);
 		active[device] = 1;
 		doCapture(device);
 	}
@@ -43,13 +44,6 @@ void devicewindow(int device)
 
 	if (isCaptureDone(device))
 	{
-		// OpenGL red and blue are swapped, so we'll need to do some converting here..
-		int i;
-		for (i = 0; i < 256 * 256; i++)
-			capture[device].mTargetBuf[i] = (capture[device].mTargetBuf[i] & 0xff00ff00) |
-			((capture[device].mTargetBuf[i] & 0xff) << 16) |
-			((capture[device].mTargetBuf[i] & 0xff0000) >> 16);
-
 		glBindTexture(GL_TEXTURE_2D, texture[device]);
 		// Load up the new data
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)capture[device].mTargetBuf);
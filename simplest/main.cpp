@@ -20,12 +20,17 @@ void main()
    * ESCAPI will scale the data received from the camera 
    * (with point sampling) to whatever values you want. 
    * Typically the native resolution is 320*240.
+   * We only need brightness, so ask for one byte of luma per pixel.
    */
 
-	struct SimpleCapParams capture;
+	unsigned char *luma = new unsigned char[24 * 18];
+	struct SimpleCapParamsEx capture;
 	capture.mWidth = 24;
 	capture.mHeight = 18;
-	capture.mTargetBuf = new int[24 * 18];
+	capture.mStride = 24;
+	capture.mFormat = CAPTURE_FORMAT_GRAY8;
+	capture.mFlags = 0;
+	capture.mTargetBuf = luma;
 	
 	/* Initialize capture - only one capture may be active per device,
 	 * but several devices may be captured at the same time. 
@@ -33,7 +38,7 @@ void main()
 	 * 0 is the first device.
 	 */
 	
-	if (initCapture(0, &capture) == 0)
+	if (initCaptureEx(0, &capture, 0) == 0)
 	{
 		printf("Capture failed - device may already be in use.\n");
 		return;
@@ -59,14 +64,14 @@ void main()
 	}
 	
 	/* now we have the data.. what shall we do with it? let's 
-	 * render it in ASCII.. (using 3 top bits of green as the value)
+	 * render it in ASCII.. (using 3 top bits of luma as the value)
 	 */
 	char light[] = " .,-o+O0@";
 	for (i = 0; i < 18; i++)
 	{
 		for (j = 0; j < 24; j++)
 		{
-			printf("%c", light[(capture.mTargetBuf[i*24+j] >> 13) & 7]);
+			printf("%c", light[luma[i * 24 + j] >> 5]);
 		}
 		printf("\n");
 	}